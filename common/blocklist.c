@@ -8,38 +8,63 @@
 
 #define BLOCKLIST_LINE_BUFFER 256
 
-static char **g_blocklist = NULL;
+// --- suffix index ---
+// open addressing, linear probing, keyed by domain_hash() of each entry
+// so a query's precomputed suffix hashes probe it directly
+typedef struct {
+    uint32_t hash;      // domain_hash() of the entry
+    uint32_t len;       // strlen of the entry, 0 marks an empty slot
+    const char *domain; // points into g_blocklist_arena
+} blocklist_slot_t;
+
+static blocklist_slot_t *g_blocklist = NULL;
+static size_t g_blocklist_mask = 0;     // capacity - 1 (capacity is a power of two)
 static size_t g_blocklist_size = 0;
+static char *g_blocklist_arena = NULL;  // every entry, NUL-separated, one allocation
 
-// Comparison function for bsearch/qsort. Expects pointers to string pointers.
-static int compare_strings(const void *a, const void *b)
+// Probe helper for one suffix of a parsed name.
+static bool check_suffix(const domain_name_t *domain, int label)
 {
-    const char *sa = *(const char **)a;
-    const char *sb = *(const char **)b;
-    return strcmp(sa, sb);
+    const char *suffix = domain->name + domain->label_off[label];
+    size_t suffix_len = domain->len - domain->label_off[label];
+    uint32_t hash = domain->suffix_hash[label];
+
+    for (size_t i = hash & g_blocklist_mask; g_blocklist[i].len != 0; i = (i + 1) & g_blocklist_mask)
+    {
+        if (g_blocklist[i].hash == hash && g_blocklist[i].len == suffix_len &&
+            memcmp(g_blocklist[i].domain, suffix, suffix_len) == 0)
+            return true;
+    }
+    return false;
 }
 
-// Binary-search helper for one domain string.
-static bool check_domain(const char *domain)
+// Inserts one entry; duplicates are ignored.
+static void index_insert(const char *domain, size_t len)
 {
-    if (!domain || !g_blocklist || g_blocklist_size == 0)
-        return false;
+    uint32_t hash = domain_hash(domain, len);
+    size_t i = hash & g_blocklist_mask;
+    while (g_blocklist[i].len != 0)
+    {
+        if (g_blocklist[i].hash == hash && g_blocklist[i].len == len &&
+            memcmp(g_blocklist[i].domain, domain, len) == 0)
+            return;
+        i = (i + 1) & g_blocklist_mask;
+    }
 
-    void *found = bsearch(&domain, g_blocklist, g_blocklist_size,
-                          sizeof(char *), compare_strings);
-    return (found != NULL);
+    g_blocklist[i].hash = hash;
+    g_blocklist[i].len = (uint32_t)len;
+    g_blocklist[i].domain = domain;
+    g_blocklist_size++;
 }
 
 void free_blocklist(void)
 {
-    if (g_blocklist)
-    {
-        for (size_t i = 0; i < g_blocklist_size; i++)
-            free(g_blocklist[i]);
-        free(g_blocklist);
-    }
+    free(g_blocklist);
+    free(g_blocklist_arena);
 
     g_blocklist = NULL;
+    g_blocklist_arena = NULL;
+    g_blocklist_mask = 0;
     g_blocklist_size = 0;
 }
 
@@ -54,66 +79,83 @@ int load_blocklist(const char *filename)
 
     free_blocklist();
 
+    // --- first pass: size the index and the string arena ---
     size_t lines = 0;
+    size_t bytes = 0;
     char buffer[BLOCKLIST_LINE_BUFFER];
     while (fgets(buffer, sizeof(buffer), file))
+    {
         lines++;
+        bytes += strlen(buffer) + 1;
+    }
 
     rewind(file);
 
-    g_blocklist = calloc(lines, sizeof(char *));
-    if (!g_blocklist)
+    // keep the load factor at or below 50% so probe chains stay short
+    size_t capacity = 16;
+    while (capacity < lines * 2)
+        capacity <<= 1;
+
+    g_blocklist = calloc(capacity, sizeof(blocklist_slot_t));
+    g_blocklist_arena = malloc(bytes + 1);
+    if (!g_blocklist || !g_blocklist_arena)
     {
         fclose(file);
+        free_blocklist();
         perror("Out of memory loading blocklist");
         return -1;
     }
+    g_blocklist_mask = capacity - 1;
 
-    size_t i = 0;
-    while (fgets(buffer, sizeof(buffer), file) && i < lines)
+    // --- second pass: copy, lowercase and index every entry ---
+    size_t used = 0;
+    while (fgets(buffer, sizeof(buffer), file) && used < bytes)
     {
         buffer[strcspn(buffer, "\r\n")] = '\0';
-        if (buffer[0] == '\0')
+        size_t len = strlen(buffer);
+        if (len > 0 && buffer[len - 1] == '.')
+            buffer[--len] = '\0';
+        if (len == 0 || len >= DOMAIN_NAME_SIZE)
             continue;
 
-        g_blocklist[i] = strdup(buffer);
-        if (g_blocklist[i] == NULL)
-        {
-            fclose(file);
-            free_blocklist();
-            perror("Failure to allocate memory for blocklist entry");
-            return -1;
-        }
-        i++;
+        domain_lowercase(buffer, len);
+        char *entry = g_blocklist_arena + used;
+        memcpy(entry, buffer, len + 1);
+        used += len + 1;
+
+        index_insert(entry, len);
     }
 
     fclose(file);
-    g_blocklist_size = i;
 
-    qsort(g_blocklist, g_blocklist_size, sizeof(char *), compare_strings);
     printf("Blocklist loaded: %zu domains active.\n", g_blocklist_size);
     return 0;
 }
 
-bool is_blocked(const char *host)
+bool is_blocked_name(const domain_name_t *domain)
 {
-    if (!host)
+    if (!domain || !g_blocklist || g_blocklist_size == 0 || domain->label_count == 0)
         return false;
 
-    if (check_domain(host))
-        return true;
-
-    const char *dot = strchr(host, '.');
-    while (dot != NULL)
+    // Walk suffixes from the TLD side: google.com, then www.google.com.
+    // A bare TLD only matches when it is the whole name.
+    for (int label = domain->label_count - 2; label >= 0; label--)
     {
-        const char *parent_domain = dot + 1;
-        dot = strchr(parent_domain, '.');
-        if (!dot)
-            break;
-
-        if (check_domain(parent_domain))
+        if (check_suffix(domain, label))
             return true;
     }
 
-    return false;
+    return domain->label_count == 1 && check_suffix(domain, 0);
+}
+
+bool is_blocked(const char *host)
+{
+    if (!host)
+        return false;
+
+    domain_name_t domain;
+    if (domain_name_from_string(host, &domain) < 0)
+        return false;
+
+    return is_blocked_name(&domain);
 }
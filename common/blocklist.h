@@ -3,6 +3,8 @@
 
 #include <stdbool.h>
 
+#include "domain.h"
+
 // Loads a text file of domains into memory.
 // Returns 0 on success, -1 on failure.
 int load_blocklist(const char *filename);
@@ -11,6 +13,10 @@ int load_blocklist(const char *filename);
 // Matches exact host and parent domains.
 bool is_blocked(const char *host);
 
+// Same check for an already parsed name: probes each suffix with its
+// precomputed hash, walking labels from the TLD side, no rescanning.
+bool is_blocked_name(const domain_name_t *domain);
+
 // Frees all memory associated with the loaded blocklist.
 void free_blocklist(void);
 
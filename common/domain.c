@@ -0,0 +1,114 @@
+#include "domain.h"
+
+#include <string.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define DOMAIN_SIMD_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define DOMAIN_SIMD_SSE2 1
+#endif
+
+void domain_lowercase(char *buf, size_t len)
+{
+    size_t i = 0;
+
+#if defined(DOMAIN_SIMD_NEON)
+    // 'A'..'Z' → set bit 0x20, 16 bytes per iteration
+    const uint8x16_t upper_a = vdupq_n_u8('A');
+    const uint8x16_t upper_z = vdupq_n_u8('Z');
+    const uint8x16_t case_bit = vdupq_n_u8(0x20);
+    for (; i < len; i += 16)
+    {
+        uint8x16_t chunk = vld1q_u8((const uint8_t *)buf + i);
+        uint8x16_t is_upper = vandq_u8(vcgeq_u8(chunk, upper_a), vcleq_u8(chunk, upper_z));
+        vst1q_u8((uint8_t *)buf + i, vorrq_u8(chunk, vandq_u8(is_upper, case_bit)));
+    }
+#elif defined(DOMAIN_SIMD_SSE2)
+    // signed compares are fine: bytes >= 0x80 are negative and never match
+    const __m128i before_a = _mm_set1_epi8('A' - 1);
+    const __m128i after_z = _mm_set1_epi8('Z' + 1);
+    const __m128i case_bit = _mm_set1_epi8(0x20);
+    for (; i < len; i += 16)
+    {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(buf + i));
+        __m128i is_upper = _mm_and_si128(_mm_cmpgt_epi8(chunk, before_a),
+                                         _mm_cmplt_epi8(chunk, after_z));
+        _mm_storeu_si128((__m128i *)(buf + i),
+                         _mm_or_si128(chunk, _mm_and_si128(is_upper, case_bit)));
+    }
+#endif
+
+    // scalar fallback
+    for (; i < len; i++)
+    {
+        if (buf[i] >= 'A' && buf[i] <= 'Z')
+            buf[i] = (char)(buf[i] | 0x20);
+    }
+}
+
+uint32_t domain_hash(const char *name, size_t len)
+{
+    uint32_t hash = DOMAIN_HASH_SEED;
+    while (len > 0)
+    {
+        len--;
+        hash ^= (unsigned char)name[len];
+        hash *= DOMAIN_HASH_PRIME;
+    }
+    return hash;
+}
+
+int domain_name_finish(domain_name_t *domain)
+{
+    domain->label_count = 0;
+    if (domain->len == 0)
+        return 0; // root name — no labels
+
+    // --- label offsets, left to right ---
+    size_t start = 0;
+    for (size_t i = 0; i <= domain->len; i++)
+    {
+        if (i < domain->len && domain->name[i] != '.')
+            continue;
+
+        if (i == start || domain->label_count >= DOMAIN_MAX_LABELS)
+            return -1; // empty label or too many labels
+
+        domain->label_off[domain->label_count++] = (uint8_t)start;
+        start = i + 1;
+    }
+
+    // --- suffix hashes, right to left in one pass ---
+    uint32_t hash = DOMAIN_HASH_SEED;
+    int label = domain->label_count - 1;
+    for (int i = (int)domain->len - 1; i >= 0 && label >= 0; i--)
+    {
+        hash ^= (unsigned char)domain->name[i];
+        hash *= DOMAIN_HASH_PRIME;
+        if (i == domain->label_off[label])
+            domain->suffix_hash[label--] = hash;
+    }
+
+    return 0;
+}
+
+int domain_name_from_string(const char *host, domain_name_t *domain)
+{
+    if (!host || !domain)
+        return -1;
+
+    size_t len = strlen(host);
+    if (len > 0 && host[len - 1] == '.')
+        len--;
+    if (len >= DOMAIN_NAME_SIZE)
+        return -1;
+
+    memcpy(domain->name, host, len);
+    domain->name[len] = '\0';
+    domain->len = (uint16_t)len;
+    domain_lowercase(domain->name, len);
+
+    return domain_name_finish(domain);
+}
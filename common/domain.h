@@ -0,0 +1,49 @@
+#ifndef DOMAIN_H
+#define DOMAIN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// RFC 1035 section 2.3.4 — names are at most 255 octets on the wire
+// buffer is a multiple of 16 so the vector lowercase pass never runs off the end
+#define DOMAIN_NAME_SIZE    256
+// a 255-octet name holds at most 127 one-byte labels
+#define DOMAIN_MAX_LABELS   128
+
+// FNV-1a parameters shared by every suffix hash
+#define DOMAIN_HASH_SEED    2166136261u
+#define DOMAIN_HASH_PRIME   16777619u
+
+// --- parsed domain name ---
+// filled once (by the DNS wire parser or domain_name_from_string) and then
+// reused by every lookup so nothing downstream rescans or rehashes the name
+typedef struct {
+    char name[DOMAIN_NAME_SIZE];                // lowercased, dotted: "www.google.com"
+    uint16_t len;                               // strlen(name)
+    uint8_t label_count;                        // 3 for www.google.com
+    uint8_t label_off[DOMAIN_MAX_LABELS];       // where each label starts in name
+    uint32_t suffix_hash[DOMAIN_MAX_LABELS];    // domain_hash() of name + label_off[i]
+} domain_name_t;
+
+// lowercases len bytes of buf in place, 16 bytes at a time with NEON / SSE2
+// when available, scalar otherwise
+// buf must have room for len rounded up to a multiple of 16
+void domain_lowercase(char *buf, size_t len);
+
+// hashes a dotted name right to left, so the running value at each label
+// boundary is the hash of that suffix — one pass yields every parent's hash
+// domain_hash("google.com") == suffix_hash[1] of "www.google.com"
+uint32_t domain_hash(const char *name, size_t len);
+
+// completes a domain_name_t whose name/len are already set (and lowercased):
+// fills label offsets and suffix hashes
+// returns 0 on success, -1 on an empty label or too many labels
+int domain_name_finish(domain_name_t *domain);
+
+// builds a domain_name_t from a dotted string (copied, lowercased, a single
+// trailing dot dropped)
+// returns 0 on success, -1 if the name is too long or malformed
+int domain_name_from_string(const char *host, domain_name_t *domain);
+
+#endif
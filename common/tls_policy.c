@@ -0,0 +1,333 @@
+#include "tls_policy.h"
+#include "blocklist.h"
+#include "net_hdrs.h"   // for struct tls_record_hdr and struct tls_handshake_hdr
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <string.h>
+
+// ---------- CLIENTHELLO PARSING ----------
+
+int is_tls_client_hello(unsigned char *buffer, int len)
+{
+    // --- minimum size check ---
+    if (!buffer || len < TLS_RECORD_HEADER_SIZE + TLS_HANDSHAKE_HEADER_SIZE)
+        return 0;
+
+    // --- check content type ---
+    struct tls_record_hdr *record_hdr = (struct tls_record_hdr *)buffer;
+    if (record_hdr->content_type != TLS_CONTENT_TYPE_HANDSHAKE)
+        return 0;
+
+    // --- check handshake type ---
+    struct tls_handshake_hdr *handshake_hdr =
+        (struct tls_handshake_hdr *)(buffer + TLS_RECORD_HEADER_SIZE);
+    if (handshake_hdr->handshake_type != TLS_HANDSHAKE_CLIENT_HELLO)
+        return 0;
+
+    return 1;
+}
+
+int tls_record_size(const unsigned char *buffer, int len)
+{
+    if (!buffer || len < TLS_RECORD_HEADER_SIZE)
+        return 0;
+
+    const struct tls_record_hdr *record_hdr = (const struct tls_record_hdr *)buffer;
+    return TLS_RECORD_HEADER_SIZE + ntohs(record_hdr->length);
+}
+
+int extract_sni(unsigned char *buffer, int len,
+                        char *hostname, int hostname_len)
+{
+    // --- initial checks ---
+    if (!buffer || !hostname || hostname_len <= 1)
+        return -1;
+
+    int pos = TLS_RECORD_HEADER_SIZE + TLS_HANDSHAKE_HEADER_SIZE;
+
+    // skip legacy_version (2) + random (32)
+    CHECK_BOUNDS(pos, 2 + 32, len);
+    pos += 2 + 32;
+
+    // --- skip session_id ---
+    CHECK_BOUNDS(pos, 1, len);
+    uint8_t session_id_len = buffer[pos];
+    CHECK_BOUNDS(pos, 1 + session_id_len, len);
+    pos += 1 + session_id_len;
+
+    // --- skip cipher_suites ---
+    CHECK_BOUNDS(pos, 2, len);
+    uint16_t cipher_suites_len = ntohs(*(uint16_t *)(buffer + pos));
+    CHECK_BOUNDS(pos, 2 + cipher_suites_len, len);
+    pos += 2 + cipher_suites_len;
+
+    // --- skip compression methods ---
+    CHECK_BOUNDS(pos, 1, len);
+    uint8_t compression_len = buffer[pos];
+    CHECK_BOUNDS(pos, 1 + compression_len, len);
+    pos += 1 + compression_len;
+
+    // --- read extensions length ---
+    CHECK_BOUNDS(pos, 2, len);
+    uint16_t extensions_len = ntohs(*(uint16_t *)(buffer + pos));
+    pos += 2;
+    int extensions_end = pos + extensions_len;
+    if (extensions_end > len)
+        extensions_end = len;   // a cut-short record: as far as the bytes go
+
+    // walk extensions
+    while (pos + 4 <= extensions_end && pos + 4 <= len)
+    {
+        uint16_t ext_type = ntohs(*(uint16_t *)(buffer + pos));
+        pos += 2;
+
+        // --- read extension length and validate bounds ---
+        uint16_t ext_len = ntohs(*(uint16_t *)(buffer + pos));
+        pos += 2;
+
+        if (pos + ext_len > extensions_end || pos + ext_len > len)
+            return -1;
+
+        if (ext_type == TLS_EXT_SNI)
+        {
+            // RFC 6066 section 3 — SNI structure:
+            //   server_name_list_length (2)
+            //   name_type               (1) — 0x00 = host_name
+            //   name_length             (2)
+            //   name                    (variable)
+            int sni_pos = pos;
+            int sni_end = pos + ext_len;
+
+            CHECK_BOUNDS(sni_pos, 2, sni_end);
+            sni_pos += 2; // skip list length
+
+            CHECK_BOUNDS(sni_pos, 1, sni_end);
+            uint8_t name_type = buffer[sni_pos];
+            sni_pos += 1;
+
+            if (name_type != TLS_SNI_HOST_NAME)
+                return -1;
+
+            CHECK_BOUNDS(sni_pos, 2, sni_end);
+            uint16_t name_len = ntohs(*(uint16_t *)(buffer + sni_pos));
+            sni_pos += 2;
+
+            CHECK_BOUNDS(sni_pos, name_len, sni_end);
+
+            int copy_len = (name_len < hostname_len - 1) ? name_len : (hostname_len - 1);
+            memcpy(hostname, buffer + sni_pos, copy_len);
+            hostname[copy_len] = '\0';
+
+            for (int i = 0; hostname[i]; i++)
+                hostname[i] = tolower((unsigned char)hostname[i]);
+
+            return 0;
+        }
+
+        pos += ext_len;
+    }
+
+    return -1;
+}
+
+int extract_alpn(unsigned char *buffer, int len, tls_hello_t *hello)
+{
+    // RFC 7301 section 3.1 — ALPN extension structure:
+    //   protocol_name_list_length (2)
+    //   protocol_name_length      (1)
+    //   protocol_name             (variable)
+    if (!buffer || len < 4) return -1;
+
+    int pos = 0;
+
+    CHECK_BOUNDS(pos, 2, len);
+    pos += 2; // skip list length
+
+    CHECK_BOUNDS(pos, 1, len);
+    uint8_t name_len = buffer[pos];
+    pos += 1;
+
+    CHECK_BOUNDS(pos, name_len, len);
+    if (name_len >= (int)sizeof(hello->alpn))
+        name_len = sizeof(hello->alpn) - 1;
+
+    memcpy(hello->alpn, buffer + pos, name_len);
+    hello->alpn[name_len] = '\0';
+
+    return 0;
+}
+
+int parse_client_hello(unsigned char *buffer, int len, tls_hello_t *hello)
+{
+    if (!is_tls_client_hello(buffer, len))
+        return 0;
+
+    int total_tls_record_size = tls_record_size(buffer, len);
+    if (total_tls_record_size > len)
+        return 0; // incomplete TLS record in this packet
+
+    hello->parse_complete = 1;
+    hello->client_hello_size = total_tls_record_size;
+    len = total_tls_record_size;
+
+    int pos = TLS_RECORD_HEADER_SIZE + TLS_HANDSHAKE_HEADER_SIZE;
+
+    // extract legacy_version
+    CHECK_BOUNDS_ZERO(pos, 2, len);
+    hello->tls_version = ntohs(*(uint16_t *)(buffer + pos));
+    pos += 2;
+
+    // skip random (32 bytes)
+    CHECK_BOUNDS_ZERO(pos, 32, len);
+    pos += 32;
+
+    // skip session_id
+    CHECK_BOUNDS_ZERO(pos, 1, len);
+    uint8_t session_id_len = buffer[pos];
+    CHECK_BOUNDS_ZERO(pos, 1 + session_id_len, len);
+    pos += 1 + session_id_len;
+
+    // skip cipher_suites
+    CHECK_BOUNDS_ZERO(pos, 2, len);
+    uint16_t cipher_suites_len = ntohs(*(uint16_t *)(buffer + pos));
+    CHECK_BOUNDS_ZERO(pos, 2 + cipher_suites_len, len);
+    pos += 2 + cipher_suites_len;
+
+    // skip compression methods
+    CHECK_BOUNDS_ZERO(pos, 1, len);
+    uint8_t compression_len = buffer[pos];
+    CHECK_BOUNDS_ZERO(pos, 1 + compression_len, len);
+    pos += 1 + compression_len;
+
+    // read extensions block — no extensions is still valid
+    if (pos + 2 > len)
+        goto done_extensions;
+
+    uint16_t extensions_len = ntohs(*(uint16_t *)(buffer + pos));
+    pos += 2;
+
+    if (pos + extensions_len > len)
+        goto done_extensions;
+
+    int extensions_end = pos + extensions_len;
+
+    // walk extensions, count them and extract ALPN
+    hello->extension_count = 0;
+    while (pos + 4 <= extensions_end && pos + 4 <= len)
+    {
+        uint16_t ext_type = ntohs(*(uint16_t *)(buffer + pos));
+        pos += 2;
+        uint16_t ext_len = ntohs(*(uint16_t *)(buffer + pos));
+        pos += 2;
+
+        if (pos + ext_len > extensions_end || pos + ext_len > len)
+            break;
+
+        hello->extension_count++;
+
+        if (ext_type == TLS_EXT_ALPN)
+            extract_alpn(buffer + pos, ext_len, hello);
+
+        pos += ext_len;
+    }
+
+done_extensions:
+    // extract SNI — sets sni_present flag
+    hello->sni_present = 0;
+    if (extract_sni(buffer, len, hello->hostname, TLS_MAX_HOSTNAME_LEN) == 0)
+        hello->sni_present = 1;
+
+    return 1;
+}
+
+// ---------- POLICY ----------
+
+tls_policy_verdict_t check_tls_policy(tls_hello_t *hello)
+{
+    if (!hello->parse_complete) return POLICY_PASS;
+
+    // policy 1 — alert on missing SNI
+    // alert-only — some clients legitimately connect by IP address
+    if (!hello->sni_present)
+        return POLICY_ALERT_NO_SNI;
+
+    // policy 2 — block deprecated TLS versions
+    // TLS 1.0 and 1.1 deprecated by RFC 8996
+    // block anything below TLS 1.2 (0x0303)
+    if (hello->tls_version < TLS_MIN_VERSION)
+        return POLICY_BLOCK_OLD_TLS;
+
+    // policy 3 — alert on suspicious ALPN
+    // legitimate HTTPS uses "h2" or "http/1.1"
+    // anything else on port 443 may be C2 tunneling — T1071
+    if (hello->alpn[0] != '\0' &&
+        strcmp(hello->alpn, "h2")       != 0 &&
+        strcmp(hello->alpn, "http/1.1") != 0 &&
+        strcmp(hello->alpn, "http/1.0") != 0)
+        return POLICY_ALERT_ALPN;
+
+    // policy 4 — alert on anomalous extension count
+    // real browsers send 10-20 extensions
+    // very few or very many suggests a non-standard TLS client
+    if (hello->extension_count > TLS_MAX_EXTENSION_COUNT)
+        return POLICY_ALERT_EXT_COUNT;
+
+    // policy 5 — alert on oversized ClientHello
+    if (hello->client_hello_size > TLS_MAX_CLIENTHELLO_SIZE)
+        return POLICY_ALERT_LARGE_HELLO;
+
+    return POLICY_PASS;
+}
+
+tls_policy_verdict_t tls_hello_verdict(tls_hello_t *hello)
+{
+    hello->verdict = check_tls_policy(hello);
+
+    // a deprecated version is blocked whatever the name
+    if (hello->verdict != POLICY_BLOCK_OLD_TLS && hello->sni_present && is_blocked(hello->hostname))
+        hello->verdict = POLICY_BLOCK_BLOCKLIST;
+
+    return hello->verdict;
+}
+
+tls_policy_verdict_t tls_prefix_verdict(unsigned char *buffer, int len, int record_size, tls_hello_t *hello)
+{
+    hello->client_hello_size = record_size;
+    if (len >= TLS_RECORD_HEADER_SIZE + TLS_HANDSHAKE_HEADER_SIZE + 2)
+        hello->tls_version = ntohs(*(uint16_t *)(buffer + TLS_RECORD_HEADER_SIZE + TLS_HANDSHAKE_HEADER_SIZE));
+
+    hello->sni_present = (extract_sni(buffer, len, hello->hostname, TLS_MAX_HOSTNAME_LEN) == 0);
+    if (!hello->sni_present)
+        hello->verdict = POLICY_BLOCK_UNCHECKED;
+    else if (is_blocked(hello->hostname))
+        hello->verdict = POLICY_BLOCK_BLOCKLIST;
+    else
+        hello->verdict = POLICY_ALERT_LARGE_HELLO;
+    return hello->verdict;
+}
+
+bool tls_verdict_blocks(tls_policy_verdict_t verdict)
+{
+    return verdict == POLICY_BLOCK_OLD_TLS || verdict == POLICY_BLOCK_BLOCKLIST ||
+           verdict == POLICY_BLOCK_UNCHECKED;
+}
+
+const char *tls_verdict_action(tls_policy_verdict_t verdict)
+{
+    switch (verdict)
+    {
+        case POLICY_ALERT_NO_SNI:       return "ALERT (missing SNI)";
+        case POLICY_BLOCK_OLD_TLS:      return "BLOCKED (deprecated TLS)";
+        case POLICY_ALERT_ALPN:         return "ALERT (suspicious ALPN)";
+        case POLICY_ALERT_EXT_COUNT:    return "ALERT (anomalous extensions)";
+        case POLICY_ALERT_LARGE_HELLO:  return "ALERT (oversized ClientHello)";
+        case POLICY_BLOCK_BLOCKLIST:    return "BLOCKED (blocklist)";
+        case POLICY_BLOCK_UNCHECKED:    return "BLOCKED (oversized ClientHello, no SNI)";
+        default:                        return "ALLOWED";
+    }
+}
+
+const char *tls_verdict_attck(tls_policy_verdict_t verdict)
+{
+    return (verdict == POLICY_ALERT_ALPN) ? "T1071" : "T1573";
+}
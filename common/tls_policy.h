@@ -0,0 +1,130 @@
+#ifndef TLS_POLICY_H
+#define TLS_POLICY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// --- TLS ClientHello parsing and policy ---
+// shared by the Layer 6 inspector (packets off a raw socket) and the
+// Layer 7 proxy (the first bytes through a CONNECT tunnel)
+
+// --- TLS version constants ---
+// RFC 8446 Appendix B — legacy_version values
+#define TLS_VERSION_1_0     0x0301
+#define TLS_VERSION_1_1     0x0302
+#define TLS_VERSION_1_2     0x0303
+#define TLS_VERSION_1_3     0x0304
+#define TLS_MIN_VERSION     TLS_VERSION_1_2   // block anything older than this
+
+// --- extension type constants ---
+// RFC 7301 — Application Layer Protocol Negotiation
+#define TLS_EXT_ALPN        0x0010
+// RFC 8446 section 4.2.1 — supported versions extension
+#define TLS_EXT_SUPPORTED_VERSIONS 0x002B
+
+// --- policy thresholds ---
+#define TLS_MAX_EXTENSION_COUNT     30    // alert if more than this
+#define TLS_MAX_CLIENTHELLO_SIZE    2048  // alert if larger than this
+
+// RFC 8446 Appendix B.1 — content type for handshake records
+#define TLS_CONTENT_TYPE_HANDSHAKE      0x16
+
+// RFC 8446 Appendix B.3 — handshake type for ClientHello
+#define TLS_HANDSHAKE_CLIENT_HELLO      0x01
+
+// RFC 6066 Section 3 — extension type number for SNI
+#define TLS_EXT_SNI                     0x0000
+
+// RFC 6066 Section 3 — name type for hostname
+#define TLS_SNI_HOST_NAME               0x00
+
+// TLS record header is always 5 bytes
+// RFC 8446 section 5.1 — content_type(1) + version(2) + length(2)
+#define TLS_RECORD_HEADER_SIZE          5
+
+// TLS handshake header is 4 bytes
+// RFC 8446 section 4 — type(1) + length(3)
+#define TLS_HANDSHAKE_HEADER_SIZE       4
+
+// reuse hostname max length from RFC 1035
+#define TLS_MAX_HOSTNAME_LEN            253
+
+// --- bounds check macro ---
+#define CHECK_BOUNDS(pos, needed, length) \
+    do { if ((pos) + (needed) > (length)) return -1; } while (0)
+
+#define CHECK_BOUNDS_ZERO(pos, needed, length) \
+    do { if ((pos) + (needed) > (length)) return 0; } while (0)
+
+// --- policy verdicts ---
+typedef enum {
+    POLICY_PASS              = 0,
+    POLICY_ALERT_NO_SNI      = 1,   // missing SNI
+    POLICY_BLOCK_OLD_TLS     = 2,   // TLS version < 1.2 — T1573
+    POLICY_ALERT_ALPN        = 3,   // suspicious ALPN — T1071
+    POLICY_ALERT_EXT_COUNT   = 4,   // anomalous extension count
+    POLICY_ALERT_LARGE_HELLO = 5,   // oversized ClientHello
+    POLICY_BLOCK_BLOCKLIST   = 6,   // hostname matched local deny list
+    POLICY_BLOCK_UNCHECKED   = 7,   // ClientHello too big to hold, no SNI in what was
+} tls_policy_verdict_t;
+
+// --- what a ClientHello says about the connection ---
+typedef struct {
+    char          hostname[TLS_MAX_HOSTNAME_LEN];   // filled in by extract_sni()
+    uint16_t      tls_version;          // legacy_version from ClientHello
+    int           sni_present;          // 1 if SNI found, 0 if missing
+    char          alpn[64];             // ALPN value if present
+    int           extension_count;      // total number of extensions
+    int           client_hello_size;    // total ClientHello size in bytes
+    int           parse_complete;       // 1 only when full TLS record is present
+    tls_policy_verdict_t verdict;       // result of policy check
+} tls_hello_t;
+
+// checks if buffer starts with a TLS ClientHello
+// looks at content type byte and handshake type byte
+// returns 1 if yes, 0 if no
+int is_tls_client_hello(unsigned char *buffer, int len);
+
+// bytes the TLS record at the start of buffer takes, header included
+// returns 0 while the record header isn't all there
+int tls_record_size(const unsigned char *buffer, int len);
+
+// walks through TLS record bytes and extracts the SNI hostname; a buffer
+// holding only the start of the record is searched as far as it goes
+// returns 0 on success, -1 if SNI extension not found
+//
+// WARNING: caller is responsible for hostname buffer size
+int extract_sni(unsigned char *buffer, int len,
+                char *hostname, int hostname_len);
+
+// extracts ALPN extension value into hello->alpn
+// RFC 7301 — Application Layer Protocol Negotiation
+// returns 0 on success, -1 if not found
+int extract_alpn(unsigned char *buffer, int len, tls_hello_t *hello);
+
+// parses a ClientHello record and fills hello
+// returns 1 if ClientHello, 0 if not (or the record is cut short)
+int parse_client_hello(unsigned char *buffer, int len, tls_hello_t *hello);
+
+// runs all policy checks against parsed ClientHello metadata
+// returns POLICY_PASS or a violation code
+tls_policy_verdict_t check_tls_policy(tls_hello_t *hello);
+
+// check_tls_policy(), then the SNI hostname against the blocklist
+// sets and returns hello->verdict
+tls_policy_verdict_t tls_hello_verdict(tls_hello_t *hello);
+
+// for a ClientHello record of record_size bytes of which only the first len
+// could be held: the SNI in them against the blocklist, and a block when
+// there is none to check — otherwise one oversized hello would get anything
+// past the policy. Fills what it can of hello, sets and returns its verdict
+tls_policy_verdict_t tls_prefix_verdict(unsigned char *buffer, int len, int record_size, tls_hello_t *hello);
+
+// true for the verdicts that end the connection
+bool tls_verdict_blocks(tls_policy_verdict_t verdict);
+
+// log wording for a verdict: the action ("BLOCKED (blocklist)") and its ATT&CK ID
+const char *tls_verdict_action(tls_policy_verdict_t verdict);
+const char *tls_verdict_attck(tls_policy_verdict_t verdict);
+
+#endif
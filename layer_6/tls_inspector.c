@@ -6,7 +6,6 @@
 #include "../common/blocklist.h"
 #include "../common/net_hdrs.h"  // for struct ip_hdr and struct tcp_hdr
 #include "../common/enforce.h"   // for rst_inject()
-#include <ctype.h>
 
 // --- packet view helper ---
 // parse packet once into header pointers/lengths used by detection and enforcement
@@ -86,9 +85,11 @@ void start_tls_inspector()
             continue;
         }
 
-        // --- filter TLS on direct 443 and proxy 8080 ---
+        // --- filter TLS on direct 443 ---
+        // tunnels through the Layer 7 proxy are inspected in the proxy, which
+        // can close them itself
         uint16_t dst_port = ntohs(tcp_header->dst_port);
-        if (dst_port != HTTPS_PORT && dst_port != HTTP_PROXY_PORT)
+        if (dst_port != HTTPS_PORT)
         {
             free(task);
             continue;
@@ -115,272 +116,9 @@ void start_tls_inspector()
     }
 }
 
-int is_tls_client_hello(unsigned char *buffer, int len)
-{
-    // --- minimum size check ---
-    if (!buffer || len < TLS_RECORD_HEADER_SIZE + TLS_HANDSHAKE_HEADER_SIZE)
-        return 0;
-
-    // --- check content type ---
-    struct tls_record_hdr *record_hdr = (struct tls_record_hdr *)buffer;
-    if (record_hdr->content_type != TLS_CONTENT_TYPE_HANDSHAKE)
-        return 0;
-
-    // --- check handshake type ---
-    struct tls_handshake_hdr *handshake_hdr =
-        (struct tls_handshake_hdr *)(buffer + TLS_RECORD_HEADER_SIZE);
-    if (handshake_hdr->handshake_type != TLS_HANDSHAKE_CLIENT_HELLO)
-        return 0;
-
-    return 1;
-}
-
-int extract_sni(unsigned char *buffer, int len,
-                        char *hostname, int hostname_len)
-{
-    // --- initial checks ---
-    if (!buffer || !hostname || hostname_len <= 1)
-        return -1;
-
-    int pos = TLS_RECORD_HEADER_SIZE + TLS_HANDSHAKE_HEADER_SIZE;
-
-    // skip legacy_version (2) + random (32)
-    CHECK_BOUNDS(pos, 2 + 32, len);
-    pos += 2 + 32;
-
-    // --- skip session_id ---
-    CHECK_BOUNDS(pos, 1, len);
-    uint8_t session_id_len = buffer[pos];
-    CHECK_BOUNDS(pos, 1 + session_id_len, len);
-    pos += 1 + session_id_len;
-
-    // --- skip cipher_suites ---
-    CHECK_BOUNDS(pos, 2, len);
-    uint16_t cipher_suites_len = ntohs(*(uint16_t *)(buffer + pos));
-    CHECK_BOUNDS(pos, 2 + cipher_suites_len, len);
-    pos += 2 + cipher_suites_len;
-
-    // --- skip compression methods ---
-    CHECK_BOUNDS(pos, 1, len);
-    uint8_t compression_len = buffer[pos];
-    CHECK_BOUNDS(pos, 1 + compression_len, len);
-    pos += 1 + compression_len;
-
-    // --- read extensions length ---
-    CHECK_BOUNDS(pos, 2, len);
-    uint16_t extensions_len = ntohs(*(uint16_t *)(buffer + pos));
-    pos += 2;
-    CHECK_BOUNDS(pos, extensions_len, len);
-    int extensions_end = pos + extensions_len;
-
-    // walk extensions
-    while (pos + 4 <= extensions_end && pos + 4 <= len)
-    {
-        uint16_t ext_type = ntohs(*(uint16_t *)(buffer + pos));
-        pos += 2;
-
-        // --- read extension length and validate bounds ---
-        uint16_t ext_len = ntohs(*(uint16_t *)(buffer + pos));
-        pos += 2;
-
-        if (pos + ext_len > extensions_end || pos + ext_len > len)
-            return -1;
-
-        if (ext_type == TLS_EXT_SNI)
-        {
-            // RFC 6066 section 3 — SNI structure:
-            //   server_name_list_length (2)
-            //   name_type               (1) — 0x00 = host_name
-            //   name_length             (2)
-            //   name                    (variable)
-            int sni_pos = pos;
-            int sni_end = pos + ext_len;
-
-            CHECK_BOUNDS(sni_pos, 2, sni_end);
-            sni_pos += 2; // skip list length
-
-            CHECK_BOUNDS(sni_pos, 1, sni_end);
-            uint8_t name_type = buffer[sni_pos];
-            sni_pos += 1;
-
-            if (name_type != TLS_SNI_HOST_NAME)
-                return -1;
-
-            CHECK_BOUNDS(sni_pos, 2, sni_end);
-            uint16_t name_len = ntohs(*(uint16_t *)(buffer + sni_pos));
-            sni_pos += 2;
-
-            CHECK_BOUNDS(sni_pos, name_len, sni_end);
-
-            int copy_len = (name_len < hostname_len - 1) ? name_len : (hostname_len - 1);
-            memcpy(hostname, buffer + sni_pos, copy_len);
-            hostname[copy_len] = '\0';
-
-            for (int i = 0; hostname[i]; i++)
-                hostname[i] = tolower((unsigned char)hostname[i]);
-
-            return 0;
-        }
-
-        pos += ext_len;
-    }
-
-    return -1;
-}
-
-int extract_alpn(unsigned char *buffer, int len, tls_task_t *task)
-{
-    // RFC 7301 section 3.1 — ALPN extension structure:
-    //   protocol_name_list_length (2)
-    //   protocol_name_length      (1)
-    //   protocol_name             (variable)
-    if (!buffer || len < 4) return -1;
-
-    int pos = 0;
-
-    CHECK_BOUNDS(pos, 2, len);
-    pos += 2; // skip list length
-
-    CHECK_BOUNDS(pos, 1, len);
-    uint8_t name_len = buffer[pos];
-    pos += 1;
-
-    CHECK_BOUNDS(pos, name_len, len);
-    if (name_len >= (int)sizeof(task->alpn))
-        name_len = sizeof(task->alpn) - 1;
-
-    memcpy(task->alpn, buffer + pos, name_len);
-    task->alpn[name_len] = '\0';
-
-    return 0;
-}
-
-int parse_client_hello(unsigned char *buffer, int len, tls_task_t *task)
-{
-    if (!is_tls_client_hello(buffer, len))
-        return 0;
-
-    const struct tls_record_hdr *record_hdr = (const struct tls_record_hdr *)buffer;
-    int tls_record_len = ntohs(record_hdr->length);
-    int total_tls_record_size = TLS_RECORD_HEADER_SIZE + tls_record_len;
-    if (total_tls_record_size > len)
-        return 0; // incomplete TLS record in this packet
-
-    task->parse_complete = 1;
-    task->client_hello_size = total_tls_record_size;
-    len = total_tls_record_size;
-
-    int pos = TLS_RECORD_HEADER_SIZE + TLS_HANDSHAKE_HEADER_SIZE;
-
-    // extract legacy_version
-    CHECK_BOUNDS_ZERO(pos, 2, len);
-    task->tls_version = ntohs(*(uint16_t *)(buffer + pos));
-    pos += 2;
-
-    // skip random (32 bytes)
-    CHECK_BOUNDS_ZERO(pos, 32, len);
-    pos += 32;
-
-    // skip session_id
-    CHECK_BOUNDS_ZERO(pos, 1, len);
-    uint8_t session_id_len = buffer[pos];
-    CHECK_BOUNDS_ZERO(pos, 1 + session_id_len, len);
-    pos += 1 + session_id_len;
-
-    // skip cipher_suites
-    CHECK_BOUNDS_ZERO(pos, 2, len);
-    uint16_t cipher_suites_len = ntohs(*(uint16_t *)(buffer + pos));
-    CHECK_BOUNDS_ZERO(pos, 2 + cipher_suites_len, len);
-    pos += 2 + cipher_suites_len;
-
-    // skip compression methods
-    CHECK_BOUNDS_ZERO(pos, 1, len);
-    uint8_t compression_len = buffer[pos];
-    CHECK_BOUNDS_ZERO(pos, 1 + compression_len, len);
-    pos += 1 + compression_len;
-
-    // read extensions block — no extensions is still valid
-    if (pos + 2 > len)
-        goto done_extensions;
-
-    uint16_t extensions_len = ntohs(*(uint16_t *)(buffer + pos));
-    pos += 2;
-
-    if (pos + extensions_len > len)
-        goto done_extensions;
-
-    int extensions_end = pos + extensions_len;
-
-    // walk extensions, count them and extract ALPN
-    task->extension_count = 0;
-    while (pos + 4 <= extensions_end && pos + 4 <= len)
-    {
-        uint16_t ext_type = ntohs(*(uint16_t *)(buffer + pos));
-        pos += 2;
-        uint16_t ext_len = ntohs(*(uint16_t *)(buffer + pos));
-        pos += 2;
-
-        if (pos + ext_len > extensions_end || pos + ext_len > len)
-            break;
-
-        task->extension_count++;
-
-        if (ext_type == TLS_EXT_ALPN)
-            extract_alpn(buffer + pos, ext_len, task);
-
-        pos += ext_len;
-    }
-
-done_extensions:
-    // extract SNI — sets sni_present flag
-    task->sni_present = 0;
-    if (extract_sni(buffer, len, task->hostname, TLS_MAX_HOSTNAME_LEN) == 0)
-        task->sni_present = 1;
-
-    return 1;
-}
-
-tls_policy_verdict_t check_tls_policy(tls_task_t *task)
-{
-    if (!task->parse_complete) return POLICY_PASS;
-
-    // policy 1 — alert on missing SNI
-    // NOTE: alert-only while parser is packet-based and does not do TCP reassembly
-    if (!task->sni_present)
-        return POLICY_ALERT_NO_SNI;
-
-    // policy 2 — block deprecated TLS versions
-    // TLS 1.0 and 1.1 deprecated by RFC 8996
-    // block anything below TLS 1.2 (0x0303)
-    if (task->tls_version < TLS_MIN_VERSION)
-        return POLICY_BLOCK_OLD_TLS;
-
-    // policy 3 — alert on suspicious ALPN
-    // legitimate HTTPS uses "h2" or "http/1.1"
-    // anything else on port 443 may be C2 tunneling — T1071
-    if (task->alpn[0] != '\0' &&
-        strcmp(task->alpn, "h2")       != 0 &&
-        strcmp(task->alpn, "http/1.1") != 0 &&
-        strcmp(task->alpn, "http/1.0") != 0)
-        return POLICY_ALERT_ALPN;
-
-    // policy 4 — alert on anomalous extension count
-    // real browsers send 10-20 extensions
-    // very few or very many suggests a non-standard TLS client
-    if (task->extension_count > TLS_MAX_EXTENSION_COUNT)
-        return POLICY_ALERT_EXT_COUNT;
-
-    // policy 5 — alert on oversized ClientHello
-    if (task->client_hello_size > TLS_MAX_CLIENTHELLO_SIZE)
-        return POLICY_ALERT_LARGE_HELLO;
-
-    return POLICY_PASS;
-}
-
 void enforce_block(tls_task_t *task)
 {
     /// -- currently only supports TCP RST injection for TLS blocks ---
-    //  --- Effective for blocking direct TLS but not TLS over HTTP proxies (port 8080) ---
     struct ip_hdr *ip_header;
     struct tcp_hdr *tcp_header;
     unsigned char *tls_start;
@@ -423,36 +161,21 @@ void *handle_tls_packet(void *arg)
     }
 
     // --- parse ClientHello and fill task metadata ---
-    if (!parse_client_hello(tls_start, tls_len, task))
+    if (!parse_client_hello(tls_start, tls_len, &task->hello))
     {
         free(task);
         return NULL;
     }
 
-    // --- run policy engine ---
-    task->verdict = check_tls_policy(task);
+    // --- run policy engine, blocklist included ---
+    tls_hello_verdict(&task->hello);
 
     // --- enforce block verdicts ---
-    if (task->verdict == POLICY_BLOCK_OLD_TLS)
-    {
+    if (tls_verdict_blocks(task->hello.verdict))
         enforce_block(task);
-        log_policy_decision(task->verdict, task);
-        free(task);
-        return NULL;
-    }
 
-    // --- check blocklist if SNI was present ---
-    if (task->sni_present && is_blocked(task->hostname))
-    {
-        task->verdict = POLICY_BLOCK_BLOCKLIST;
-        enforce_block(task);
-        log_policy_decision(task->verdict, task);
-        free(task);
-        return NULL;
-    }
-
-    // --- log alerts and allowed ---
-    log_policy_decision(task->verdict, task);
+    // --- log blocks, alerts and allowed ---
+    log_policy_decision(task->hello.verdict, task);
 
     free(task);
     return NULL;
@@ -460,40 +183,8 @@ void *handle_tls_packet(void *arg)
 
 void log_policy_decision(tls_policy_verdict_t verdict, tls_task_t *task)
 {
-    const char *action;
-    const char *attck;
-
-    switch (verdict)
-    {
-        case POLICY_ALERT_NO_SNI:
-            action = "ALERT (missing SNI)";
-            attck  = "T1573";
-            break;
-        case POLICY_BLOCK_OLD_TLS:
-            action = "BLOCKED (deprecated TLS)";
-            attck  = "T1573";
-            break;
-        case POLICY_ALERT_ALPN:
-            action = "ALERT (suspicious ALPN)";
-            attck  = "T1071";
-            break;
-        case POLICY_ALERT_EXT_COUNT:
-            action = "ALERT (anomalous extensions)";
-            attck  = "T1573";
-            break;
-        case POLICY_ALERT_LARGE_HELLO:
-            action = "ALERT (oversized ClientHello)";
-            attck  = "T1573";
-            break;
-        case POLICY_BLOCK_BLOCKLIST:
-            action = "BLOCKED (blocklist)";
-            attck  = "T1573";
-            break;
-        default:
-            action = "ALLOWED";
-            attck  = "T1573";
-            break;
-    }
+    const char *action = tls_verdict_action(verdict);
+    const char *attck = tls_verdict_attck(verdict);
 
     time_t now = time(NULL);
     struct tm tm_buf;
@@ -512,10 +203,10 @@ void log_policy_decision(tls_policy_verdict_t verdict, tls_task_t *task)
            "tls_ver=0x%04X ext_count=%d alpn=%s "
            "d3fend=D3-TLSIC attck=%s\n",
            timestamp, action,
-           (task && task->hostname[0]) ? task->hostname : "unknown",
+           (task && task->hello.hostname[0]) ? task->hello.hostname : "unknown",
            src_ip,
-           task ? task->tls_version : 0,
-           task ? task->extension_count : 0,
-           (task && task->alpn[0]) ? task->alpn : "none",
+           task ? task->hello.tls_version : 0,
+           task ? task->hello.extension_count : 0,
+           (task && task->hello.alpn[0]) ? task->hello.alpn : "none",
            attck);
 }
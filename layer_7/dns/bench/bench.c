@@ -0,0 +1,438 @@
+// dns-bench — open-loop load generator for the DNS filter
+//
+// Replays a dnsperf-style dataset ("name TYPE" per line) at a fixed target
+// rate: queries leave on schedule whether or not earlier ones were answered,
+// so a slow server shows up as latency and loss instead of a lower send rate.
+// Reports achieved qps, latency percentiles, RCODEs and losses; with -u
+// pointing at dns-stub it also reports how many answers never reached the
+// upstream (cache, coalescing, blocks).
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#define BENCH_DEFAULT_SERVER    "127.0.0.1:53"
+#define BENCH_DEFAULT_DATASET   "../../../hostnames/random-domains-dnsperf.txt"
+#define BENCH_DEFAULT_QPS       1000
+#define BENCH_DEFAULT_SECONDS   10
+#define BENCH_DEFAULT_TIMEOUT   2000   // ms a query may take before it counts as lost
+// option limits — a run is rate * seconds queries held in memory
+#define BENCH_MAX_QPS           1000000
+#define BENCH_MAX_SECONDS       3600
+#define BENCH_MAX_TIMEOUT       60000
+// source sockets; each gives the 16-bit ID space its own port
+#define BENCH_SOCKETS           4
+#define BENCH_SLOTS             (BENCH_SOCKETS * 65536)
+#define BENCH_QUERY_SIZE        272    // header + 255-octet name + root + QTYPE/QCLASS
+#define BENCH_RECV_BUFFER       4096
+// a send this far past its slot counts toward "sender behind"
+#define BENCH_LATE_NS           1000000LL
+
+// --- one prebuilt query from the dataset ---
+typedef struct {
+	uint16_t len;
+	unsigned char packet[BENCH_QUERY_SIZE];
+} bench_query_t;
+
+static int g_sockets[BENCH_SOCKETS];
+
+// send time per (socket, ID) slot, 0 when nothing is outstanding
+// sender and receiver hand slots over with atomic exchanges
+static long long *g_sent_ns;
+
+// receiver-owned results
+static uint32_t *g_latency_us;
+static size_t g_answered = 0;
+static unsigned long long g_rcodes[16];
+static unsigned long long g_truncated = 0;
+static unsigned long long g_late = 0;
+
+static volatile int g_done = 0;
+
+static long long now_ns(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+// whole-string decimal in [0, max]; returns 0, or -1 on junk or out of range
+static int parse_number(const char *text, unsigned long max, unsigned long *out)
+{
+	char *end;
+	errno = 0;
+	unsigned long value = strtoul(text, &end, 10);
+	if (end == text || *end != '\0' || *text == '-' || errno == ERANGE || value > max)
+		return -1;
+	*out = value;
+	return 0;
+}
+
+// "ip" or "ip:port"
+static int parse_addr(const char *spec, uint16_t default_port, struct sockaddr_in *addr)
+{
+	char ip[INET_ADDRSTRLEN];
+	const char *colon = strchr(spec, ':');
+	size_t ip_len = colon ? (size_t)(colon - spec) : strlen(spec);
+	if (ip_len == 0 || ip_len >= sizeof(ip))
+		return -1;
+	memcpy(ip, spec, ip_len);
+	ip[ip_len] = '\0';
+
+	unsigned long port = default_port;
+	if (colon && parse_number(colon + 1, 65535, &port) < 0)
+		return -1;
+
+	memset(addr, 0, sizeof(*addr));
+	addr->sin_family = AF_INET;
+	addr->sin_port = htons((uint16_t)port);
+	return (inet_pton(AF_INET, ip, &addr->sin_addr) == 1 && port != 0) ? 0 : -1;
+}
+
+static uint16_t parse_type(const char *name)
+{
+	static const struct { const char *name; uint16_t type; } TYPES[] = {
+		{ "A", 1 }, { "NS", 2 }, { "CNAME", 5 }, { "SOA", 6 }, { "PTR", 12 },
+		{ "MX", 15 }, { "TXT", 16 }, { "AAAA", 28 }, { "SRV", 33 }, { "HTTPS", 65 },
+	};
+	for (size_t i = 0; i < sizeof(TYPES) / sizeof(TYPES[0]); i++)
+	{
+		if (strcasecmp(name, TYPES[i].name) == 0)
+			return TYPES[i].type;
+	}
+	return 1;
+}
+
+// RD query for name / type, ID filled in at send time; returns length, 0 if the name is invalid
+static size_t build_query(const char *name, uint16_t type, unsigned char *out)
+{
+	memset(out, 0, 12);
+	out[2] = 0x01;                      // RD
+	out[5] = 1;                         // QDCOUNT
+
+	size_t len = 12;
+	const char *label = name;
+	while (*label)
+	{
+		const char *dot = strchr(label, '.');
+		size_t label_len = dot ? (size_t)(dot - label) : strlen(label);
+		if (label_len == 0 || label_len > 63 || len + label_len + 6 > BENCH_QUERY_SIZE)
+			return 0;
+		out[len++] = (unsigned char)label_len;
+		memcpy(out + len, label, label_len);
+		len += label_len;
+		label += label_len + (dot ? 1 : 0);
+	}
+	out[len++] = 0;
+	out[len++] = (unsigned char)(type >> 8);
+	out[len++] = (unsigned char)type;
+	out[len++] = 0;
+	out[len++] = 1;                     // IN
+	return len;
+}
+
+static bench_query_t *load_dataset(const char *path, size_t *count)
+{
+	FILE *file = fopen(path, "r");
+	if (!file)
+	{
+		perror("Could not open dataset");
+		return NULL;
+	}
+
+	size_t cap = 1024;
+	bench_query_t *queries = malloc(cap * sizeof(bench_query_t));
+	*count = 0;
+
+	char line[512];
+	while (queries && fgets(line, sizeof(line), file))
+	{
+		char name[300], type[16] = "A";
+		if (line[0] == '#' || sscanf(line, "%299s %15s", name, type) < 1)
+			continue;
+
+		if (*count == cap)
+		{
+			cap *= 2;
+			bench_query_t *grown = realloc(queries, cap * sizeof(bench_query_t));
+			if (!grown)
+			{
+				free(queries);
+				queries = NULL;
+				break;
+			}
+			queries = grown;
+		}
+
+		size_t len = build_query(name, parse_type(type), queries[*count].packet);
+		if (len > 0)
+			queries[(*count)++].len = (uint16_t)len;
+	}
+	fclose(file);
+
+	if (!queries)
+		perror("Out of memory loading dataset");
+	return queries;
+}
+
+// --- receiver: match answers to slots, record latency ---
+static void* receiver(void *arg)
+{
+	(void)arg;
+	struct pollfd pfds[BENCH_SOCKETS];
+	for (int i = 0; i < BENCH_SOCKETS; i++)
+		pfds[i] = (struct pollfd){ .fd = g_sockets[i], .events = POLLIN };
+
+	unsigned char buffer[BENCH_RECV_BUFFER];
+	while (!g_done)
+	{
+		if (poll(pfds, BENCH_SOCKETS, 100) <= 0)
+			continue;
+
+		for (int i = 0; i < BENCH_SOCKETS; i++)
+		{
+			if (!(pfds[i].revents & POLLIN))
+				continue;
+
+			ssize_t n;
+			while ((n = recv(g_sockets[i], buffer, sizeof(buffer), MSG_DONTWAIT)) >= 12)
+			{
+				long long now = now_ns();
+				size_t slot = ((size_t)i << 16) | (size_t)((buffer[0] << 8) | buffer[1]);
+				long long sent = __atomic_exchange_n(&g_sent_ns[slot], 0, __ATOMIC_ACQ_REL);
+				if (sent == 0)
+				{
+					g_late++;   // already written off, or a duplicate
+					continue;
+				}
+
+				g_latency_us[g_answered++] = (uint32_t)((now - sent) / 1000);
+				g_rcodes[buffer[3] & 0x0F]++;
+				if (buffer[2] & 0x02)
+					g_truncated++;
+			}
+		}
+	}
+	return NULL;
+}
+
+// asks dns-stub for its query counter; returns -1 if it does not answer
+static long long stub_queries(const struct sockaddr_in *stub)
+{
+	unsigned char query[BENCH_QUERY_SIZE];
+	size_t len = build_query("stats.dns-stub", 16, query);
+
+	int sock = socket(AF_INET, SOCK_DGRAM, 0);
+	if (sock < 0)
+		return -1;
+
+	long long queries = -1;
+	unsigned char answer[BENCH_RECV_BUFFER];
+	struct pollfd pfd = { .fd = sock, .events = POLLIN };
+	if (sendto(sock, query, len, 0, (const struct sockaddr *)stub, sizeof(*stub)) == (ssize_t)len &&
+		poll(&pfd, 1, 1000) == 1)
+	{
+		ssize_t n = recv(sock, answer, sizeof(answer) - 1, 0);
+		if (n > 0)
+		{
+			answer[n] = '\0';
+			const char *found = memmem(answer, (size_t)n, "queries=", 8);
+			if (found)
+				queries = strtoll(found + 8, NULL, 10);
+		}
+	}
+	close(sock);
+	return queries;
+}
+
+static int compare_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+	return (x > y) - (x < y);
+}
+
+static double percentile_ms(const uint32_t *sorted, size_t count, double pct)
+{
+	if (count == 0)
+		return 0.0;
+	size_t index = (size_t)(pct / 100.0 * (double)(count - 1) + 0.5);
+	return sorted[index] / 1000.0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-s server[:port]] [-f dataset] [-r qps] [-d seconds] "
+		"[-w timeout_ms] [-u stub[:port]]\n", prog);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *server_spec = BENCH_DEFAULT_SERVER;
+	const char *dataset = BENCH_DEFAULT_DATASET;
+	const char *stub_spec = NULL;
+	unsigned long rate = BENCH_DEFAULT_QPS;
+	unsigned long seconds = BENCH_DEFAULT_SECONDS;
+	unsigned long timeout_ms = BENCH_DEFAULT_TIMEOUT;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "s:f:r:d:w:u:")) != -1)
+	{
+		switch (opt)
+		{
+			case 's': server_spec = optarg; break;
+			case 'f': dataset = optarg; break;
+			case 'r': if (parse_number(optarg, BENCH_MAX_QPS, &rate) < 0) rate = 0; break;
+			case 'd': if (parse_number(optarg, BENCH_MAX_SECONDS, &seconds) < 0) seconds = 0; break;
+			case 'w': if (parse_number(optarg, BENCH_MAX_TIMEOUT, &timeout_ms) < 0) timeout_ms = 0; break;
+			case 'u': stub_spec = optarg; break;
+			default: usage(argv[0]); return 1;
+		}
+	}
+
+	struct sockaddr_in server, stub;
+	if (rate == 0 || seconds == 0 || timeout_ms == 0 || parse_addr(server_spec, 53, &server) < 0 ||
+		(stub_spec && parse_addr(stub_spec, 5353, &stub) < 0))
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	size_t query_count = 0;
+	bench_query_t *queries = load_dataset(dataset, &query_count);
+	if (!queries || query_count == 0)
+	{
+		fprintf(stderr, "No usable queries in %s\n", dataset);
+		free(queries);
+		return 1;
+	}
+
+	size_t total = (size_t)rate * seconds;
+	g_sent_ns = calloc(BENCH_SLOTS, sizeof(long long));
+	g_latency_us = malloc(total * sizeof(uint32_t));
+	if (!g_sent_ns || !g_latency_us)
+	{
+		perror("Out of memory");
+		return 1;
+	}
+
+	for (int i = 0; i < BENCH_SOCKETS; i++)
+	{
+		g_sockets[i] = socket(AF_INET, SOCK_DGRAM, 0);
+		int buffer_size = 4 * 1024 * 1024;
+		if (g_sockets[i] < 0 ||
+			setsockopt(g_sockets[i], SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size)) < 0 ||
+			connect(g_sockets[i], (struct sockaddr *)&server, sizeof(server)) < 0)
+		{
+			perror("Bench socket failed");
+			return 1;
+		}
+	}
+
+	long long stub_before = stub_spec ? stub_queries(&stub) : -1;
+
+	printf("[LAYER_7] [BENCH] %s: %zu queries from %s, target %lu qps for %lus\n",
+		server_spec, query_count, dataset, rate, seconds);
+	fflush(stdout);
+
+	pthread_t receiver_thread;
+	if (pthread_create(&receiver_thread, NULL, receiver, NULL) != 0)
+	{
+		perror("Failed to start receiver");
+		return 1;
+	}
+
+	// --- open loop: query i leaves at start + i / rate, answered or not ---
+	unsigned long long overwritten = 0, send_errors = 0, behind = 0;
+	long long start = now_ns();
+	for (size_t seq = 0; seq < total; seq++)
+	{
+		long long due = start + (long long)((unsigned long long)seq * 1000000000ULL / rate);
+		long long now = now_ns();
+		if (now < due)
+		{
+			struct timespec wake = { due / 1000000000LL, due % 1000000000LL };
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL);
+		}
+		else if (now - due > BENCH_LATE_NS)
+			behind++;
+
+		size_t slot = seq % BENCH_SLOTS;
+		bench_query_t *query = &queries[seq % query_count];
+		unsigned char packet[BENCH_QUERY_SIZE];
+		memcpy(packet, query->packet, query->len);
+		packet[0] = (unsigned char)(slot >> 8);
+		packet[1] = (unsigned char)slot;
+
+		// A slot still outstanding one full ID cycle later is lost for good
+		if (__atomic_exchange_n(&g_sent_ns[slot], now_ns(), __ATOMIC_ACQ_REL) != 0)
+			overwritten++;
+
+		if (send(g_sockets[slot >> 16], packet, query->len, 0) < 0)
+		{
+			__atomic_store_n(&g_sent_ns[slot], 0, __ATOMIC_RELEASE);
+			send_errors++;
+		}
+	}
+	long long send_end = now_ns();
+
+	// --- give the stragglers their timeout, then stop listening ---
+	struct timespec grace = { (time_t)(timeout_ms / 1000), (long)(timeout_ms % 1000) * 1000000L };
+	nanosleep(&grace, NULL);
+	g_done = 1;
+	pthread_join(receiver_thread, NULL);
+
+	unsigned long long unanswered = overwritten;
+	for (size_t i = 0; i < BENCH_SLOTS; i++)
+	{
+		if (g_sent_ns[i] != 0)
+			unanswered++;
+	}
+
+	// --- report ---
+	double send_seconds = (send_end - start) / 1e9;
+	size_t answered = g_answered;
+	qsort(g_latency_us, answered, sizeof(uint32_t), compare_u32);
+
+	double sent_rate = (double)(total - send_errors) / send_seconds;
+	printf("[LAYER_7] [BENCH] sent=%llu in %.2fs (%.1f qps, %llu sends >1ms late)%s\n",
+		total - send_errors, send_seconds, sent_rate, behind,
+		(sent_rate < 0.99 * (double)rate) ? " — generator fell behind, target rate not reached" : "");
+	printf("[LAYER_7] [BENCH] answered=%zu (%.1f qps) lost=%llu (%.2f%%) send_errors=%llu late=%llu\n",
+		answered, answered / send_seconds, unanswered, 100.0 * unanswered / total, send_errors, g_late);
+	printf("[LAYER_7] [BENCH] latency ms: p50=%.3f p90=%.3f p99=%.3f p99.9=%.3f max=%.3f\n",
+		percentile_ms(g_latency_us, answered, 50), percentile_ms(g_latency_us, answered, 90),
+		percentile_ms(g_latency_us, answered, 99), percentile_ms(g_latency_us, answered, 99.9),
+		answered ? g_latency_us[answered - 1] / 1000.0 : 0.0);
+	printf("[LAYER_7] [BENCH] rcode: NOERROR=%llu NXDOMAIN=%llu SERVFAIL=%llu REFUSED=%llu truncated=%llu\n",
+		g_rcodes[0], g_rcodes[3], g_rcodes[2], g_rcodes[5], g_truncated);
+
+	long long stub_after = stub_spec ? stub_queries(&stub) : -1;
+	if (stub_before >= 0 && stub_after >= 0 && answered > 0)
+	{
+		long long upstream = stub_after - stub_before;
+		long long local = (long long)answered - upstream;
+		if (local < 0) local = 0;
+		printf("[LAYER_7] [BENCH] upstream queries=%lld, answered without upstream=%lld (%.1f%% hit ratio)\n",
+			upstream, local, 100.0 * local / answered);
+	}
+	else if (stub_spec)
+		printf("[LAYER_7] [BENCH] stub at %s did not report its counters\n", stub_spec);
+
+	for (int i = 0; i < BENCH_SOCKETS; i++)
+		close(g_sockets[i]);
+	free(queries);
+	free(g_sent_ns);
+	free(g_latency_us);
+	return 0;
+}
@@ -0,0 +1,160 @@
+#!/usr/bin/env bash
+# Checks the filter's pooled TCP upstream against dns-stub, with no network:
+#   1. a truncated UDP answer is fetched again, whole, over a pooled stream
+#   2. pipelined TCP client queries share the pool's streams (no new connection each)
+#   3. an idle stream sends keepalive probes
+#   4. with the upstream's TCP closed queries fall back to UDP, and the pool
+#      reconnects once TCP is back
+# Needs python3 for the client side. Takes about 30s (the keepalive interval).
+set -euo pipefail
+
+BENCH_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+DNS_DIR="$(dirname "$BENCH_DIR")"
+FILTER_PORT="${FILTER_PORT:-5300}"
+STUB_PORT="${STUB_PORT:-5353}"
+POOL_SIZE="$(awk '/#define DNS_UPSTREAM_POOL_SIZE/ {print $3}' "$DNS_DIR/upstream.h")"
+KEEPALIVE_MS="$(awk '/#define DNS_UPSTREAM_KEEPALIVE_MS/ {print $3}' "$DNS_DIR/upstream.h")"
+
+command -v python3 >/dev/null 2>&1 || { echo "Missing required command: python3"; exit 1; }
+
+make -s -C "$DNS_DIR"
+make -s -C "$BENCH_DIR"
+
+cleanup() {
+    [[ -n "${filter_pid:-}" ]] && kill "$filter_pid" 2>/dev/null || true
+    [[ -n "${stub_pid:-}" ]] && kill "$stub_pid" 2>/dev/null || true
+    wait 2>/dev/null || true
+}
+trap cleanup INT TERM EXIT
+
+failures=0
+check() {
+    if [[ "$2" == "true" ]]; then
+        echo "[TEST][POOL] PASS $1"
+    else
+        echo "[TEST][POOL] FAIL $1"
+        failures=$((failures + 1))
+    fi
+}
+
+# query PORT udp|tcp COUNT NAME_PREFIX [TYPE] — COUNT queries for distinct names,
+# pipelined on one connection over TCP; prints "answered truncated" (answers with records)
+query() {
+    python3 - "$@" <<'EOF'
+import random, socket, struct, sys
+port, proto, count, prefix = int(sys.argv[1]), sys.argv[2], int(sys.argv[3]), sys.argv[4]
+qtype = int(sys.argv[5]) if len(sys.argv) > 5 else 1
+def build(name, qid):
+    qname = b"".join(bytes([len(l)]) + l.encode() for l in name.split(".")) + b"\0"
+    return struct.pack(">HHHHHH", qid, 0x0100, 1, 0, 0, 0) + qname + struct.pack(">HH", qtype, 1)
+tag = random.randrange(1 << 30)
+queries = [build("%s%d-%d.example" % (prefix, i, tag) if prefix != "stats" else "stats.dns-stub", i + 1)
+           for i in range(count)]
+answers = []
+if proto == "tcp":
+    s = socket.create_connection(("127.0.0.1", port), timeout=5)
+    s.sendall(b"".join(struct.pack(">H", len(q)) + q for q in queries))
+    data = b""
+    try:
+        while len(answers) < count:
+            while len(data) >= 2 and len(data) >= 2 + struct.unpack(">H", data[:2])[0]:
+                n = struct.unpack(">H", data[:2])[0]
+                answers.append(data[2:2 + n]); data = data[2 + n:]
+            if len(answers) < count:
+                chunk = s.recv(65536)
+                if not chunk:
+                    break
+                data += chunk
+    except socket.timeout:
+        pass
+else:
+    s = socket.socket(socket.AF_INET, socket.SOCK_DGRAM); s.settimeout(5)
+    for q in queries:
+        s.sendto(q, ("127.0.0.1", port))
+        try:
+            answers.append(s.recv(65536))
+        except socket.timeout:
+            pass
+if prefix == "stats":
+    text = answers[0][answers[0].index(b"queries="):].decode() if answers else ""
+    print(" ".join(f.split("=")[1] for f in text.split()))
+else:
+    answered = sum(1 for a in answers if struct.unpack(">H", a[6:8])[0] > 0)
+    truncated = sum(1 for a in answers if a[2] & 0x02)
+    print(answered, truncated)
+EOF
+}
+
+# prints "queries dropped tcp_queries tcp_connections" as the stub counts them
+stub_stats() {
+    query "$STUB_PORT" udp 1 stats 16
+}
+
+start_stub() {
+    "$BENCH_DIR/dns-stub" -p "$STUB_PORT" -l 2 "$@" > /dev/null &
+    stub_pid=$!
+    sleep 0.5
+}
+
+stop_stub() {
+    kill "$stub_pid" 2>/dev/null || true
+    wait "$stub_pid" 2>/dev/null || true
+    stub_pid=
+}
+
+start_stub -T
+(
+    cd "$DNS_DIR"
+    exec ./dns-filter -l 0 -c none -p "$FILTER_PORT" "127.0.0.1:$STUB_PORT" > "$BENCH_DIR/dns-filter.log" 2>&1
+) &
+filter_pid=$!
+sleep 2
+
+# --- 1. TC=1 over UDP → refetched over the pool ---
+read -r answered truncated <<< "$(query "$FILTER_PORT" udp 5 tc)"
+check "truncated UDP answers refetched whole over the pool ($answered/5 answered, $truncated truncated)" \
+    "$([[ $answered -eq 5 && $truncated -eq 0 ]] && echo true || echo false)"
+
+# --- 2. pipelined TCP client queries reuse the pool's streams ---
+read -r _ _ tcp_before conns_before <<< "$(stub_stats)"
+read -r answered _ <<< "$(query "$FILTER_PORT" tcp 200 pipe)"
+read -r _ _ tcp_after conns_after <<< "$(stub_stats)"
+check "200 pipelined TCP queries answered ($answered)" "$([[ $answered -eq 200 ]] && echo true || echo false)"
+check "they went upstream over the pool ($((tcp_after - tcp_before)) TCP queries at the stub)" \
+    "$([[ $((tcp_after - tcp_before)) -ge 200 ]] && echo true || echo false)"
+check "on at most $POOL_SIZE streams, none opened for them ($conns_after connections in all)" \
+    "$([[ $conns_after -le $POOL_SIZE && $conns_after -eq $conns_before ]] && echo true || echo false)"
+
+# --- 3. keepalive probes on idle streams ---
+echo "[TEST][POOL] Idling $((KEEPALIVE_MS / 1000 + 2))s for keepalive probes"
+sleep $((KEEPALIVE_MS / 1000 + 2))
+read -r _ _ tcp_idle _ <<< "$(stub_stats)"
+check "idle streams sent keepalive probes ($((tcp_idle - tcp_after)))" \
+    "$([[ $tcp_idle -gt $tcp_after ]] && echo true || echo false)"
+
+# --- 4. UDP fallback while TCP is refused, reconnect once it is back ---
+stop_stub
+start_stub -U
+read -r answered _ <<< "$(query "$FILTER_PORT" tcp 20 fallback)"
+read -r queries _ tcp_queries _ <<< "$(stub_stats)"
+check "with upstream TCP refused, TCP client queries answered over UDP ($answered/20, $queries UDP at the stub)" \
+    "$([[ $answered -eq 20 && $queries -ge 20 && $tcp_queries -eq 0 ]] && echo true || echo false)"
+
+# the pool is backing off by now; give it up to the longest delay to come back
+stop_stub
+start_stub
+for _ in $(seq 60); do
+    read -r _ _ _ conns <<< "$(stub_stats)"
+    [[ $conns -ge 1 ]] && break
+    sleep 0.5
+done
+read -r answered _ <<< "$(query "$FILTER_PORT" tcp 20 back)"
+read -r _ _ tcp_queries conns <<< "$(stub_stats)"
+check "pool reconnected after backoff ($conns streams, $tcp_queries TCP queries)" \
+    "$([[ $answered -eq 20 && $conns -ge 1 && $tcp_queries -ge 20 ]] && echo true || echo false)"
+
+if [[ $failures -gt 0 ]]; then
+    echo "[TEST][POOL] $failures check(s) failed — see $BENCH_DIR/dns-filter.log"
+    exit 1
+fi
+echo "[TEST][POOL] All checks passed"
@@ -0,0 +1,36 @@
+#!/usr/bin/env bash
+# Benchmarks the DNS filter on this box alone: dns-stub stands in for the
+# upstream, the filter listens on an unprivileged port, dns-bench drives it.
+#   ./run_bench.sh                      # 1000 qps for 10s, 20ms upstream
+#   STUB_LATENCY=5 ./run_bench.sh -r 5000 -d 30
+# Extra arguments go to dns-bench; STUB_LATENCY / STUB_TTL / STUB_NX tune the stub.
+set -euo pipefail
+
+BENCH_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+DNS_DIR="$(dirname "$BENCH_DIR")"
+FILTER_PORT="${FILTER_PORT:-5300}"
+STUB_PORT="${STUB_PORT:-5353}"
+
+make -s -C "$DNS_DIR"
+make -s -C "$BENCH_DIR"
+
+cleanup() {
+    [[ -n "${filter_pid:-}" ]] && kill "$filter_pid" 2>/dev/null || true
+    [[ -n "${stub_pid:-}" ]] && kill "$stub_pid" 2>/dev/null || true
+    wait 2>/dev/null || true
+}
+trap cleanup INT TERM EXIT
+
+"$BENCH_DIR/dns-stub" -p "$STUB_PORT" -l "${STUB_LATENCY:-20}" -t "${STUB_TTL:-300}" -n "${STUB_NX:-0}" &
+stub_pid=$!
+
+# No rate limit (one client IP sends everything), no snapshot (cold cache every run)
+(
+    cd "$DNS_DIR"
+    exec ./dns-filter -l 0 -c none -p "$FILTER_PORT" "127.0.0.1:$STUB_PORT" > "$BENCH_DIR/dns-filter.log" 2>&1
+) &
+filter_pid=$!
+sleep 2
+
+cd "$BENCH_DIR"
+./dns-bench -s "127.0.0.1:$FILTER_PORT" -u "127.0.0.1:$STUB_PORT" "$@"
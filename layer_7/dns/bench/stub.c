@@ -0,0 +1,516 @@
+// dns-stub — a local upstream for benchmarking the DNS filter with no network
+//
+// Answers A queries with a TEST-NET-1 address (192.0.2.x, stable per name),
+// other types with NODATA + SOA, and a configurable share of names with
+// NXDOMAIN — all after a fixed delay, so upstream RTT is a knob instead of
+// whatever the WAN does today. A TXT query for "stats.dns-stub" returns the
+// query counter (answered at once, not counted) for dns-bench's hit ratio.
+//
+// Serves UDP and RFC 7766 TCP on the same port, so the filter's pooled
+// upstream streams (pipelining, keepalive probes, reconnects) have something
+// to talk to; -T truncates every UDP answer to push the filter onto them,
+// -U leaves TCP closed so the filter has to fall back to UDP.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#define STUB_DEFAULT_PORT       5353
+#define STUB_DEFAULT_TTL        300
+#define STUB_DEFAULT_LATENCY_MS 20
+#define STUB_MAX_LATENCY_MS     60000
+#define STUB_MAX_TTL            2147483647  // RFC 2181 section 8
+// delayed answers waiting to go out (power of two); past this, queries are dropped
+#define STUB_QUEUE_SIZE         16384
+#define STUB_PACKET_SIZE        512
+#define STUB_RECV_BUFFER        4096
+#define STUB_MAX_CONNECTIONS    64          // TCP clients at once; more are closed on accept
+
+#define TYPE_A      1
+#define TYPE_SOA    6
+#define TYPE_TXT    16
+
+// control query answered with the counters
+static const unsigned char STATS_QNAME[] = "\x05stats\x08" "dns-stub";
+
+// SOA MNAME / RNAME of the stub zone
+static const unsigned char SOA_MNAME[] = "\x02ns\x04stub";
+static const unsigned char SOA_RNAME[] = "\x04host\x04stub";
+
+// --- one TCP client: a length-framed stream of queries ---
+typedef struct {
+	int fd;                             // -1 when the slot is free
+	unsigned generation;                // bumped on close, so late answers find out
+	size_t used;
+	unsigned char buffer[2 + STUB_RECV_BUFFER];
+} stub_conn_t;
+
+// --- one answer waiting for its due time ---
+typedef struct {
+	long long due_us;
+	struct sockaddr_in addr;            // UDP client
+	int conn;                           // TCP client slot, -1 for UDP
+	unsigned generation;
+	uint16_t len;
+	unsigned char packet[STUB_PACKET_SIZE];
+} stub_pending_t;
+
+static stub_pending_t g_queue[STUB_QUEUE_SIZE];
+static size_t g_queue_head = 0;
+static size_t g_queue_count = 0;
+
+static stub_conn_t g_conns[STUB_MAX_CONNECTIONS];
+
+static uint32_t g_ttl = STUB_DEFAULT_TTL;
+static unsigned g_nx_percent = 0;
+static bool g_truncate_udp = false;
+static bool g_udp_only = false;
+
+static unsigned long long g_queries = 0;
+static unsigned long long g_dropped = 0;
+static unsigned long long g_tcp_queries = 0;
+static unsigned long long g_tcp_connections = 0;
+
+static volatile sig_atomic_t g_stop = 0;
+
+static void handle_signal(int sig)
+{
+	(void)sig;
+	g_stop = 1;
+}
+
+static long long now_us(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (long long)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static void write_u16(unsigned char *p, uint16_t value)
+{
+	p[0] = (unsigned char)(value >> 8);
+	p[1] = (unsigned char)value;
+}
+
+static void write_u32(unsigned char *p, uint32_t value)
+{
+	write_u16(p, (uint16_t)(value >> 16));
+	write_u16(p + 2, (uint16_t)value);
+}
+
+// owner pointer to the question + TYPE, CLASS IN, TTL, RDLENGTH
+static size_t write_rr_header(unsigned char *out, uint16_t type, uint32_t ttl, uint16_t rdlength)
+{
+	out[0] = 0xC0;
+	out[1] = 12;
+	write_u16(out + 2, type);
+	write_u16(out + 4, 1);
+	write_u32(out + 6, ttl);
+	write_u16(out + 10, rdlength);
+	return 12;
+}
+
+static size_t write_soa(unsigned char *out)
+{
+	size_t rdlength = sizeof(SOA_MNAME) + sizeof(SOA_RNAME) + 20;
+	size_t len = write_rr_header(out, TYPE_SOA, g_ttl, (uint16_t)rdlength);
+	memcpy(out + len, SOA_MNAME, sizeof(SOA_MNAME));
+	len += sizeof(SOA_MNAME);
+	memcpy(out + len, SOA_RNAME, sizeof(SOA_RNAME));
+	len += sizeof(SOA_RNAME);
+	write_u32(out + len, 1);            // SERIAL
+	write_u32(out + len + 4, 3600);     // REFRESH
+	write_u32(out + len + 8, 600);      // RETRY
+	write_u32(out + len + 12, 86400);   // EXPIRE
+	write_u32(out + len + 16, g_ttl);   // MINIMUM — the negative TTL
+	return len + 20;
+}
+
+// case-insensitive FNV-1a over the wire name, so a name always gets the same answer
+static uint32_t name_hash(const unsigned char *name, size_t len)
+{
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < len; i++)
+	{
+		unsigned char c = name[i];
+		if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+		hash = (hash ^ c) * 16777619u;
+	}
+	return hash;
+}
+
+// builds the answer for one query into out; returns its length, 0 to ignore the packet
+// *stats is set for the control query
+static size_t build_answer(const unsigned char *query, size_t query_len, bool tcp, unsigned char *out, bool *stats)
+{
+	*stats = false;
+	if (query_len < 12 + 5 || (query[2] & 0x80))
+		return 0;
+
+	// Queries are never compressed — walk the labels of the first question
+	size_t pos = 12;
+	while (pos < query_len && query[pos] != 0)
+	{
+		if (query[pos] & 0xC0)
+			return 0;
+		pos += (size_t)query[pos] + 1;
+	}
+	if (pos + 5 > query_len)
+		return 0;
+
+	size_t name_len = pos + 1 - 12;
+	size_t question_end = pos + 5;
+	uint16_t qtype = (uint16_t)((query[pos + 1] << 8) | query[pos + 2]);
+	if (question_end + 128 > STUB_PACKET_SIZE)
+		return 0;
+
+	// --- header + question, answer records follow ---
+	memcpy(out, query, question_end);
+	out[2] = 0x80 | (query[2] & 0x79);      // QR, keep OPCODE and RD
+	out[3] = 0x80;                          // RA, NOERROR
+	write_u16(out + 4, 1);
+	memset(out + 6, 0, 6);
+	size_t len = question_end;
+
+	if (name_len == sizeof(STATS_QNAME) && qtype == TYPE_TXT &&
+		memcmp(query + 12, STATS_QNAME, sizeof(STATS_QNAME)) == 0)
+	{
+		char text[128];
+		int text_len = snprintf(text, sizeof(text), "queries=%llu dropped=%llu tcp_queries=%llu tcp_connections=%llu",
+			g_queries, g_dropped, g_tcp_queries, g_tcp_connections);
+		len += write_rr_header(out + len, TYPE_TXT, 0, (uint16_t)(text_len + 1));
+		out[len++] = (unsigned char)text_len;
+		memcpy(out + len, text, (size_t)text_len);
+		len += (size_t)text_len;
+		write_u16(out + 6, 1);
+		*stats = true;
+		return len;
+	}
+
+	// header and question only, TC set — the client has to ask again over TCP
+	if (!tcp && g_truncate_udp)
+	{
+		out[2] |= 0x02;
+		return len;
+	}
+
+	uint32_t hash = name_hash(query + 12, name_len);
+	if (hash % 100 < g_nx_percent)
+	{
+		out[3] |= 3;                        // NXDOMAIN
+		len += write_soa(out + len);
+		write_u16(out + 8, 1);
+	}
+	else if (qtype == TYPE_A)
+	{
+		len += write_rr_header(out + len, TYPE_A, g_ttl, 4);
+		out[len++] = 192;
+		out[len++] = 0;
+		out[len++] = 2;
+		out[len++] = (unsigned char)(hash % 254 + 1);
+		write_u16(out + 6, 1);
+	}
+	else
+	{
+		len += write_soa(out + len);        // NODATA
+		write_u16(out + 8, 1);
+	}
+	return len;
+}
+
+// whole-string decimal in [0, max]; returns 0, or -1 on junk or out of range
+static int parse_number(const char *text, unsigned long max, unsigned long *out)
+{
+	char *end;
+	errno = 0;
+	unsigned long value = strtoul(text, &end, 10);
+	if (end == text || *end != '\0' || *text == '-' || errno == ERANGE || value > max)
+		return -1;
+	*out = value;
+	return 0;
+}
+
+// ---------- TCP CLIENTS ----------
+
+static void conn_close(int slot)
+{
+	close(g_conns[slot].fd);
+	g_conns[slot].fd = -1;
+	g_conns[slot].generation++;
+	g_conns[slot].used = 0;
+}
+
+static void accept_clients(int listener)
+{
+	int fd;
+	while ((fd = accept(listener, NULL, NULL)) >= 0)
+	{
+		int slot = 0;
+		while (slot < STUB_MAX_CONNECTIONS && g_conns[slot].fd >= 0)
+			slot++;
+		if (slot == STUB_MAX_CONNECTIONS || fcntl(fd, F_SETFL, O_NONBLOCK) < 0)
+		{
+			close(fd);
+			continue;
+		}
+		g_conns[slot].fd = fd;
+		g_conns[slot].used = 0;
+		g_tcp_connections++;
+	}
+}
+
+// a UDP datagram, or a length-prefixed TCP frame; an answer the client can't
+// take right away closes the stream — the filter reads its streams constantly
+static void send_answer(int sock, const stub_pending_t *answer)
+{
+	if (answer->conn < 0)
+	{
+		sendto(sock, answer->packet, answer->len, 0,
+			(const struct sockaddr *)&answer->addr, sizeof(answer->addr));
+		return;
+	}
+
+	stub_conn_t *conn = &g_conns[answer->conn];
+	if (conn->fd < 0 || conn->generation != answer->generation)
+		return;                         // the client went away meanwhile
+
+	unsigned char frame[2 + STUB_PACKET_SIZE];
+	write_u16(frame, answer->len);
+	memcpy(frame + 2, answer->packet, answer->len);
+	if (send(conn->fd, frame, (size_t)answer->len + 2, MSG_NOSIGNAL) != (ssize_t)answer->len + 2)
+		conn_close(answer->conn);
+}
+
+// ---------- QUERIES ----------
+
+// answers at once (control query, zero latency) or queues it in due order
+static void handle_query(int sock, const unsigned char *query, size_t len, long long latency_us,
+                         const struct sockaddr_in *client, int conn)
+{
+	stub_pending_t answer = { .conn = conn };
+	if (client)
+		answer.addr = *client;
+	if (conn >= 0)
+		answer.generation = g_conns[conn].generation;
+
+	bool stats;
+	size_t answer_len = build_answer(query, len, conn >= 0, answer.packet, &stats);
+	if (answer_len == 0)
+		return;
+	answer.len = (uint16_t)answer_len;
+
+	if (!stats)
+	{
+		g_queries++;
+		if (conn >= 0)
+			g_tcp_queries++;
+	}
+	if (stats || latency_us == 0)
+	{
+		send_answer(sock, &answer);
+		return;
+	}
+
+	if (g_queue_count == STUB_QUEUE_SIZE)
+	{
+		g_dropped++;
+		return;
+	}
+	answer.due_us = now_us() + latency_us;
+	g_queue[(g_queue_head + g_queue_count) & (STUB_QUEUE_SIZE - 1)] = answer;
+	g_queue_count++;
+}
+
+// reads what the stream has and handles every complete frame in it
+static void read_conn(int sock, int slot, long long latency_us)
+{
+	stub_conn_t *conn = &g_conns[slot];
+	ssize_t n = recv(conn->fd, conn->buffer + conn->used, sizeof(conn->buffer) - conn->used, 0);
+	if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR))
+	{
+		conn_close(slot);
+		return;
+	}
+	if (n < 0)
+		return;
+	conn->used += (size_t)n;
+
+	size_t pos = 0;
+	while (conn->used - pos >= 2)
+	{
+		size_t frame_len = ((size_t)conn->buffer[pos] << 8) | conn->buffer[pos + 1];
+		if (frame_len == 0 || frame_len > STUB_RECV_BUFFER)
+		{
+			conn_close(slot);
+			return;
+		}
+		if (conn->used - pos < 2 + frame_len)
+			break;
+		handle_query(sock, conn->buffer + pos + 2, frame_len, latency_us, NULL, slot);
+		if (conn->fd < 0)
+			return;                     // an immediate answer failed and closed it
+		pos += 2 + frame_len;
+	}
+	memmove(conn->buffer, conn->buffer + pos, conn->used - pos);
+	conn->used -= pos;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-p port] [-l latency_ms] [-t ttl] [-n nxdomain_percent] [-T | -U]\n", prog);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long port = STUB_DEFAULT_PORT;
+	unsigned long ttl = STUB_DEFAULT_TTL;
+	unsigned long nx_percent = 0;
+	long long latency_us = STUB_DEFAULT_LATENCY_MS * 1000LL;
+	bool valid = true;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "p:l:t:n:TU")) != -1)
+	{
+		char *end;
+		double latency_ms;
+		switch (opt)
+		{
+			case 'p': valid &= parse_number(optarg, 65535, &port) == 0 && port != 0; break;
+			case 't': valid &= parse_number(optarg, STUB_MAX_TTL, &ttl) == 0; break;
+			case 'n': valid &= parse_number(optarg, 100, &nx_percent) == 0; break;
+			case 'T': g_truncate_udp = true; break;
+			case 'U': g_udp_only = true; break;
+			case 'l':
+				latency_ms = strtod(optarg, &end);
+				valid &= end != optarg && *end == '\0' && latency_ms >= 0 && latency_ms <= STUB_MAX_LATENCY_MS;
+				latency_us = (long long)(latency_ms * 1000.0);
+				break;
+			default: usage(argv[0]); return 1;
+		}
+	}
+	g_ttl = (uint32_t)ttl;
+	g_nx_percent = (unsigned)nx_percent;
+	if (!valid || (g_truncate_udp && g_udp_only))
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	int sock = socket(AF_INET, SOCK_DGRAM, 0);
+	int listener = socket(AF_INET, SOCK_STREAM, 0);
+	if (sock < 0 || listener < 0)
+	{
+		perror("Stub socket failed");
+		return 1;
+	}
+
+	// Bursts from the filter must queue in the kernel, not get dropped there
+	int buffer_size = 4 * 1024 * 1024;
+	setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+	setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &buffer_size, sizeof(buffer_size));
+	int reuse = 1;
+	setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons((uint16_t)port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+		fcntl(sock, F_SETFL, O_NONBLOCK) < 0 ||
+		(!g_udp_only && (bind(listener, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+			listen(listener, 16) < 0 ||
+			fcntl(listener, F_SETFL, O_NONBLOCK) < 0)))
+	{
+		perror("Couldn't bind stub socket");
+		close(sock);
+		close(listener);
+		return 1;
+	}
+	for (int i = 0; i < STUB_MAX_CONNECTIONS; i++)
+		g_conns[i].fd = -1;
+
+	signal(SIGINT, handle_signal);
+	signal(SIGTERM, handle_signal);
+
+	printf("[LAYER_7] [STUB] Listening on 127.0.0.1:%lu (%s) latency=%.1fms ttl=%u nxdomain=%u%%%s\n",
+		port, g_udp_only ? "UDP" : "UDP + TCP", latency_us / 1000.0, g_ttl, g_nx_percent,
+		g_truncate_udp ? " truncate-udp" : "");
+	fflush(stdout);
+
+	unsigned char query[STUB_RECV_BUFFER];
+	struct pollfd pfds[2 + STUB_MAX_CONNECTIONS];
+	int slots[2 + STUB_MAX_CONNECTIONS];
+	while (!g_stop)
+	{
+		// --- sleep until a packet arrives or the oldest answer is due ---
+		int timeout_ms = -1;
+		if (g_queue_count > 0)
+		{
+			long long wait = g_queue[g_queue_head].due_us - now_us();
+			timeout_ms = (wait > 0) ? (int)((wait + 999) / 1000) : 0;
+		}
+		nfds_t nfds = 0;
+		pfds[nfds++] = (struct pollfd){ .fd = sock, .events = POLLIN };
+		pfds[nfds++] = (struct pollfd){ .fd = g_udp_only ? -1 : listener, .events = POLLIN };
+		for (int i = 0; i < STUB_MAX_CONNECTIONS; i++)
+		{
+			if (g_conns[i].fd < 0)
+				continue;
+			slots[nfds] = i;
+			pfds[nfds++] = (struct pollfd){ .fd = g_conns[i].fd, .events = POLLIN };
+		}
+		if (poll(pfds, nfds, timeout_ms) < 0 && errno != EINTR)
+			break;
+
+		// --- drain the socket; fixed latency keeps the queue in due order ---
+		while (1)
+		{
+			struct sockaddr_in client;
+			socklen_t client_len = sizeof(client);
+			ssize_t n = recvfrom(sock, query, sizeof(query), 0, (struct sockaddr *)&client, &client_len);
+			if (n < 0)
+				break;
+			handle_query(sock, query, (size_t)n, latency_us, &client, -1);
+		}
+
+		if (pfds[1].revents & POLLIN)
+			accept_clients(listener);
+		for (nfds_t i = 2; i < nfds; i++)
+		{
+			if (pfds[i].revents)
+				read_conn(sock, slots[i], latency_us);
+		}
+
+		// --- send everything that is due ---
+		long long now = now_us();
+		while (g_queue_count > 0 && g_queue[g_queue_head].due_us <= now)
+		{
+			send_answer(sock, &g_queue[g_queue_head]);
+			g_queue_head = (g_queue_head + 1) & (STUB_QUEUE_SIZE - 1);
+			g_queue_count--;
+		}
+	}
+
+	printf("[LAYER_7] [STUB] queries=%llu dropped=%llu tcp_queries=%llu tcp_connections=%llu\n",
+		g_queries, g_dropped, g_tcp_queries, g_tcp_connections);
+	for (int i = 0; i < STUB_MAX_CONNECTIONS; i++)
+	{
+		if (g_conns[i].fd >= 0)
+			close(g_conns[i].fd);
+	}
+	close(listener);
+	close(sock);
+	return 0;
+}
@@ -0,0 +1,603 @@
+#include <errno.h>
+
+#include "cache.h"
+#include "../../common/blocklist.h"
+
+// --- global cache state ---
+// receive loop and worker threads share both tables
+// access protected by g_cache_lock
+static dns_cache_table_t g_positive_cache;
+static dns_cache_table_t g_negative_cache;
+static pthread_mutex_t g_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void cache_table_init(dns_cache_table_t *table, size_t bucket_count,
+                             size_t max_entries, uint32_t max_ttl)
+{
+	memset(table, 0, sizeof(*table));
+	table->buckets = calloc(bucket_count, sizeof(dns_cache_entry_t *));
+	if (!table->buckets)
+	{
+		perror("Failed to allocate DNS cache buckets");
+		exit(1);
+	}
+	table->bucket_count = bucket_count;
+	table->max_entries = max_entries;
+	table->max_ttl = max_ttl;
+}
+
+// --- LRU list helpers ---
+// caller must hold g_cache_lock
+static void lru_unlink(dns_cache_table_t *table, dns_cache_entry_t *entry)
+{
+	if (entry->lru_prev) entry->lru_prev->lru_next = entry->lru_next;
+	else table->lru_head = entry->lru_next;
+
+	if (entry->lru_next) entry->lru_next->lru_prev = entry->lru_prev;
+	else table->lru_tail = entry->lru_prev;
+
+	entry->lru_prev = entry->lru_next = NULL;
+}
+
+static void lru_push_front(dns_cache_table_t *table, dns_cache_entry_t *entry)
+{
+	entry->lru_prev = NULL;
+	entry->lru_next = table->lru_head;
+	if (table->lru_head) table->lru_head->lru_prev = entry;
+	table->lru_head = entry;
+	if (!table->lru_tail) table->lru_tail = entry;
+}
+
+// unlinks entry from its bucket and the LRU list, then frees it
+// caller must hold g_cache_lock
+static void cache_remove(dns_cache_table_t *table, dns_cache_entry_t *entry)
+{
+	dns_cache_entry_t **cursor = &table->buckets[entry->hash % table->bucket_count];
+	while (*cursor && *cursor != entry)
+		cursor = &(*cursor)->next;
+	if (*cursor) *cursor = entry->next;
+
+	lru_unlink(table, entry);
+	free(entry->response);
+	free(entry);
+	table->total_entries--;
+}
+
+// caller must hold g_cache_lock
+static dns_cache_entry_t *cache_find(dns_cache_table_t *table, const char *name,
+                                     uint16_t qtype, uint16_t qclass, uint32_t hash)
+{
+	dns_cache_entry_t *entry = table->buckets[hash % table->bucket_count];
+	while (entry)
+	{
+		if (entry->hash == hash && entry->qtype == qtype &&
+			entry->qclass == qclass && strcmp(entry->name, name) == 0)
+			return entry;
+		entry = entry->next;
+	}
+	return NULL;
+}
+
+// --- wire helpers ---
+
+// walks every resource record after the question and calls back with a
+// pointer to its fixed part (TYPE..RDLENGTH) and section index
+// 0 = answer, 1 = authority, 2 = additional
+// returns -1 if the packet is malformed
+typedef int (*rr_visitor_t)(unsigned char *rr, int section, const unsigned char *packet,
+                            size_t packet_len, size_t rdata_offset, void *ctx);
+
+static int walk_records(unsigned char *packet, size_t packet_len, size_t question_end,
+                        rr_visitor_t visit, void *ctx)
+{
+	const struct dns_hdr *header = (const struct dns_hdr *)packet;
+	uint16_t counts[3] = { ntohs(header->ancount), ntohs(header->nscount), ntohs(header->arcount) };
+	size_t offset = question_end;
+
+	for (int section = 0; section < 3; section++)
+	{
+		for (uint16_t i = 0; i < counts[section]; i++)
+		{
+			int after_name = dns_skip_name(packet, packet_len, offset);
+			if (after_name < 0 || (size_t)after_name + DNS_RR_FIXED_SIZE > packet_len)
+				return -1;
+
+			unsigned char *rr = packet + after_name;
+			size_t rdata_offset = (size_t)after_name + DNS_RR_FIXED_SIZE;
+			size_t rdlength = dns_read_u16(rr + 8);
+			if (rdata_offset + rdlength > packet_len)
+				return -1;
+
+			if (visit && visit(rr, section, packet, packet_len, rdata_offset, ctx) < 0)
+				return -1;
+
+			offset = rdata_offset + rdlength;
+		}
+	}
+	return 0;
+}
+
+static int age_ttl(unsigned char *rr, int section, const unsigned char *packet,
+                   size_t packet_len, size_t rdata_offset, void *ctx)
+{
+	(void)section; (void)packet; (void)packet_len; (void)rdata_offset;
+	uint32_t elapsed = *(uint32_t *)ctx;
+
+	if (dns_read_u16(rr) == DNS_TYPE_OPT)
+		return 0;
+
+	uint32_t ttl = dns_read_u32(rr + 4);
+	dns_write_u32(rr + 4, (ttl > elapsed) ? ttl - elapsed : 0);
+	return 0;
+}
+
+static int set_ttl(unsigned char *rr, int section, const unsigned char *packet,
+                   size_t packet_len, size_t rdata_offset, void *ctx)
+{
+	(void)section; (void)packet; (void)packet_len; (void)rdata_offset;
+
+	if (dns_read_u16(rr) != DNS_TYPE_OPT)
+		dns_write_u32(rr + 4, *(uint32_t *)ctx);
+	return 0;
+}
+
+// copies the client's ID and question spelling (0x20 case randomization)
+// onto a cached answer
+static void stamp_client(unsigned char *out, const unsigned char *query,
+                         const dns_question_t *question)
+{
+	memcpy(out + sizeof(struct dns_hdr), query + sizeof(struct dns_hdr),
+		question->question_end - sizeof(struct dns_hdr));
+	((struct dns_hdr *)out)->id = ((const struct dns_hdr *)query)->id;
+}
+
+// --- public API ---
+
+void dns_cache_init(void)
+{
+	cache_table_init(&g_positive_cache, DNS_CACHE_POS_BUCKETS,
+		DNS_CACHE_POS_MAX_ENTRIES, DNS_CACHE_MAX_TTL);
+	cache_table_init(&g_negative_cache, DNS_CACHE_NEG_BUCKETS,
+		DNS_CACHE_NEG_MAX_ENTRIES, DNS_CACHE_NEG_MAX_TTL);
+}
+
+size_t dns_cache_lookup(const dns_question_t *question, const unsigned char *query,
+                        unsigned char *out, size_t out_size, bool *negative, bool *refresh)
+{
+	uint32_t hash = question->hash;
+	dns_cache_table_t *tables[2] = { &g_positive_cache, &g_negative_cache };
+	time_t now = time(NULL);
+	size_t written = 0;
+	uint32_t elapsed = 0;
+
+	pthread_mutex_lock(&g_cache_lock);
+	for (int i = 0; i < 2 && written == 0; i++)
+	{
+		dns_cache_table_t *table = tables[i];
+		if (!table->buckets)
+			continue;
+
+		dns_cache_entry_t *entry = cache_find(table, question->qname.name,
+			question->qtype, question->qclass, hash);
+		if (!entry)
+			continue;
+
+		// Expired — keep it around for serve-stale, drop it once that window closes
+		if (now - entry->stored_at >= (time_t)entry->ttl)
+		{
+			if (now - entry->stored_at >= (time_t)entry->ttl + DNS_CACHE_STALE_WINDOW)
+				cache_remove(table, entry);
+			continue;
+		}
+
+		// The client's question must line up byte for byte with ours
+		if (entry->response_len > out_size || entry->question_end != question->question_end)
+			continue;
+
+		memcpy(out, entry->response, entry->response_len);
+		written = entry->response_len;
+		elapsed = (uint32_t)(now - entry->stored_at);
+
+		lru_unlink(table, entry);
+		lru_push_front(table, entry);
+		table->hits++;
+		entry->hits++;
+
+		if (negative) *negative = (table == &g_negative_cache);
+
+		// Popular answer nearing expiry — ask for one background refresh
+		if (refresh && table == &g_positive_cache && !entry->prefetch_pending &&
+			entry->hits >= DNS_CACHE_PREFETCH_MIN_HITS &&
+			(uint64_t)elapsed * 100 >= (uint64_t)entry->ttl * DNS_CACHE_PREFETCH_PERCENT)
+		{
+			entry->prefetch_pending = true;
+			*refresh = true;
+		}
+	}
+	pthread_mutex_unlock(&g_cache_lock);
+
+	if (written == 0)
+		return 0;
+
+	stamp_client(out, query, question);
+	if (walk_records(out, written, question->question_end, age_ttl, &elapsed) < 0)
+		return 0;
+
+	return written;
+}
+
+size_t dns_cache_lookup_stale(const dns_question_t *question, const unsigned char *query,
+                              unsigned char *out, size_t out_size)
+{
+	dns_cache_table_t *tables[2] = { &g_positive_cache, &g_negative_cache };
+	time_t now = time(NULL);
+	size_t written = 0;
+
+	pthread_mutex_lock(&g_cache_lock);
+	for (int i = 0; i < 2 && written == 0; i++)
+	{
+		dns_cache_table_t *table = tables[i];
+		if (!table->buckets)
+			continue;
+
+		dns_cache_entry_t *entry = cache_find(table, question->qname.name,
+			question->qtype, question->qclass, question->hash);
+		if (!entry || entry->response_len > out_size ||
+			entry->question_end != question->question_end)
+			continue;
+
+		time_t age = now - entry->stored_at;
+		if (age >= (time_t)entry->ttl + DNS_CACHE_STALE_WINDOW)
+			continue;
+
+		memcpy(out, entry->response, entry->response_len);
+		written = entry->response_len;
+		table->stale_hits++;
+	}
+	pthread_mutex_unlock(&g_cache_lock);
+
+	if (written == 0)
+		return 0;
+
+	// RFC 8767 section 4 — stale data goes out with a short TTL
+	uint32_t stale_ttl = DNS_CACHE_STALE_ANSWER_TTL;
+	stamp_client(out, query, question);
+	if (walk_records(out, written, question->question_end, set_ttl, &stale_ttl) < 0)
+		return 0;
+
+	return written;
+}
+
+// Copies a response into a new, unlinked entry
+static dns_cache_entry_t *cache_entry_new(const dns_question_t *question,
+                                          const unsigned char *response, size_t response_len,
+                                          time_t stored_at, uint32_t ttl)
+{
+	dns_cache_entry_t *entry = calloc(1, sizeof(dns_cache_entry_t));
+	if (!entry)
+		return NULL;
+
+	entry->response = malloc(response_len);
+	if (!entry->response)
+	{
+		free(entry);
+		return NULL;
+	}
+
+	memcpy(entry->response, response, response_len);
+	memcpy(entry->name, question->qname.name, sizeof(entry->name));
+	entry->response_len = response_len;
+	entry->question_end = question->question_end;
+	entry->qtype = question->qtype;
+	entry->qclass = question->qclass;
+	entry->hash = question->hash;
+	entry->stored_at = stored_at;
+	entry->ttl = ttl;
+	return entry;
+}
+
+// Links a fully built entry into its table, replacing any previous answer for
+// the same question and evicting from the LRU tail until there is room.
+// Frees the entry if the cache has already been torn down.
+static void cache_insert(dns_cache_table_t *table, dns_cache_entry_t *entry, bool carry_hits)
+{
+	pthread_mutex_lock(&g_cache_lock);
+	if (!table->buckets)
+	{
+		pthread_mutex_unlock(&g_cache_lock);
+		free(entry->response);
+		free(entry);
+		return;
+	}
+
+	// A name can only live in one table — replace whatever we had before,
+	// keeping a decayed share of its popularity so hot names stay prefetched
+	dns_cache_table_t *tables[2] = { &g_positive_cache, &g_negative_cache };
+	for (int i = 0; i < 2; i++)
+	{
+		dns_cache_entry_t *old = cache_find(tables[i], entry->name,
+			entry->qtype, entry->qclass, entry->hash);
+		if (old)
+		{
+			if (carry_hits)
+				entry->hits = old->hits / 2;
+			cache_remove(tables[i], old);
+		}
+	}
+
+	// Evict least recently used answers until there is room
+	while (table->total_entries >= table->max_entries && table->lru_tail)
+	{
+		cache_remove(table, table->lru_tail);
+		table->evictions++;
+	}
+
+	size_t index = entry->hash % table->bucket_count;
+	entry->next = table->buckets[index];
+	table->buckets[index] = entry;
+	lru_push_front(table, entry);
+	table->total_entries++;
+	pthread_mutex_unlock(&g_cache_lock);
+}
+
+void dns_cache_store(const dns_question_t *question,
+                     const unsigned char *response, size_t response_len,
+                     const dns_response_info_t *info)
+{
+	if (response_len < question->question_end || response_len > DNS_CACHE_MAX_RESPONSE)
+		return;
+
+	const struct dns_hdr *header = (const struct dns_hdr *)response;
+	uint16_t flags = ntohs(header->flags);
+	uint16_t rcode = flags & DNS_FLAG_RCODE;
+
+	// Truncated answers are incomplete by definition
+	if (flags & DNS_FLAG_TC)
+		return;
+
+	// --- classify: positive, negative or uncacheable ---
+	dns_cache_table_t *table;
+	uint32_t ttl;
+	if (rcode == DNS_RCODE_NOERROR && ntohs(header->ancount) > 0)
+	{
+		table = &g_positive_cache;
+		ttl = info->min_ttl;
+	}
+	else if ((rcode == DNS_RCODE_NXDOMAIN || rcode == DNS_RCODE_NOERROR) && info->have_soa)
+	{
+		// RFC 2308 section 5 — no SOA means the negative answer must not be cached
+		table = &g_negative_cache;
+		ttl = info->soa_ttl;
+	}
+	else
+		return;
+
+	if (ttl > table->max_ttl) ttl = table->max_ttl;
+	if (ttl == 0)
+		return;
+
+	// --- build the entry outside the lock ---
+	dns_cache_entry_t *entry = cache_entry_new(question, response, response_len, time(NULL), ttl);
+	if (entry)
+		cache_insert(table, entry, true);
+}
+
+static void cache_table_cleanup(dns_cache_table_t *table)
+{
+	while (table->lru_tail)
+		cache_remove(table, table->lru_tail);
+	free(table->buckets);
+	table->buckets = NULL;
+}
+
+void dns_cache_cleanup(void)
+{
+	pthread_mutex_lock(&g_cache_lock);
+	cache_table_cleanup(&g_positive_cache);
+	cache_table_cleanup(&g_negative_cache);
+	pthread_mutex_unlock(&g_cache_lock);
+}
+
+void dns_cache_dump_stats(FILE *out)
+{
+	pthread_mutex_lock(&g_cache_lock);
+	const dns_cache_table_t *tables[2] = { &g_positive_cache, &g_negative_cache };
+	const char *names[2] = { "positive", "negative" };
+	for (int i = 0; i < 2; i++)
+	{
+		fprintf(out, "[LAYER_7] [DNS] [STATS] cache=%s entries=%zu/%zu hits=%lu stale=%lu evicted=%lu\n",
+			names[i], tables[i]->total_entries, tables[i]->max_entries,
+			tables[i]->hits, tables[i]->stale_hits, tables[i]->evictions);
+	}
+	pthread_mutex_unlock(&g_cache_lock);
+}
+
+// ---------- SNAPSHOTS ----------
+
+// header: magic, version, saved_at (u64), entry count (u32)
+// entry:  table (u8), stored_at (u64), ttl (u32), hits (u32), length (u32), response bytes
+// all integers big-endian
+#define SNAPSHOT_HEADER_SIZE    20
+#define SNAPSHOT_ENTRY_SIZE     21
+
+static void write_u64(unsigned char *p, uint64_t value)
+{
+	dns_write_u32(p, (uint32_t)(value >> 32));
+	dns_write_u32(p + 4, (uint32_t)value);
+}
+
+static uint64_t read_u64(const unsigned char *p)
+{
+	return ((uint64_t)dns_read_u32(p) << 32) | dns_read_u32(p + 4);
+}
+
+// caller must hold the snapshot lock in dns_cache_save()
+static int cache_save_locked(const char *path)
+{
+	dns_cache_table_t *tables[2] = { &g_positive_cache, &g_negative_cache };
+
+	// --- serialize under the lock: copies only, the file I/O happens after ---
+	pthread_mutex_lock(&g_cache_lock);
+	size_t total = SNAPSHOT_HEADER_SIZE;
+	uint32_t count = 0;
+	for (int t = 0; t < 2; t++)
+	{
+		for (dns_cache_entry_t *entry = tables[t]->lru_tail; entry; entry = entry->lru_prev)
+		{
+			total += SNAPSHOT_ENTRY_SIZE + entry->response_len;
+			count++;
+		}
+	}
+
+	unsigned char *buffer = malloc(total);
+	if (!buffer)
+	{
+		pthread_mutex_unlock(&g_cache_lock);
+		perror("Out of memory writing DNS cache snapshot");
+		return -1;
+	}
+
+	memcpy(buffer, DNS_CACHE_SNAPSHOT_MAGIC, 4);
+	dns_write_u32(buffer + 4, DNS_CACHE_SNAPSHOT_VERSION);
+	write_u64(buffer + 8, (uint64_t)time(NULL));
+	dns_write_u32(buffer + 16, count);
+
+	// Least recently used first, so reloading in file order rebuilds the same LRU order
+	unsigned char *writer = buffer + SNAPSHOT_HEADER_SIZE;
+	for (int t = 0; t < 2; t++)
+	{
+		for (dns_cache_entry_t *entry = tables[t]->lru_tail; entry; entry = entry->lru_prev)
+		{
+			writer[0] = (unsigned char)t;
+			write_u64(writer + 1, (uint64_t)entry->stored_at);
+			dns_write_u32(writer + 9, entry->ttl);
+			dns_write_u32(writer + 13, entry->hits);
+			dns_write_u32(writer + 17, (uint32_t)entry->response_len);
+			memcpy(writer + SNAPSHOT_ENTRY_SIZE, entry->response, entry->response_len);
+			writer += SNAPSHOT_ENTRY_SIZE + entry->response_len;
+		}
+	}
+	pthread_mutex_unlock(&g_cache_lock);
+
+	// --- write beside the target and rename, so a crash never leaves half a snapshot ---
+	char tmp_path[4096];
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+	FILE *file = fopen(tmp_path, "wb");
+	if (!file)
+	{
+		perror("Could not write DNS cache snapshot");
+		free(buffer);
+		return -1;
+	}
+
+	bool ok = fwrite(buffer, 1, total, file) == total && fflush(file) == 0 &&
+		fsync(fileno(file)) == 0;
+	ok = (fclose(file) == 0) && ok;
+	free(buffer);
+
+	if (!ok || rename(tmp_path, path) < 0)
+	{
+		perror("Could not write DNS cache snapshot");
+		unlink(tmp_path);
+		return -1;
+	}
+	return (int)count;
+}
+
+int dns_cache_save(const char *path)
+{
+	// periodic and shutdown snapshots share path.tmp — one writer at a time
+	static pthread_mutex_t snapshot_lock = PTHREAD_MUTEX_INITIALIZER;
+	pthread_mutex_lock(&snapshot_lock);
+	int written = cache_save_locked(path);
+	pthread_mutex_unlock(&snapshot_lock);
+	return written;
+}
+
+int dns_cache_load(const char *path)
+{
+	FILE *file = fopen(path, "rb");
+	if (!file)
+	{
+		if (errno == ENOENT)
+			return 0; // first start — nothing to warm up from
+		perror("Could not open DNS cache snapshot");
+		return -1;
+	}
+
+	// --- read the whole snapshot; it is bounded by the cache size ---
+	unsigned char *buffer = NULL;
+	long size = -1;
+	if (fseek(file, 0, SEEK_END) == 0 && (size = ftell(file)) >= SNAPSHOT_HEADER_SIZE &&
+		fseek(file, 0, SEEK_SET) == 0)
+		buffer = malloc((size_t)size);
+	bool read_ok = buffer && fread(buffer, 1, (size_t)size, file) == (size_t)size;
+	fclose(file);
+
+	if (!read_ok || memcmp(buffer, DNS_CACHE_SNAPSHOT_MAGIC, 4) != 0 ||
+		dns_read_u32(buffer + 4) != DNS_CACHE_SNAPSHOT_VERSION)
+	{
+		fprintf(stderr, "Ignoring unreadable DNS cache snapshot %s\n", path);
+		free(buffer);
+		return -1;
+	}
+
+	dns_cache_table_t *tables[2] = { &g_positive_cache, &g_negative_cache };
+	time_t now = time(NULL);
+	uint32_t count = dns_read_u32(buffer + 16);
+	size_t pos = SNAPSHOT_HEADER_SIZE;
+	int loaded = 0, expired = 0, blocked = 0;
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		if ((size_t)size - pos < SNAPSHOT_ENTRY_SIZE)
+			break;
+
+		const unsigned char *record = buffer + pos;
+		uint8_t kind = record[0];
+		time_t stored_at = (time_t)read_u64(record + 1);
+		uint32_t ttl = dns_read_u32(record + 9);
+		uint32_t hits = dns_read_u32(record + 13);
+		size_t response_len = dns_read_u32(record + 17);
+		const unsigned char *response = record + SNAPSHOT_ENTRY_SIZE;
+
+		if (response_len > (size_t)size - pos - SNAPSHOT_ENTRY_SIZE)
+			break; // truncated file
+		pos += SNAPSHOT_ENTRY_SIZE + response_len;
+
+		// The answer carries its own question — rebuild the key from it
+		dns_question_t question;
+		if (kind > 1 || response_len > DNS_CACHE_MAX_RESPONSE ||
+			dns_parse_question(response, response_len, &question) < 0)
+			continue;
+
+		// Remaining TTL follows from stored_at, so elapsed downtime is already
+		// accounted for; answers past even the stale window are useless
+		if (stored_at > now) stored_at = now;
+		if (ttl > tables[kind]->max_ttl) ttl = tables[kind]->max_ttl;
+		if ((uint64_t)(now - stored_at) > (uint64_t)ttl + DNS_CACHE_STALE_WINDOW)
+		{
+			expired++;
+			continue;
+		}
+
+		// The blocklist may have grown since the snapshot was taken
+		if (is_blocked_name(&question.qname))
+		{
+			blocked++;
+			continue;
+		}
+
+		dns_cache_entry_t *entry = cache_entry_new(&question, response, response_len, stored_at, ttl);
+		if (!entry)
+			break;
+		entry->hits = hits;
+		cache_insert(tables[kind], entry, false);
+		loaded++;
+	}
+	free(buffer);
+
+	printf("[LAYER_7] [DNS] Cache snapshot: %d answers restored (%d expired, %d now blocked)\n",
+		loaded, expired, blocked);
+	return loaded;
+}
@@ -0,0 +1,132 @@
+#ifndef DNS_CACHE_H
+#define DNS_CACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "dns.h"
+
+// --- positive cache sizing ---
+// number of hash buckets — prime to reduce collisions
+#define DNS_CACHE_POS_BUCKETS       2039
+// max answers kept before the least recently used one is evicted
+#define DNS_CACHE_POS_MAX_ENTRIES   4096
+
+// --- negative cache sizing (RFC 2308) ---
+// kept separate so NXDOMAIN floods (typos, DGA noise) can't evict real answers
+#define DNS_CACHE_NEG_BUCKETS       1021
+#define DNS_CACHE_NEG_MAX_ENTRIES   2048
+
+// --- TTL clamps (seconds) ---
+#define DNS_CACHE_MAX_TTL           86400  // never trust an answer for more than a day
+#define DNS_CACHE_NEG_MAX_TTL       10800  // RFC 2308 section 5 — cap negative TTLs at 3 hours
+
+// --- prefetch policy ---
+// a positive entry is refreshed in the background once it has been hit this
+// many times and DNS_CACHE_PREFETCH_PERCENT of its TTL has elapsed
+#define DNS_CACHE_PREFETCH_MIN_HITS 3
+#define DNS_CACHE_PREFETCH_PERCENT  90
+
+// --- serve-stale policy (RFC 8767) ---
+// expired answers are kept this long past their TTL so they can stand in
+// when the upstream is slow or unreachable
+#define DNS_CACHE_STALE_WINDOW      3600
+// TTL stamped on every record of a stale answer (RFC 8767 recommends 30s)
+#define DNS_CACHE_STALE_ANSWER_TTL  30
+
+// --- warm-start snapshots ---
+#define DNS_CACHE_SNAPSHOT_PATH     "dns-cache.snapshot"
+#define DNS_CACHE_SNAPSHOT_INTERVAL 300    // seconds between periodic snapshots
+#define DNS_CACHE_SNAPSHOT_MAGIC    "L7DC"
+#define DNS_CACHE_SNAPSHOT_VERSION  1
+
+// largest response we are willing to keep a copy of
+#define DNS_CACHE_MAX_RESPONSE      UPSTREAM_BUFFER_SIZE
+
+// --- cache entry ---
+// one cached upstream response, keyed by (qname, qtype, qclass)
+// lives in a bucket chain and in the table's LRU list at the same time
+typedef struct dns_cache_entry {
+	char name[DNS_NAME_SIZE];             // lowercased question name
+	uint16_t qtype;                       // question type (host byte order)
+	uint16_t qclass;                      // question class (host byte order)
+	uint32_t hash;                        // full key hash, bucket = hash % buckets
+	unsigned char *response;              // raw wire copy of the upstream answer
+	size_t response_len;                  // bytes in response
+	size_t question_end;                  // offset just past the question section
+	time_t stored_at;                     // when the answer was inserted
+	uint32_t ttl;                         // seconds the answer stays fresh
+	uint32_t hits;                        // lookups served, carried (halved) across refreshes
+	bool prefetch_pending;                // refresh already handed to the prefetcher
+	struct dns_cache_entry *next;         // next entry in the bucket chain
+	struct dns_cache_entry *lru_prev;     // towards most recently used
+	struct dns_cache_entry *lru_next;     // towards least recently used
+} dns_cache_entry_t;
+
+// --- cache table ---
+// positive and negative answers each get one of these with their own limits
+typedef struct {
+	dns_cache_entry_t **buckets;          // bucket heads
+	size_t bucket_count;                  // number of buckets
+	size_t max_entries;                   // LRU eviction threshold
+	size_t total_entries;                 // entries currently stored
+	uint32_t max_ttl;                     // TTL clamp applied on insert
+	dns_cache_entry_t *lru_head;          // most recently used
+	dns_cache_entry_t *lru_tail;          // least recently used, evicted first
+	unsigned long hits;                   // lookups answered from this table
+	unsigned long stale_hits;             // expired answers served under RFC 8767
+	unsigned long evictions;              // entries dropped to make room
+} dns_cache_table_t;
+
+// initializes both cache tables — call once before the listener starts
+void dns_cache_init(void);
+
+// looks up the question and, if a fresh answer exists, copies it into out
+// with every TTL decremented by the time spent in the cache
+// the client's transaction ID and question bytes are stamped onto the copy
+// returns bytes written, 0 on miss or if out is too small
+// *negative is set when the answer came from the negative cache
+// *refresh is set (once per entry lifetime) when a popular positive answer is
+// close to expiry and should be prefetched — see DNS_CACHE_PREFETCH_*
+size_t dns_cache_lookup(const dns_question_t *question, const unsigned char *query,
+                        unsigned char *out, size_t out_size, bool *negative, bool *refresh);
+
+// returns an answer for the question even if it has expired, as long as it
+// is still inside DNS_CACHE_STALE_WINDOW — every TTL is set to
+// DNS_CACHE_STALE_ANSWER_TTL and the client's ID / question are stamped on
+// returns bytes written, 0 if nothing usable is cached
+size_t dns_cache_lookup_stale(const dns_question_t *question, const unsigned char *query,
+                              unsigned char *out, size_t out_size);
+
+// classifies an upstream response and stores it in the matching table:
+// NOERROR with answers → positive cache, TTL = smallest RR TTL
+// NXDOMAIN / NODATA with an SOA → negative cache, TTL = min(SOA TTL, SOA MINIMUM)
+// anything else (SERVFAIL, truncated, no SOA) is not cached
+// info is the caller's dns_inspect_response() pass over the same bytes
+void dns_cache_store(const dns_question_t *question,
+                     const unsigned char *response, size_t response_len,
+                     const dns_response_info_t *info);
+
+// prints entry counts and hit / stale / eviction counters for both tables
+void dns_cache_dump_stats(FILE *out);
+
+// writes every cached answer (positive and negative) to a compact binary
+// snapshot at path — via path.tmp + rename, so readers never see half a file
+// entries are copied under the cache lock, the disk write happens outside it
+// returns the number of answers written, -1 on error
+int dns_cache_save(const char *path);
+
+// reloads a snapshot written by dns_cache_save() — call after dns_cache_init()
+// and load_blocklist(), before the listener binds
+// answers keep their original store time, so TTLs count down across the
+// downtime; answers past the stale window or now on the blocklist are skipped
+// returns the number of answers restored, 0 if there is no snapshot, -1 on error
+int dns_cache_load(const char *path);
+
+// frees every entry in both tables — call on shutdown
+void dns_cache_cleanup(void);
+
+#endif
@@ -1,10 +1,63 @@
 #include <ctype.h>
+#include <signal.h>
+#include <sys/uio.h>
 #include <time.h>
 
 #include "dns.h"
+#include "cache.h"
+#include "inflight.h"
+#include "prefetch.h"
+#include "sinkhole.h"
+#include "tcp.h"
+#include "upstream.h"
+#include "ratelimit.h"
+#include "forward.h"
+#include "local.h"
+#include "topk.h"
 #include "../../common/blocklist.h"
 
-void start_dns_server(const char *upstream_ip)
+// --- listener shutdown ---
+// set from signal context; closing the socket unblocks recvfrom()
+static volatile sig_atomic_t g_dns_stop = 0;
+static int g_dns_socket = -1;
+
+void request_dns_server_stop(void)
+{
+	g_dns_stop = 1;
+	if (g_dns_socket >= 0)
+		shutdown(g_dns_socket, SHUT_RDWR);
+}
+
+int dns_parse_addr(const char *spec, struct sockaddr_in *addr)
+{
+	char ip[INET_ADDRSTRLEN];
+	unsigned long port = DNS_PORT;
+
+	memset(addr, 0, sizeof(*addr));
+	addr->sin_family = AF_INET;
+
+	const char *colon = strchr(spec, ':');
+	size_t ip_len = colon ? (size_t)(colon - spec) : strlen(spec);
+	if (ip_len == 0 || ip_len >= sizeof(ip))
+		return -1;
+	memcpy(ip, spec, ip_len);
+	ip[ip_len] = '\0';
+
+	if (colon)
+	{
+		char *end;
+		port = strtoul(colon + 1, &end, 10);
+		if (end == colon + 1 || *end != '\0' || port == 0 || port > 65535)
+			return -1;
+	}
+
+	if (inet_pton(AF_INET, ip, &addr->sin_addr) <= 0)
+		return -1;
+	addr->sin_port = htons((uint16_t)port);
+	return 0;
+}
+
+void start_dns_server(const char *upstream_ip, uint16_t listen_port)
 {
 	// Declare socket
 	int client_socket;
@@ -17,7 +70,7 @@ void start_dns_server(const char *upstream_ip)
 	struct sockaddr_in server_addr;
 	memset(&server_addr, 0, sizeof(server_addr));
 	server_addr.sin_family = AF_INET;
-	server_addr.sin_port = htons(DNS_PORT);
+	server_addr.sin_port = htons(listen_port);
 	server_addr.sin_addr.s_addr = INADDR_ANY;
 
 	// Bind the client socket
@@ -30,60 +83,166 @@ void start_dns_server(const char *upstream_ip)
 
 	// Upstream address (where we forward valid requests)
 	struct sockaddr_in upstream_addr;
-	memset(&upstream_addr, 0, sizeof(upstream_addr));
-	upstream_addr.sin_family = AF_INET;
-	upstream_addr.sin_port = htons(DNS_PORT);
-
-	// Convert upstream ip to compact binary
-	if (inet_pton(AF_INET, upstream_ip, &upstream_addr.sin_addr) <= 0) {
-		perror("Invalid upstream IP address");
+	if (dns_parse_addr(upstream_ip, &upstream_addr) < 0) {
+		fprintf(stderr, "Invalid upstream address: %s\n", upstream_ip);
 		close(client_socket);
 		exit(1);
 	}
 
-	printf("[LAYER_7] [DNS] Listening on 0.0.0.0:%d\n", DNS_PORT);
+	dns_prefetch_start(&upstream_addr);
+	dns_upstream_start(&upstream_addr);
+	dns_tcp_start(&upstream_addr, listen_port);
+
+	// expose socket to stop-request path
+	g_dns_socket = client_socket;
+
+	printf("[LAYER_7] [DNS] Listening on 0.0.0.0:%u\n", listen_port);
 	printf("[LAYER_7] [DNS] Waiting for incoming DNS queries...\n");
 
+	// Receive into a reusable buffer so cache hits and blocks never allocate
+	unsigned char packet[DNS_BUFFER_SIZE];
+	static unsigned char cached_answer[DNS_CACHE_MAX_RESPONSE];
+
 	// Main loop process
-	while(1)
+	while (!g_dns_stop)
 	{
-		// Allocate memory for new DNS task
-		dns_task_t *task = calloc(1, sizeof(dns_task_t));
-		if (!task)
-		{
-			perror("Calloc failed for DNS task");
-			continue; // Keep going on for new requests n that
-		}
-
-		task->client_socket = client_socket;
-		task->upstream_addr = upstream_addr;
-		socklen_t client_addr_len = sizeof(task->client_addr);
+		dns_client_t client = { .socket = client_socket, .max_payload = DNS_UDP_PAYLOAD_MIN };
+		socklen_t client_addr_len = sizeof(client.addr);
 
-		// Receive packet into the task buffer
-		task->query_size = recvfrom(client_socket, task->buffer, DNS_BUFFER_SIZE,
-			0, (struct sockaddr *)&task->client_addr, &client_addr_len);
+		// Receive packet into the shared receive buffer
+		ssize_t query_size = recvfrom(client_socket, packet, DNS_BUFFER_SIZE,
+			0, (struct sockaddr *)&client.addr, &client_addr_len);
 
 		// Drop junk packet
-		if (task->query_size < (ssize_t)sizeof(struct dns_hdr))
+		if (query_size < (ssize_t)sizeof(struct dns_hdr))
 		{
-			free(task);
+			if (g_dns_stop)
+				break;
 			continue;
 		}
 
 		if (DNS_VERBOSE_RX) {
 			printf("Received a %zd-byte packet from %s\n",
-				task->query_size, inet_ntoa(task->client_addr.sin_addr));
+				query_size, inet_ntoa(client.addr.sin_addr));
 		}
 
-		// Create new worked thread
-		pthread_t thread_id;
-		if (pthread_create(&thread_id, NULL, handle_dns_request, task) != 0)
-		{
-			perror("Failed to create pthread");
-			free(task);
-		}
-		pthread_detach(thread_id);
+		dns_dispatch_query(&client, packet, (size_t)query_size, &upstream_addr,
+			cached_answer, sizeof(cached_answer));
 	}
+
+	g_dns_socket = -1;
+	close(client_socket);
+}
+
+void dns_dispatch_query(const dns_client_t *origin, const unsigned char *packet, size_t packet_len,
+                        const struct sockaddr_in *upstream_addr,
+                        unsigned char *scratch, size_t scratch_size)
+{
+	// Heavy-hitter sketches see every packet, limited or not
+	dns_topk_count_client(&origin->addr);
+
+	// Over-limit clients are turned away before any parsing or allocation
+	if (!dns_ratelimit_allow(&origin->addr))
+	{
+		size_t short_size = dns_ratelimit_answer(packet, packet_len, origin->tcp != NULL,
+			scratch, scratch_size);
+		if (short_size > 0)
+			dns_client_reply(origin, scratch, short_size);
+		return;
+	}
+
+	// Drop packets without a usable question
+	dns_question_t question;
+	if (dns_parse_question(packet, packet_len, &question) < 0)
+		return;
+	dns_topk_count_name(TOPK_DOMAINS, &question.qname);
+
+	// Learn how large an answer this client can take over UDP
+	dns_client_t client = *origin;
+	if (dns_read_edns(packet, packet_len, &client) < 0)
+		return;
+	if (client.tcp)
+		client.max_payload = UINT16_MAX;
+
+	// Names from the local hosts file are answered authoritatively and never leave the box
+	size_t local_size = dns_local_answer(packet, &question, scratch, scratch_size);
+	if (local_size > 0)
+	{
+		log_dns_decision("LOCAL", question.qname.name, &client.addr);
+		if (client.edns)
+			local_size = dns_append_opt(scratch, local_size, scratch_size);
+		dns_client_reply(&client, scratch, local_size);
+		return;
+	}
+
+	// Repeat lookups are answered right here — no thread, no upstream round trip
+	bool negative = false;
+	bool refresh = false;
+	size_t cached_size = dns_cache_lookup(&question, packet, scratch,
+		scratch_size, &negative, &refresh);
+	if (cached_size > 0)
+	{
+		// Hot name close to expiry — refresh it before the next client pays the RTT
+		if (refresh)
+			dns_prefetch_schedule(&question);
+
+		log_dns_decision(negative ? "CACHED (NEGATIVE)" : "CACHED",
+			question.qname.name, &client.addr);
+		dns_client_reply(&client, scratch, cached_size);
+		return;
+	}
+
+	// Sinkhole the name with one final answer so the client doesn't retry
+	if ( is_blocked_name(&question.qname) )
+	{
+		log_dns_decision("BLOCKED", question.qname.name, &client.addr);
+		dns_topk_count_name(TOPK_BLOCKED, &question.qname);
+
+		size_t block_size = dns_sinkhole_answer(packet, &question, scratch, scratch_size);
+		if (block_size > 0 && client.edns)
+			block_size = dns_append_opt(scratch, block_size, scratch_size);
+		if (block_size > 0)
+			dns_client_reply(&client, scratch, block_size);
+		return;
+	}
+
+	// Same question already outstanding upstream — ride along on its answer
+	if (dns_inflight_join(&question, packet, &client))
+	{
+		log_dns_decision("COALESCED", question.qname.name, &client.addr);
+		return;
+	}
+
+	// Allocate memory for new DNS task
+	dns_task_t *task = calloc(1, sizeof(dns_task_t));
+	if (!task)
+	{
+		perror("Calloc failed for DNS task");
+		dns_inflight_complete(&question, NULL, 0);
+		return; // Keep going on for new requests n that
+	}
+
+	task->client = client;
+	// Local zones go to their own servers — one more probe of hashes the parser already made
+	task->default_upstream = !dns_forward_route(&question.qname, &task->upstream_addr);
+	if (task->default_upstream)
+		task->upstream_addr = *upstream_addr;
+	task->query_size = (ssize_t)packet_len;
+	task->question = question;
+	memcpy(task->buffer, packet, packet_len);
+	dns_client_hold(&task->client);
+
+	// Create new worked thread
+	pthread_t thread_id;
+	if (pthread_create(&thread_id, NULL, handle_dns_request, task) != 0)
+	{
+		perror("Failed to create pthread");
+		dns_inflight_complete(&question, NULL, 0);
+		dns_client_release(&task->client);
+		free(task);
+		return;
+	}
+	pthread_detach(thread_id);
 }
 
 void log_dns_decision(const char *action, const char *domain, const struct sockaddr_in *client_addr)
@@ -117,161 +276,668 @@ void log_dns_decision(const char *action, const char *domain, const struct socka
 
 // ---------- DNS PARSER ----------
 
-// Reads the name of a domain
-unsigned char* read_name(unsigned char* reader, unsigned char* buffer, int* count)
+int dns_read_name(const unsigned char *packet, size_t packet_len, size_t offset,
+                  domain_name_t *domain, size_t *next_offset)
 {
-	// Parameter checks
-	if (!reader || !buffer || !count)
+	if (!packet || !domain)
+		return -1;
+
+	size_t pos = offset;
+	size_t end = 0;            // where the caller resumes — set at the first pointer or root
+	size_t jump_limit = offset; // every pointer must land strictly before this
+	size_t wire_len = 0;       // RFC 1035 — 255 octets including length bytes
+	size_t out = 0;
+	int loop_count = 0;        // To prevent malicious continuous jumps
+
+	while (1)
 	{
-		perror("Null / invalid arguments to read_name");
-		return NULL;
+		if (pos >= packet_len || loop_count++ >= MAX_LOOP_COUNT)
+			return -1;
+
+		unsigned char label_len = packet[pos];
+
+		if (label_len == 0) // 0 marks end of name
+		{
+			if (end == 0) end = pos + 1;
+			break;
+		}
+
+		// Compression check (11xxxxxx / 0xC0)
+		if ((label_len & JUMP_HEX_VALUE) == JUMP_HEX_VALUE)
+		{
+			if (pos + 1 >= packet_len)
+				return -1;
+
+			// Combine bottom 6 bits of byte 1 with byte 2
+			size_t jump_offset = ((size_t)(label_len & FIRST_OFFSET_HEX_VALUE) << 8) | packet[pos + 1];
+			if (jump_offset >= jump_limit)
+				return -1; // forward or looping pointer
+
+			if (end == 0) end = pos + 2;
+			jump_limit = jump_offset;
+			pos = jump_offset;
+			continue;
+		}
+
+		// 01/10 label types are reserved
+		if (label_len & JUMP_HEX_VALUE)
+			return -1;
+
+		wire_len += (size_t)label_len + 1;
+		if (pos + 1 + label_len > packet_len || wire_len + 1 > DOMAIN_NAME_SIZE - 1)
+			return -1;
+
+		// Standard label — copy it, separated by '.'
+		if (out > 0)
+			domain->name[out++] = '.';
+		memcpy(domain->name + out, packet + pos + 1, label_len);
+		out += label_len;
+		pos += (size_t)label_len + 1;
 	}
 
-	// Malloc name buffer
-	char *name = (char *)calloc(DNS_NAME_SIZE, 1);
-	if (name == NULL)
+	domain->name[out] = '\0';
+	domain->len = (uint16_t)out;
+	domain_lowercase(domain->name, out);
+
+	if (domain_name_finish(domain) < 0)
+		return -1;
+
+	if (next_offset) *next_offset = end;
+	return 0;
+}
+
+int dns_parse_question(const unsigned char *packet, size_t packet_len, dns_question_t *question)
+{
+	const struct dns_hdr *header = (const struct dns_hdr *)packet;
+	if (packet_len <= sizeof(struct dns_hdr) || ntohs(header->qdcount) == 0)
+		return -1;
+
+	// Decode straight into the question, then QTYPE / QCLASS right after
+	size_t name_end = 0;
+	if (dns_read_name(packet, packet_len, sizeof(struct dns_hdr), &question->qname, &name_end) < 0 ||
+		name_end + 4 > packet_len)
+		return -1;
+
+	question->qtype = dns_read_u16(packet + name_end);
+	question->qclass = dns_read_u16(packet + name_end + 2);
+	question->question_end = name_end + 4;
+
+	// Reuse the name hash the parser already computed, mix in type and class
+	uint32_t hash = (question->qname.label_count > 0) ? question->qname.suffix_hash[0] : DOMAIN_HASH_SEED;
+	hash ^= question->qtype;
+	hash *= DOMAIN_HASH_PRIME;
+	hash ^= question->qclass;
+	hash *= DOMAIN_HASH_PRIME;
+	question->hash = hash;
+	return 0;
+}
+
+int dns_skip_name(const unsigned char *packet, size_t packet_len, size_t offset)
+{
+	while (offset < packet_len)
 	{
-		perror("Unable to malloc for name in read_name");
-		return NULL;
+		unsigned char len = packet[offset];
+
+		if (len == 0) // Root label ends the name
+			return (int)(offset + 1);
+
+		if ((len & JUMP_HEX_VALUE) == JUMP_HEX_VALUE) // Pointer ends the name
+			return (offset + 2 <= packet_len) ? (int)(offset + 2) : -1;
+
+		if (len & JUMP_HEX_VALUE) // 01/10 label types are reserved
+			return -1;
+
+		offset += (size_t)len + 1;
 	}
+	return -1;
+}
 
-	*count = 0;
-	int name_offset = 0;
-	int jumped = 0;
-	int loop_count = 0; // To prevent malicious continuous jumps
+bool dns_response_matches(const unsigned char *response, size_t response_len,
+                                 const unsigned char *query, const dns_question_t *question)
+{
+	if (response_len < question->question_end)
+		return false;
+
+	const struct dns_hdr *resp_hdr = (const struct dns_hdr *)response;
+	const struct dns_hdr *query_hdr = (const struct dns_hdr *)query;
+	if (resp_hdr->id != query_hdr->id || !(ntohs(resp_hdr->flags) & DNS_FLAG_QR) ||
+		ntohs(resp_hdr->qdcount) != 1)
+		return false;
 
-	// Main loop, checks standard end and max count
-	while( *reader != 0 && *count < DNS_NAME_SIZE && loop_count < MAX_LOOP_COUNT) // 0 marks end of name
+	for (size_t i = sizeof(struct dns_hdr); i < question->question_end; i++)
 	{
-		// Compression check (11xxxxxx / 0xC0)
-		if ( (*reader & JUMP_HEX_VALUE) == JUMP_HEX_VALUE )
-		{
-			// Calculate offset
-			// Combine bottom 6 bits of byte 1 with byte 2
-			int jump_offset = ( (*reader & FIRST_OFFSET_HEX_VALUE) << 8)
-						| *(reader + 1);
+		if (tolower(response[i]) != tolower(query[i]))
+			return false;
+	}
+	return true;
+}
+
+size_t dns_encode_name(const char *name, unsigned char *out, size_t out_size)
+{
+	// Encode "www.google.com" as 3www6google3com0
+	unsigned char *writer = out;
+	const char *label = name;
+	while (*label)
+	{
+		const char *dot = strchr(label, '.');
+		size_t label_len = dot ? (size_t)(dot - label) : strlen(label);
+		if (label_len == 0 || label_len > 63 || (size_t)(writer - out) + label_len + 2 > out_size)
+			return 0;
+
+		*writer++ = (unsigned char)label_len;
+		memcpy(writer, label, label_len);
+		writer += label_len;
+		label += label_len + (dot ? 1 : 0);
+	}
+	if ((size_t)(writer - out) + 1 > out_size)
+		return 0;
+	*writer++ = 0;
+	return (size_t)(writer - out);
+}
+
+size_t dns_build_query(const dns_question_t *question, uint16_t id,
+                       unsigned char *out, size_t out_size)
+{
+	size_t name_len = strlen(question->qname.name);
+	size_t query_len = sizeof(struct dns_hdr) + name_len + 2 + 4;
+	if (query_len > out_size || name_len + 2 > DNS_NAME_SIZE)
+		return 0;
+
+	// Header: recursion desired, one question
+	struct dns_hdr *header = (struct dns_hdr *)out;
+	memset(header, 0, sizeof(*header));
+	header->id = htons(id);
+	header->flags = htons(DNS_FLAG_RD);
+	header->qdcount = htons(1);
+
+	unsigned char *writer = out + sizeof(struct dns_hdr);
+	size_t encoded = dns_encode_name(question->qname.name, writer, name_len + 2);
+	if (encoded == 0)
+		return 0;
+	writer += encoded;
+
+	writer[0] = (unsigned char)(question->qtype >> 8);
+	writer[1] = (unsigned char)question->qtype;
+	writer[2] = (unsigned char)(question->qclass >> 8);
+	writer[3] = (unsigned char)question->qclass;
+	writer += 4;
+
+	return (size_t)(writer - out);
+}
 
-			// Count the pointer size if we haven't jumped yet
-			if (jumped == 0)
-				*count += 2;
+// Walks every section once. Reports where the question section ends and,
+// if the additional section carries an OPT record, where that record sits.
+static int scan_sections(const unsigned char *packet, size_t packet_len, size_t *question_end,
+                         size_t *opt_start, size_t *opt_end)
+{
+	const struct dns_hdr *header = (const struct dns_hdr *)packet;
+	if (packet_len < sizeof(struct dns_hdr))
+		return -1;
 
-			jumped = 1; // Set to "jump mode"
+	size_t pos = sizeof(struct dns_hdr);
+	for (uint16_t i = 0; i < ntohs(header->qdcount); i++)
+	{
+		int name_end = dns_skip_name(packet, packet_len, pos);
+		if (name_end < 0 || (size_t)name_end + 4 > packet_len)
+			return -1;
+		pos = (size_t)name_end + 4;
+	}
+	*question_end = pos;
+	*opt_start = *opt_end = 0;
+
+	uint32_t answers = (uint32_t)ntohs(header->ancount) + ntohs(header->nscount);
+	uint32_t records = answers + ntohs(header->arcount);
+	for (uint32_t i = 0; i < records; i++)
+	{
+		size_t rr_start = pos;
+		int name_end = dns_skip_name(packet, packet_len, pos);
+		if (name_end < 0 || (size_t)name_end + DNS_RR_FIXED_SIZE > packet_len)
+			return -1;
+
+		size_t fixed = (size_t)name_end;
+		size_t rr_end = fixed + DNS_RR_FIXED_SIZE + dns_read_u16(packet + fixed + 8);
+		if (rr_end > packet_len)
+			return -1;
+
+		// RFC 6891 section 6.1.1 — root owner, additional section only
+		if (i >= answers && dns_read_u16(packet + fixed) == DNS_TYPE_OPT &&
+			packet[rr_start] == 0)
+		{
+			*opt_start = rr_start;
+			*opt_end = rr_end;
+		}
+		pos = rr_end;
+	}
+	return 0;
+}
 
-			reader = buffer + jump_offset;
+// Runs the name at 'offset' through the blocklist unless it is a bare pointer
+// to a name already checked; remembers where checked names start
+static int inspect_name(const unsigned char *packet, size_t packet_len, size_t offset,
+                        size_t *checked, int *checked_count, dns_response_info_t *info)
+{
+	if (offset + 1 < packet_len && (packet[offset] & JUMP_HEX_VALUE) == JUMP_HEX_VALUE)
+	{
+		size_t target = ((size_t)(packet[offset] & FIRST_OFFSET_HEX_VALUE) << 8) | packet[offset + 1];
+		for (int i = 0; i < *checked_count; i++)
+		{
+			if (checked[i] == target)
+				return 0;
 		}
-		else // Standard labeling
+	}
+
+	domain_name_t name;
+	if (dns_read_name(packet, packet_len, offset, &name, NULL) < 0)
+		return -1;
+	if (*checked_count < DNS_INSPECT_MAX_CHECKED)
+		checked[(*checked_count)++] = offset;
+
+	if (is_blocked_name(&name))
+	{
+		info->blocked = true;
+		memcpy(info->blocked_name, name.name, (size_t)name.len + 1);
+	}
+	return 0;
+}
+
+int dns_inspect_response(const unsigned char *response, size_t response_len,
+                         const dns_question_t *question, dns_response_info_t *info)
+{
+	memset(info, 0, sizeof(*info));
+	if (response_len < question->question_end)
+		return -1;
+
+	const struct dns_hdr *header = (const struct dns_hdr *)response;
+	uint16_t counts[3] = { ntohs(header->ancount), ntohs(header->nscount), ntohs(header->arcount) };
+	size_t offset = question->question_end;
+
+	// The question name was checked by the receive loop before we forwarded it
+	size_t checked[DNS_INSPECT_MAX_CHECKED] = { sizeof(struct dns_hdr) };
+	int checked_count = 1;
+
+	for (int section = 0; section < 3; section++)
+	{
+		for (uint16_t i = 0; i < counts[section]; i++)
 		{
-			unsigned int segment_len = *reader;
+			size_t owner = offset;
+			int after_name = dns_skip_name(response, response_len, offset);
+			if (after_name < 0 || (size_t)after_name + DNS_RR_FIXED_SIZE > response_len)
+				return -1;
+
+			const unsigned char *rr = response + after_name;
+			uint16_t type = dns_read_u16(rr);
+			uint32_t ttl = dns_read_u32(rr + 4);
+			size_t rdata_offset = (size_t)after_name + DNS_RR_FIXED_SIZE;
+			size_t rdlength = dns_read_u16(rr + 8);
+			if (rdata_offset + rdlength > response_len)
+				return -1;
+			offset = rdata_offset + rdlength;
+
+			// OPT pseudo-RR reuses the TTL field for extended flags
+			if (type == DNS_TYPE_OPT)
+				continue;
+
+			if (!info->have_ttl || ttl < info->min_ttl)
+			{
+				info->min_ttl = ttl;
+				info->have_ttl = true;
+			}
 
-			// Prevent buffer overflow
-			if (name_offset + segment_len + 1 >= DNS_NAME_SIZE)
+			// RFC 2308 section 5 — negative TTL is min(SOA TTL, SOA MINIMUM)
+			if (section == 1 && type == DNS_TYPE_SOA && !info->have_soa)
 			{
-				fprintf(stderr, "Error: DNS name too long, truncated.\n");
-				free(name);
-				return NULL; // Stop reading to protect memory
+				int after_mname = dns_skip_name(response, response_len, rdata_offset);
+				if (after_mname < 0) return -1;
+				int after_rname = dns_skip_name(response, response_len, (size_t)after_mname);
+				if (after_rname < 0) return -1;
+
+				// SERIAL, REFRESH, RETRY, EXPIRE, MINIMUM — 5 x 32 bits
+				if ((size_t)after_rname + 20 > rdata_offset + rdlength)
+					return -1;
+
+				uint32_t minimum = dns_read_u32(response + after_rname + 16);
+				info->soa_ttl = (ttl < minimum) ? ttl : minimum;
+				info->have_soa = true;
 			}
 
-			// Copy the segment length of letters into the url name
-			memcpy(&name[name_offset], reader + 1, segment_len);
+			// The answer chain: every owner and every CNAME target meets the blocklist
+			if (section == 0 && !info->blocked)
+			{
+				if (inspect_name(response, response_len, owner, checked, &checked_count, info) < 0)
+					return -1;
+				if (type == DNS_TYPE_CNAME &&
+					inspect_name(response, response_len, rdata_offset, checked, &checked_count, info) < 0)
+					return -1;
+			}
+		}
+	}
+	return 0;
+}
 
-			// Update positions
-			name_offset += segment_len;
-			reader += segment_len + 1;
+int dns_read_edns(const unsigned char *query, size_t query_len, dns_client_t *client)
+{
+	size_t question_end, opt_start, opt_end;
+	if (scan_sections(query, query_len, &question_end, &opt_start, &opt_end) < 0)
+		return -1;
 
-			// Add the '.'
-			name[name_offset] = '.';
-			name_offset++;
+	client->edns = opt_end > 0;
+	client->max_payload = DNS_UDP_PAYLOAD_MIN;
+	if (client->edns)
+	{
+		// The OPT CLASS field carries the requestor's UDP payload size
+		uint16_t advertised = dns_read_u16(query + opt_start + 3);
+		if (advertised > DNS_EDNS_PAYLOAD_MAX) advertised = DNS_EDNS_PAYLOAD_MAX;
+		if (advertised > DNS_UDP_PAYLOAD_MIN) client->max_payload = advertised;
+	}
+	return 0;
+}
 
-			// Increment count only if we haven't jumped
-			if (jumped == 0)
-				*count += segment_len + 1;
-		}
-		loop_count++;
+size_t dns_append_opt(unsigned char *answer, size_t answer_len, size_t out_size)
+{
+	// root owner, TYPE=OPT, CLASS=payload size, extended RCODE/flags 0, no options
+	static const unsigned char opt[11] = {
+		0x00,
+		DNS_TYPE_OPT >> 8, DNS_TYPE_OPT & 0xFF,
+		DNS_EDNS_PAYLOAD_MAX >> 8, DNS_EDNS_PAYLOAD_MAX & 0xFF,
+		0x00, 0x00, 0x00, 0x00,
+		0x00, 0x00,
+	};
+	if (answer_len + sizeof(opt) > out_size)
+		return answer_len;
+
+	memcpy(answer + answer_len, opt, sizeof(opt));
+	struct dns_hdr *header = (struct dns_hdr *)answer;
+	header->arcount = htons(ntohs(header->arcount) + 1);
+	return answer_len + sizeof(opt);
+}
+
+// ---------- DNS CLIENTS ----------
+
+void dns_client_reply(const dns_client_t *client, const unsigned char *response, size_t response_len)
+{
+	if (response_len < sizeof(struct dns_hdr))
+		return;
+
+	if (client->tcp)
+	{
+		dns_tcp_send(client->tcp, response, response_len);
+		return;
+	}
+
+	size_t question_end, opt_start, opt_end;
+	if (scan_sections(response, response_len, &question_end, &opt_start, &opt_end) < 0)
+		return;
+
+	// The common case goes out untouched
+	bool strip_opt = !client->edns && opt_end == response_len && opt_start > 0;
+	size_t body_len = strip_opt ? opt_start : response_len;
+	if (!strip_opt && body_len <= client->max_payload)
+	{
+		sendto(client->socket, response, response_len, 0,
+			(struct sockaddr *)&client->addr, sizeof(client->addr));
+		return;
+	}
+
+	// Rewrite just the header, gather the rest straight from the response
+	struct dns_hdr header;
+	memcpy(&header, response, sizeof(header));
+	struct iovec iov[3];
+	size_t iov_count = 0;
+
+	if (body_len <= client->max_payload)
+	{
+		// RFC 6891 section 7 — no OPT back to a client that didn't send one
+		header.arcount = htons(ntohs(header.arcount) - 1);
+		iov[iov_count++] = (struct iovec){ &header, sizeof(header) };
+		iov[iov_count++] = (struct iovec){ (void *)(response + sizeof(header)), body_len - sizeof(header) };
 	}
-	// Remove potential trailing dot
-	if (name_offset > 0)
-		name[name_offset - 1] = '\0';
 	else
-		name[0] = '\0';
+	{
+		// RFC 2181 section 9 — too big: question only, TC=1, client retries over TCP
+		bool keep_opt = client->edns && opt_end > 0;
+		header.flags = htons(ntohs(header.flags) | DNS_FLAG_TC);
+		header.ancount = 0;
+		header.nscount = 0;
+		header.arcount = htons(keep_opt ? 1 : 0);
+		iov[iov_count++] = (struct iovec){ &header, sizeof(header) };
+		iov[iov_count++] = (struct iovec){ (void *)(response + sizeof(header)), question_end - sizeof(header) };
+		if (keep_opt)
+			iov[iov_count++] = (struct iovec){ (void *)(response + opt_start), opt_end - opt_start };
+	}
 
-	// Account for the final null byte
-	if (jumped == 0) *count += 1;
+	struct msghdr msg = {
+		.msg_name = (void *)&client->addr,
+		.msg_namelen = sizeof(client->addr),
+		.msg_iov = iov,
+		.msg_iovlen = iov_count,
+	};
+	sendmsg(client->socket, &msg, 0);
+}
 
-	return (unsigned char*)name;
+void dns_client_hold(const dns_client_t *client)
+{
+	if (client->tcp)
+		dns_tcp_hold(client->tcp);
+}
+
+void dns_client_release(const dns_client_t *client)
+{
+	if (client->tcp)
+		dns_tcp_release(client->tcp);
 }
 
 // ---------- DNS THREAD HANDLING ----------
 
+// One query to the upstream, over a connected UDP socket or a pooled TCP stream
+typedef struct {
+	const dns_task_t *task;
+	unsigned char *response;
+	size_t response_size;
+	int udp_socket;                     // -1 while the query rides the TCP pool
+	bool pooled;
+	dns_upstream_pending_t pending;
+} upstream_exchange_t;
+
+static int exchange_start_udp(upstream_exchange_t *exchange)
+{
+	const dns_task_t *task = exchange->task;
+
+	// Create thread-local upstream socket to avoid race conditions
+	exchange->pooled = false;
+	if ( (exchange->udp_socket = socket(AF_INET, SOCK_DGRAM, 0)) < 0 )
+	{
+		perror("Upstream socket failed");
+		return -1;
+	}
+
+	// Connect so the kernel drops datagrams from anyone but the upstream
+	if (connect(exchange->udp_socket, (struct sockaddr *)&task->upstream_addr,
+			sizeof(task->upstream_addr)) < 0)
+	{
+		perror("Upstream connect failed");
+		close(exchange->udp_socket);
+		exchange->udp_socket = -1;
+		return -1;
+	}
+
+	// Send the query to the upstream provider (e.g., 8.8.8.8)
+	send(exchange->udp_socket, task->buffer, task->query_size, 0);
+	return 0;
+}
+
+// Pooled TCP when asked for and a stream is up, UDP otherwise
+static int exchange_start(upstream_exchange_t *exchange, const dns_task_t *task, bool use_tcp,
+                          unsigned char *response, size_t response_size)
+{
+	exchange->task = task;
+	exchange->response = response;
+	exchange->response_size = response_size;
+	exchange->udp_socket = -1;
+	exchange->pooled = use_tcp &&
+		dns_upstream_submit(&exchange->pending, task->buffer, (size_t)task->query_size,
+			response, response_size) == 0;
+	return exchange->pooled ? 0 : exchange_start_udp(exchange);
+}
+
+// Returns the answer length, or 0 if nothing arrived within timeout_ms
+static ssize_t exchange_wait(upstream_exchange_t *exchange, int timeout_ms)
+{
+	if (exchange->pooled)
+	{
+		ssize_t n = dns_upstream_wait(&exchange->pending, timeout_ms);
+		if (n >= 0)
+			return n;
+
+		// Stream dropped under us — ask again over UDP
+		dns_upstream_release(&exchange->pending);
+		if (exchange_start_udp(exchange) < 0)
+			return 0;
+	}
+
+	ssize_t n = recv_with_timeout(exchange->udp_socket, exchange->response,
+		exchange->response_size, 0, NULL, NULL, timeout_ms);
+	return (n > 0) ? n : 0;
+}
+
+static void exchange_end(upstream_exchange_t *exchange)
+{
+	if (exchange->pooled)
+		dns_upstream_release(&exchange->pending);
+	else if (exchange->udp_socket >= 0)
+		close(exchange->udp_socket);
+	exchange->udp_socket = -1;
+	exchange->pooled = false;
+}
+
+// Answers the client and every coalesced waiter from an expired cache entry
+static void serve_stale(dns_task_t *task, const unsigned char *stale_answer, size_t stale_size)
+{
+	log_dns_decision("STALE", task->question.qname.name, &task->client.addr);
+	dns_client_reply(&task->client, stale_answer, stale_size);
+	dns_inflight_complete(&task->question, stale_answer, stale_size);
+}
+
 void* handle_dns_request(void *arg)
 {
 	// Convert argument into dns_task to access dns request info
 	dns_task_t *task = (dns_task_t *)arg;
 
-	// Skip 12-byte dns hdr to get to question section
-	unsigned char *reader = task->buffer + sizeof(struct dns_hdr);
-	int bytes_read = 0;
-
-	// Use helper to extract domain name
-	char *domain_name = (char *)read_name(reader, task->buffer, &bytes_read);
-
-	// Convert domain to lowercase
-	for (int i = 0; domain_name[i]; i++)
-		domain_name[i] = tolower(domain_name[i]);
-
-	// Refuse packet so client doesn't time out
-	if ( is_blocked(domain_name) )
-	{
-		log_dns_decision("BLOCKED", domain_name, &task->client_addr);
-
-		// Create a "Refused" response
-		struct dns_hdr *header = (struct dns_hdr *)task->buffer;
-		header->flags = htons(ntohs(header->flags) | DNS_FLAG_QR | 0x0005); // QR=1 (Response), RCODE=5 (Refused)
-
-		// Send the "Refused" header back to the client immediately
-		sendto(task->client_socket, task->buffer, task->query_size, 0,
-			(struct sockaddr *)&task->client_addr, sizeof(task->client_addr));
-	}
-	else // Is a normal packet
-    {
-        log_dns_decision("FORWARD", domain_name, &task->client_addr);
-        
-        // Create thread-local upstream socket to avoid race conditions
-        int upstream_socket;
-        if ( (upstream_socket = socket(AF_INET, SOCK_DGRAM, 0)) < 0 )
-        {
-            perror("Upstream socket failed");
-            free(domain_name);
-            free(task);
-            return NULL;
-        }
-
-        // Send the query to the upstream provider (e.g., 8.8.8.8)
-        sendto(upstream_socket, task->buffer, task->query_size, 0,
-            (struct sockaddr *)&task->upstream_addr,
-            sizeof(task->upstream_addr));
-
-        // Use a thread-local buffer to prevent using the global upstream in main
-        unsigned char upstream_response[UPSTREAM_BUFFER_SIZE];
-        ssize_t response_size = recv_with_timeout(upstream_socket, upstream_response,
-            UPSTREAM_BUFFER_SIZE, 0, NULL, NULL, 2000);
-
-        if (response_size > 0)
-        {
-            // Send the successful response back to the client
-            sendto(task->client_socket, upstream_response, response_size, 0,
-                (struct sockaddr *)&task->client_addr, sizeof(task->client_addr));
-        }
-        else
-            log_dns_decision("TIMEOUT", domain_name, &task->client_addr);
-
-        // Close local socket
-        close(upstream_socket);
-    }
-
-    // Final cleanup
-    free(domain_name);
-    free(task); 
-    return NULL;
+	// Domain was parsed, lowercased and checked against the blocklist by the receive loop
+	const char *domain_name = task->question.qname.name;
+	log_dns_decision("FORWARD", domain_name, &task->client.addr);
+
+	// Use a thread-local buffer to prevent using the global upstream in main
+	unsigned char upstream_response[UPSTREAM_BUFFER_SIZE];
+	ssize_t response_size = 0;
+
+	// RFC 8767 — an expired answer we can fall back on if the upstream is slow
+	unsigned char stale_answer[UPSTREAM_BUFFER_SIZE];
+	size_t stale_size = dns_cache_lookup_stale(&task->question, task->buffer,
+		stale_answer, sizeof(stale_answer));
+	bool answered = false;
+
+	// TCP clients expect answers of any size — go straight to a pooled stream
+	// (the pool only reaches the default upstream; zone servers are asked over UDP)
+	upstream_exchange_t exchange;
+	if (exchange_start(&exchange, task, task->client.tcp != NULL && task->default_upstream,
+			upstream_response, sizeof(upstream_response)) < 0)
+		goto done;
+
+	// With a stale fallback in hand, only give the upstream a short budget
+	response_size = exchange_wait(&exchange,
+		stale_size > 0 ? DNS_STALE_BUDGET_MS : DNS_UPSTREAM_TIMEOUT_MS);
+
+	if (response_size == 0 && stale_size > 0)
+	{
+		serve_stale(task, stale_answer, stale_size);
+		answered = true;
+
+		// Keep waiting so the refreshed answer still lands in the cache
+		response_size = exchange_wait(&exchange, DNS_UPSTREAM_TIMEOUT_MS - DNS_STALE_BUDGET_MS);
+	}
+
+	// Truncated over UDP — fetch the whole answer on a pooled stream
+	if (response_size > 0 && !exchange.pooled && task->default_upstream &&
+		(ntohs(((struct dns_hdr *)upstream_response)->flags) & DNS_FLAG_TC))
+	{
+		dns_upstream_pending_t retry;
+		if (dns_upstream_submit(&retry, task->buffer, (size_t)task->query_size,
+				upstream_response, sizeof(upstream_response)) == 0)
+		{
+			// The truncated answer stays in place unless the full one arrives
+			ssize_t full_size = dns_upstream_wait(&retry, DNS_UPSTREAM_TIMEOUT_MS);
+			if (full_size > 0)
+				response_size = full_size;
+			dns_upstream_release(&retry);
+		}
+	}
+
+	// One pass over the answer feeds both the CNAME check and the cache TTLs
+	dns_response_info_t info;
+	bool inspected = response_size > 0 &&
+		dns_response_matches(upstream_response, (size_t)response_size, task->buffer, &task->question) &&
+		dns_inspect_response(upstream_response, (size_t)response_size, &task->question, &info) == 0;
+
+	// CNAME cloaking — the chain leads to a blocked name: answer as if the
+	// question itself were blocked, and cache that instead
+	if (inspected && info.blocked)
+	{
+		log_dns_decision("BLOCKED (CNAME)", info.blocked_name, &task->client.addr);
+		dns_topk_count(TOPK_BLOCKED, info.blocked_name, strlen(info.blocked_name),
+			domain_hash(info.blocked_name, strlen(info.blocked_name)));
+
+		size_t block_size = dns_sinkhole_answer(task->buffer, &task->question,
+			upstream_response, sizeof(upstream_response));
+		if (block_size > 0 && task->client.edns)
+			block_size = dns_append_opt(upstream_response, block_size, sizeof(upstream_response));
+		response_size = (ssize_t)block_size;
+		inspected = block_size > 0 &&
+			dns_inspect_response(upstream_response, block_size, &task->question, &info) == 0;
+	}
+
+	if (response_size > 0)
+	{
+		// Remember the answer (positive or RFC 2308 negative) for repeat lookups
+		if (inspected)
+			dns_cache_store(&task->question, upstream_response, (size_t)response_size, &info);
+
+		uint16_t rcode = ntohs(((struct dns_hdr *)upstream_response)->flags) & DNS_FLAG_RCODE;
+		if (answered)
+			; // client already has the stale answer
+		else if (rcode == DNS_RCODE_SERVFAIL && stale_size > 0)
+		{
+			// RFC 8767 section 5 — stale data beats a resolution failure
+			serve_stale(task, stale_answer, stale_size);
+			answered = true;
+		}
+		else
+		{
+			// Send the successful response back to the client
+			dns_client_reply(&task->client, upstream_response, (size_t)response_size);
+		}
+	}
+	else if (!answered)
+		log_dns_decision("TIMEOUT", domain_name, &task->client.addr);
+
+	// Close local socket / give back the pooled slot
+	exchange_end(&exchange);
+
+done:
+	if (!answered && response_size == 0 && stale_size > 0)
+	{
+		serve_stale(task, stale_answer, stale_size);
+		answered = true;
+	}
+
+	// Answer every client that was coalesced onto this query
+	if (!answered)
+		dns_inflight_complete(&task->question,
+			(response_size > 0) ? upstream_response : NULL, (size_t)response_size);
+
+	// Final cleanup
+	dns_client_release(&task->client);
+	free(task);
+	return NULL;
 }
 
 // Receives a request without blocking after a certain period
@@ -15,63 +15,251 @@
 #include <poll.h>
 #include <pthread.h>
 #include "../../common/net_hdrs.h"
+#include "../../common/domain.h"
 
 // Masks for the Flags field
 #define DNS_FLAG_QR     0x8000  // 1000 0000 0000 0000 (The very first bit)
 #define DNS_FLAG_OPCODE 0x7800  // 0111 1000 0000 0000
 #define DNS_FLAG_AA     0x0400  // 0000 0100 0000 0000
+#define DNS_FLAG_TC     0x0200  // 0000 0010 0000 0000
 #define DNS_FLAG_RD     0x0100  // 0000 0001 0000 0000
+#define DNS_FLAG_RA     0x0080  // 0000 0000 1000 0000
 #define DNS_FLAG_RCODE  0x000F  // 0000 0000 0000 1111 (The last 4 bits)
 
+// RCODE values (RFC 1035 section 4.1.1)
+#define DNS_RCODE_NOERROR   0
+#define DNS_RCODE_SERVFAIL  2
+#define DNS_RCODE_NXDOMAIN  3
+#define DNS_RCODE_REFUSED   5
+
+// RR TYPE / CLASS values (RFC 1035 section 3.2.2, RFC 6891)
+#define DNS_TYPE_A      1
+#define DNS_TYPE_CNAME  5
+#define DNS_TYPE_SOA    6
+#define DNS_TYPE_PTR    12
+#define DNS_TYPE_AAAA   28
+#define DNS_TYPE_OPT    41
+#define DNS_CLASS_IN    1
+
+// Fixed part of a resource record after its owner name:
+// TYPE(2) CLASS(2) TTL(4) RDLENGTH(2)
+#define DNS_RR_FIXED_SIZE 10
+
 // Constants used in main.c and dns.c
 #define DNS_PORT 53
-#define DNS_BUFFER_SIZE 512
+#define DNS_UDP_PAYLOAD_MIN 512        // RFC 1035 UDP limit for clients without EDNS0
+#define DNS_EDNS_PAYLOAD_MAX 4096      // largest EDNS0 payload we accept or answer with (RFC 6891)
+#define DNS_BUFFER_SIZE DNS_EDNS_PAYLOAD_MAX
 #define DNS_NAME_SIZE 256
 #define UPSTREAM_BUFFER_SIZE 65536
 #define DNS_DEFAULT_UPSTREAM "8.8.8.8"
+#define DNS_UPSTREAM_TIMEOUT_MS 2000   // give up on the upstream after this
+#define DNS_STALE_BUDGET_MS 300        // serve a stale answer if the upstream is slower than this
 #define DNS_VERBOSE_RX 0
 #define MAX_LOOP_COUNT 100
 #define JUMP_HEX_VALUE 0xC0
 #define FIRST_OFFSET_HEX_VALUE 0x3F
+#define DNS_INSPECT_MAX_CHECKED 16     // names per answer remembered as already blocklist-checked
 
 // -------------------------- DNS STRUCTS -----------------------------
 
+/**
+ * The parsed question section of a query (first question only).
+ * Filled once in the receive loop and reused for the cache and the blocklist.
+ */
+typedef struct {
+    domain_name_t qname;        // Lowercased name + label offsets / suffix hashes
+    uint16_t qtype;             // QTYPE in host byte order
+    uint16_t qclass;            // QCLASS in host byte order
+    size_t question_end;        // Offset just past QCLASS in the packet
+    uint32_t hash;              // qname hash mixed with qtype / qclass — shared table key
+} dns_question_t;
+
+struct dns_tcp_conn;
+
+/**
+ * Where an answer has to go: a UDP peer on the listener socket, or one TCP
+ * connection that may have many queries outstanding at once (see tcp.h).
+ * Copied by value into tasks and coalesced waiters; anything holding a copy
+ * past the receive path pins the connection with dns_client_hold().
+ */
+typedef struct {
+    int socket;                     // UDP listener socket (-1 for TCP clients)
+    struct sockaddr_in addr;        // Who sent the request
+    uint16_t max_payload;           // Largest UDP answer the client accepts (RFC 6891)
+    bool edns;                      // Query carried an OPT record
+    struct dns_tcp_conn *tcp;       // Set when the query arrived over TCP
+} dns_client_t;
+
 /**
  * Data structure used to pass context to worker threads.
  * Since pthread_create only accepts a single pointer argument, this struct 
  * bundles everything a thread needs to process a DNS request independently.
  */
 typedef struct {
-    int client_socket;                      // The port we listen on
-    struct sockaddr_in client_addr;         // Who sent the request
+    dns_client_t client;                    // Who to answer, and how
     unsigned char buffer[DNS_BUFFER_SIZE];  // Buffer for DNS queries
     ssize_t query_size;                     // Size of the DNS buffer
-    struct sockaddr_in upstream_addr;       // Pre-configured Google/Cloudflare addr
+    struct sockaddr_in upstream_addr;       // Default upstream, or the server of a forwarding zone
+    bool default_upstream;                  // false when a zone routed it (no TCP pool for those)
+    dns_question_t question;                // Parsed by the receive loop
 } dns_task_t;
 
 // -------------------------- DNS PARSER -----------------------------
 
 /**
- * Reads a DNS Domain Name from the packet, handling both standard labels
- * (e.g., 3www6google3com0).
+ * Decodes the (possibly compressed) name at 'offset' straight into caller
+ * storage — no allocation. The name is lowercased with the vector pass in
+ * domain_lowercase(), then label offsets and suffix hashes are filled in so
+ * the cache and blocklist reuse them.
+ *
+ * Bounds-safe: every label and pointer is checked against packet_len, pointers
+ * must point strictly backwards of the previous jump, and the decoded name is
+ * capped at 255 wire octets.
  *
- * @param reader  Pointer to the current location in the packet where the name starts.
- * @param buffer  Pointer to the start of the full packet (needed for jumping to compressed offsets).
- * @param count   [Output] Stores the number of bytes read/advanced. The caller should use this
- * to move their pointer past the name after reading.
+ * @param next_offset [Output] Offset just past the name in the packet (past the
+ *                    first pointer if the name is compressed). May be NULL.
+ * @return 0 on success, -1 if the name is malformed or runs off the packet.
+ */
+int dns_read_name(const unsigned char *packet, size_t packet_len, size_t offset,
+                  domain_name_t *domain, size_t *next_offset);
+
+/**
+ * Parses the first question of a query into a dns_question_t (lowercased name,
+ * QTYPE, QCLASS and the offset where the question section ends).
  *
- * @return A dynamically allocated string (e.g., "www.google.com").
- * WARNING: The caller is responsible for freeing this memory!
+ * @return 0 on success, -1 if the packet has no usable question.
  */
-unsigned char* read_name(unsigned char* reader, unsigned char* buffer, int* count);
+int dns_parse_question(const unsigned char *packet, size_t packet_len, dns_question_t *question);
+
+/**
+ * Returns the offset just past the (possibly compressed) name starting at
+ * 'offset', or -1 if the name runs past the end of the packet.
+ * Compression pointers are not followed — they always end the name.
+ */
+int dns_skip_name(const unsigned char *packet, size_t packet_len, size_t offset);
+
+/**
+ * Checks that an upstream answer belongs to the query we sent
+ * (same ID, QR set, same question) before it is cached or relayed.
+ */
+bool dns_response_matches(const unsigned char *response, size_t response_len,
+                          const unsigned char *query, const dns_question_t *question);
+
+/**
+ * Encodes a dotted name ("www.google.com") as wire labels (3www6google3com0).
+ *
+ * @return Encoded length in bytes, or 0 if out is too small or a label is
+ *         empty or longer than 63 bytes.
+ */
+size_t dns_encode_name(const char *name, unsigned char *out, size_t out_size);
+
+/**
+ * Builds a recursive query for question->qname / qtype / qclass into out.
+ * Used for background refreshes that have no client packet to forward.
+ *
+ * @return Query length in bytes, or 0 if out is too small or the name is invalid.
+ */
+size_t dns_build_query(const dns_question_t *question, uint16_t id,
+                       unsigned char *out, size_t out_size);
+
+/**
+ * What one pass over an upstream answer found: the TTLs the cache needs and
+ * whether a name further down the answer chain is blocked (CNAME cloaking,
+ * e.g. metrics.site.com -> site.tracker.net).
+ */
+typedef struct {
+    uint32_t min_ttl;                       // Smallest TTL of any record (OPT excluded)
+    bool have_ttl;
+    uint32_t soa_ttl;                       // RFC 2308 negative TTL: min(SOA TTL, SOA MINIMUM)
+    bool have_soa;
+    bool blocked;                           // An answer owner or CNAME target is blocklisted
+    char blocked_name[DOMAIN_NAME_SIZE];    // The first such name, for the log
+} dns_response_info_t;
+
+/**
+ * Walks every record of an upstream answer once, in place — no copy of the
+ * packet. Collects the TTLs for dns_cache_store() and runs each answer owner
+ * and CNAME target through the blocklist. Owners that are bare compression
+ * pointers to a name already checked (the question, an earlier CNAME target)
+ * are not decoded again.
+ *
+ * @return 0 on success, -1 if the sections run off the packet.
+ */
+int dns_inspect_response(const unsigned char *response, size_t response_len,
+                         const dns_question_t *question, dns_response_info_t *info);
+
+/**
+ * Reads the EDNS0 OPT record from a query's additional section.
+ * Sets client->edns and client->max_payload (the advertised UDP payload size,
+ * clamped to DNS_UDP_PAYLOAD_MIN..DNS_EDNS_PAYLOAD_MAX, or 512 without OPT).
+ *
+ * @return 0 on success, -1 if the sections run off the packet.
+ */
+int dns_read_edns(const unsigned char *query, size_t query_len, dns_client_t *client);
+
+/**
+ * Appends an OPT record advertising DNS_EDNS_PAYLOAD_MAX to an answer we
+ * synthesized ourselves and bumps ARCOUNT. Used when the client spoke EDNS0.
+ *
+ * @return New answer length, or answer_len unchanged if out_size is too small.
+ */
+size_t dns_append_opt(unsigned char *answer, size_t answer_len, size_t out_size);
+
+// Big-endian field accessors for resource records
+static inline uint16_t dns_read_u16(const unsigned char *p)
+{
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static inline uint32_t dns_read_u32(const unsigned char *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+           ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static inline void dns_write_u32(unsigned char *p, uint32_t value)
+{
+    p[0] = (unsigned char)(value >> 24);
+    p[1] = (unsigned char)(value >> 16);
+    p[2] = (unsigned char)(value >> 8);
+    p[3] = (unsigned char)value;
+}
+
+// -------------------------- DNS CLIENTS -----------------------------
+
+/**
+ * Sends a complete DNS message to a client over whichever transport it used.
+ * UDP answers are fitted to the client's limits on the way out: an OPT record
+ * is dropped for clients that did not send one, and anything larger than
+ * client->max_payload goes out as header + question with TC=1 so the client
+ * retries over TCP. TCP answers are length-framed and may leave out of order.
+ */
+void dns_client_reply(const dns_client_t *client, const unsigned char *response, size_t response_len);
+
+// Pins a TCP client's connection while a task or waiter keeps a copy (no-op for UDP)
+void dns_client_hold(const dns_client_t *client);
+void dns_client_release(const dns_client_t *client);
+
+/**
+ * Runs one received query through the pipeline shared by the UDP and TCP
+ * listeners: parse, cache, blocklist, coalescing, then a worker thread.
+ * scratch is caller-owned answer space (at least DNS_CACHE_MAX_RESPONSE bytes)
+ * so cache hits and blocks never allocate.
+ */
+void dns_dispatch_query(const dns_client_t *client, const unsigned char *packet, size_t packet_len,
+                        const struct sockaddr_in *upstream_addr,
+                        unsigned char *scratch, size_t scratch_size);
 
 // -------------------------- DNS THREAD HANDLING -----------------------------
 
 /**
  * The entry point for worker threads handling individual DNS queries.
  * * This function runs in its own thread to prevent "Head-of-Line Blocking."
- * It parses the domain, checks the blocklist, and either sends a REFUSED 
- * response or forwards the query to the upstream server via a thread-local socket.
+ * The receive loop has already parsed the question, answered cache hits and
+ * blocked domains, and registered this task as the leader for its question.
+ * The worker forwards the query upstream, caches and relays the answer, and
+ * fans it out to every client coalesced onto the same question.
  *
  * @param arg A pointer to a dns_task_t structure (must be cast to void*).
  * @return NULL upon completion. This function is responsible for freeing 'arg'.
@@ -79,14 +267,35 @@ unsigned char* read_name(unsigned char* reader, unsigned char* buffer, int* coun
 void* handle_dns_request(void* arg);
 
 /**
- * Starts the Layer 7 DNS filter service:
- * - binds UDP socket on DNS_PORT
- * - receives client DNS queries
- * - dispatches each query to handle_dns_request() in a worker thread
+ * Runs the Layer 7 DNS filter service:
+ * - binds UDP socket on listen_port and starts the TCP listener (see tcp.h)
+ * - receives client DNS queries, up to the EDNS0 payload size
+ * - answers repeat queries from the response cache (positive + negative)
+ * - answers blocked domains from the prebuilt sinkhole records (see sinkhole.h)
+ * - attaches duplicates of an outstanding upstream query to that query
+ * - dispatches each remaining query to handle_dns_request() in a worker thread
  *
- * @param upstream_ip Upstream resolver IPv4 string (e.g. "8.8.8.8")
+ * The cache must already be initialized (and warmed from a snapshot) by main.c.
+ * Returns once request_dns_server_stop() has been called.
+ *
+ * @param upstream_ip Upstream resolver as "ip[:port]" (e.g. "8.8.8.8")
+ * @param listen_port UDP + TCP port to serve on (DNS_PORT in production)
+ */
+void start_dns_server(const char *upstream_ip, uint16_t listen_port);
+
+/**
+ * Parses an upstream server written as "ip" or "ip:port" (port defaults to
+ * DNS_PORT). Shared by the default upstream and the forwarding zones.
+ *
+ * @return 0 on success, -1 if the address or port is invalid.
+ */
+int dns_parse_addr(const char *spec, struct sockaddr_in *addr);
+
+/**
+ * Signal-safe stop request: flags the receive loop and shuts the UDP socket
+ * so a blocked recvfrom() returns. Registered for SIGINT / SIGTERM in main.c.
  */
-void start_dns_server(const char *upstream_ip);
+void request_dns_server_stop(void);
 
 /**
  * Receives data from a socket with a safety timeout mechanism.
@@ -0,0 +1,146 @@
+#include <ctype.h>
+
+#include "forward.h"
+
+// --- zone index ---
+// open addressing, linear probing, keyed by domain_hash() like the blocklist
+// built once at startup, read-only afterwards (except the round-robin cursors)
+static dns_forward_zone_t *g_zones = NULL;
+static size_t g_zone_mask = 0;      // capacity - 1 (capacity is a power of two)
+static size_t g_zone_count = 0;
+
+static dns_forward_zone_t *find_zone(const char *zone, size_t len, uint32_t hash)
+{
+	for (size_t i = hash & g_zone_mask; g_zones[i].len != 0; i = (i + 1) & g_zone_mask)
+	{
+		if (g_zones[i].hash == hash && g_zones[i].len == len &&
+			memcmp(g_zones[i].zone, zone, len) == 0)
+			return &g_zones[i];
+	}
+	return NULL;
+}
+
+// parses one config line into a zone; returns 0 on success, -1 on a bad line
+static int parse_line(char *line, dns_forward_zone_t *out)
+{
+	memset(out, 0, sizeof(*out));
+
+	char *save = NULL;
+	char *zone = strtok_r(line, " \t", &save);
+	if (!zone)
+		return -1;
+
+	domain_name_t name;
+	if (domain_name_from_string(zone, &name) < 0 || name.len == 0)
+		return -1;
+	memcpy(out->zone, name.name, name.len + 1);
+	out->len = name.len;
+	out->hash = domain_hash(name.name, name.len);
+
+	char *server;
+	while ((server = strtok_r(NULL, " \t", &save)) != NULL)
+	{
+		if (out->upstream_count >= DNS_FORWARD_MAX_UPSTREAMS ||
+			dns_parse_addr(server, &out->upstreams[out->upstream_count]) < 0)
+			return -1;
+		out->upstream_count++;
+	}
+	return (out->upstream_count > 0) ? 0 : -1;
+}
+
+void dns_forward_free(void)
+{
+	free(g_zones);
+	g_zones = NULL;
+	g_zone_mask = 0;
+	g_zone_count = 0;
+}
+
+int dns_forward_load(const char *filename)
+{
+	FILE *file = fopen(filename, "r");
+	if (!file)
+	{
+		perror("Could not open forwarding zones file");
+		return -1;
+	}
+
+	dns_forward_free();
+
+	// --- first pass: size the index ---
+	size_t lines = 0;
+	char buffer[DNS_FORWARD_LINE_BUFFER];
+	while (fgets(buffer, sizeof(buffer), file))
+		lines++;
+	rewind(file);
+
+	size_t capacity = 16;
+	while (capacity < lines * 2)
+		capacity <<= 1;
+
+	g_zones = calloc(capacity, sizeof(dns_forward_zone_t));
+	if (!g_zones)
+	{
+		fclose(file);
+		perror("Out of memory loading forwarding zones");
+		return -1;
+	}
+	g_zone_mask = capacity - 1;
+
+	// --- second pass: parse and index ---
+	int line_no = 0;
+	while (fgets(buffer, sizeof(buffer), file))
+	{
+		line_no++;
+		buffer[strcspn(buffer, "#\r\n")] = '\0';
+
+		char *start = buffer;
+		while (isspace((unsigned char)*start)) start++;
+		if (*start == '\0')
+			continue;
+
+		dns_forward_zone_t zone;
+		if (parse_line(start, &zone) < 0)
+		{
+			fprintf(stderr, "%s:%d: expected \"zone upstream[:port] ...\"\n", filename, line_no);
+			continue;
+		}
+
+		// A repeated zone replaces the earlier line
+		dns_forward_zone_t *slot = find_zone(zone.zone, zone.len, zone.hash);
+		if (!slot)
+		{
+			size_t i = zone.hash & g_zone_mask;
+			while (g_zones[i].len != 0)
+				i = (i + 1) & g_zone_mask;
+			slot = &g_zones[i];
+			g_zone_count++;
+		}
+		*slot = zone;
+	}
+	fclose(file);
+
+	printf("[LAYER_7] [DNS] Forwarding zones loaded: %zu\n", g_zone_count);
+	return (int)g_zone_count;
+}
+
+bool dns_forward_route(const domain_name_t *name, struct sockaddr_in *upstream_addr)
+{
+	if (g_zone_count == 0 || name->label_count == 0)
+		return false;
+
+	// Longest suffix first — the name's own hashes, no rehashing
+	for (int label = 0; label < name->label_count; label++)
+	{
+		size_t off = name->label_off[label];
+		dns_forward_zone_t *zone = find_zone(name->name + off, name->len - off,
+			name->suffix_hash[label]);
+		if (zone)
+		{
+			unsigned pick = __atomic_fetch_add(&zone->next, 1, __ATOMIC_RELAXED);
+			*upstream_addr = zone->upstreams[pick % (unsigned)zone->upstream_count];
+			return true;
+		}
+	}
+	return false;
+}
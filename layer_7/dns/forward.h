@@ -0,0 +1,38 @@
+#ifndef DNS_FORWARD_H
+#define DNS_FORWARD_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "dns.h"
+
+// servers per zone, tried round robin
+#define DNS_FORWARD_MAX_UPSTREAMS   4
+#define DNS_FORWARD_LINE_BUFFER     512
+
+// --- one forwarding zone ---
+// every name at or below 'zone' goes to these servers instead of the default upstream
+typedef struct {
+	char zone[DOMAIN_NAME_SIZE];        // lowercased, no trailing dot: "168.192.in-addr.arpa"
+	uint16_t len;                       // strlen(zone), 0 marks an empty slot
+	uint32_t hash;                      // domain_hash() — matches a query's suffix_hash[]
+	struct sockaddr_in upstreams[DNS_FORWARD_MAX_UPSTREAMS];
+	int upstream_count;
+	unsigned next;                      // round-robin cursor (atomic)
+} dns_forward_zone_t;
+
+// loads "zone upstream[:port] [upstream[:port] ...]" lines ('#' comments)
+// into a suffix hash index — call once at startup
+// returns the number of zones loaded, -1 if the file can't be read
+int dns_forward_load(const char *filename);
+
+// picks the upstream for a name: the most specific matching zone wins
+// (corp.example.com over example.com), one hash probe per label
+// returns true and fills *upstream_addr if a zone matched,
+// false if the name goes to the default upstream
+bool dns_forward_route(const domain_name_t *name, struct sockaddr_in *upstream_addr);
+
+void dns_forward_free(void);
+
+#endif
@@ -0,0 +1,117 @@
+#include "inflight.h"
+
+// --- global pending table ---
+// receive loop adds entries and waiters, leader threads remove them
+// access protected by g_inflight_lock
+static dns_inflight_t *g_inflight[DNS_INFLIGHT_BUCKETS];
+static pthread_mutex_t g_inflight_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// caller must hold g_inflight_lock
+static dns_inflight_t **inflight_find(const dns_question_t *question)
+{
+	dns_inflight_t **cursor = &g_inflight[question->hash % DNS_INFLIGHT_BUCKETS];
+	while (*cursor)
+	{
+		dns_inflight_t *pending = *cursor;
+		if (pending->hash == question->hash && pending->qtype == question->qtype &&
+			pending->qclass == question->qclass && strcmp(pending->name, question->qname.name) == 0)
+			return cursor;
+		cursor = &pending->next;
+	}
+	return cursor;
+}
+
+bool dns_inflight_join(const dns_question_t *question, const unsigned char *query,
+                       const dns_client_t *client)
+{
+	pthread_mutex_lock(&g_inflight_lock);
+	dns_inflight_t **slot = inflight_find(question);
+
+	// --- nothing outstanding: caller becomes the leader ---
+	if (*slot == NULL)
+	{
+		dns_inflight_t *pending = calloc(1, sizeof(dns_inflight_t));
+		if (pending)
+		{
+			memcpy(pending->name, question->qname.name, sizeof(pending->name));
+			pending->qtype = question->qtype;
+			pending->qclass = question->qclass;
+			pending->hash = question->hash;
+			pending->question_end = question->question_end;
+			*slot = pending;
+		}
+		pthread_mutex_unlock(&g_inflight_lock);
+		return false;
+	}
+
+	// --- identical query outstanding: park this client behind it ---
+	dns_inflight_t *pending = *slot;
+	if (pending->question_end != question->question_end ||
+		question->question_end - sizeof(struct dns_hdr) > sizeof(((dns_waiter_t *)0)->question) ||
+		pending->waiter_count >= DNS_INFLIGHT_MAX_WAITERS)
+	{
+		pthread_mutex_unlock(&g_inflight_lock);
+		return false;
+	}
+
+	dns_waiter_t *waiter = malloc(sizeof(dns_waiter_t));
+	if (!waiter)
+	{
+		pthread_mutex_unlock(&g_inflight_lock);
+		return false;
+	}
+
+	waiter->client = *client;
+	dns_client_hold(&waiter->client);
+	memcpy(waiter->header_id, query, sizeof(waiter->header_id));
+	memcpy(waiter->question, query + sizeof(struct dns_hdr),
+		question->question_end - sizeof(struct dns_hdr));
+	waiter->next = pending->waiters;
+	pending->waiters = waiter;
+	pending->waiter_count++;
+
+	pthread_mutex_unlock(&g_inflight_lock);
+	return true;
+}
+
+void dns_inflight_complete(const dns_question_t *question,
+                           const unsigned char *response, size_t response_len)
+{
+	// --- detach the pending entry so new queries start fresh ---
+	pthread_mutex_lock(&g_inflight_lock);
+	dns_inflight_t **slot = inflight_find(question);
+	dns_inflight_t *pending = *slot;
+	if (pending) *slot = pending->next;
+	pthread_mutex_unlock(&g_inflight_lock);
+
+	if (!pending)
+		return;
+
+	// --- fan the single answer out, each under its own ID and question ---
+	unsigned char answer[UPSTREAM_BUFFER_SIZE];
+	bool have_answer = response && response_len >= pending->question_end &&
+		response_len <= sizeof(answer);
+	if (have_answer)
+		memcpy(answer, response, response_len);
+
+	dns_waiter_t *waiter = pending->waiters;
+	while (waiter)
+	{
+		dns_waiter_t *next = waiter->next;
+
+		if (have_answer)
+		{
+			memcpy(answer, waiter->header_id, sizeof(waiter->header_id));
+			memcpy(answer + sizeof(struct dns_hdr), waiter->question,
+				pending->question_end - sizeof(struct dns_hdr));
+			dns_client_reply(&waiter->client, answer, response_len);
+		}
+		else
+			log_dns_decision("TIMEOUT", pending->name, &waiter->client.addr);
+
+		dns_client_release(&waiter->client);
+		free(waiter);
+		waiter = next;
+	}
+	free(pending);
+}
@@ -0,0 +1,55 @@
+#ifndef DNS_INFLIGHT_H
+#define DNS_INFLIGHT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "dns.h"
+
+// number of hash buckets — prime to reduce collisions
+#define DNS_INFLIGHT_BUCKETS        251
+// cap on clients parked behind one upstream query
+// past this, duplicates get their own upstream query again
+#define DNS_INFLIGHT_MAX_WAITERS    64
+
+// --- waiter ---
+// a client whose query is identical to one already outstanding upstream
+// keeps only what is needed to answer it under its own ID and transport
+typedef struct dns_waiter {
+	dns_client_t client;                        // who sent the duplicate query (held)
+	unsigned char header_id[2];                 // client's transaction ID (wire order)
+	unsigned char question[DNS_NAME_SIZE + 4];  // client's question bytes (0x20 casing)
+	struct dns_waiter *next;
+} dns_waiter_t;
+
+// --- pending upstream query ---
+// one per (qname, qtype, qclass) currently being resolved by a leader thread
+typedef struct dns_inflight {
+	char name[DNS_NAME_SIZE];
+	uint16_t qtype;
+	uint16_t qclass;
+	uint32_t hash;
+	size_t question_end;                        // waiters must match the leader's layout
+	int waiter_count;
+	dns_waiter_t *waiters;
+	struct dns_inflight *next;
+} dns_inflight_t;
+
+// called from the receive loop after a cache miss
+// returns true if an identical query is already outstanding — the client was
+// attached to it and will be answered when the leader's response arrives
+// returns false if the caller is now the leader and must query upstream,
+// then call dns_inflight_complete() exactly once
+bool dns_inflight_join(const dns_question_t *question, const unsigned char *query,
+                       const dns_client_t *client);
+
+// called by the leader once its upstream exchange is over
+// sends response (if any) to every attached waiter with its own ID and
+// question bytes, fitted to that waiter's transport, then forgets the pending entry
+// response may be NULL when the upstream timed out
+void dns_inflight_complete(const dns_question_t *question,
+                           const unsigned char *response, size_t response_len);
+
+#endif
@@ -0,0 +1,545 @@
+#include <ctype.h>
+#include <strings.h>
+#include <sys/stat.h>
+
+#include "local.h"
+
+// --- one record from the file, before compilation ---
+typedef struct {
+	char name[DOMAIN_NAME_SIZE];        // owner, lowercased
+	uint16_t len;
+	uint32_t hash;
+	uint16_t type;
+	uint16_t rdlength;
+	unsigned char rdata[DNS_NAME_SIZE]; // address bytes, or the encoded target name
+	char target[DOMAIN_NAME_SIZE];      // CNAME / PTR target, lowercased
+	uint16_t target_len;
+	uint32_t target_hash;
+	size_t slot;                        // owner's slot in the compiled index
+} local_record_t;
+
+typedef struct {
+	local_record_t *items;
+	size_t count;
+	size_t cap;
+} record_list_t;
+
+// --- compiled index ---
+// open addressing, linear probing, keyed by domain_hash() of the full name
+typedef struct {
+	dns_local_name_t *names;
+	size_t mask;                        // capacity - 1 (capacity is a power of two)
+	size_t count;                       // names
+	size_t records;                     // records they were built from
+} local_table_t;
+
+// the live index, swapped whole on reload
+// readers (UDP loop, TCP listener) hold g_local_lock shared while copying an answer
+static local_table_t *g_table = NULL;
+static pthread_rwlock_t g_local_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+// file being served — only the maintenance thread touches these after startup
+static const char *g_path = NULL;
+static struct timespec g_mtime;
+static off_t g_size = -1;
+
+// QTYPE each prebuilt answer is built for (0: none — CNAME or NODATA only)
+static const uint16_t KIND_TYPES[LOCAL_ANSWER_KINDS] = { DNS_TYPE_A, DNS_TYPE_AAAA, DNS_TYPE_PTR, 0 };
+
+// --- SOA for the authority section of NODATA answers ---
+// RFC 2308 section 2.2: without it clients can't negatively cache "no such
+// type". Owner is the question name (0xC00C), MINIMUM is DNS_LOCAL_TTL; built
+// by dns_local_load() before any reader runs
+static const unsigned char LOCAL_SOA_MNAME[] = "\x05local\x0api-blocker";
+static const unsigned char LOCAL_SOA_RNAME[] = "\x0ahostmaster\x0api-blocker";
+static unsigned char g_soa_record[96];
+static size_t g_soa_len = 0;
+
+static void build_soa(void)
+{
+	size_t rdlength = sizeof(LOCAL_SOA_MNAME) + sizeof(LOCAL_SOA_RNAME) + 20;
+	unsigned char *writer = g_soa_record;
+	writer[0] = JUMP_HEX_VALUE;
+	writer[1] = sizeof(struct dns_hdr);
+	writer[2] = 0;
+	writer[3] = DNS_TYPE_SOA;
+	writer[4] = 0;
+	writer[5] = DNS_CLASS_IN;
+	dns_write_u32(writer + 6, DNS_LOCAL_TTL);
+	writer[10] = (unsigned char)(rdlength >> 8);
+	writer[11] = (unsigned char)rdlength;
+	writer += DNS_RR_FIXED_SIZE + 2;
+
+	memcpy(writer, LOCAL_SOA_MNAME, sizeof(LOCAL_SOA_MNAME));
+	writer += sizeof(LOCAL_SOA_MNAME);
+	memcpy(writer, LOCAL_SOA_RNAME, sizeof(LOCAL_SOA_RNAME));
+	writer += sizeof(LOCAL_SOA_RNAME);
+	dns_write_u32(writer, 1);                   // SERIAL
+	dns_write_u32(writer + 4, 3600);            // REFRESH
+	dns_write_u32(writer + 8, 600);             // RETRY
+	dns_write_u32(writer + 12, 86400);          // EXPIRE
+	dns_write_u32(writer + 16, DNS_LOCAL_TTL);  // MINIMUM — the negative TTL
+	writer += 20;
+	g_soa_len = (size_t)(writer - g_soa_record);
+}
+
+static dns_local_name_t *find_name(const local_table_t *table, const char *name, size_t len, uint32_t hash)
+{
+	for (size_t i = hash & table->mask; table->names[i].len != 0; i = (i + 1) & table->mask)
+	{
+		if (table->names[i].hash == hash && table->names[i].len == len &&
+			memcmp(table->names[i].name, name, len) == 0)
+			return &table->names[i];
+	}
+	return NULL;
+}
+
+static void table_free(local_table_t *table)
+{
+	if (!table)
+		return;
+	for (size_t i = 0; i <= table->mask; i++)
+	{
+		for (int kind = 0; kind < LOCAL_ANSWER_KINDS; kind++)
+			free(table->names[i].answers[kind].records);
+	}
+	free(table->names);
+	free(table);
+}
+
+// ---------- FILE PARSING ----------
+
+// 192.168.1.10 -> 10.1.168.192.in-addr.arpa, IPv6 -> nibbles under ip6.arpa
+static void reverse_name(const unsigned char *addr, bool v4, char *out, size_t out_size)
+{
+	if (v4)
+	{
+		snprintf(out, out_size, "%u.%u.%u.%u.in-addr.arpa", addr[3], addr[2], addr[1], addr[0]);
+		return;
+	}
+
+	static const char HEX[] = "0123456789abcdef";
+	char *writer = out;
+	for (int i = 15; i >= 0; i--)
+	{
+		*writer++ = HEX[addr[i] & 0x0F];
+		*writer++ = '.';
+		*writer++ = HEX[addr[i] >> 4];
+		*writer++ = '.';
+	}
+	snprintf(writer, out_size - (size_t)(writer - out), "ip6.arpa");
+}
+
+// appends one record owned by 'owner'; rdata is filled in by the caller
+static local_record_t *add_record(record_list_t *list, const char *owner, uint16_t type)
+{
+	domain_name_t name;
+	if (domain_name_from_string(owner, &name) < 0 || name.len == 0)
+		return NULL;
+
+	if (list->count == list->cap)
+	{
+		size_t cap = list->cap ? list->cap * 2 : 64;
+		local_record_t *items = realloc(list->items, cap * sizeof(local_record_t));
+		if (!items)
+		{
+			perror("Out of memory loading local names");
+			return NULL;
+		}
+		list->items = items;
+		list->cap = cap;
+	}
+
+	local_record_t *record = &list->items[list->count++];
+	memset(record, 0, sizeof(*record));
+	memcpy(record->name, name.name, name.len + 1);
+	record->len = name.len;
+	record->hash = name.suffix_hash[0];
+	record->type = type;
+	return record;
+}
+
+static int add_address(record_list_t *list, const char *owner, bool v4, const unsigned char *addr)
+{
+	local_record_t *record = add_record(list, owner, v4 ? DNS_TYPE_A : DNS_TYPE_AAAA);
+	if (!record)
+		return -1;
+	record->rdlength = v4 ? 4 : 16;
+	memcpy(record->rdata, addr, record->rdlength);
+	return 0;
+}
+
+static int add_target(record_list_t *list, const char *owner, uint16_t type, const char *target)
+{
+	domain_name_t name;
+	if (domain_name_from_string(target, &name) < 0 || name.len == 0)
+		return -1;
+
+	local_record_t *record = add_record(list, owner, type);
+	if (!record)
+		return -1;
+	memcpy(record->target, name.name, name.len + 1);
+	record->target_len = name.len;
+	record->target_hash = name.suffix_hash[0];
+	record->rdlength = (uint16_t)dns_encode_name(name.name, record->rdata, sizeof(record->rdata));
+	return (record->rdlength > 0) ? 0 : -1;
+}
+
+// one line: "ip name [name ...]", "name CNAME target" or "name|ip PTR target"
+static int parse_line(char *line, record_list_t *list)
+{
+	char *save = NULL;
+	char *first = strtok_r(line, " \t", &save);
+	char *second = strtok_r(NULL, " \t", &save);
+	if (!first || !second)
+		return -1;
+
+	unsigned char addr[16];
+	bool v4 = inet_pton(AF_INET, first, addr) == 1;
+	bool v6 = !v4 && inet_pton(AF_INET6, first, addr) == 1;
+	char reverse[DOMAIN_NAME_SIZE];
+	if (v4 || v6)
+		reverse_name(addr, v4, reverse, sizeof(reverse));
+
+	if (strcasecmp(second, "CNAME") == 0 || strcasecmp(second, "PTR") == 0)
+	{
+		char *target = strtok_r(NULL, " \t", &save);
+		if (!target || strtok_r(NULL, " \t", &save))
+			return -1;
+
+		uint16_t type = (toupper((unsigned char)second[0]) == 'C') ? DNS_TYPE_CNAME : DNS_TYPE_PTR;
+		if ((v4 || v6) && type != DNS_TYPE_PTR)
+			return -1;
+		return add_target(list, (v4 || v6) ? reverse : first, type, target);
+	}
+
+	if (!v4 && !v6)
+		return -1;
+
+	// hosts(5) semantics: every name gets the address, the address maps back to the first
+	for (char *name = second; name; name = strtok_r(NULL, " \t", &save))
+	{
+		if (add_address(list, name, v4, addr) < 0)
+			return -1;
+	}
+	return add_target(list, reverse, DNS_TYPE_PTR, second);
+}
+
+// ---------- COMPILATION ----------
+
+typedef struct {
+	local_table_t *table;
+	const record_list_t *list;
+	size_t *start;                      // per slot: first record (records sorted by slot)
+	size_t *num;                        // per slot: record count
+} compile_ctx_t;
+
+static int compare_slot(const void *a, const void *b)
+{
+	const local_record_t *x = (const local_record_t *)a;
+	const local_record_t *y = (const local_record_t *)b;
+	return (x->slot > y->slot) - (x->slot < y->slot);
+}
+
+// appends one RR; hop 0 owners are the question name (0xC00C), later hops a chased target
+// returns the new length, unchanged if the record does not fit
+static size_t append_rr(unsigned char *out, size_t len, int hop, const char *owner,
+                        const local_record_t *record, uint16_t *count)
+{
+	unsigned char owner_wire[DNS_NAME_SIZE];
+	size_t owner_len = 2;
+	if (hop == 0)
+	{
+		owner_wire[0] = JUMP_HEX_VALUE;
+		owner_wire[1] = sizeof(struct dns_hdr);
+	}
+	else if ((owner_len = dns_encode_name(owner, owner_wire, sizeof(owner_wire))) == 0)
+		return len;
+
+	size_t rr_len = owner_len + DNS_RR_FIXED_SIZE + record->rdlength;
+	if (len + rr_len > DNS_LOCAL_MAX_RECORDS_SIZE)
+		return len;
+
+	unsigned char *writer = out + len;
+	memcpy(writer, owner_wire, owner_len);
+	writer += owner_len;
+	writer[0] = (unsigned char)(record->type >> 8);
+	writer[1] = (unsigned char)record->type;
+	writer[2] = 0;
+	writer[3] = DNS_CLASS_IN;
+	dns_write_u32(writer + 4, DNS_LOCAL_TTL);
+	writer[8] = (unsigned char)(record->rdlength >> 8);
+	writer[9] = (unsigned char)record->rdlength;
+	memcpy(writer + DNS_RR_FIXED_SIZE, record->rdata, record->rdlength);
+
+	(*count)++;
+	return len + rr_len;
+}
+
+// answer section for one (name, type): the name's records of that type, or its
+// CNAME followed by whatever the target has locally
+static size_t build_answer(const compile_ctx_t *ctx, size_t slot, uint16_t type,
+                           unsigned char *out, uint16_t *count)
+{
+	size_t len = 0;
+	*count = 0;
+
+	for (int hop = 0; hop <= DNS_LOCAL_MAX_CNAME_CHAIN; hop++)
+	{
+		const char *owner = ctx->table->names[slot].name;
+		const local_record_t *records = &ctx->list->items[ctx->start[slot]];
+		size_t num = ctx->num[slot];
+
+		// RFC 1034 section 3.6.2 — a CNAME owner has no other data, so it wins
+		const local_record_t *cname = NULL;
+		for (size_t i = 0; i < num && !cname; i++)
+		{
+			if (records[i].type == DNS_TYPE_CNAME)
+				cname = &records[i];
+		}
+
+		if (!cname)
+		{
+			for (size_t i = 0; i < num; i++)
+			{
+				if (records[i].type == type)
+					len = append_rr(out, len, hop, owner, &records[i], count);
+			}
+			break;
+		}
+
+		len = append_rr(out, len, hop, owner, cname, count);
+
+		// Target not local — the client's resolver follows the rest
+		dns_local_name_t *target = find_name(ctx->table, cname->target, cname->target_len,
+			cname->target_hash);
+		if (!target)
+			break;
+		slot = (size_t)(target - ctx->table->names);
+	}
+	return len;
+}
+
+static local_table_t *compile(record_list_t *list)
+{
+	size_t capacity = 16;
+	while (capacity < list->count * 2)
+		capacity <<= 1;
+
+	local_table_t *table = calloc(1, sizeof(local_table_t));
+	compile_ctx_t ctx = { table, list, calloc(capacity, sizeof(size_t)), calloc(capacity, sizeof(size_t)) };
+	if (table)
+		table->names = calloc(capacity, sizeof(dns_local_name_t));
+	if (!table || !table->names || !ctx.start || !ctx.num)
+	{
+		perror("Out of memory compiling local names");
+		free(ctx.start);
+		free(ctx.num);
+		if (table) free(table->names);
+		free(table);
+		return NULL;
+	}
+	table->mask = capacity - 1;
+	table->records = list->count;
+
+	// --- one slot per distinct owner ---
+	for (size_t i = 0; i < list->count; i++)
+	{
+		local_record_t *record = &list->items[i];
+		dns_local_name_t *name = find_name(table, record->name, record->len, record->hash);
+		if (!name)
+		{
+			size_t at = record->hash & table->mask;
+			while (table->names[at].len != 0)
+				at = (at + 1) & table->mask;
+			name = &table->names[at];
+			memcpy(name->name, record->name, record->len + 1);
+			name->len = record->len;
+			name->hash = record->hash;
+			table->count++;
+		}
+		record->slot = (size_t)(name - table->names);
+	}
+
+	// --- group each owner's records, then prebuild its answers ---
+	qsort(list->items, list->count, sizeof(local_record_t), compare_slot);
+	for (size_t i = list->count; i-- > 0; )
+	{
+		ctx.start[list->items[i].slot] = i;
+		ctx.num[list->items[i].slot]++;
+	}
+
+	unsigned char buffer[DNS_LOCAL_MAX_RECORDS_SIZE];
+	for (size_t slot = 0; slot < capacity; slot++)
+	{
+		if (table->names[slot].len == 0)
+			continue;
+
+		for (int kind = 0; kind < LOCAL_ANSWER_KINDS; kind++)
+		{
+			dns_local_answer_t *answer = &table->names[slot].answers[kind];
+			size_t len = build_answer(&ctx, slot, KIND_TYPES[kind], buffer, &answer->count);
+			if (len == 0)
+				continue;
+
+			answer->records = malloc(len);
+			if (!answer->records)
+			{
+				answer->count = 0;
+				continue;
+			}
+			memcpy(answer->records, buffer, len);
+			answer->len = (uint16_t)len;
+		}
+	}
+
+	free(ctx.start);
+	free(ctx.num);
+	return table;
+}
+
+static local_table_t *read_file(const char *filename)
+{
+	FILE *file = fopen(filename, "r");
+	if (!file)
+	{
+		perror("Could not open local names file");
+		return NULL;
+	}
+
+	record_list_t list = { NULL, 0, 0 };
+	char buffer[DNS_LOCAL_LINE_BUFFER];
+	int line_no = 0;
+	while (fgets(buffer, sizeof(buffer), file))
+	{
+		line_no++;
+		buffer[strcspn(buffer, "#\r\n")] = '\0';
+
+		char *start = buffer;
+		while (isspace((unsigned char)*start)) start++;
+		if (*start == '\0')
+			continue;
+
+		// A bad line contributes nothing, not half its names
+		size_t mark = list.count;
+		if (parse_line(start, &list) < 0)
+		{
+			list.count = mark;
+			fprintf(stderr, "%s:%d: expected \"ip name ...\", \"name CNAME target\" "
+				"or \"name PTR target\"\n", filename, line_no);
+		}
+	}
+	fclose(file);
+
+	local_table_t *table = compile(&list);
+	free(list.items);
+	return table;
+}
+
+static void install(local_table_t *table, const char *verb)
+{
+	pthread_rwlock_wrlock(&g_local_lock);
+	local_table_t *old = g_table;
+	g_table = table;
+	pthread_rwlock_unlock(&g_local_lock);
+
+	printf("[LAYER_7] [DNS] Local names %s: %zu names, %zu records\n",
+		verb, table->count, table->records);
+	table_free(old);
+}
+
+// ---------- PUBLIC API ----------
+
+int dns_local_load(const char *filename)
+{
+	// Stat before reading, so an edit landing mid-read triggers another reload
+	struct stat st;
+	if (stat(filename, &st) == 0)
+	{
+		g_mtime = st.st_mtim;
+		g_size = st.st_size;
+	}
+	g_path = filename;
+	build_soa();
+
+	local_table_t *table = read_file(filename);
+	if (!table)
+		return -1;
+
+	install(table, "loaded");
+	return (int)table->count;
+}
+
+void dns_local_reload_if_changed(void)
+{
+	struct stat st;
+	if (!g_path || stat(g_path, &st) < 0)
+		return; // file gone — keep serving what we have
+
+	if (st.st_mtim.tv_sec == g_mtime.tv_sec && st.st_mtim.tv_nsec == g_mtime.tv_nsec &&
+		st.st_size == g_size)
+		return;
+	g_mtime = st.st_mtim;
+	g_size = st.st_size;
+
+	local_table_t *table = read_file(g_path);
+	if (table)
+		install(table, "reloaded");
+}
+
+size_t dns_local_answer(const unsigned char *query, const dns_question_t *question,
+                        unsigned char *out, size_t out_size)
+{
+	if (question->qclass != DNS_CLASS_IN || question->qname.label_count == 0)
+		return 0;
+
+	int kind;
+	switch (question->qtype)
+	{
+		case DNS_TYPE_A:    kind = LOCAL_ANSWER_A;     break;
+		case DNS_TYPE_AAAA: kind = LOCAL_ANSWER_AAAA;  break;
+		case DNS_TYPE_PTR:  kind = LOCAL_ANSWER_PTR;   break;
+		default:            kind = LOCAL_ANSWER_OTHER; break;
+	}
+
+	size_t answer_len = 0;
+	pthread_rwlock_rdlock(&g_local_lock);
+
+	const dns_local_name_t *name = g_table ? find_name(g_table, question->qname.name,
+		question->qname.len, question->qname.suffix_hash[0]) : NULL;
+	const dns_local_answer_t *answer = name ? &name->answers[kind] : NULL;
+	bool nodata = answer && answer->count == 0;
+	if (answer && question->question_end + answer->len + (nodata ? g_soa_len : 0) <= out_size)
+	{
+		// --- client header + question, then the prebuilt records (or the SOA) ---
+		memcpy(out, query, question->question_end);
+		if (answer->len > 0)
+			memcpy(out + question->question_end, answer->records, answer->len);
+		answer_len = question->question_end + answer->len;
+		if (nodata)
+		{
+			memcpy(out + answer_len, g_soa_record, g_soa_len);
+			answer_len += g_soa_len;
+		}
+
+		// Authoritative: NOERROR with records, or NODATA for a type the name lacks
+		struct dns_hdr *header = (struct dns_hdr *)out;
+		uint16_t flags = ntohs(header->flags) & (DNS_FLAG_OPCODE | DNS_FLAG_RD);
+		header->flags = htons(flags | DNS_FLAG_QR | DNS_FLAG_AA | DNS_FLAG_RA);
+		header->qdcount = htons(1);
+		header->ancount = htons(answer->count);
+		header->nscount = htons(nodata ? 1 : 0);
+		header->arcount = 0;
+	}
+
+	pthread_rwlock_unlock(&g_local_lock);
+	return answer_len;
+}
+
+void dns_local_free(void)
+{
+	pthread_rwlock_wrlock(&g_local_lock);
+	table_free(g_table);
+	g_table = NULL;
+	pthread_rwlock_unlock(&g_local_lock);
+}
@@ -0,0 +1,66 @@
+#ifndef DNS_LOCAL_H
+#define DNS_LOCAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "dns.h"
+
+// TTL on local answers — short, so an edited file takes effect downstream quickly
+#define DNS_LOCAL_TTL               60
+// answer section of one prebuilt answer; keeps local answers well inside 512 bytes
+#define DNS_LOCAL_MAX_RECORDS_SIZE  448
+// CNAMEs followed inside the file before the chain is cut
+#define DNS_LOCAL_MAX_CNAME_CHAIN   8
+#define DNS_LOCAL_LINE_BUFFER       512
+
+// --- which prebuilt answer a QTYPE gets ---
+typedef enum {
+	LOCAL_ANSWER_A     = 0,
+	LOCAL_ANSWER_AAAA  = 1,
+	LOCAL_ANSWER_PTR   = 2,
+	LOCAL_ANSWER_OTHER = 3,   // CNAME if the name has one, NODATA otherwise
+	LOCAL_ANSWER_KINDS = 4,
+} dns_local_kind_t;
+
+// --- one prebuilt answer section ---
+// the first record's owner is a compression pointer to the question (0xC00C),
+// records of a chased CNAME target carry the target name in full
+typedef struct {
+	unsigned char *records;   // NULL with count 0 is a NODATA answer
+	uint16_t len;
+	uint16_t count;           // ANCOUNT
+} dns_local_answer_t;
+
+// --- one local name ---
+typedef struct {
+	char name[DOMAIN_NAME_SIZE];        // lowercased, no trailing dot
+	uint16_t len;                       // strlen(name), 0 marks an empty slot
+	uint32_t hash;                      // domain_hash() — a query's suffix_hash[0]
+	dns_local_answer_t answers[LOCAL_ANSWER_KINDS];
+} dns_local_name_t;
+
+// compiles a hosts-style file into the answer index:
+//   192.168.1.10  nas.lan nas      A/AAAA for every name, PTR back to the first
+//   media.lan     CNAME nas.lan
+//   192.168.1.1   PTR   router.lan (the owner may also be a reverse name)
+// '#' starts a comment; the file is remembered for dns_local_reload_if_changed()
+// returns the number of names loaded, -1 if the file can't be read
+int dns_local_load(const char *filename);
+
+// re-reads the file if its mtime or size changed since the last load
+// called from the maintenance thread; queries keep using the old index until
+// the new one is swapped in
+void dns_local_reload_if_changed(void);
+
+// assembles the local answer for a query into out:
+// client header + client question + the prebuilt answer section, AA set;
+// a NODATA answer carries an SOA in the authority section (RFC 2308)
+// returns bytes written, 0 if the name is not local (or out is too small)
+size_t dns_local_answer(const unsigned char *query, const dns_question_t *question,
+                        unsigned char *out, size_t out_size);
+
+void dns_local_free(void);
+
+#endif
@@ -1,21 +1,129 @@
 #define _POSIX_C_SOURCE 200809L
 #include "dns.h"
+#include "cache.h"
+#include "sinkhole.h"
+#include "ratelimit.h"
+#include "maintenance.h"
+#include "forward.h"
+#include "local.h"
 #include "../../common/blocklist.h"
 
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-b refused|nxdomain|null] [-l qps] [-r drop|tc|refused] "
+		"[-c snapshot|-c none] [-f zones_file] [-H hosts_file] [-p port] "
+		"[upstream_ip[:port]]\n", prog);
+}
+
+static void handle_signal(int sig)
+{
+	if (sig == SIGUSR1)
+		dns_maintenance_request_stats();
+	else
+		request_dns_server_stop();
+}
+
 int main(int argc, char *argv[])
 {
 	const char *upstream_ip = DNS_DEFAULT_UPSTREAM;
-	if (argc > 1) upstream_ip = argv[1];
+	dns_sinkhole_mode_t block_mode = DNS_SINKHOLE_DEFAULT_MODE;
+	unsigned rate_qps = DNS_RATELIMIT_DEFAULT_QPS;
+	dns_ratelimit_action_t rate_action = DNS_RATELIMIT_DEFAULT_ACTION;
+	const char *snapshot_path = DNS_CACHE_SNAPSHOT_PATH;
+	const char *zones_path = NULL;
+	const char *hosts_path = NULL;
+	uint16_t listen_port = DNS_PORT;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "b:l:r:c:f:H:p:")) != -1)
+	{
+		if (opt == 'c')
+		{
+			snapshot_path = (strcmp(optarg, "none") == 0) ? NULL : optarg;
+			continue;
+		}
+		if (opt == 'f')
+		{
+			zones_path = optarg;
+			continue;
+		}
+		if (opt == 'H')
+		{
+			hosts_path = optarg;
+			continue;
+		}
+		if (opt == 'b' && dns_sinkhole_parse_mode(optarg, &block_mode) == 0)
+			continue;
+		if (opt == 'l')
+		{
+			char *end;
+			unsigned long qps = strtoul(optarg, &end, 10);
+			if (*end == '\0' && qps <= 1000000)
+			{
+				rate_qps = (unsigned)qps;
+				continue;
+			}
+		}
+		if (opt == 'p')
+		{
+			// Unprivileged port for benchmarks and tests (see bench/)
+			char *end;
+			unsigned long port = strtoul(optarg, &end, 10);
+			if (*end == '\0' && port > 0 && port <= 65535)
+			{
+				listen_port = (uint16_t)port;
+				continue;
+			}
+		}
+		if (opt == 'r' && dns_ratelimit_parse_action(optarg, &rate_action) == 0)
+			continue;
+		usage(argv[0]);
+		return 1;
+	}
+	if (optind < argc) upstream_ip = argv[optind];
 
 	printf("[LAYER_7] [DNS] Loading blocklist...\n");
 	if (load_blocklist("../../hostnames/blocklist.txt") != 0)
 		return 1;
 
+	// Conditional forwarding: "lan 192.168.1.1" sends *.lan to the LAN resolver
+	if (zones_path && dns_forward_load(zones_path) < 0)
+		return 1;
+
+	// Local names (this Pi, printers, NAS) answered from memory, reloaded when edited
+	if (hosts_path && dns_local_load(hosts_path) < 0)
+		return 1;
+
 	printf("[LAYER_7] [DNS] Starting DNS proxy server...\n");
 	printf("[LAYER_7] [DNS] Upstream DNS: %s\n", upstream_ip);
 
-	start_dns_server(upstream_ip);
+	dns_sinkhole_init(block_mode);
+	dns_ratelimit_init(rate_qps, rate_action);
+
+	// Warm the cache before the listener binds so a restart doesn't cost hit rate
+	dns_cache_init();
+	if (snapshot_path)
+		dns_cache_load(snapshot_path);
+	dns_maintenance_start(snapshot_path);
+
+	// kill -USR1 <pid> prints cache and per-client counters, and the top-K sketches
+	signal(SIGUSR1, handle_signal);
+	signal(SIGINT, handle_signal);
+	signal(SIGTERM, handle_signal);
+
+	start_dns_server(upstream_ip, listen_port);
+
+	printf("[LAYER_7] [DNS] Shutting down...\n");
+	if (snapshot_path)
+	{
+		int saved = dns_cache_save(snapshot_path);
+		if (saved >= 0)
+			printf("[LAYER_7] [DNS] Cache snapshot: %d answers saved to %s\n", saved, snapshot_path);
+	}
 
+	dns_cache_cleanup();
+	dns_forward_free();
+	dns_local_free();
 	free_blocklist();
 	return 0;
 }
@@ -0,0 +1,69 @@
+#include <time.h>
+
+#include "maintenance.h"
+#include "cache.h"
+#include "ratelimit.h"
+#include "local.h"
+#include "topk.h"
+
+// set from signal context, consumed by the maintenance thread
+static volatile sig_atomic_t g_stats_requested = 0;
+
+static const char *g_snapshot_path = NULL;
+
+void dns_maintenance_request_stats(void)
+{
+	g_stats_requested = 1;
+}
+
+static void dump_stats(void)
+{
+	dns_cache_dump_stats(stdout);
+	dns_ratelimit_dump(stdout);
+	dns_topk_dump(stdout);
+	fflush(stdout);
+}
+
+static void* maintenance_worker(void *arg)
+{
+	(void)arg;
+	struct timespec tick = { DNS_MAINTENANCE_TICK_MS / 1000, (DNS_MAINTENANCE_TICK_MS % 1000) * 1000000L };
+	time_t last_snapshot = time(NULL);
+
+	while (1)
+	{
+		nanosleep(&tick, NULL);
+
+		// A crash or power cut loses at most one interval of warm cache
+		time_t now = time(NULL);
+		if (g_snapshot_path && now - last_snapshot >= DNS_CACHE_SNAPSHOT_INTERVAL)
+		{
+			last_snapshot = now;
+			dns_cache_save(g_snapshot_path);
+		}
+
+		// Picks up edits to the local names file within a tick
+		dns_local_reload_if_changed();
+
+		if (g_stats_requested)
+		{
+			g_stats_requested = 0;
+			dump_stats();
+		}
+	}
+	return NULL;
+}
+
+void dns_maintenance_start(const char *snapshot_path)
+{
+	g_snapshot_path = snapshot_path;
+
+	pthread_t thread_id;
+	int result = pthread_create(&thread_id, NULL, maintenance_worker, NULL);
+	if (result != 0)
+	{
+		fprintf(stderr, "Failed to start DNS maintenance thread: %s\n", strerror(result));
+		return;
+	}
+	pthread_detach(thread_id);
+}
@@ -0,0 +1,22 @@
+#ifndef DNS_MAINTENANCE_H
+#define DNS_MAINTENANCE_H
+
+#include <signal.h>
+
+#include "dns.h"
+
+// how often the maintenance thread wakes to look for work (milliseconds)
+#define DNS_MAINTENANCE_TICK_MS     1000
+
+// starts the background thread that does housekeeping off the query path:
+// stats dumps on request, reloads of an edited local names file, and a cache
+// snapshot to snapshot_path every DNS_CACHE_SNAPSHOT_INTERVAL seconds
+// (NULL disables snapshots)
+// call once before the listener starts
+void dns_maintenance_start(const char *snapshot_path);
+
+// async-signal-safe: flags a stats dump for the next maintenance tick
+// main.c wires this to SIGUSR1
+void dns_maintenance_request_stats(void);
+
+#endif
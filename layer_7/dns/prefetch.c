@@ -0,0 +1,165 @@
+#include <errno.h>
+#include <sys/random.h>
+
+#include "prefetch.h"
+#include "cache.h"
+#include "forward.h"
+#include "sinkhole.h"
+
+// --- refresh queue ---
+// receive loop pushes, the prefetch thread pops
+// access protected by g_prefetch_lock
+static dns_question_t g_queue[DNS_PREFETCH_QUEUE_SIZE];
+static size_t g_queue_head = 0;
+static size_t g_queue_count = 0;
+static pthread_mutex_t g_prefetch_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_prefetch_ready = PTHREAD_COND_INITIALIZER;
+
+static struct sockaddr_in g_upstream_addr;
+
+// --- token bucket ---
+// only touched by the prefetch thread, no locking needed
+static double g_tokens = DNS_PREFETCH_BURST;
+static struct timespec g_last_refill;
+
+static double elapsed_seconds(const struct timespec *from, const struct timespec *to)
+{
+	return (double)(to->tv_sec - from->tv_sec) +
+		(double)(to->tv_nsec - from->tv_nsec) / 1e9;
+}
+
+// blocks until one refresh token is available, then spends it
+static void take_token(void)
+{
+	while (1)
+	{
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		g_tokens += elapsed_seconds(&g_last_refill, &now) * DNS_PREFETCH_RATE;
+		if (g_tokens > DNS_PREFETCH_BURST) g_tokens = DNS_PREFETCH_BURST;
+		g_last_refill = now;
+
+		if (g_tokens >= 1.0)
+		{
+			g_tokens -= 1.0;
+			return;
+		}
+
+		// Sleep just long enough for the next token to drip in
+		double wait = (1.0 - g_tokens) / DNS_PREFETCH_RATE;
+		struct timespec pause = { (time_t)wait, (long)((wait - (time_t)wait) * 1e9) };
+		nanosleep(&pause, NULL);
+	}
+}
+
+// resolves one question upstream and writes the answer back to the cache
+static void refresh_question(const dns_question_t *question)
+{
+	uint16_t id = 0;
+	if (getrandom(&id, sizeof(id), 0) != sizeof(id))
+		id = (uint16_t)rand();
+
+	unsigned char query[DNS_BUFFER_SIZE];
+	size_t query_len = dns_build_query(question, id, query, sizeof(query));
+	if (query_len == 0)
+		return;
+
+	int upstream_socket = socket(AF_INET, SOCK_DGRAM, 0);
+	if (upstream_socket < 0)
+	{
+		perror("Prefetch socket failed");
+		return;
+	}
+
+	// Refresh from the same server the query was forwarded to
+	struct sockaddr_in upstream_addr = g_upstream_addr;
+	dns_forward_route(&question->qname, &upstream_addr);
+
+	if (connect(upstream_socket, (struct sockaddr *)&upstream_addr, sizeof(upstream_addr)) < 0 ||
+		send(upstream_socket, query, query_len, 0) < 0)
+	{
+		perror("Prefetch send failed");
+		close(upstream_socket);
+		return;
+	}
+
+	unsigned char response[UPSTREAM_BUFFER_SIZE];
+	ssize_t response_size = recv_with_timeout(upstream_socket, response, sizeof(response),
+		0, NULL, NULL, DNS_PREFETCH_TIMEOUT_MS);
+	close(upstream_socket);
+
+	dns_response_info_t info;
+	if (response_size > 0 &&
+		dns_response_matches(response, (size_t)response_size, query, question) &&
+		dns_inspect_response(response, (size_t)response_size, question, &info) == 0)
+	{
+		// The chain may have moved onto a blocked name since the entry was cached
+		if (info.blocked)
+		{
+			log_dns_decision("BLOCKED (CNAME)", info.blocked_name, NULL);
+			response_size = (ssize_t)dns_sinkhole_answer(query, question, response, sizeof(response));
+			if (response_size == 0 ||
+				dns_inspect_response(response, (size_t)response_size, question, &info) < 0)
+				return;
+		}
+
+		dns_cache_store(question, response, (size_t)response_size, &info);
+		log_dns_decision("PREFETCH", question->qname.name, NULL);
+	}
+}
+
+static void* prefetch_worker(void *arg)
+{
+	(void)arg;
+
+	while (1)
+	{
+		// --- wait for work ---
+		pthread_mutex_lock(&g_prefetch_lock);
+		while (g_queue_count == 0)
+			pthread_cond_wait(&g_prefetch_ready, &g_prefetch_lock);
+
+		dns_question_t question = g_queue[g_queue_head];
+		g_queue_head = (g_queue_head + 1) % DNS_PREFETCH_QUEUE_SIZE;
+		g_queue_count--;
+		pthread_mutex_unlock(&g_prefetch_lock);
+
+		// --- one refresh at a time, rate limited ---
+		take_token();
+		refresh_question(&question);
+	}
+	return NULL;
+}
+
+void dns_prefetch_start(const struct sockaddr_in *upstream_addr)
+{
+	g_upstream_addr = *upstream_addr;
+	clock_gettime(CLOCK_MONOTONIC, &g_last_refill);
+
+	pthread_t thread_id;
+	int result = pthread_create(&thread_id, NULL, prefetch_worker, NULL);
+	if (result != 0)
+	{
+		fprintf(stderr, "Failed to start DNS prefetch thread: %s\n", strerror(result));
+		return;
+	}
+	pthread_detach(thread_id);
+}
+
+bool dns_prefetch_schedule(const dns_question_t *question)
+{
+	bool queued = false;
+
+	pthread_mutex_lock(&g_prefetch_lock);
+	if (g_queue_count < DNS_PREFETCH_QUEUE_SIZE)
+	{
+		size_t tail = (g_queue_head + g_queue_count) % DNS_PREFETCH_QUEUE_SIZE;
+		g_queue[tail] = *question;
+		g_queue_count++;
+		queued = true;
+		pthread_cond_signal(&g_prefetch_ready);
+	}
+	pthread_mutex_unlock(&g_prefetch_lock);
+
+	return queued;
+}
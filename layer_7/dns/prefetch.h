@@ -0,0 +1,27 @@
+#ifndef DNS_PREFETCH_H
+#define DNS_PREFETCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "dns.h"
+
+// pending refreshes waiting for the prefetch thread — extras are dropped
+#define DNS_PREFETCH_QUEUE_SIZE     128
+// token bucket: sustained refreshes per second and burst allowance
+// kept well below live query rates so refreshes never crowd them out
+#define DNS_PREFETCH_RATE           10
+#define DNS_PREFETCH_BURST          20
+// upstream timeout for one refresh (ms)
+#define DNS_PREFETCH_TIMEOUT_MS     2000
+
+// starts the background prefetch thread
+// refreshed answers are sent to upstream_addr and written back to the cache
+void dns_prefetch_start(const struct sockaddr_in *upstream_addr);
+
+// queues a background refresh of question — never blocks
+// returns false if the queue is full (refresh dropped)
+bool dns_prefetch_schedule(const dns_question_t *question);
+
+#endif
@@ -0,0 +1,189 @@
+#include <time.h>
+#include <strings.h>
+
+#include "ratelimit.h"
+
+// --- global client table ---
+// touched by the UDP receive loop and the TCP listener
+// access protected by g_ratelimit_lock
+static dns_ratelimit_entry_t g_clients[DNS_RATELIMIT_SLOTS];
+static pthread_mutex_t g_ratelimit_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static float g_rate = DNS_RATELIMIT_DEFAULT_QPS;
+static float g_burst = DNS_RATELIMIT_DEFAULT_QPS * DNS_RATELIMIT_BURST_FACTOR;
+static dns_ratelimit_action_t g_action = DNS_RATELIMIT_DEFAULT_ACTION;
+
+static unsigned long g_evictions = 0;
+
+static long long now_ms(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+int dns_ratelimit_parse_action(const char *name, dns_ratelimit_action_t *action)
+{
+	if (strcasecmp(name, "drop") == 0)         *action = RATELIMIT_DROP;
+	else if (strcasecmp(name, "tc") == 0)      *action = RATELIMIT_TRUNCATE;
+	else if (strcasecmp(name, "refused") == 0) *action = RATELIMIT_REFUSED;
+	else return -1;
+	return 0;
+}
+
+void dns_ratelimit_init(unsigned qps, dns_ratelimit_action_t action)
+{
+	g_rate = (float)qps;
+	g_burst = (float)qps * DNS_RATELIMIT_BURST_FACTOR;
+	g_action = action;
+
+	if (qps == 0)
+		printf("[LAYER_7] [DNS] Per-client rate limit: off\n");
+	else
+		printf("[LAYER_7] [DNS] Per-client rate limit: %u qps, burst %u\n",
+			qps, qps * DNS_RATELIMIT_BURST_FACTOR);
+}
+
+// caller must hold g_ratelimit_lock
+// finds the client's slot among its ways, or claims the emptiest / stalest one
+static dns_ratelimit_entry_t *find_client(uint32_t ip, long long now)
+{
+	// FNV-1a over the four bytes, as for the top-K clients: every octet
+	// reaches the low bits, so the hosts of one /24 spread over the table
+	uint32_t home = domain_hash((const char *)&ip, sizeof(ip)) & (DNS_RATELIMIT_SLOTS - 1);
+	dns_ratelimit_entry_t *victim = NULL;
+
+	for (uint32_t way = 0; way < DNS_RATELIMIT_WAYS; way++)
+	{
+		dns_ratelimit_entry_t *entry = &g_clients[(home + way) & (DNS_RATELIMIT_SLOTS - 1)];
+		if (entry->ip == ip)
+			return entry;
+		if (entry->ip == 0)
+		{
+			if (!victim || victim->ip != 0) victim = entry;
+		}
+		else if (!victim || (victim->ip != 0 && entry->last_ms < victim->last_ms))
+			victim = entry;
+	}
+
+	if (victim->ip != 0)
+		g_evictions++;
+
+	// New clients start with a full bucket
+	memset(victim, 0, sizeof(*victim));
+	victim->ip = ip;
+	victim->tokens = g_burst;
+	victim->last_ms = now;
+	return victim;
+}
+
+bool dns_ratelimit_allow(const struct sockaddr_in *client_addr)
+{
+	if (g_rate <= 0)
+		return true;
+
+	uint32_t ip = client_addr->sin_addr.s_addr;
+	if (ip == 0)
+		return false;
+
+	long long now = now_ms();
+	bool allowed;
+	bool first_limited = false;
+
+	pthread_mutex_lock(&g_ratelimit_lock);
+	dns_ratelimit_entry_t *entry = find_client(ip, now);
+
+	// Lazy refill — only clients that actually send pay for the arithmetic
+	entry->tokens += (float)(now - entry->last_ms) * g_rate / 1000.0f;
+	if (entry->tokens > g_burst) entry->tokens = g_burst;
+	entry->last_ms = now;
+
+	allowed = entry->tokens >= 1.0f;
+	if (allowed)
+	{
+		entry->tokens -= 1.0f;
+		entry->allowed++;
+		entry->limited = false;
+	}
+	else
+	{
+		entry->limited_count++;
+		first_limited = !entry->limited;
+		entry->limited = true;
+	}
+	pthread_mutex_unlock(&g_ratelimit_lock);
+
+	// One log line per episode, not per packet — a flood must not become a log flood
+	if (first_limited)
+		log_dns_decision("RATELIMITED", "-", client_addr);
+	return allowed;
+}
+
+size_t dns_ratelimit_answer(const unsigned char *query, size_t query_len, bool tcp,
+                            unsigned char *out, size_t out_size)
+{
+	if (g_action == RATELIMIT_DROP)
+		return 0;
+
+	// Only the first question is echoed — no full parse on the limited path
+	int name_end = dns_skip_name(query, query_len, sizeof(struct dns_hdr));
+	if (name_end < 0 || (size_t)name_end + 4 > query_len || (size_t)name_end + 4 > out_size)
+		return 0;
+
+	size_t answer_len = (size_t)name_end + 4;
+	memcpy(out, query, answer_len);
+
+	struct dns_hdr *header = (struct dns_hdr *)out;
+	uint16_t flags = (ntohs(header->flags) & (DNS_FLAG_OPCODE | DNS_FLAG_RD)) | DNS_FLAG_QR;
+	if (g_action == RATELIMIT_TRUNCATE && !tcp)
+		flags |= DNS_FLAG_TC;
+	else
+		flags |= DNS_RCODE_REFUSED;
+
+	header->flags = htons(flags);
+	header->qdcount = htons(1);
+	header->ancount = 0;
+	header->nscount = 0;
+	header->arcount = 0;
+	return answer_len;
+}
+
+static int compare_busiest(const void *a, const void *b)
+{
+	const dns_ratelimit_entry_t *x = (const dns_ratelimit_entry_t *)a;
+	const dns_ratelimit_entry_t *y = (const dns_ratelimit_entry_t *)b;
+	uint64_t total_x = x->allowed + x->limited_count;
+	uint64_t total_y = y->allowed + y->limited_count;
+	return (total_x < total_y) - (total_x > total_y);
+}
+
+void dns_ratelimit_dump(FILE *out)
+{
+	// Snapshot under the lock, sort and print outside it
+	static dns_ratelimit_entry_t snapshot[DNS_RATELIMIT_SLOTS];
+	size_t count = 0;
+	unsigned long evictions;
+
+	pthread_mutex_lock(&g_ratelimit_lock);
+	for (size_t i = 0; i < DNS_RATELIMIT_SLOTS; i++)
+	{
+		if (g_clients[i].ip != 0)
+			snapshot[count++] = g_clients[i];
+	}
+	evictions = g_evictions;
+	pthread_mutex_unlock(&g_ratelimit_lock);
+
+	qsort(snapshot, count, sizeof(snapshot[0]), compare_busiest);
+
+	fprintf(out, "[LAYER_7] [DNS] [STATS] clients tracked=%zu evicted=%lu\n", count, evictions);
+	for (size_t i = 0; i < count && i < DNS_RATELIMIT_DUMP_TOP; i++)
+	{
+		char ip[INET_ADDRSTRLEN];
+		struct in_addr addr = { .s_addr = snapshot[i].ip };
+		inet_ntop(AF_INET, &addr, ip, sizeof(ip));
+		fprintf(out, "[LAYER_7] [DNS] [STATS] client=%s allowed=%llu limited=%llu%s\n",
+			ip, (unsigned long long)snapshot[i].allowed,
+			(unsigned long long)snapshot[i].limited_count,
+			snapshot[i].limited ? " (limited now)" : "");
+	}
+}
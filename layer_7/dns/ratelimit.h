@@ -0,0 +1,67 @@
+#ifndef DNS_RATELIMIT_H
+#define DNS_RATELIMIT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#include "dns.h"
+
+// --- table sizing ---
+// fixed number of tracked client IPs (power of two) — never grows, so a
+// spoofed-source flood can cost at most this much memory
+#define DNS_RATELIMIT_SLOTS         4096
+// slots probed per client; a new client evicts the stalest of these
+#define DNS_RATELIMIT_WAYS          4
+
+// --- default policy ---
+#define DNS_RATELIMIT_DEFAULT_QPS   50     // sustained queries per second per client IP
+#define DNS_RATELIMIT_BURST_FACTOR  4      // bucket depth = qps * factor
+
+// clients listed by the SIGUSR1 stats dump, busiest first
+#define DNS_RATELIMIT_DUMP_TOP      32
+
+// --- what an over-limit query gets ---
+typedef enum {
+	RATELIMIT_DROP     = 0,   // silence — costs nothing, client times out
+	RATELIMIT_TRUNCATE = 1,   // TC=1, no records: real clients retry over TCP, spoofed ones gain nothing
+	RATELIMIT_REFUSED  = 2,   // RCODE=5, no records
+} dns_ratelimit_action_t;
+
+#define DNS_RATELIMIT_DEFAULT_ACTION RATELIMIT_TRUNCATE
+
+// --- one tracked client ---
+typedef struct {
+	uint32_t ip;              // network byte order, 0 marks an empty slot
+	float tokens;             // queries the client may still send right now
+	long long last_ms;        // last refill (CLOCK_MONOTONIC), also the eviction age
+	bool limited;             // currently over its limit — logged once per episode
+	uint64_t allowed;         // queries let through
+	uint64_t limited_count;   // queries dropped or answered short
+} dns_ratelimit_entry_t;
+
+// parses "drop" / "tc" / "refused"
+// returns 0 and sets *action on success, -1 if the name is unknown
+int dns_ratelimit_parse_action(const char *name, dns_ratelimit_action_t *action);
+
+// sets the per-client rate and the over-limit action; qps 0 disables limiting
+// call once at startup before the listeners start
+void dns_ratelimit_init(unsigned qps, dns_ratelimit_action_t action);
+
+// charges one query to the client's bucket, refilling it lazily first
+// returns true if the query may proceed
+bool dns_ratelimit_allow(const struct sockaddr_in *client_addr);
+
+// builds the short answer for a query that was not allowed into out:
+// client header + question, TC=1 or RCODE=REFUSED, no records
+// returns bytes written, 0 if the action is RATELIMIT_DROP or the query is malformed
+// tcp: TC means nothing to a TCP client, so it gets REFUSED instead
+size_t dns_ratelimit_answer(const unsigned char *query, size_t query_len, bool tcp,
+                            unsigned char *out, size_t out_size);
+
+// prints the busiest clients and their counters
+void dns_ratelimit_dump(FILE *out);
+
+#endif
@@ -0,0 +1,119 @@
+#include <strings.h>
+
+#include "sinkhole.h"
+
+// --- prebuilt answer records ---
+// built once by dns_sinkhole_init(), read-only afterwards, no locking required
+// every record's owner is a compression pointer to the question name (0xC00C)
+static dns_sinkhole_mode_t g_mode = DNS_SINKHOLE_DEFAULT_MODE;
+static unsigned char g_soa_record[96];
+static size_t g_soa_len = 0;
+static unsigned char g_a_record[DNS_RR_FIXED_SIZE + 2 + 4];
+static unsigned char g_aaaa_record[DNS_RR_FIXED_SIZE + 2 + 16];
+
+// SOA MNAME / RNAME of the synthetic zone: pi-blocker. / blocked.pi-blocker.
+static const unsigned char SINKHOLE_MNAME[] = "\x0api-blocker";
+static const unsigned char SINKHOLE_RNAME[] = "\x07" "blocked" "\x0api-blocker";
+
+// writes owner pointer + TYPE, CLASS, TTL, RDLENGTH; returns bytes written
+static size_t write_rr_header(unsigned char *out, uint16_t type, uint16_t rdlength)
+{
+	out[0] = JUMP_HEX_VALUE;
+	out[1] = sizeof(struct dns_hdr);
+	out[2] = (unsigned char)(type >> 8);
+	out[3] = (unsigned char)type;
+	out[4] = 0;
+	out[5] = DNS_CLASS_IN;
+	dns_write_u32(out + 6, DNS_SINKHOLE_TTL);
+	out[10] = (unsigned char)(rdlength >> 8);
+	out[11] = (unsigned char)rdlength;
+	return DNS_RR_FIXED_SIZE + 2;
+}
+
+int dns_sinkhole_parse_mode(const char *name, dns_sinkhole_mode_t *mode)
+{
+	if (strcasecmp(name, "refused") == 0)       *mode = SINKHOLE_REFUSED;
+	else if (strcasecmp(name, "nxdomain") == 0) *mode = SINKHOLE_NXDOMAIN;
+	else if (strcasecmp(name, "null") == 0)     *mode = SINKHOLE_NULL;
+	else return -1;
+	return 0;
+}
+
+void dns_sinkhole_init(dns_sinkhole_mode_t mode)
+{
+	g_mode = mode;
+
+	// --- SOA: names (sizeof includes the root label's 0) + 5 x 32-bit fields ---
+	size_t rdlength = sizeof(SINKHOLE_MNAME) + sizeof(SINKHOLE_RNAME) + 20;
+	unsigned char *writer = g_soa_record + write_rr_header(g_soa_record, DNS_TYPE_SOA, (uint16_t)rdlength);
+	memcpy(writer, SINKHOLE_MNAME, sizeof(SINKHOLE_MNAME));
+	writer += sizeof(SINKHOLE_MNAME);
+	memcpy(writer, SINKHOLE_RNAME, sizeof(SINKHOLE_RNAME));
+	writer += sizeof(SINKHOLE_RNAME);
+	dns_write_u32(writer, 1);                   // SERIAL
+	dns_write_u32(writer + 4, 3600);            // REFRESH
+	dns_write_u32(writer + 8, 600);             // RETRY
+	dns_write_u32(writer + 12, 86400);          // EXPIRE
+	dns_write_u32(writer + 16, DNS_SINKHOLE_TTL); // MINIMUM — the negative TTL
+	writer += 20;
+	g_soa_len = (size_t)(writer - g_soa_record);
+
+	// --- A 0.0.0.0 / AAAA :: ---
+	size_t a_header = write_rr_header(g_a_record, DNS_TYPE_A, 4);
+	memset(g_a_record + a_header, 0, 4);
+	size_t aaaa_header = write_rr_header(g_aaaa_record, DNS_TYPE_AAAA, 16);
+	memset(g_aaaa_record + aaaa_header, 0, 16);
+}
+
+size_t dns_sinkhole_answer(const unsigned char *query, const dns_question_t *question,
+                           unsigned char *out, size_t out_size)
+{
+	// --- pick the record and section for this query ---
+	const unsigned char *record = NULL;
+	size_t record_len = 0;
+	uint16_t rcode = DNS_RCODE_NOERROR;
+	bool in_answer = false;
+
+	if (g_mode == SINKHOLE_REFUSED)
+		rcode = DNS_RCODE_REFUSED;
+	else if (g_mode == SINKHOLE_NULL && question->qclass == DNS_CLASS_IN &&
+		question->qtype == DNS_TYPE_A)
+	{
+		record = g_a_record;
+		record_len = sizeof(g_a_record);
+		in_answer = true;
+	}
+	else if (g_mode == SINKHOLE_NULL && question->qclass == DNS_CLASS_IN &&
+		question->qtype == DNS_TYPE_AAAA)
+	{
+		record = g_aaaa_record;
+		record_len = sizeof(g_aaaa_record);
+		in_answer = true;
+	}
+	else
+	{
+		// NXDOMAIN, or NODATA for other types in null mode — SOA in authority
+		rcode = (g_mode == SINKHOLE_NXDOMAIN) ? DNS_RCODE_NXDOMAIN : DNS_RCODE_NOERROR;
+		record = g_soa_record;
+		record_len = g_soa_len;
+	}
+
+	size_t answer_len = question->question_end + record_len;
+	if (answer_len > out_size)
+		return 0;
+
+	// --- client header + question, then the prebuilt record ---
+	memcpy(out, query, question->question_end);
+	if (record_len > 0)
+		memcpy(out + question->question_end, record, record_len);
+
+	struct dns_hdr *header = (struct dns_hdr *)out;
+	uint16_t flags = ntohs(header->flags) & (DNS_FLAG_OPCODE | DNS_FLAG_RD);
+	header->flags = htons(flags | DNS_FLAG_QR | DNS_FLAG_RA | rcode);
+	header->qdcount = htons(1);
+	header->ancount = htons(in_answer ? 1 : 0);
+	header->nscount = htons((!in_answer && record_len > 0) ? 1 : 0);
+	header->arcount = 0;
+
+	return answer_len;
+}
@@ -0,0 +1,36 @@
+#ifndef DNS_SINKHOLE_H
+#define DNS_SINKHOLE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "dns.h"
+
+// --- block response modes ---
+typedef enum {
+	SINKHOLE_REFUSED  = 0,   // legacy: echo the query back with RCODE=5
+	SINKHOLE_NXDOMAIN = 1,   // RCODE=3 + synthetic SOA so clients negatively cache it
+	SINKHOLE_NULL     = 2,   // A → 0.0.0.0, AAAA → ::, anything else NODATA + SOA
+} dns_sinkhole_mode_t;
+
+#define DNS_SINKHOLE_DEFAULT_MODE   SINKHOLE_NXDOMAIN
+
+// TTL on synthesized records — also the SOA MINIMUM, so it is the
+// negative-cache lifetime clients apply (RFC 2308 section 5)
+#define DNS_SINKHOLE_TTL            300
+
+// parses "refused" / "nxdomain" / "null"
+// returns 0 and sets *mode on success, -1 if the name is unknown
+int dns_sinkhole_parse_mode(const char *name, dns_sinkhole_mode_t *mode);
+
+// prebuilds the wire-format SOA / A / AAAA records for the chosen mode
+// call once at startup before the listener starts
+void dns_sinkhole_init(dns_sinkhole_mode_t mode);
+
+// assembles the block answer for a query into out:
+// client header + client question + one prebuilt record, no allocation
+// returns bytes written, 0 if out is too small
+size_t dns_sinkhole_answer(const unsigned char *query, const dns_question_t *question,
+                           unsigned char *out, size_t out_size);
+
+#endif
@@ -0,0 +1,370 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+
+#include "tcp.h"
+#include "cache.h"
+
+// --- listener state ---
+// only the listener thread touches these
+static dns_tcp_conn_t *g_conns[DNS_TCP_MAX_CONNECTIONS];
+static size_t g_conn_count = 0;
+static int g_listen_fd = -1;
+static int g_wake_fd = -1;      // workers poke this when a reply is left queued
+static struct sockaddr_in g_upstream_addr;
+
+static long long now_ms(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static int set_nonblocking(int fd)
+{
+	int flags = fcntl(fd, F_GETFL, 0);
+	return (flags < 0) ? -1 : fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+// caller must hold conn->lock
+// appends bytes the socket would not take, growing the queue up to the cap
+static bool queue_out(dns_tcp_conn_t *conn, const unsigned char *data, size_t len)
+{
+	if (conn->out_len + len > DNS_TCP_MAX_PENDING_OUT)
+		return false;
+
+	if (conn->out_len + len > conn->out_cap)
+	{
+		size_t cap = conn->out_cap ? conn->out_cap : 4096;
+		while (cap < conn->out_len + len)
+			cap *= 2;
+		unsigned char *grown = realloc(conn->out, cap);
+		if (!grown)
+			return false;
+		conn->out = grown;
+		conn->out_cap = cap;
+	}
+
+	memcpy(conn->out + conn->out_len, data, len);
+	conn->out_len += len;
+	return true;
+}
+
+// caller must hold conn->lock
+// marks the connection dead; the listener notices on its next pass
+static void abort_conn(dns_tcp_conn_t *conn)
+{
+	conn->closed = true;
+	shutdown(conn->fd, SHUT_RDWR);
+}
+
+void dns_tcp_send(dns_tcp_conn_t *conn, const unsigned char *message, size_t message_len)
+{
+	if (message_len > UINT16_MAX)
+		return;
+
+	unsigned char prefix[2] = { (unsigned char)(message_len >> 8), (unsigned char)message_len };
+	bool wake = false;
+
+	pthread_mutex_lock(&conn->lock);
+	if (conn->closed)
+	{
+		pthread_mutex_unlock(&conn->lock);
+		return;
+	}
+
+	// Nothing queued ahead of us — try to hand the whole frame to the kernel now
+	size_t sent = 0;
+	if (conn->out_len == 0)
+	{
+		struct iovec iov[2] = {
+			{ prefix, sizeof(prefix) },
+			{ (void *)message, message_len },
+		};
+		struct msghdr msg = { .msg_iov = iov, .msg_iovlen = 2 };
+		ssize_t n = sendmsg(conn->fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (n > 0)
+			sent = (size_t)n;
+		else if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+		{
+			abort_conn(conn);
+			pthread_mutex_unlock(&conn->lock);
+			return;
+		}
+	}
+
+	// Keep whatever is left for the listener to flush on POLLOUT
+	size_t total = sizeof(prefix) + message_len;
+	if (sent < total)
+	{
+		bool ok = true;
+		if (sent < sizeof(prefix))
+			ok = queue_out(conn, prefix + sent, sizeof(prefix) - sent);
+		size_t body_off = (sent > sizeof(prefix)) ? sent - sizeof(prefix) : 0;
+		if (ok)
+			ok = queue_out(conn, message + body_off, message_len - body_off);
+		if (!ok)
+			abort_conn(conn); // slow reader — don't let it pin unbounded memory
+		wake = true;
+	}
+	pthread_mutex_unlock(&conn->lock);
+
+	if (wake)
+	{
+		uint64_t one = 1;
+		if (write(g_wake_fd, &one, sizeof(one)) < 0) { /* already pending */ }
+	}
+}
+
+void dns_tcp_hold(dns_tcp_conn_t *conn)
+{
+	pthread_mutex_lock(&conn->lock);
+	conn->refs++;
+	pthread_mutex_unlock(&conn->lock);
+}
+
+void dns_tcp_release(dns_tcp_conn_t *conn)
+{
+	pthread_mutex_lock(&conn->lock);
+	int refs = --conn->refs;
+	pthread_mutex_unlock(&conn->lock);
+
+	if (refs > 0)
+		return;
+
+	close(conn->fd);
+	pthread_mutex_destroy(&conn->lock);
+	free(conn->out);
+	free(conn);
+}
+
+// ---------- LISTENER THREAD ----------
+
+// drops the listener's reference; late replies are discarded by dns_tcp_send
+static void drop_conn(size_t index)
+{
+	dns_tcp_conn_t *conn = g_conns[index];
+	g_conns[index] = g_conns[--g_conn_count];
+
+	pthread_mutex_lock(&conn->lock);
+	abort_conn(conn);
+	pthread_mutex_unlock(&conn->lock);
+	dns_tcp_release(conn);
+}
+
+static void accept_conns(void)
+{
+	while (1)
+	{
+		struct sockaddr_in addr;
+		socklen_t addr_len = sizeof(addr);
+		int fd = accept(g_listen_fd, (struct sockaddr *)&addr, &addr_len);
+		if (fd < 0)
+			return; // EAGAIN — backlog drained
+
+		dns_tcp_conn_t *conn = NULL;
+		if (g_conn_count < DNS_TCP_MAX_CONNECTIONS && set_nonblocking(fd) == 0)
+			conn = calloc(1, sizeof(dns_tcp_conn_t));
+		if (!conn)
+		{
+			close(fd);
+			continue;
+		}
+
+		conn->fd = fd;
+		conn->addr = addr;
+		conn->refs = 1;
+		conn->last_active_ms = now_ms();
+		pthread_mutex_init(&conn->lock, NULL);
+		g_conns[g_conn_count++] = conn;
+	}
+}
+
+// reads what is available and dispatches every complete query in the buffer
+// returns false if the connection should be dropped
+static bool read_queries(dns_tcp_conn_t *conn, unsigned char *scratch, size_t scratch_size)
+{
+	ssize_t n = recv(conn->fd, conn->in + conn->in_len, sizeof(conn->in) - conn->in_len, 0);
+	if (n == 0)
+	{
+		conn->read_closed = true; // half-close — still owe answers for what was read
+		return true;
+	}
+	if (n < 0)
+		return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+
+	conn->in_len += (size_t)n;
+	conn->last_active_ms = now_ms();
+
+	dns_client_t client = {
+		.socket = -1,
+		.addr = conn->addr,
+		.max_payload = UINT16_MAX,
+		.tcp = conn,
+	};
+
+	// Pipelined queries: several may have arrived in one read
+	size_t pos = 0;
+	while (conn->in_len - pos >= 2)
+	{
+		size_t message_len = dns_read_u16(conn->in + pos);
+		if (message_len < sizeof(struct dns_hdr) || message_len > DNS_BUFFER_SIZE)
+			return false; // no legitimate query looks like this
+
+		if (conn->in_len - pos < 2 + message_len)
+			break;
+
+		dns_dispatch_query(&client, conn->in + pos + 2, message_len,
+			&g_upstream_addr, scratch, scratch_size);
+		pos += 2 + message_len;
+	}
+
+	// Keep the partial query at the front for the next read
+	memmove(conn->in, conn->in + pos, conn->in_len - pos);
+	conn->in_len -= pos;
+	return true;
+}
+
+// pushes queued replies out; returns false if the connection broke
+static bool flush_out(dns_tcp_conn_t *conn)
+{
+	bool ok = true;
+	pthread_mutex_lock(&conn->lock);
+	if (conn->out_len > 0)
+	{
+		ssize_t n = send(conn->fd, conn->out, conn->out_len, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (n > 0)
+		{
+			memmove(conn->out, conn->out + n, conn->out_len - (size_t)n);
+			conn->out_len -= (size_t)n;
+		}
+		else if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+			ok = false;
+	}
+	pthread_mutex_unlock(&conn->lock);
+	return ok;
+}
+
+static void* tcp_listener(void *arg)
+{
+	(void)arg;
+
+	struct pollfd fds[2 + DNS_TCP_MAX_CONNECTIONS];
+	static unsigned char scratch[DNS_CACHE_MAX_RESPONSE];
+
+	while (1)
+	{
+		// --- build the poll set: listener, wake fd, then every connection ---
+		fds[0] = (struct pollfd){ .fd = g_listen_fd, .events = POLLIN };
+		fds[1] = (struct pollfd){ .fd = g_wake_fd, .events = POLLIN };
+		size_t polled = g_conn_count;
+		for (size_t i = 0; i < polled; i++)
+		{
+			dns_tcp_conn_t *conn = g_conns[i];
+			pthread_mutex_lock(&conn->lock);
+			short events = (conn->closed || conn->read_closed) ? 0 : POLLIN;
+			if (conn->out_len > 0) events |= POLLOUT;
+			pthread_mutex_unlock(&conn->lock);
+			fds[2 + i] = (struct pollfd){ .fd = conn->fd, .events = events };
+		}
+
+		if (poll(fds, 2 + polled, 1000) < 0)
+		{
+			if (errno != EINTR)
+				perror("DNS TCP poll error");
+			continue;
+		}
+
+		if (fds[1].revents & POLLIN)
+		{
+			uint64_t drained;
+			if (read(g_wake_fd, &drained, sizeof(drained)) < 0) { /* spurious wake */ }
+		}
+
+		// --- connections, walked backwards so drop_conn can swap-remove ---
+		long long now = now_ms();
+		for (size_t i = polled; i-- > 0; )
+		{
+			dns_tcp_conn_t *conn = g_conns[i];
+			short revents = fds[2 + i].revents;
+			bool keep = true;
+
+			if (revents & POLLOUT)
+				keep = flush_out(conn);
+			if (keep && (revents & POLLIN))
+				keep = read_queries(conn, scratch, sizeof(scratch));
+			if (keep && (revents & (POLLERR | POLLNVAL | POLLHUP)))
+				keep = false;
+
+			// Idle: nothing outstanding and nothing left to send
+			if (keep)
+			{
+				pthread_mutex_lock(&conn->lock);
+				bool idle = conn->refs == 1 && conn->out_len == 0;
+				keep = !conn->closed && !(idle && (conn->read_closed ||
+					now - conn->last_active_ms >= DNS_TCP_IDLE_TIMEOUT_MS));
+				pthread_mutex_unlock(&conn->lock);
+			}
+
+			if (!keep)
+				drop_conn(i);
+		}
+
+		if (fds[0].revents & POLLIN)
+			accept_conns();
+	}
+	return NULL;
+}
+
+void dns_tcp_start(const struct sockaddr_in *upstream_addr, uint16_t listen_port)
+{
+	g_upstream_addr = *upstream_addr;
+
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0)
+	{
+		perror("DNS TCP socket failed");
+		return;
+	}
+
+	int reuse = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+	struct sockaddr_in server_addr;
+	memset(&server_addr, 0, sizeof(server_addr));
+	server_addr.sin_family = AF_INET;
+	server_addr.sin_port = htons(listen_port);
+	server_addr.sin_addr.s_addr = INADDR_ANY;
+
+	if (bind(fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0 ||
+		listen(fd, DNS_TCP_BACKLOG) < 0 || set_nonblocking(fd) < 0)
+	{
+		perror("Couldn't start DNS TCP listener");
+		close(fd);
+		return;
+	}
+
+	g_wake_fd = eventfd(0, EFD_NONBLOCK);
+	if (g_wake_fd < 0)
+	{
+		perror("DNS TCP eventfd failed");
+		close(fd);
+		return;
+	}
+	g_listen_fd = fd;
+
+	pthread_t thread_id;
+	int result = pthread_create(&thread_id, NULL, tcp_listener, NULL);
+	if (result != 0)
+	{
+		fprintf(stderr, "Failed to start DNS TCP listener: %s\n", strerror(result));
+		close(g_listen_fd);
+		close(g_wake_fd);
+		return;
+	}
+	pthread_detach(thread_id);
+
+	printf("[LAYER_7] [DNS] Listening on 0.0.0.0:%u (TCP)\n", listen_port);
+}
@@ -0,0 +1,53 @@
+#ifndef DNS_TCP_H
+#define DNS_TCP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "dns.h"
+
+// --- listener limits (RFC 7766) ---
+// connections served at once — past this, new connections are closed right away
+#define DNS_TCP_MAX_CONNECTIONS     256
+// idle connections (nothing outstanding, nothing to send) are closed after this
+#define DNS_TCP_IDLE_TIMEOUT_MS     10000
+// replies a slow reader has not picked up yet — past this the connection is dropped
+#define DNS_TCP_MAX_PENDING_OUT     (256 * 1024)
+#define DNS_TCP_BACKLOG             64
+
+// --- one client connection ---
+// owned by the listener thread; workers answering pipelined queries write to
+// it from their own threads, so the outbound side is shared under 'lock'
+// freed when the listener has dropped it and the last outstanding query is answered
+typedef struct dns_tcp_conn {
+	int fd;
+	struct sockaddr_in addr;
+	unsigned char in[2 + DNS_BUFFER_SIZE];  // length prefix + one query, partially read
+	size_t in_len;
+	long long last_active_ms;               // CLOCK_MONOTONIC, listener thread only
+	bool read_closed;                       // peer sent FIN — answer what is pending, then close
+
+	pthread_mutex_t lock;                   // guards everything below
+	int refs;                               // listener + every query still outstanding
+	bool closed;                            // listener gave up, drop late replies
+	unsigned char *out;                     // framed replies the socket could not take yet
+	size_t out_len;
+	size_t out_cap;
+} dns_tcp_conn_t;
+
+// binds TCP on listen_port (DNS_PORT unless main.c got -p) and starts the listener thread
+// queries are fed through dns_dispatch_query() exactly like UDP ones
+// a bind failure is reported and the resolver keeps running UDP-only
+void dns_tcp_start(const struct sockaddr_in *upstream_addr, uint16_t listen_port);
+
+// queues one length-framed reply; safe from any thread, never blocks
+// replies leave in completion order, not query order (RFC 7766 section 7)
+void dns_tcp_send(dns_tcp_conn_t *conn, const unsigned char *message, size_t message_len);
+
+// reference counting for tasks and waiters that answer after the receive path
+void dns_tcp_hold(dns_tcp_conn_t *conn);
+void dns_tcp_release(dns_tcp_conn_t *conn);
+
+#endif
@@ -0,0 +1,222 @@
+#include "topk.h"
+
+// --- one sketch: counters, their buckets, and the key index ---
+// fixed arrays, nothing is allocated after startup
+// access protected by the sketch's own lock
+typedef struct {
+	const char *label;                  // key name in the stats dump
+	bool ip_keys;                       // keys are raw IPv4 addresses
+	pthread_mutex_t lock;
+	uint64_t total;                     // every occurrence ever counted
+	dns_topk_counter_t counters[DNS_TOPK_CAPACITY];
+	size_t used;
+	dns_topk_bucket_t buckets[DNS_TOPK_CAPACITY + 1];  // one spare for the move in increment()
+	size_t buckets_used;
+	dns_topk_bucket_t *free_buckets;    // released buckets, linked through next
+	dns_topk_bucket_t *min;             // smallest count — the eviction candidates
+	dns_topk_bucket_t *max;             // largest count — where the dump starts
+	dns_topk_counter_t *index[DNS_TOPK_INDEX_SIZE];
+} topk_sketch_t;
+
+static topk_sketch_t g_sketches[TOPK_SKETCHES] = {
+	[TOPK_DOMAINS] = { .label = "domain",  .lock = PTHREAD_MUTEX_INITIALIZER },
+	[TOPK_BLOCKED] = { .label = "blocked", .lock = PTHREAD_MUTEX_INITIALIZER },
+	[TOPK_CLIENTS] = { .label = "client",  .lock = PTHREAD_MUTEX_INITIALIZER, .ip_keys = true },
+};
+
+// ---------- BUCKET LIST (caller holds the sketch lock) ----------
+
+static dns_topk_bucket_t *bucket_alloc(topk_sketch_t *sketch)
+{
+	dns_topk_bucket_t *bucket = sketch->free_buckets;
+	if (bucket)
+		sketch->free_buckets = bucket->next;
+	else
+		bucket = &sketch->buckets[sketch->buckets_used++];
+	bucket->counters = NULL;
+	return bucket;
+}
+
+static void bucket_release(topk_sketch_t *sketch, dns_topk_bucket_t *bucket)
+{
+	if (bucket->prev) bucket->prev->next = bucket->next;
+	else sketch->min = bucket->next;
+	if (bucket->next) bucket->next->prev = bucket->prev;
+	else sketch->max = bucket->prev;
+
+	bucket->next = sketch->free_buckets;
+	sketch->free_buckets = bucket;
+}
+
+static void counter_unlink(dns_topk_counter_t *counter)
+{
+	dns_topk_bucket_t *bucket = counter->bucket;
+	if (counter->prev) counter->prev->next = counter->next;
+	else bucket->counters = counter->next;
+	if (counter->next) counter->next->prev = counter->prev;
+}
+
+static void counter_push(dns_topk_bucket_t *bucket, dns_topk_counter_t *counter)
+{
+	counter->bucket = bucket;
+	counter->prev = NULL;
+	counter->next = bucket->counters;
+	if (bucket->counters) bucket->counters->prev = counter;
+	bucket->counters = counter;
+}
+
+// moves the counter to the bucket for count + 1, creating it next door if needed
+static void increment(topk_sketch_t *sketch, dns_topk_counter_t *counter)
+{
+	dns_topk_bucket_t *from = counter->bucket;
+	dns_topk_bucket_t *next = from ? from->next : sketch->min;
+	uint64_t count = counter->count + 1;
+
+	dns_topk_bucket_t *to = next;
+	if (!to || to->count != count)
+	{
+		to = bucket_alloc(sketch);
+		to->count = count;
+		to->prev = from;
+		to->next = next;
+		if (from) from->next = to;
+		else sketch->min = to;
+		if (next) next->prev = to;
+		else sketch->max = to;
+	}
+
+	if (from)
+	{
+		counter_unlink(counter);
+		if (!from->counters)
+			bucket_release(sketch, from);
+	}
+	counter_push(to, counter);
+	counter->count = count;
+}
+
+// ---------- KEY INDEX (caller holds the sketch lock) ----------
+
+static dns_topk_counter_t *index_find(const topk_sketch_t *sketch, const char *key, size_t len, uint32_t hash)
+{
+	dns_topk_counter_t *counter = sketch->index[hash & (DNS_TOPK_INDEX_SIZE - 1)];
+	while (counter)
+	{
+		if (counter->hash == hash && counter->len == len && memcmp(counter->key, key, len) == 0)
+			return counter;
+		counter = counter->hnext;
+	}
+	return NULL;
+}
+
+static void index_remove(topk_sketch_t *sketch, dns_topk_counter_t *counter)
+{
+	dns_topk_counter_t **link = &sketch->index[counter->hash & (DNS_TOPK_INDEX_SIZE - 1)];
+	while (*link && *link != counter)
+		link = &(*link)->hnext;
+	if (*link)
+		*link = counter->hnext;
+}
+
+// ---------- PUBLIC API ----------
+
+void dns_topk_count(dns_topk_sketch_id_t id, const char *key, size_t len, uint32_t hash)
+{
+	if (len == 0 || len >= DOMAIN_NAME_SIZE)
+		return;
+
+	topk_sketch_t *sketch = &g_sketches[id];
+	pthread_mutex_lock(&sketch->lock);
+	sketch->total++;
+
+	dns_topk_counter_t *counter = index_find(sketch, key, len, hash);
+	if (!counter)
+	{
+		if (sketch->used < DNS_TOPK_CAPACITY)
+		{
+			counter = &sketch->counters[sketch->used++];
+			counter->count = 0;
+			counter->error = 0;
+			counter->bucket = NULL;
+		}
+		else
+		{
+			// Space-saving: the new key takes over a minimum counter and
+			// inherits its count as the error bound
+			counter = sketch->min->counters;
+			index_remove(sketch, counter);
+			counter->error = counter->count;
+		}
+
+		memcpy(counter->key, key, len);
+		counter->len = (uint16_t)len;
+		counter->hash = hash;
+		size_t slot = hash & (DNS_TOPK_INDEX_SIZE - 1);
+		counter->hnext = sketch->index[slot];
+		sketch->index[slot] = counter;
+	}
+
+	increment(sketch, counter);
+	pthread_mutex_unlock(&sketch->lock);
+}
+
+void dns_topk_count_name(dns_topk_sketch_id_t id, const domain_name_t *name)
+{
+	if (name->label_count > 0)
+		dns_topk_count(id, name->name, name->len, name->suffix_hash[0]);
+}
+
+void dns_topk_count_client(const struct sockaddr_in *client_addr)
+{
+	// FNV-1a over the four bytes: the index takes the low bits of the hash, and
+	// with FNV every octet reaches them — a multiplicative hash's low bits only
+	// see the first octets, which a whole /16 shares
+	uint32_t ip = client_addr->sin_addr.s_addr;
+	dns_topk_count(TOPK_CLIENTS, (const char *)&ip, sizeof(ip), domain_hash((const char *)&ip, sizeof(ip)));
+}
+
+void dns_topk_dump(FILE *out)
+{
+	for (int id = 0; id < TOPK_SKETCHES; id++)
+	{
+		topk_sketch_t *sketch = &g_sketches[id];
+
+		// Copy the heaviest counters under the lock, print outside it
+		struct {
+			char key[DOMAIN_NAME_SIZE];
+			uint64_t count;
+			uint64_t error;
+		} top[DNS_TOPK_DUMP_TOP];
+		size_t shown = 0;
+
+		pthread_mutex_lock(&sketch->lock);
+		uint64_t total = sketch->total;
+		size_t tracked = sketch->used;
+		for (dns_topk_bucket_t *bucket = sketch->max; bucket && shown < DNS_TOPK_DUMP_TOP; bucket = bucket->prev)
+		{
+			for (dns_topk_counter_t *counter = bucket->counters;
+				counter && shown < DNS_TOPK_DUMP_TOP; counter = counter->next)
+			{
+				if (sketch->ip_keys)
+					inet_ntop(AF_INET, counter->key, top[shown].key, sizeof(top[shown].key));
+				else
+				{
+					memcpy(top[shown].key, counter->key, counter->len);
+					top[shown].key[counter->len] = '\0';
+				}
+				top[shown].count = counter->count;
+				top[shown].error = counter->error;
+				shown++;
+			}
+		}
+		pthread_mutex_unlock(&sketch->lock);
+
+		fprintf(out, "[LAYER_7] [DNS] [STATS] top %s: counted=%llu tracked=%zu\n",
+			sketch->label, (unsigned long long)total, tracked);
+		for (size_t i = 0; i < shown; i++)
+		{
+			fprintf(out, "[LAYER_7] [DNS] [STATS] %s=%s count=%llu error=%llu\n", sketch->label,
+				top[i].key, (unsigned long long)top[i].count, (unsigned long long)top[i].error);
+		}
+	}
+}
@@ -0,0 +1,66 @@
+#ifndef DNS_TOPK_H
+#define DNS_TOPK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#include "dns.h"
+
+// --- sketch sizing ---
+// keys tracked per sketch; anything that ranks inside the top
+// DNS_TOPK_CAPACITY / 2 or so is reported with a tight error bound
+#define DNS_TOPK_CAPACITY       256
+// key -> counter index heads (power of two, 2x capacity keeps chains short)
+#define DNS_TOPK_INDEX_SIZE     512
+// entries per sketch printed by the SIGUSR1 stats dump
+#define DNS_TOPK_DUMP_TOP       20
+
+// --- the sketches ---
+typedef enum {
+	TOPK_DOMAINS  = 0,   // every question name received
+	TOPK_BLOCKED  = 1,   // names answered with a block (question or CNAME target)
+	TOPK_CLIENTS  = 2,   // source IPs, counted before rate limiting
+	TOPK_SKETCHES = 3,
+} dns_topk_sketch_id_t;
+
+struct dns_topk_bucket;
+
+// --- one monitored key (space-saving counter) ---
+// count overestimates the true frequency by at most error
+typedef struct dns_topk_counter {
+	char key[DOMAIN_NAME_SIZE];         // name, or 4 raw IPv4 bytes in TOPK_CLIENTS
+	uint16_t len;
+	uint32_t hash;
+	uint64_t count;
+	uint64_t error;                     // count of the key this counter replaced
+	struct dns_topk_bucket *bucket;     // bucket holding every counter with this count
+	struct dns_topk_counter *prev;      // siblings within the bucket
+	struct dns_topk_counter *next;
+	struct dns_topk_counter *hnext;     // index chain
+} dns_topk_counter_t;
+
+// --- counters sharing one count (Stream-Summary) ---
+// buckets form a list ordered by count, so the minimum to evict is always
+// the head and an increment only ever moves a counter to the next bucket
+typedef struct dns_topk_bucket {
+	uint64_t count;
+	dns_topk_counter_t *counters;
+	struct dns_topk_bucket *prev;       // smaller counts
+	struct dns_topk_bucket *next;       // larger counts
+} dns_topk_bucket_t;
+
+// counts one occurrence of key in a sketch — O(1), no allocation
+// hash is any stable hash of key (domain_hash() / suffix_hash[0] for names)
+void dns_topk_count(dns_topk_sketch_id_t sketch, const char *key, size_t len, uint32_t hash);
+
+// convenience wrappers for the receive path
+void dns_topk_count_name(dns_topk_sketch_id_t sketch, const domain_name_t *name);
+void dns_topk_count_client(const struct sockaddr_in *client_addr);
+
+// prints the heaviest keys of every sketch with their error bounds
+void dns_topk_dump(FILE *out);
+
+#endif
@@ -0,0 +1,413 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <netinet/tcp.h>
+#include <sys/random.h>
+
+#include "upstream.h"
+
+enum {
+	PENDING_WAITING = 0,
+	PENDING_ANSWERED,
+	PENDING_LOST,
+};
+
+static dns_upstream_conn_t g_pool[DNS_UPSTREAM_POOL_SIZE];
+static struct sockaddr_in g_upstream_addr;
+static bool g_pool_started = false;
+
+static long long now_ms(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static void sleep_ms(long long ms)
+{
+	struct timespec pause = { (time_t)(ms / 1000), (long)(ms % 1000) * 1000000 };
+	nanosleep(&pause, NULL);
+}
+
+// ---------- PLAIN TCP TRANSPORT ----------
+
+static int tcp_open(dns_upstream_conn_t *conn, const struct sockaddr_in *addr)
+{
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -1;
+
+	// Non-blocking connect so a dead upstream can't hang the reader for minutes
+	int flags = fcntl(fd, F_GETFL, 0);
+	fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+	if (connect(fd, (const struct sockaddr *)addr, sizeof(*addr)) < 0 && errno != EINPROGRESS)
+	{
+		close(fd);
+		return -1;
+	}
+
+	struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+	int error = 0;
+	socklen_t error_len = sizeof(error);
+	if (poll(&pfd, 1, DNS_UPSTREAM_CONNECT_TIMEOUT_MS) <= 0 ||
+		getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &error_len) < 0 || error != 0)
+	{
+		close(fd);
+		return -1;
+	}
+	fcntl(fd, F_SETFL, flags);
+
+	// Small queries must leave immediately; a stuck send must not hold the write lock forever
+	int one = 1;
+	struct timeval send_timeout = { 1, 0 };
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &one, sizeof(one));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &send_timeout, sizeof(send_timeout));
+
+	conn->fd = fd;
+	return 0;
+}
+
+static ssize_t tcp_send(dns_upstream_conn_t *conn, const void *buf, size_t len)
+{
+	size_t sent = 0;
+	while (sent < len)
+	{
+		ssize_t n = send(conn->fd, (const unsigned char *)buf + sent, len - sent, MSG_NOSIGNAL);
+		if (n <= 0)
+		{
+			// A half-written frame desyncs the stream — make the reader start over
+			shutdown(conn->fd, SHUT_RDWR);
+			return -1;
+		}
+		sent += (size_t)n;
+	}
+	return (ssize_t)len;
+}
+
+static ssize_t tcp_recv(dns_upstream_conn_t *conn, void *buf, size_t len)
+{
+	return recv(conn->fd, buf, len, 0);
+}
+
+static void tcp_close(dns_upstream_conn_t *conn)
+{
+	close(conn->fd);
+	conn->fd = -1;
+}
+
+const dns_transport_ops_t dns_transport_tcp = {
+	.name = "tcp",
+	.open = tcp_open,
+	.send = tcp_send,
+	.recv = tcp_recv,
+	.close = tcp_close,
+};
+
+// ---------- READER THREAD ----------
+
+// caller must hold conn->lock
+// hands a framed answer to whoever is waiting on its ID
+static void deliver(dns_upstream_conn_t *conn, const unsigned char *message, size_t len)
+{
+	if (len < sizeof(struct dns_hdr))
+		return;
+
+	uint16_t wire_id = dns_read_u16(message);
+	dns_upstream_pending_t *pending = conn->slots[wire_id % DNS_UPSTREAM_MAX_INFLIGHT];
+	if (!pending || pending->wire_id != wire_id || pending->state != PENDING_WAITING)
+		return; // keepalive answer, or the caller already gave up
+
+	if (len <= pending->response_size)
+	{
+		memcpy(pending->response, message, len);
+		memcpy(pending->response, &pending->client_id, sizeof(pending->client_id));
+		pending->response_len = len;
+		pending->state = PENDING_ANSWERED;
+	}
+	else
+		pending->state = PENDING_LOST;
+	pthread_cond_signal(&pending->done);
+}
+
+// queries the root NS set under an ID no slot uses — cheap, and the answer is discarded
+static void send_keepalive(dns_upstream_conn_t *conn)
+{
+	static const unsigned char probe[] = {
+		0x00, 17,                               // length prefix
+		0xFF, 0xFF, 0x01, 0x00,                 // ID, RD
+		0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0x00, 0x00, 0x02, 0x00, 0x01,           // ". NS IN"
+	};
+
+	pthread_mutex_lock(&conn->write_lock);
+	conn->ops->send(conn, probe, sizeof(probe));
+	pthread_mutex_unlock(&conn->write_lock);
+}
+
+// reads framed answers until the stream breaks
+static void read_stream(dns_upstream_conn_t *conn)
+{
+	unsigned char frame[2 + UPSTREAM_BUFFER_SIZE];
+	size_t have = 0;
+
+	while (1)
+	{
+		struct pollfd pfd = { .fd = conn->fd, .events = POLLIN };
+		int ready = poll(&pfd, 1, 1000);
+		if (ready < 0 && errno != EINTR)
+			return;
+
+		if (ready <= 0)
+		{
+			// Idle stream — poke it before the upstream's idle timer closes it
+			pthread_mutex_lock(&conn->lock);
+			bool idle = conn->inflight == 0 &&
+				now_ms() - conn->last_used_ms >= DNS_UPSTREAM_KEEPALIVE_MS;
+			if (idle) conn->last_used_ms = now_ms();
+			pthread_mutex_unlock(&conn->lock);
+			if (idle)
+				send_keepalive(conn);
+			continue;
+		}
+
+		ssize_t n = conn->ops->recv(conn, frame + have, sizeof(frame) - have);
+		if (n <= 0)
+			return;
+		have += (size_t)n;
+
+		// Answers arrive in whatever order the upstream finishes them
+		size_t pos = 0;
+		pthread_mutex_lock(&conn->lock);
+		while (have - pos >= 2)
+		{
+			size_t len = dns_read_u16(frame + pos);
+			if (have - pos < 2 + len)
+				break;
+			deliver(conn, frame + pos + 2, len);
+			pos += 2 + len;
+		}
+		pthread_mutex_unlock(&conn->lock);
+
+		memmove(frame, frame + pos, have - pos);
+		have -= pos;
+	}
+}
+
+static void* upstream_reader(void *arg)
+{
+	dns_upstream_conn_t *conn = (dns_upstream_conn_t *)arg;
+	long long backoff = DNS_UPSTREAM_BACKOFF_MIN_MS;
+	bool was_up = false;
+
+	while (1)
+	{
+		// --- connect, backing off while the upstream refuses ---
+		if (conn->ops->open(conn, &g_upstream_addr) < 0)
+		{
+			if (was_up)
+				printf("[LAYER_7] [DNS] Upstream %s stream down, queries fall back to UDP\n",
+					conn->ops->name);
+			was_up = false;
+			sleep_ms(backoff);
+			backoff = (backoff * 2 > DNS_UPSTREAM_BACKOFF_MAX_MS) ? DNS_UPSTREAM_BACKOFF_MAX_MS : backoff * 2;
+			continue;
+		}
+
+		long long connected_at = now_ms();
+		pthread_mutex_lock(&conn->lock);
+		conn->up = true;
+		conn->last_used_ms = connected_at;
+		pthread_mutex_unlock(&conn->lock);
+		if (!was_up)
+			printf("[LAYER_7] [DNS] Upstream %s stream connected\n", conn->ops->name);
+		was_up = true;
+
+		read_stream(conn);
+
+		// --- stream lost: fail everything pending so callers retry over UDP ---
+		pthread_mutex_lock(&conn->write_lock);
+		pthread_mutex_lock(&conn->lock);
+		conn->up = false;
+		for (int i = 0; i < DNS_UPSTREAM_MAX_INFLIGHT; i++)
+		{
+			dns_upstream_pending_t *pending = conn->slots[i];
+			if (pending && pending->state == PENDING_WAITING)
+			{
+				pending->state = PENDING_LOST;
+				pthread_cond_signal(&pending->done);
+			}
+		}
+		pthread_mutex_unlock(&conn->lock);
+		conn->ops->close(conn);
+		pthread_mutex_unlock(&conn->write_lock);
+
+		// Upstreams close idle streams routinely — only back off if it died young
+		if (now_ms() - connected_at >= DNS_UPSTREAM_STABLE_MS)
+			backoff = DNS_UPSTREAM_BACKOFF_MIN_MS;
+		else
+		{
+			sleep_ms(backoff);
+			backoff = (backoff * 2 > DNS_UPSTREAM_BACKOFF_MAX_MS) ? DNS_UPSTREAM_BACKOFF_MAX_MS : backoff * 2;
+		}
+	}
+	return NULL;
+}
+
+// ---------- POOL API ----------
+
+void dns_upstream_start(const struct sockaddr_in *upstream_addr)
+{
+	g_upstream_addr = *upstream_addr;
+	g_pool_started = true;
+
+	for (int i = 0; i < DNS_UPSTREAM_POOL_SIZE; i++)
+	{
+		dns_upstream_conn_t *conn = &g_pool[i];
+		conn->ops = &dns_transport_tcp;
+		conn->fd = -1;
+		getrandom(&conn->next_seq, sizeof(conn->next_seq), 0);
+		pthread_mutex_init(&conn->lock, NULL);
+		pthread_mutex_init(&conn->write_lock, NULL);
+
+		pthread_t thread_id;
+		int result = pthread_create(&thread_id, NULL, upstream_reader, conn);
+		if (result != 0)
+		{
+			fprintf(stderr, "Failed to start DNS upstream stream: %s\n", strerror(result));
+			return;
+		}
+		pthread_detach(thread_id);
+	}
+}
+
+// caller must hold conn->lock
+static int claim_slot(dns_upstream_conn_t *conn, dns_upstream_pending_t *pending)
+{
+	for (int i = 0; i < DNS_UPSTREAM_MAX_INFLIGHT; i++)
+	{
+		uint16_t wire_id = (uint16_t)((conn->next_seq++ << 8) | (uint16_t)i);
+		if (conn->slots[i] || wire_id == 0xFFFF)
+			continue;
+
+		conn->slots[i] = pending;
+		pending->wire_id = wire_id;
+		conn->inflight++;
+		return 0;
+	}
+	return -1;
+}
+
+int dns_upstream_submit(dns_upstream_pending_t *pending, const unsigned char *query, size_t query_len,
+                        unsigned char *response, size_t response_size)
+{
+	memset(pending, 0, sizeof(*pending));
+	if (!g_pool_started || query_len < sizeof(struct dns_hdr) || query_len > DNS_BUFFER_SIZE)
+		return -1;
+
+	// --- least loaded live stream ---
+	dns_upstream_conn_t *conn = NULL;
+	int best = DNS_UPSTREAM_MAX_INFLIGHT;
+	for (int i = 0; i < DNS_UPSTREAM_POOL_SIZE; i++)
+	{
+		pthread_mutex_lock(&g_pool[i].lock);
+		if (g_pool[i].up && g_pool[i].inflight < best)
+		{
+			best = g_pool[i].inflight;
+			conn = &g_pool[i];
+		}
+		pthread_mutex_unlock(&g_pool[i].lock);
+	}
+	if (!conn)
+		return -1;
+
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&pending->done, &attr);
+	pthread_condattr_destroy(&attr);
+
+	pending->response = response;
+	pending->response_size = response_size;
+	memcpy(&pending->client_id, query, sizeof(pending->client_id));
+
+	pthread_mutex_lock(&conn->lock);
+	int claimed = conn->up ? claim_slot(conn, pending) : -1;
+	if (claimed == 0)
+	{
+		pending->conn = conn;
+		conn->last_used_ms = now_ms();
+	}
+	pthread_mutex_unlock(&conn->lock);
+	if (claimed < 0)
+	{
+		pthread_cond_destroy(&pending->done);
+		return -1;
+	}
+
+	// --- frame it under the pool's ID ---
+	unsigned char frame[2 + DNS_BUFFER_SIZE];
+	frame[0] = (unsigned char)(query_len >> 8);
+	frame[1] = (unsigned char)query_len;
+	memcpy(frame + 2, query, query_len);
+	frame[2] = (unsigned char)(pending->wire_id >> 8);
+	frame[3] = (unsigned char)pending->wire_id;
+
+	pthread_mutex_lock(&conn->write_lock);
+	bool sent = conn->up && conn->ops->send(conn, frame, 2 + query_len) == (ssize_t)(2 + query_len);
+	pthread_mutex_unlock(&conn->write_lock);
+
+	if (!sent)
+	{
+		// Let the reader notice the broken stream; this query goes over UDP
+		dns_upstream_release(pending);
+		return -1;
+	}
+	return 0;
+}
+
+ssize_t dns_upstream_wait(dns_upstream_pending_t *pending, int timeout_ms)
+{
+	dns_upstream_conn_t *conn = pending->conn;
+	if (!conn)
+		return -1;
+
+	struct timespec deadline;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += timeout_ms / 1000;
+	deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000;
+	if (deadline.tv_nsec >= 1000000000) { deadline.tv_sec++; deadline.tv_nsec -= 1000000000; }
+
+	pthread_mutex_lock(&conn->lock);
+	while (pending->state == PENDING_WAITING)
+	{
+		if (pthread_cond_timedwait(&pending->done, &conn->lock, &deadline) == ETIMEDOUT)
+			break;
+	}
+	int state = pending->state;
+	size_t len = pending->response_len;
+	pthread_mutex_unlock(&conn->lock);
+
+	if (state == PENDING_ANSWERED) return (ssize_t)len;
+	if (state == PENDING_LOST) return -1;
+	return 0;
+}
+
+void dns_upstream_release(dns_upstream_pending_t *pending)
+{
+	dns_upstream_conn_t *conn = pending->conn;
+	if (!conn)
+		return;
+
+	pthread_mutex_lock(&conn->lock);
+	size_t slot = pending->wire_id % DNS_UPSTREAM_MAX_INFLIGHT;
+	if (conn->slots[slot] == pending)
+	{
+		conn->slots[slot] = NULL;
+		conn->inflight--;
+	}
+	pthread_mutex_unlock(&conn->lock);
+
+	pthread_cond_destroy(&pending->done);
+	pending->conn = NULL;
+}
@@ -0,0 +1,90 @@
+#ifndef DNS_UPSTREAM_H
+#define DNS_UPSTREAM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "dns.h"
+
+// --- pool sizing ---
+// persistent streams to the upstream; queries go to the least loaded one
+#define DNS_UPSTREAM_POOL_SIZE          2
+// pipelined queries outstanding on one stream (also the size of its ID table)
+#define DNS_UPSTREAM_MAX_INFLIGHT       256
+
+// --- connection policy (milliseconds) ---
+#define DNS_UPSTREAM_CONNECT_TIMEOUT_MS 1000
+// an idle stream sends a tiny probe this often so the upstream keeps it open
+#define DNS_UPSTREAM_KEEPALIVE_MS       15000
+// reconnect delay doubles on every failed attempt, from MIN up to MAX
+#define DNS_UPSTREAM_BACKOFF_MIN_MS     250
+#define DNS_UPSTREAM_BACKOFF_MAX_MS     30000
+// a stream that lived this long reconnects at once when the upstream closes it
+#define DNS_UPSTREAM_STABLE_MS          5000
+
+struct dns_upstream_conn;
+
+// --- transport ---
+// how bytes move on one stream; plain TCP today, a TLS (DoT) transport can
+// keep its session in conn->transport_ctx and plug in the same four calls
+typedef struct {
+	const char *name;
+	// connects conn->fd to addr, ready for framed queries; 0 on success
+	int (*open)(struct dns_upstream_conn *conn, const struct sockaddr_in *addr);
+	// sends all len bytes or fails; returns len or -1
+	ssize_t (*send)(struct dns_upstream_conn *conn, const void *buf, size_t len);
+	// reads what is available; 0 on EOF, -1 on error
+	ssize_t (*recv)(struct dns_upstream_conn *conn, void *buf, size_t len);
+	void (*close)(struct dns_upstream_conn *conn);
+} dns_transport_ops_t;
+
+extern const dns_transport_ops_t dns_transport_tcp;
+
+// --- one outstanding query ---
+// lives on the caller's stack between dns_upstream_submit() and dns_upstream_release()
+typedef struct {
+	struct dns_upstream_conn *conn;
+	uint16_t wire_id;                   // ID the query carries on the stream
+	uint16_t client_id;                 // ID restored on the answer (network order)
+	unsigned char *response;            // caller's buffer, filled by the reader thread
+	size_t response_size;
+	size_t response_len;
+	int state;                          // pending / answered / stream lost
+	pthread_cond_t done;
+} dns_upstream_pending_t;
+
+// --- one pooled stream ---
+typedef struct dns_upstream_conn {
+	const dns_transport_ops_t *ops;
+	void *transport_ctx;                // transport-private state (e.g. a TLS session)
+	int fd;
+
+	pthread_mutex_t write_lock;         // one framed query on the wire at a time
+	pthread_mutex_t lock;               // guards everything below
+	bool up;
+	int inflight;
+	uint8_t next_seq;                   // high byte of wire IDs, so a reused slot gets a new ID
+	long long last_used_ms;
+	dns_upstream_pending_t *slots[DNS_UPSTREAM_MAX_INFLIGHT];
+} dns_upstream_conn_t;
+
+// opens the pool against the upstream and starts one reader thread per stream
+// streams connect in the background — until one is up, every query uses UDP
+void dns_upstream_start(const struct sockaddr_in *upstream_addr);
+
+// sends query on the least loaded live stream under a pool-assigned ID
+// the answer (with the caller's ID restored) is copied into response
+// returns 0 on success, -1 if no stream can take it (caller falls back to UDP)
+int dns_upstream_submit(dns_upstream_pending_t *pending, const unsigned char *query, size_t query_len,
+                        unsigned char *response, size_t response_size);
+
+// waits for the answer to a submitted query
+// returns its length, 0 on timeout, -1 if the stream was lost (retry over UDP)
+ssize_t dns_upstream_wait(dns_upstream_pending_t *pending, int timeout_ms);
+
+// forgets a submitted query; late answers for it are discarded
+void dns_upstream_release(dns_upstream_pending_t *pending);
+
+#endif
@@ -0,0 +1,74 @@
+#include "admit.h"
+
+typedef struct http_client {
+    uint32_t ip;                            // network byte order
+    unsigned count;                         // open connections
+    struct http_client *next;               // bucket chain
+} http_client_t;
+
+static http_client_t *g_clients[HTTP_ADMIT_BUCKETS];
+static size_t g_client_count = 0;
+static size_t g_connections = 0;
+static pthread_mutex_t g_admit_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static http_client_t **client_link(uint32_t ip)
+{
+    http_client_t **link = &g_clients[((ip * 2654435761u) >> 22) & (HTTP_ADMIT_BUCKETS - 1)];
+    while (*link && (*link)->ip != ip)
+        link = &(*link)->next;
+    return link;
+}
+
+bool http_admit(const struct sockaddr_in *addr, http_evict_t *refused)
+{
+    uint32_t ip = addr->sin_addr.s_addr;
+    bool admitted = false;
+
+    pthread_mutex_lock(&g_admit_lock);
+    http_client_t **link = client_link(ip);
+    if (g_connections >= HTTP_MAX_CONNECTIONS)
+        *refused = HTTP_EVICT_GLOBAL_CAP;
+    else if (*link && (*link)->count >= HTTP_MAX_PER_CLIENT)
+        *refused = HTTP_EVICT_CLIENT_CAP;
+    else if (*link || (*link = calloc(1, sizeof(http_client_t))) != NULL)
+    {
+        if ((*link)->count++ == 0)
+        {
+            (*link)->ip = ip;
+            g_client_count++;
+        }
+        g_connections++;
+        admitted = true;
+    }
+    else
+        *refused = HTTP_EVICT_GLOBAL_CAP;     // out of memory counts as full
+    pthread_mutex_unlock(&g_admit_lock);
+
+    return admitted;
+}
+
+void http_release(const struct sockaddr_in *addr)
+{
+    pthread_mutex_lock(&g_admit_lock);
+    http_client_t **link = client_link(addr->sin_addr.s_addr);
+    http_client_t *client = *link;
+    if (client)
+    {
+        g_connections--;
+        if (--client->count == 0)
+        {
+            *link = client->next;
+            free(client);
+            g_client_count--;
+        }
+    }
+    pthread_mutex_unlock(&g_admit_lock);
+}
+
+void http_admitted(size_t *connections, size_t *clients)
+{
+    pthread_mutex_lock(&g_admit_lock);
+    *connections = g_connections;
+    *clients = g_client_count;
+    pthread_mutex_unlock(&g_admit_lock);
+}
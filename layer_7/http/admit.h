@@ -0,0 +1,24 @@
+#ifndef ADMIT_H
+#define ADMIT_H
+
+#include "proxy.h"
+
+// --- connection admission ---
+// shared by every event loop: SO_REUSEPORT spreads one client's connections
+// across all of them. Checked once per accept and once per close, so a
+// single lock is plenty
+#define HTTP_MAX_CONNECTIONS    4096        // open client connections, all loops together
+#define HTTP_MAX_PER_CLIENT     64          // open connections from one client IP
+#define HTTP_ADMIT_BUCKETS      1024        // power of two
+
+// counts a new connection from addr against both caps
+// returns true when it may stay; false with *refused set to the cap it hit
+bool   http_admit(const struct sockaddr_in *addr, http_evict_t *refused);
+
+// gives back what http_admit() counted for addr
+void   http_release(const struct sockaddr_in *addr);
+
+// client connections open right now, and the clients they come from
+void   http_admitted(size_t *connections, size_t *clients);
+
+#endif
@@ -1,21 +1,53 @@
 #define _POSIX_C_SOURCE 200809L
 
 #include "proxy.h"
+#include "pathrules.h"
 #include "../../common/blocklist.h"
 
-int main(void)
+static void usage(const char *prog)
 {
+    fprintf(stderr, "Usage: %s [-r dns_server_ip[:port]] [-p path_rules_file]\n", prog);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *dns_server = NULL;     // the local Layer 7 DNS
+    const char *path_rules = NULL;     // the shipped list, optional
+
+    int opt;
+    while ((opt = getopt(argc, argv, "r:p:")) != -1)
+    {
+        if (opt == 'r')
+        {
+            dns_server = optarg;
+            continue;
+        }
+        if (opt == 'p')
+        {
+            path_rules = optarg;
+            continue;
+        }
+        usage(argv[0]);
+        return 1;
+    }
+
     // --- load the blocklist ---
     printf("[LAYER_7] [HTTP] Loading blocklist...\n");
     if (load_blocklist("../../hostnames/blocklist.txt") != 0)
         return 1;
 
+    // --- load the URL path rules ---
+    // a missing default list only means no path blocking; a missing -p file is an error
+    if (http_path_rules_load(path_rules ? path_rules : "../../hostnames/pathlist.txt") < 0 && path_rules)
+        return 1;
+
     printf("[LAYER_7] [HTTP] Starting HTTP proxy server...\n");
 
     // --- start the proxy ---
-    start_proxy_server();
+    start_proxy_server(dns_server);
 
     // --- cleanup ---
+    http_path_rules_free();
     free_blocklist();
 
     return 0;
@@ -0,0 +1,350 @@
+#include "parse.h"
+#include <string.h>
+#include <strings.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// ---------- SCANNING ----------
+
+// tchar (RFC 7230 section 3.2.6) — methods and header names
+static bool is_tchar(unsigned char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+           (c != '\0' && strchr("!#$%&'*+-.^_`|~", c) != NULL);
+}
+
+static const char *token_end(const char *p, const char *end)
+{
+    while (p < end && is_tchar((unsigned char)*p))
+        p++;
+    return p;
+}
+
+// first byte at or after p that can't be part of a field: a control
+// character or DEL, and with space_ends also SP and HTAB (request targets)
+// obs-text (0x80 and up) passes, as header values may carry it
+static const char *field_end(const char *p, const char *end, bool space_ends)
+{
+    const unsigned char last_ctl = space_ends ? 0x20 : 0x1f;   // bytes up to this one stop
+
+#if defined(__SSE2__)
+    // x86-64 always has SSE2 — no build flags needed
+    const __m128i limit = _mm_set1_epi8((char)last_ctl);
+    const __m128i del = _mm_set1_epi8(0x7f);
+    const __m128i tab = _mm_set1_epi8('\t');
+    while (end - p >= 16)
+    {
+        __m128i bytes = _mm_loadu_si128((const __m128i *)p);
+        __m128i stop = _mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(bytes, limit), bytes),
+                                    _mm_cmpeq_epi8(bytes, del));
+        if (!space_ends)
+            stop = _mm_andnot_si128(_mm_cmpeq_epi8(bytes, tab), stop);
+        int mask = _mm_movemask_epi8(stop);
+        if (mask)
+            return p + __builtin_ctz((unsigned)mask);
+        p += 16;
+    }
+#elif defined(__ARM_NEON)
+    // always there on the Pi's AArch64 cores
+    const uint8x16_t limit = vdupq_n_u8(last_ctl);
+    const uint8x16_t del = vdupq_n_u8(0x7f);
+    const uint8x16_t tab = vdupq_n_u8('\t');
+    while (end - p >= 16)
+    {
+        uint8x16_t bytes = vld1q_u8((const uint8_t *)p);
+        uint8x16_t stop = vorrq_u8(vcleq_u8(bytes, limit), vceqq_u8(bytes, del));
+        if (!space_ends)
+            stop = vbicq_u8(stop, vceqq_u8(bytes, tab));
+        // narrow each byte of the mask to a nibble so it fits in 64 bits
+        uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(stop), 4)), 0);
+        if (mask)
+            return p + (__builtin_ctzll(mask) >> 2);
+        p += 16;
+    }
+#endif
+
+    for (; p < end; p++)
+    {
+        unsigned char c = (unsigned char)*p;
+        if ((c <= last_ctl && !(c == '\t' && !space_ends)) || c == 0x7f)
+            break;
+    }
+    return p;
+}
+
+// CRLF, or a bare LF (RFC 7230 section 3.5)
+// returns the start of the next line, or NULL
+static const char *line_end(const char *p, const char *end)
+{
+    if (p < end && *p == '\r')
+        p++;
+    return (p < end && *p == '\n') ? p + 1 : NULL;
+}
+
+// "HTTP/1.x"
+static const char *parse_version(const char *p, const char *end, int *minor_version)
+{
+    if (end - p < 8 || memcmp(p, "HTTP/1.", 7) != 0 || p[7] < '0' || p[7] > '9')
+        return NULL;
+    *minor_version = p[7] - '0';
+    return p + 8;
+}
+
+// ---------- HEADERS ----------
+
+// header lines up to and including the blank line, which has to end the head
+// obs-fold is refused, as RFC 7230 section 3.2.4 allows — a fold the proxy
+// passed on could be read differently by the next hop
+static int parse_headers(const char *p, const char *end, http_message_t *msg)
+{
+    msg->header_count = 0;
+
+    while (p < end)
+    {
+        if (*p == '\r' || *p == '\n')
+        {
+            p = line_end(p, end);
+            return (p == end) ? 0 : -1;
+        }
+        if (msg->header_count == HTTP_MAX_HEADERS)
+            return -1;
+
+        // --- name, then the colon right after it ---
+        const char *name = p;
+        p = token_end(p, end);
+        if (p == name || p == end || *p != ':')
+            return -1;
+        size_t name_len = (size_t)(p - name);
+        p++;
+
+        // --- value, without the whitespace around it ---
+        while (p < end && (*p == ' ' || *p == '\t'))
+            p++;
+        const char *value = p;
+        p = field_end(p, end, false);
+        const char *value_end = p;
+        while (value_end > value && (value_end[-1] == ' ' || value_end[-1] == '\t'))
+            value_end--;
+        if (!(p = line_end(p, end)))
+            return -1;
+
+        msg->headers[msg->header_count++] = (http_header_t){
+            .name = name, .name_len = name_len,
+            .value = value, .value_len = (size_t)(value_end - value),
+        };
+    }
+    return -1;
+}
+
+// ---------- PUBLIC API ----------
+
+size_t http_find_head_end(const char *buf, size_t len, size_t *scanned)
+{
+    // every LF gets a look at what follows it; an LF too close to the end to
+    // tell is where the next call picks up
+    size_t pos = *scanned;
+    const char *newline;
+    while (pos < len && (newline = memchr(buf + pos, '\n', len - pos)) != NULL)
+    {
+        size_t next = (size_t)(newline - buf) + 1;
+        if (next < len && buf[next] == '\n')
+            return next + 1;
+        if (next + 1 < len && buf[next] == '\r' && buf[next + 1] == '\n')
+            return next + 2;
+        if (next == len || (next + 1 == len && buf[next] == '\r'))
+        {
+            *scanned = next - 1;
+            return 0;
+        }
+        pos = next;
+    }
+    *scanned = len;
+    return 0;
+}
+
+int http_parse_request(const char *buf, size_t len, http_message_t *msg)
+{
+    const char *p = buf;
+    const char *end = buf + len;
+
+    // empty lines ahead of the request line are ignored (RFC 7230 section 3.5)
+    while (p < end && (*p == '\r' || *p == '\n'))
+        p++;
+
+    // --- method SP request-target SP HTTP-version CRLF ---
+    msg->method = p;
+    p = token_end(p, end);
+    msg->method_len = (size_t)(p - msg->method);
+    if (msg->method_len == 0 || p == end || *p++ != ' ')
+        return -1;
+
+    msg->target = p;
+    p = field_end(p, end, true);
+    msg->target_len = (size_t)(p - msg->target);
+    if (msg->target_len == 0 || p == end || *p++ != ' ')
+        return -1;
+
+    if (!(p = parse_version(p, end, &msg->minor_version)) || !(p = line_end(p, end)))
+        return -1;
+    msg->status = 0;
+    msg->reason = NULL;
+    msg->reason_len = 0;
+
+    return parse_headers(p, end, msg);
+}
+
+int http_parse_response(const char *buf, size_t len, http_message_t *msg)
+{
+    const char *p = buf;
+    const char *end = buf + len;
+
+    // --- HTTP-version SP status-code SP reason-phrase CRLF ---
+    if (!(p = parse_version(p, end, &msg->minor_version)) || end - p < 4 || *p++ != ' ')
+        return -1;
+
+    msg->status = 0;
+    for (int i = 0; i < 3; i++, p++)
+    {
+        if (*p < '0' || *p > '9')
+            return -1;
+        msg->status = msg->status * 10 + (*p - '0');
+    }
+
+    // the reason phrase can be empty, and some servers drop the space before it
+    msg->reason = (p < end && *p == ' ') ? ++p : p;
+    p = field_end(p, end, false);
+    msg->reason_len = (size_t)(p - msg->reason);
+    if (!(p = line_end(p, end)))
+        return -1;
+    msg->method = msg->target = NULL;
+    msg->method_len = msg->target_len = 0;
+
+    return parse_headers(p, end, msg);
+}
+
+bool http_header_is(const http_header_t *header, const char *name)
+{
+    size_t name_len = strlen(name);
+    return header->name_len == name_len && strncasecmp(header->name, name, name_len) == 0;
+}
+
+const http_header_t *http_find_header(const http_message_t *msg, const char *name)
+{
+    for (size_t i = 0; i < msg->header_count; i++)
+    {
+        if (http_header_is(&msg->headers[i], name))
+            return &msg->headers[i];
+    }
+    return NULL;
+}
+
+bool http_has_token(const http_message_t *msg, const char *name, const char *token)
+{
+    size_t token_len = strlen(token);
+
+    for (size_t i = 0; i < msg->header_count; i++)
+    {
+        const http_header_t *header = &msg->headers[i];
+        if (!http_header_is(header, name))
+            continue;
+
+        const char *value = header->value;
+        const char *end = value + header->value_len;
+        while (value < end)
+        {
+            while (value < end && (*value == ' ' || *value == '\t' || *value == ','))
+                value++;
+            const char *item = value;
+            while (value < end && *value != ',')
+                value++;
+            const char *item_end = value;
+            while (item_end > item && (item_end[-1] == ' ' || item_end[-1] == '\t'))
+                item_end--;
+
+            if ((size_t)(item_end - item) == token_len && strncasecmp(item, token, token_len) == 0)
+                return true;
+        }
+    }
+    return false;
+}
+
+int http_chunk_size(const char *line, size_t len, uint64_t *size)
+{
+    uint64_t value = 0;
+    size_t i = 0;
+    for (; i < len; i++)
+    {
+        unsigned char c = (unsigned char)line[i];
+        int digit;
+        if (c >= '0' && c <= '9')
+            digit = c - '0';
+        else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f')
+            digit = (c | 0x20) - 'a' + 10;
+        else
+            break;
+        if (value > (UINT64_MAX >> 4))
+            return -1;
+        value = (value << 4) | (uint64_t)digit;
+    }
+
+    // a framing the next hop would read differently is refused, not passed on
+    if (i == 0 || i == len || !(line[i] == '\r' || line[i] == '\n' || line[i] == ';' ||
+                                line[i] == ' ' || line[i] == '\t'))
+        return -1;
+    *size = value;
+    return 0;
+}
+
+// RFC 7230 section 3.3.3
+int http_body_framing(const http_message_t *msg, http_framing_t *framing, uint64_t *length)
+{
+    // chunked has to be the final coding; anything else runs until close
+    const http_header_t *coding = NULL;
+    for (size_t i = 0; i < msg->header_count; i++)
+    {
+        if (http_header_is(&msg->headers[i], "Transfer-Encoding"))
+            coding = &msg->headers[i];
+    }
+    if (coding)
+    {
+        const char *value = coding->value;
+        const char *last = value + coding->value_len;
+        while (last > value && last[-1] != ',')
+            last--;
+        while (last < value + coding->value_len && (*last == ' ' || *last == '\t'))
+            last++;
+        bool chunked = (size_t)(value + coding->value_len - last) == 7 && strncasecmp(last, "chunked", 7) == 0;
+        *framing = chunked ? HTTP_BODY_CHUNKED : HTTP_BODY_CLOSE;
+        return 0;
+    }
+
+    // a repeated Content-Length has to agree with the first one
+    bool counted = false;
+    for (size_t i = 0; i < msg->header_count; i++)
+    {
+        const http_header_t *header = &msg->headers[i];
+        if (!http_header_is(header, "Content-Length"))
+            continue;
+        if (header->value_len == 0 || header->value_len > 18)
+            return -1;
+
+        uint64_t value = 0;
+        for (size_t j = 0; j < header->value_len; j++)
+        {
+            if (header->value[j] < '0' || header->value[j] > '9')
+                return -1;
+            value = value * 10 + (uint64_t)(header->value[j] - '0');
+        }
+        if (counted && value != *length)
+            return -1;
+        counted = true;
+        *length = value;
+    }
+
+    *framing = counted ? HTTP_BODY_LENGTH : HTTP_BODY_NONE;
+    return 0;
+}
@@ -0,0 +1,74 @@
+#ifndef PARSE_H
+#define PARSE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// --- HTTP/1.x message heads (RFC 7230 section 3) ---
+// zero-copy: every field is a span into the caller's buffer, which has to
+// outlive the parsed message. The end of the head is searched for
+// incrementally as bytes arrive; the head is then parsed once, in one pass,
+// 16 bytes at a time where the CPU allows (SSE2 / NEON)
+#define HTTP_MAX_HEADERS 64
+
+typedef struct {
+    const char *name;
+    size_t name_len;
+    const char *value;                      // surrounding whitespace trimmed
+    size_t value_len;
+} http_header_t;
+
+// --- message body framing (RFC 7230 section 3.3.3) ---
+typedef enum {
+    HTTP_BODY_NONE,
+    HTTP_BODY_LENGTH,                       // Content-Length
+    HTTP_BODY_CHUNKED,                      // Transfer-Encoding: chunked
+    HTTP_BODY_CLOSE,                        // until the sender closes
+} http_framing_t;
+
+typedef struct {
+    const char *method;                     // requests only
+    size_t method_len;
+    const char *target;
+    size_t target_len;
+    int status;                             // responses only
+    const char *reason;
+    size_t reason_len;
+    int minor_version;                      // HTTP/1.<minor_version>
+    http_header_t headers[HTTP_MAX_HEADERS];
+    size_t header_count;
+} http_message_t;
+
+// looks for the blank line ending a head in buf, resuming at *scanned
+// (0 for a new message), which it advances past what can't hold the end
+// returns the head's length including the blank line, or 0 when it isn't in yet
+size_t http_find_head_end(const char *buf, size_t len, size_t *scanned);
+
+// parse a complete head of len bytes (as found by http_find_head_end)
+// return 0 on success, -1 on anything malformed or past the limits
+int http_parse_request(const char *buf, size_t len, http_message_t *msg);
+int http_parse_response(const char *buf, size_t len, http_message_t *msg);
+
+// true when the header is called name (any case)
+bool http_header_is(const http_header_t *header, const char *name);
+
+// first header called name (any case), or NULL
+const http_header_t *http_find_header(const http_message_t *msg, const char *name);
+
+// true when any header called name lists token (any case) in its
+// comma-separated value
+bool http_has_token(const http_message_t *msg, const char *name, const char *token);
+
+// the size on a chunk-size line of len bytes (RFC 7230 section 4.1): 1*HEXDIG
+// and nothing else — no sign, whitespace or "0x" ahead of it — followed by
+// the line end, a chunk extension or whitespace before one
+// returns 0 and sets *size, -1 when malformed or past 64 bits
+int http_chunk_size(const char *line, size_t len, uint64_t *size);
+
+// how the body after a parsed head is delimited; Transfer-Encoding wins over
+// Content-Length, and *length is set for HTTP_BODY_LENGTH only
+// returns 0, or -1 on a malformed or conflicting Content-Length
+int http_body_framing(const http_message_t *msg, http_framing_t *framing, uint64_t *length);
+
+#endif
@@ -0,0 +1,353 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "pathrules.h"
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NO_STATE    UINT32_MAX
+#define NO_RULE     UINT32_MAX
+
+typedef struct {
+    const char *pattern;                    // lowercased, points into g_arena
+    uint32_t scope;                         // 0: any host, else index + 1 into g_scopes
+    uint32_t next;                          // next rule ending in the same state
+} path_rule_t;
+
+// --- host scopes ---
+// open addressing, linear probing, keyed by domain_hash() like the blocklist,
+// so a request's precomputed suffix hashes probe it directly
+typedef struct {
+    char name[DOMAIN_NAME_SIZE];            // lowercased, no trailing dot
+    uint16_t len;                           // 0 marks an empty slot
+    uint32_t hash;
+} path_scope_t;
+
+static path_rule_t *g_rules = NULL;
+static size_t g_rule_count = 0;
+static char *g_arena = NULL;                // every pattern, NUL-separated, one allocation
+
+static path_scope_t *g_scopes = NULL;
+static size_t g_scope_mask = 0;             // capacity - 1 (capacity is a power of two)
+static size_t g_scope_count = 0;
+
+// --- automaton ---
+// a full DFA over byte classes: bytes no pattern uses share class 0, and
+// upper-case letters share their lower-case letter's class, so the table
+// stays narrow and every input byte costs one lookup
+static uint8_t g_class[256];
+static size_t g_class_count = 0;
+static uint32_t *g_delta = NULL;            // [state * g_class_count + class] → state
+static uint32_t *g_out = NULL;              // first rule ending in the state, or NO_RULE
+static uint32_t *g_dict = NULL;             // nearest proper suffix state with rules, or NO_STATE
+static size_t g_state_count = 0;
+
+// ---------- HOST SCOPES ----------
+
+static size_t find_scope(const char *name, size_t len, uint32_t hash)
+{
+    size_t i = hash & g_scope_mask;
+    while (g_scopes[i].len != 0)
+    {
+        if (g_scopes[i].hash == hash && g_scopes[i].len == len &&
+            memcmp(g_scopes[i].name, name, len) == 0)
+            return i;
+        i = (i + 1) & g_scope_mask;
+    }
+    return i;                               // the empty slot it would go in
+}
+
+// returns the scope's index + 1, or 0 on a malformed host
+static uint32_t add_scope(const char *host)
+{
+    domain_name_t name;
+    if (domain_name_from_string(host, &name) < 0 || name.len == 0)
+        return 0;
+
+    uint32_t hash = domain_hash(name.name, name.len);
+    size_t i = find_scope(name.name, name.len, hash);
+    if (g_scopes[i].len == 0)
+    {
+        memcpy(g_scopes[i].name, name.name, name.len + 1);
+        g_scopes[i].len = name.len;
+        g_scopes[i].hash = hash;
+        g_scope_count++;
+    }
+    return (uint32_t)i + 1;
+}
+
+// ---------- BUILDING ----------
+
+static void assign_classes(void)
+{
+    memset(g_class, 0, sizeof(g_class));
+    g_class_count = 1;
+    for (size_t r = 0; r < g_rule_count; r++)
+    {
+        for (const unsigned char *p = (const unsigned char *)g_rules[r].pattern; *p; p++)
+        {
+            if (g_class[*p] == 0)
+                g_class[*p] = (uint8_t)g_class_count++;
+        }
+    }
+    for (int c = 'A'; c <= 'Z'; c++)
+        g_class[c] = g_class[tolower(c)];
+}
+
+// trie of every pattern, then failure links turned into DFA transitions
+// breadth first, so a state's failure target is always complete before it
+// returns -1 when out of memory
+static int build_automaton(size_t max_states)
+{
+    g_delta = calloc(max_states * g_class_count, sizeof(uint32_t));
+    g_out = malloc(max_states * sizeof(uint32_t));
+    g_dict = malloc(max_states * sizeof(uint32_t));
+    uint32_t *fail = malloc(max_states * sizeof(uint32_t));
+    uint32_t *queue = malloc(max_states * sizeof(uint32_t));
+    if (!g_delta || !g_out || !g_dict || !fail || !queue)
+    {
+        free(fail);
+        free(queue);
+        return -1;
+    }
+
+    // --- trie: 0 is the root, so 0 in g_delta means no child yet ---
+    g_state_count = 1;
+    g_out[0] = NO_RULE;
+    for (size_t r = 0; r < g_rule_count; r++)
+    {
+        uint32_t state = 0;
+        for (const unsigned char *p = (const unsigned char *)g_rules[r].pattern; *p; p++)
+        {
+            uint32_t *edge = &g_delta[state * g_class_count + g_class[*p]];
+            if (*edge == 0)
+            {
+                *edge = (uint32_t)g_state_count;
+                g_out[g_state_count++] = NO_RULE;
+            }
+            state = *edge;
+        }
+        g_rules[r].next = g_out[state];
+        g_out[state] = (uint32_t)r;
+    }
+
+    // --- failure links, breadth first ---
+    size_t head = 0, tail = 0;
+    g_dict[0] = NO_STATE;
+    for (size_t c = 0; c < g_class_count; c++)
+    {
+        uint32_t child = g_delta[c];
+        if (child != 0)
+        {
+            fail[child] = 0;
+            g_dict[child] = NO_STATE;
+            queue[tail++] = child;
+        }
+    }
+    while (head < tail)
+    {
+        uint32_t state = queue[head++];
+        uint32_t *row = &g_delta[state * g_class_count];
+        const uint32_t *fail_row = &g_delta[fail[state] * g_class_count];
+        for (size_t c = 0; c < g_class_count; c++)
+        {
+            if (row[c] == 0)
+            {
+                row[c] = fail_row[c];       // missing edge: where the failure state goes
+                continue;
+            }
+            uint32_t child = row[c];
+            fail[child] = fail_row[c];
+            g_dict[child] = (g_out[fail[child]] != NO_RULE) ? fail[child] : g_dict[fail[child]];
+            queue[tail++] = child;
+        }
+    }
+
+    free(fail);
+    free(queue);
+    return 0;
+}
+
+// ---------- PUBLIC API ----------
+
+void http_path_rules_free(void)
+{
+    free(g_rules);
+    free(g_arena);
+    free(g_scopes);
+    free(g_delta);
+    free(g_out);
+    free(g_dict);
+
+    g_rules = NULL;
+    g_arena = NULL;
+    g_scopes = NULL;
+    g_delta = g_out = g_dict = NULL;
+    g_rule_count = g_scope_count = g_scope_mask = 0;
+    g_state_count = g_class_count = 0;
+}
+
+int http_path_rules_load(const char *filename)
+{
+    FILE *file = fopen(filename, "r");
+    if (!file)
+    {
+        perror("Could not open path rules file");
+        return -1;
+    }
+
+    http_path_rules_free();
+
+    // --- first pass: size the rules, the arena and the scope index ---
+    size_t lines = 0;
+    size_t bytes = 0;
+    char buffer[HTTP_PATH_LINE_BUFFER];
+    while (fgets(buffer, sizeof(buffer), file))
+    {
+        lines++;
+        bytes += strlen(buffer) + 1;
+    }
+    rewind(file);
+
+    size_t capacity = 16;
+    while (capacity < lines * 2)
+        capacity <<= 1;
+
+    g_rules = malloc((lines + 1) * sizeof(path_rule_t));
+    g_arena = malloc(bytes + 1);
+    g_scopes = calloc(capacity, sizeof(path_scope_t));
+    if (!g_rules || !g_arena || !g_scopes)
+    {
+        fclose(file);
+        http_path_rules_free();
+        perror("Out of memory loading path rules");
+        return -1;
+    }
+    g_scope_mask = capacity - 1;
+
+    // --- second pass: parse, lowercase and keep every rule ---
+    size_t used = 0;
+    int line_no = 0;
+    while (fgets(buffer, sizeof(buffer), file) && g_rule_count < lines)
+    {
+        line_no++;
+        buffer[strcspn(buffer, "#\r\n")] = '\0';
+
+        char *save = NULL;
+        char *first = strtok_r(buffer, " \t", &save);
+        if (!first)
+            continue;
+        char *second = strtok_r(NULL, " \t", &save);
+
+        uint32_t scope = 0;
+        char *pattern = first;
+        if (second)
+        {
+            pattern = second;
+            if (strtok_r(NULL, " \t", &save) || (scope = add_scope(first)) == 0)
+            {
+                fprintf(stderr, "%s:%d: expected \"[host] pattern\"\n", filename, line_no);
+                continue;
+            }
+        }
+
+        size_t len = strlen(pattern);
+        if (len > HTTP_PATH_MAX_PATTERN)
+        {
+            fprintf(stderr, "%s:%d: pattern longer than %d bytes\n", filename, line_no, HTTP_PATH_MAX_PATTERN);
+            continue;
+        }
+
+        char *entry = g_arena + used;
+        for (size_t i = 0; i <= len; i++)
+            entry[i] = (char)tolower((unsigned char)pattern[i]);
+        used += len + 1;
+
+        g_rules[g_rule_count++] = (path_rule_t){ .pattern = entry, .scope = scope, .next = NO_RULE };
+    }
+    fclose(file);
+
+    // one state per pattern byte at most, plus the root
+    assign_classes();
+    if (build_automaton(used + 1) < 0)
+    {
+        http_path_rules_free();
+        perror("Out of memory building the path automaton");
+        return -1;
+    }
+
+    printf("[LAYER_7] [HTTP] Path rules loaded: %zu (%zu host scopes, %zu states)\n",
+           g_rule_count, g_scope_count, g_state_count);
+    return (int)g_rule_count;
+}
+
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    c = (char)tolower((unsigned char)c);
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+// RFC 3986 section 2.3
+static bool is_unreserved(int c)
+{
+    return isalnum(c) || c == '-' || c == '.' || c == '_' || c == '~';
+}
+
+const char *http_path_blocked(const domain_name_t *host, const char *target, size_t len)
+{
+    if (g_rule_count == 0)
+        return NULL;
+
+    // --- scopes the host falls under: one probe per suffix, its own hashes ---
+    uint32_t scopes[DOMAIN_MAX_LABELS];
+    size_t scope_count = 0;
+    if (g_scope_count > 0 && host)
+    {
+        for (int label = 0; label < host->label_count; label++)
+        {
+            size_t off = host->label_off[label];
+            size_t i = find_scope(host->name + off, host->len - off, host->suffix_hash[label]);
+            if (g_scopes[i].len != 0)
+                scopes[scope_count++] = (uint32_t)i + 1;
+        }
+    }
+
+    // --- one pass over the target ---
+    uint32_t state = 0;
+    for (size_t pos = 0; pos < len; pos++)
+    {
+        unsigned char c = (unsigned char)target[pos];
+        if (c == '%' && pos + 2 < len)
+        {
+            int hi = hex_value(target[pos + 1]);
+            int lo = hex_value(target[pos + 2]);
+            if (hi >= 0 && lo >= 0 && is_unreserved(hi * 16 + lo))
+            {
+                c = (unsigned char)(hi * 16 + lo);
+                pos += 2;
+            }
+        }
+
+        state = g_delta[state * g_class_count + g_class[c]];
+        for (uint32_t s = (g_out[state] != NO_RULE) ? state : g_dict[state]; s != NO_STATE; s = g_dict[s])
+        {
+            for (uint32_t r = g_out[s]; r != NO_RULE; r = g_rules[r].next)
+            {
+                if (g_rules[r].scope == 0)
+                    return g_rules[r].pattern;
+                for (size_t i = 0; i < scope_count; i++)
+                {
+                    if (scopes[i] == g_rules[r].scope)
+                        return g_rules[r].pattern;
+                }
+            }
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,30 @@
+#ifndef PATHRULES_H
+#define PATHRULES_H
+
+#include <stddef.h>
+
+#include "../../common/domain.h"
+
+// --- URL path and query rules ---
+// "pattern" blocks any request whose origin-form target contains it;
+// "host pattern" only on that host and its subdomains. Every pattern goes
+// into one Aho–Corasick automaton at startup, so a target is scanned once,
+// byte by byte, however many rules there are. Read-only once loaded, no
+// locking
+#define HTTP_PATH_LINE_BUFFER   512
+#define HTTP_PATH_MAX_PATTERN   255
+
+// loads "[host] pattern" lines ('#' comments) and builds the automaton —
+// call once at startup; patterns match without regard to ASCII case
+// returns the number of rules loaded, -1 if the file can't be read
+int http_path_rules_load(const char *filename);
+
+// scans the len bytes of target (origin form, path and query) for a rule
+// that applies to host; %XX escapes of unreserved characters are read
+// decoded (RFC 3986 section 6.2.2.2), so /%61ds/ still matches /ads/
+// returns the first matching pattern, or NULL
+const char *http_path_blocked(const domain_name_t *host, const char *target, size_t len);
+
+void http_path_rules_free(void);
+
+#endif
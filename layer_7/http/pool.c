@@ -0,0 +1,141 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <strings.h>
+#include <sys/epoll.h>
+
+#include "pool.h"
+#include "../../common/domain.h"
+
+static uint32_t pool_hash(const char *host, int port)
+{
+    return domain_hash(host, strlen(host)) ^ ((uint32_t)port * 2654435761u);
+}
+
+static void pool_remove(http_pool_t *pool, http_pooled_t *entry)
+{
+    http_pooled_t **link = &pool->buckets[entry->hash & (HTTP_POOL_BUCKETS - 1)];
+    while (*link && *link != entry)
+        link = &(*link)->hnext;
+    if (*link)
+        *link = entry->hnext;
+
+    if (entry->prev) entry->prev->next = entry->next;
+    else pool->oldest = entry->next;
+    if (entry->next) entry->next->prev = entry->prev;
+    else pool->newest = entry->prev;
+
+    pool->count--;
+
+    // later events in the current batch may still point at the entry, so it
+    // is only freed by the next sweep
+    entry->endpoint.fd = -1;
+    entry->hnext = pool->retired;
+    pool->retired = entry;
+}
+
+static void pool_close(http_worker_t *worker, http_pooled_t *entry)
+{
+    int fd = entry->endpoint.fd;
+    pool_remove(worker->pool, entry);
+    close(fd);  // also drops it from the epoll set
+}
+
+int http_pool_take(http_worker_t *worker, const char *host, int port)
+{
+    http_pool_t *pool = worker->pool;
+    uint32_t hash = pool_hash(host, port);
+
+    http_pooled_t *entry = pool->buckets[hash & (HTTP_POOL_BUCKETS - 1)];
+    while (entry)
+    {
+        http_pooled_t *next = entry->hnext;
+        if (entry->hash == hash && entry->port == port && strcmp(entry->host, host) == 0)
+        {
+            int fd = entry->endpoint.fd;
+            epoll_ctl(worker->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+            pool_remove(pool, entry);
+
+            // the close may be on the wire but not yet seen by epoll — anything
+            // other than "no data yet" means the origin is done with it
+            char probe;
+            ssize_t bytes = recv(fd, &probe, 1, MSG_PEEK | MSG_DONTWAIT);
+            if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                return fd;
+            close(fd);
+        }
+        entry = next;
+    }
+    return -1;
+}
+
+void http_pool_put(http_worker_t *worker, int fd, const char *host, int port)
+{
+    http_pool_t *pool = worker->pool;
+    uint32_t hash = pool_hash(host, port);
+    size_t slot = hash & (HTTP_POOL_BUCKETS - 1);
+
+    size_t same_host = 0;
+    for (http_pooled_t *entry = pool->buckets[slot]; entry; entry = entry->hnext)
+    {
+        if (entry->hash == hash && entry->port == port && strcmp(entry->host, host) == 0)
+            same_host++;
+    }
+    if (same_host >= HTTP_POOL_MAX_PER_HOST)
+    {
+        close(fd);
+        return;
+    }
+    if (pool->count >= HTTP_POOL_MAX)
+        pool_close(worker, pool->oldest);
+
+    http_pooled_t *entry = calloc(1, sizeof(http_pooled_t));
+    if (!entry)
+    {
+        close(fd);
+        return;
+    }
+    entry->endpoint = (http_endpoint_t){ .fd = fd, .kind = HTTP_EV_POOLED, .events = EPOLLIN | EPOLLRDHUP };
+    strncpy(entry->host, host, MAX_HOSTNAME_LENGTH - 1);
+    entry->port = port;
+    entry->hash = hash;
+    entry->idle_since_ms = worker->now_ms;
+
+    struct epoll_event event = { .events = EPOLLIN | EPOLLRDHUP, .data.ptr = &entry->endpoint };
+    if (epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0)
+    {
+        close(fd);
+        free(entry);
+        return;
+    }
+
+    entry->hnext = pool->buckets[slot];
+    pool->buckets[slot] = entry;
+    entry->prev = pool->newest;
+    if (pool->newest) pool->newest->next = entry;
+    else pool->oldest = entry;
+    pool->newest = entry;
+    pool->count++;
+}
+
+void http_pool_event(http_worker_t *worker, http_endpoint_t *endpoint)
+{
+    if (endpoint->fd >= 0)
+        pool_close(worker, (http_pooled_t *)endpoint);
+}
+
+long long http_pool_sweep(http_worker_t *worker)
+{
+    http_pool_t *pool = worker->pool;
+    while (pool->oldest && worker->now_ms - pool->oldest->idle_since_ms >= HTTP_POOL_IDLE_MS)
+        pool_close(worker, pool->oldest);
+
+    while (pool->retired)
+    {
+        http_pooled_t *entry = pool->retired;
+        pool->retired = entry->hnext;
+        free(entry);
+    }
+
+    return pool->oldest ? pool->oldest->idle_since_ms + HTTP_POOL_IDLE_MS - worker->now_ms : -1;
+}
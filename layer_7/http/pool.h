@@ -0,0 +1,49 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include "proxy.h"
+
+// --- idle upstream connections ---
+// per event loop, so no locking: a connection is only ever reused by the
+// loop whose epoll set it lives in
+#define HTTP_POOL_BUCKETS       128         // power of two
+#define HTTP_POOL_MAX           64          // idle connections kept per event loop
+#define HTTP_POOL_MAX_PER_HOST  6           // browsers open ~6 per origin
+#define HTTP_POOL_IDLE_MS       15000       // below the usual origin keep-alive timeout
+
+typedef struct http_pooled {
+    http_endpoint_t endpoint;               // first member — epoll's data.ptr is the entry
+    char host[MAX_HOSTNAME_LENGTH];
+    int port;
+    uint32_t hash;
+    long long idle_since_ms;
+    struct http_pooled *hnext;              // bucket chain, newest first
+    struct http_pooled *prev;               // pool-wide list, oldest first
+    struct http_pooled *next;
+} http_pooled_t;
+
+typedef struct http_pool {
+    http_pooled_t *buckets[HTTP_POOL_BUCKETS];
+    http_pooled_t *oldest;
+    http_pooled_t *newest;
+    http_pooled_t *retired;                 // taken or closed, freed by the next sweep
+    size_t count;
+} http_pool_t;
+
+// returns a live idle connection to host:port, or -1 when there is none
+// the fd is no longer registered with epoll
+int  http_pool_take(http_worker_t *worker, const char *host, int port);
+
+// parks a connection whose last response was fully read; the fd must not be
+// registered with epoll. Closes it instead when the pool or the host is full.
+void http_pool_put(http_worker_t *worker, int fd, const char *host, int port);
+
+// an idle connection turned readable — the origin closed it (or broke protocol)
+void http_pool_event(http_worker_t *worker, http_endpoint_t *endpoint);
+
+// closes connections idle for HTTP_POOL_IDLE_MS and frees retired entries,
+// once per event batch
+// returns ms until the next one expires, or -1 when the pool is empty
+long long http_pool_sweep(http_worker_t *worker);
+
+#endif
@@ -1,28 +1,1453 @@
-#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE
 
 #include "proxy.h"
+#include "pool.h"
+#include "resolve.h"
+#include "admit.h"
+#include "pathrules.h"
 #include "../../common/blocklist.h"
 #include <netdb.h>       // for getaddrinfo and struct addrinfo
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/tcp.h>
+#include <signal.h>
 #include <strings.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
 
-void start_proxy_server()
+static http_worker_t g_workers[HTTP_MAX_WORKERS];
+static size_t g_worker_count = 0;
+
+// the proxy writes headers and body separately; Nagle would hold the body
+// back until the peer's delayed ACK of the headers
+static void set_nodelay(int fd)
+{
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+static long long now_ms(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static bool would_block(void)
+{
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+}
+
+static size_t min_size(size_t a, uint64_t b)
+{
+    return (b < a) ? (size_t)b : a;
+}
+
+// ---------- RELAY BUFFERS ----------
+
+static char *buffer_get(http_worker_t *worker)
+{
+    if (worker->free_count > 0)
+        return worker->free_buffers[--worker->free_count];
+    return malloc(HTTP_BUFFER_SIZE);
+}
+
+static void buffer_put(http_worker_t *worker, char *buffer)
+{
+    if (!buffer)
+        return;
+    if (worker->free_count < HTTP_BUFFER_CACHE)
+        worker->free_buffers[worker->free_count++] = buffer;
+    else
+        free(buffer);
+}
+
+// ---------- SPLICE PIPES ----------
+
+static int pipe_get(http_worker_t *worker, http_pipe_t *pipe)
+{
+    if (worker->free_pipe_count > 0)
+    {
+        *pipe = worker->free_pipes[--worker->free_pipe_count];
+        return 0;
+    }
+
+    int fds[2];
+    if (pipe2(fds, O_NONBLOCK | O_CLOEXEC) < 0)
+        return -1;
+
+    // past the per-user pipe page budget the kernel hands out one-page
+    // pipes, so ask for the size we want and keep whatever we got
+    fcntl(fds[1], F_SETPIPE_SZ, HTTP_PIPE_SIZE);
+    int size = fcntl(fds[1], F_GETPIPE_SZ);
+    pipe->read_fd = fds[0];
+    pipe->write_fd = fds[1];
+    pipe->size = (size > 0) ? (size_t)size : 4096;
+    return 0;
+}
+
+// an empty pipe goes back to the cache, one still holding bytes is closed
+static void pipe_put(http_worker_t *worker, http_pipe_t *pipe, size_t piped)
+{
+    if (pipe->read_fd < 0)
+        return;
+    if (piped == 0 && worker->free_pipe_count < HTTP_PIPE_CACHE)
+        worker->free_pipes[worker->free_pipe_count++] = *pipe;
+    else
+    {
+        close(pipe->read_fd);
+        close(pipe->write_fd);
+    }
+    pipe->read_fd = pipe->write_fd = -1;
+}
+
+// ---------- RELAY ----------
+
+// gives the buffer and the pipe back once everything in them has been written
+static void relay_trim(http_worker_t *worker, http_relay_t *relay)
+{
+    if (relay->data && relay->start == relay->end)
+    {
+        buffer_put(worker, relay->data);
+        relay->data = NULL;
+        relay->start = relay->end = 0;
+    }
+    if (relay->piped == 0)
+        pipe_put(worker, &relay->pipe, 0);
+}
+
+static void relay_release(http_worker_t *worker, http_relay_t *relay)
+{
+    buffer_put(worker, relay->data);
+    pipe_put(worker, &relay->pipe, relay->piped);
+    *relay = (http_relay_t){ .pipe = { .read_fd = -1, .write_fd = -1 } };
+}
+
+static bool relay_pending(const http_relay_t *relay)
+{
+    return relay->start < relay->end || relay->piped > 0;
+}
+
+static bool relay_has_room(const http_relay_t *relay)
+{
+    if (relay->eof)
+        return false;
+    if (relay->pipe.read_fd >= 0)
+        return relay->piped < relay->pipe.size;
+    return relay->end < HTTP_BUFFER_SIZE;
+}
+
+// splices up to max bytes from the socket into the relay's pipe
+// returns bytes moved, 0 on EOF, -1 with errno set (EMFILE: no pipe)
+static ssize_t relay_splice_in(http_worker_t *worker, int fd, http_relay_t *relay, uint64_t max)
+{
+    if (relay->pipe.read_fd < 0 && pipe_get(worker, &relay->pipe) < 0)
+        return -1;
+
+    size_t len = min_size(relay->pipe.size - relay->piped, max);
+    ssize_t bytes = splice(fd, NULL, relay->pipe.write_fd, NULL, len, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (bytes > 0)
+        relay->piped += (size_t)bytes;
+    return bytes;
+}
+
+// moves what the source has into the pipe — or, with no fds left for a
+// pipe, copies it into the relay buffer
+// returns 0 on progress or EAGAIN, -1 on error (EOF only sets relay->eof)
+static int relay_read(http_worker_t *worker, int fd, http_relay_t *relay)
+{
+    ssize_t bytes;
+    if (relay->pipe.read_fd >= 0 || pipe_get(worker, &relay->pipe) == 0)
+        bytes = relay_splice_in(worker, fd, relay, UINT64_MAX);
+    else
+    {
+        if (!relay->data && !(relay->data = buffer_get(worker)))
+            return -1;
+        bytes = recv(fd, relay->data + relay->end, HTTP_BUFFER_SIZE - relay->end, 0);
+        if (bytes > 0)
+            relay->end += (size_t)bytes;
+    }
+
+    if (bytes == 0)
+        relay->eof = true;
+    else if (bytes < 0 && !would_block())
+        return -1;
+
+    relay_trim(worker, relay);
+    return 0;
+}
+
+// writes pending bytes to the destination, buffered ones first; shuts its
+// write side once the source has finished and everything is through
+// returns 0 on progress or EAGAIN, -1 on error
+static int relay_write(http_worker_t *worker, int fd, http_relay_t *relay)
+{
+    if (relay->start < relay->end)
+    {
+        ssize_t bytes = send(fd, relay->data + relay->start, relay->end - relay->start, MSG_NOSIGNAL);
+        if (bytes > 0)
+            relay->start += (size_t)bytes;
+        else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            return -1;
+    }
+    if (relay->start == relay->end && relay->piped > 0)
+    {
+        ssize_t bytes = splice(relay->pipe.read_fd, NULL, fd, NULL, relay->piped,
+                               SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (bytes > 0)
+            relay->piped -= (size_t)bytes;
+        else if (bytes < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            return -1;
+    }
+    relay_trim(worker, relay);
+
+    if (relay->eof && !relay_pending(relay) && !relay->shut)
+    {
+        shutdown(fd, SHUT_WR);
+        relay->shut = true;
+    }
+    return 0;
+}
+
+// how many bytes relay_queue() can take right now
+// spliced bytes go out after the buffer, so nothing can be queued behind
+// them until the pipe has drained
+static size_t relay_queue_room(const http_relay_t *relay)
+{
+    if (relay->piped > 0)
+        return 0;
+    return HTTP_BUFFER_SIZE - (relay->end - relay->start);
+}
+
+// adds bytes the proxy read or wrote itself to the relay buffer
+// returns how many bytes were taken
+static size_t relay_queue(http_worker_t *worker, http_relay_t *relay, const char *bytes, size_t len)
+{
+    size_t room = relay_queue_room(relay);
+    if (len > room)
+        len = room;
+    if (len == 0)
+        return 0;
+
+    if (!relay->data && !(relay->data = buffer_get(worker)))
+        return 0;
+    if (relay->start > 0)
+    {
+        memmove(relay->data, relay->data + relay->start, relay->end - relay->start);
+        relay->end -= relay->start;
+        relay->start = 0;
+    }
+    memcpy(relay->data + relay->end, bytes, len);
+    relay->end += len;
+    return len;
+}
+
+// ---------- PROXY-READ BYTES ----------
+
+static void input_release(http_worker_t *worker, http_input_t *input)
+{
+    buffer_put(worker, input->data);
+    *input = (http_input_t){ 0 };
+}
+
+// drops the consumed bytes, keeping whatever follows them (a pipelined
+// request, the start of a body)
+static void input_consume(http_worker_t *worker, http_input_t *input)
+{
+    if (input->used == input->len)
+    {
+        input_release(worker, input);
+        return;
+    }
+    memmove(input->data, input->data + input->used, input->len - input->used);
+    input->len -= input->used;
+    input->used = 0;
+    input->scanned = 0;
+    input->data[input->len] = '\0';
+}
+
+// reads what the socket has behind the bytes already in input
+// returns bytes read, 0 on EOF, -1 with errno set (EMSGSIZE: input is full)
+static ssize_t input_fill(http_worker_t *worker, int fd, http_input_t *input)
+{
+    bool borrowed = !input->data;
+    if (borrowed && !(input->data = buffer_get(worker)))
+        return -1;
+    if (input->len >= HTTP_BUFFER_SIZE - 1)     // leave space for null terminator
+    {
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    ssize_t bytes = recv(fd, input->data + input->len, HTTP_BUFFER_SIZE - input->len - 1, 0);
+    if (bytes > 0)
+    {
+        input->len += (size_t)bytes;
+        input->data[input->len] = '\0';     // null terminate for string functions
+    }
+    else if (borrowed)
+    {
+        // nothing came — an idle keep-alive client holds no buffer
+        int saved = errno;
+        input_release(worker, input);
+        errno = saved;
+    }
+    return bytes;
+}
+
+// the request head built for the upstream, once the exchange no longer needs it
+static void head_release(http_worker_t *worker, http_task_t *task)
+{
+    buffer_put(worker, task->request_head);
+    task->request_head = NULL;
+    task->request_head_len = 0;
+}
+
+// ---------- HEADERS ----------
+
+// the body's framing and its state at the start
+// returns 0, or -1 on a malformed or conflicting length
+static int body_framing(const http_message_t *head, http_body_t *body)
+{
+    http_framing_t framing;
+    uint64_t length = 0;
+    if (http_body_framing(head, &framing, &length) < 0)
+        return -1;
+
+    *body = (http_body_t){
+        .framing = framing,
+        .remaining = length,
+        .done = (framing == HTTP_BODY_NONE || (framing == HTTP_BODY_LENGTH && length == 0)),
+    };
+    return 0;
+}
+
+// hop-by-hop headers (RFC 7230 section 6.1) stop at the proxy, and so does a
+// Content-Length that Transfer-Encoding overrides (section 3.3.3)
+static bool is_hop_by_hop(const http_header_t *header, bool upgrade, bool drop_length)
+{
+    static const char *const names[] = {
+        "Connection", "Proxy-Connection", "Keep-Alive", "Proxy-Authorization", "TE", "Upgrade",
+    };
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+    {
+        if (http_header_is(header, names[i]))
+            return !(upgrade && (i == 0 || i == 5));    // an upgrade keeps Connection + Upgrade
+    }
+    return drop_length && http_header_is(header, "Content-Length");
+}
+
+// writes the head's end-to-end headers into out, without the final blank line
+// returns bytes written, or -1 when out is too small
+static ssize_t copy_end_to_end_headers(const http_message_t *head, bool upgrade, bool drop_length,
+                                       char *out, size_t out_size)
+{
+    size_t len = 0;
+    for (size_t i = 0; i < head->header_count; i++)
+    {
+        const http_header_t *header = &head->headers[i];
+        if (is_hop_by_hop(header, upgrade, drop_length))
+            continue;
+
+        size_t line_len = header->name_len + 2 + header->value_len + 2;
+        if (len + line_len > out_size)
+            return -1;
+        memcpy(out + len, header->name, header->name_len);
+        len += header->name_len;
+        memcpy(out + len, ": ", 2);
+        len += 2;
+        memcpy(out + len, header->value, header->value_len);
+        len += header->value_len;
+        memcpy(out + len, "\r\n", 2);
+        len += 2;
+    }
+    return (ssize_t)len;
+}
+
+// ---------- MESSAGE BODIES ----------
+
+static void body_consumed(http_body_t *body, size_t bytes)
+{
+    if (body->framing == HTTP_BODY_CLOSE)
+        return;
+    body->remaining -= bytes;
+    if (body->remaining > 0)
+        return;
+    if (body->framing == HTTP_BODY_LENGTH)
+        body->done = true;
+    else
+        body->chunk_state = HTTP_CHUNK_DATA_END;
+}
+
+// handles one chunk-size / chunk-end / trailer line, passing it on as-is
+// returns 1 when a line was handled, 0 to wait, -1 on malformed framing
+static int chunk_line(http_worker_t *worker, int fd, http_input_t *input, http_relay_t *out, http_body_t *body)
+{
+    char *line = input->data ? input->data + input->used : NULL;
+    char *newline = line ? memchr(line, '\n', input->len - input->used) : NULL;
+    if (!newline)
+    {
+        if (input->used > 0)
+            input_consume(worker, input);
+        ssize_t bytes = input_fill(worker, fd, input);
+        if (bytes > 0)
+            return 1;
+        return (bytes < 0 && would_block()) ? 0 : -1;
+    }
+
+    size_t line_len = (size_t)(newline + 1 - line);
+    if (relay_queue_room(out) < line_len)
+        return 0;
+
+    bool blank = (line_len == 1 || (line_len == 2 && line[0] == '\r'));
+    switch (body->chunk_state)
+    {
+        case HTTP_CHUNK_SIZE:
+        {
+            uint64_t size;
+            if (http_chunk_size(line, line_len, &size) < 0)
+                return -1;
+            body->remaining = size;
+            body->chunk_state = (size == 0) ? HTTP_CHUNK_TRAILER : HTTP_CHUNK_DATA;
+            break;
+        }
+        case HTTP_CHUNK_DATA_END:
+            if (!blank)
+                return -1;
+            body->chunk_state = HTTP_CHUNK_SIZE;
+            break;
+        case HTTP_CHUNK_TRAILER:
+            if (blank)
+                body->done = true;
+            break;
+        case HTTP_CHUNK_DATA:
+            break;
+    }
+
+    relay_queue(worker, out, line, line_len);
+    input->used += line_len;
+    return 1;
+}
+
+// moves one message body from fd into out, buffered bytes first, stopping
+// exactly at its end. Payload is spliced; only chunked framing lines pass
+// through user space
+// returns 0 on progress or nothing to do yet, -1 on error or a truncated body
+static int body_pump(http_worker_t *worker, int fd, http_input_t *input, http_relay_t *out, http_body_t *body)
+{
+    while (!body->done)
+    {
+        if (body->framing == HTTP_BODY_CHUNKED && body->chunk_state != HTTP_CHUNK_DATA)
+        {
+            int status = chunk_line(worker, fd, input, out, body);
+            if (status <= 0)
+                return status;
+            continue;
+        }
+
+        uint64_t want = (body->framing == HTTP_BODY_CLOSE) ? UINT64_MAX : body->remaining;
+
+        // --- bytes read along with the headers go first ---
+        if (input->used < input->len)
+        {
+            size_t taken = relay_queue(worker, out, input->data + input->used,
+                                       min_size(input->len - input->used, want));
+            if (taken == 0)
+                return 0;
+            input->used += taken;
+            body_consumed(body, taken);
+            continue;
+        }
+
+        if (!relay_has_room(out))
+            return 0;
+
+        ssize_t bytes = relay_splice_in(worker, fd, out, want);
+        if (bytes < 0 && errno == EMFILE)
+        {
+            // no fd for a pipe — copy through the input buffer instead
+            if (input->used > 0)
+                input_consume(worker, input);
+            bytes = input_fill(worker, fd, input);
+        }
+        else if (bytes > 0)
+            body_consumed(body, (size_t)bytes);
+
+        if (bytes == 0)
+        {
+            if (body->framing != HTTP_BODY_CLOSE)
+                return -1;      // sender closed mid-body
+            body->done = true;
+            out->eof = true;
+        }
+        else if (bytes < 0)
+            return would_block() ? 0 : -1;
+    }
+    return 0;
+}
+
+// ---------- DEADLINES ----------
+// each task has one timer on the worker's wheel, armed for the soonest of
+// its deadlines. Activity only stores a time: a timer that turns out to be
+// early is re-armed when it fires, so a busy connection never touches the
+// wheel. Anything that brings a deadline forward re-arms it in update_interest()
+
+static void idle_touch(http_worker_t *worker, http_task_t *task)
+{
+    task->last_active_ms = worker->now_ms;
+}
+
+// when the task is next due, and what ends it if nothing moves by then
+static long long task_deadline(const http_task_t *task, http_evict_t *reason)
+{
+    long long idle = task->last_active_ms + HTTP_IDLE_TIMEOUT_MS;
+    *reason = HTTP_EVICT_IDLE;
+
+    switch (task->state)
+    {
+        case HTTP_STATE_READ_REQUEST:
+            // reads don't push this back — a head trickled in a byte at a
+            // time still has to be complete in time. Nothing read at all
+            // is a client that went quiet, not a slow head
+            *reason = (task->request_in.len == 0) ? HTTP_EVICT_IDLE : HTTP_EVICT_HEADER_TIMEOUT;
+            return task->request_deadline_ms;
+        case HTTP_STATE_CONNECTING:
+            // the race ticks first; the tick itself closes nothing
+            return (task->connect_tick_ms < idle) ? task->connect_tick_ms : idle;
+        case HTTP_STATE_RELAY:
+        {
+            long long quiet = task->last_active_ms + HTTP_TUNNEL_IDLE_MS;
+            long long end = task->relay_started_ms + HTTP_TUNNEL_LIFETIME_MS;
+            *reason = (end <= quiet) ? HTTP_EVICT_TUNNEL_LIFETIME : HTTP_EVICT_TUNNEL_IDLE;
+            return (end <= quiet) ? end : quiet;
+        }
+        default:
+            // lingering closes aren't touched, so this bounds them too
+            return idle;
+    }
+}
+
+static void task_schedule(http_worker_t *worker, http_task_t *task)
+{
+    // a resolver thread owns the task until it hands it back
+    if (task->state == HTTP_STATE_RESOLVING)
+    {
+        http_timer_cancel(&worker->wheel, &task->timer);
+        return;
+    }
+
+    http_evict_t reason;
+    long long deadline = task_deadline(task, &reason);
+    if (!http_timer_pending(&task->timer) || deadline < task->timer.expires_ms)
+        http_timer_arm(&worker->wheel, &task->timer, deadline);
+}
+
+static void count_eviction(http_worker_t *worker, http_evict_t reason)
+{
+    __atomic_fetch_add(&worker->evicted[reason], 1, __ATOMIC_RELAXED);
+}
+
+// ---------- EPOLL INTEREST ----------
+
+static void endpoint_watch(http_worker_t *worker, http_endpoint_t *endpoint, uint32_t events)
+{
+    // a hung-up peer can't take writes, and level-triggered EPOLLHUP would
+    // fire forever if the fd stayed registered without read interest
+    if (endpoint->hup)
+        events &= EPOLLIN;
+    if (endpoint->fd < 0 || endpoint->events == events)
+        return;
+
+    struct epoll_event event = { .events = events, .data.ptr = endpoint };
+    int op = (endpoint->events == 0) ? EPOLL_CTL_ADD : (events == 0) ? EPOLL_CTL_DEL : EPOLL_CTL_MOD;
+    if (epoll_ctl(worker->epoll_fd, op, endpoint->fd, &event) < 0)
+        perror("epoll_ctl failed");
+    endpoint->events = events;
+}
+
+static void close_endpoint(http_endpoint_t *endpoint)
+{
+    if (endpoint->fd >= 0)
+        close(endpoint->fd);    // also drops it from the epoll set
+    endpoint->fd = -1;
+    endpoint->events = 0;
+    endpoint->hup = false;
+}
+
+static bool response_complete(const http_task_t *task)
+{
+    return task->response_headers_done && task->response_body.done;
+}
+
+static bool body_buffered(const http_input_t *input, const http_body_t *body)
+{
+    return !body->done && input->used < input->len;
+}
+
+static void update_interest(http_worker_t *worker, http_task_t *task)
+{
+    uint32_t client_events = 0;
+    uint32_t upstream_events = 0;
+
+    switch (task->state)
+    {
+        case HTTP_STATE_READ_REQUEST:
+            client_events = EPOLLIN;
+            break;
+        case HTTP_STATE_EXCHANGE:
+            // body bytes read along with the headers wait for the pipe ahead of
+            // them to drain; the destination turning writable is what wakes them
+            if (!task->upload_stopped && !task->request_body.done && relay_has_room(&task->up))
+                client_events |= EPOLLIN;
+            if (relay_pending(&task->down) ||
+                (task->response_headers_done && body_buffered(&task->response_in, &task->response_body)))
+                client_events |= EPOLLOUT;
+            if (!task->upload_stopped &&
+                (relay_pending(&task->up) || body_buffered(&task->request_in, &task->request_body)))
+                upstream_events |= EPOLLOUT;
+            if (!response_complete(task) &&
+                (!task->response_headers_done || relay_has_room(&task->down)))
+                upstream_events |= EPOLLIN;
+            break;
+        case HTTP_STATE_RELAY:
+            if (relay_has_room(&task->up))     client_events |= EPOLLIN;
+            if (relay_pending(&task->down))    client_events |= EPOLLOUT;
+            if (relay_has_room(&task->down))   upstream_events |= EPOLLIN;
+            if (relay_pending(&task->up))      upstream_events |= EPOLLOUT;
+            break;
+        case HTTP_STATE_CLOSING:
+            client_events = task->lingering ? EPOLLIN : EPOLLOUT;
+            break;
+        case HTTP_STATE_RESOLVING:
+        case HTTP_STATE_CONNECTING:     // attempts watch themselves
+            break;
+    }
+
+    endpoint_watch(worker, &task->client, client_events);
+    endpoint_watch(worker, &task->upstream, upstream_events);
+    task_schedule(worker, task);
+}
+
+// ---------- CONNECT ATTEMPTS ----------
+
+static void attempt_close(http_task_t *task, http_endpoint_t *attempt)
+{
+    close_endpoint(attempt);
+    task->attempt_count--;
+}
+
+// closes the attempts still racing
+static void cancel_attempts(http_task_t *task)
+{
+    for (size_t i = 0; i < HTTP_CONNECT_RACE; i++)
+    {
+        if (task->attempts[i].fd >= 0)
+            attempt_close(task, &task->attempts[i]);
+    }
+}
+
+// ---------- TASK LIFETIME ----------
+
+// closes both sockets now; the struct is freed after the event batch,
+// since later events in the same batch may still point at it
+static void close_task(http_worker_t *worker, http_task_t *task)
+{
+    if (task->closed)
+        return;
+
+    close_endpoint(&task->client);
+    close_endpoint(&task->upstream);
+    cancel_attempts(task);
+    relay_release(worker, &task->up);
+    relay_release(worker, &task->down);
+    input_release(worker, &task->request_in);
+    input_release(worker, &task->response_in);
+    head_release(worker, task);
+    http_timer_cancel(&worker->wheel, &task->timer);
+    http_release(&task->client_addr);
+
+    task->closed = true;
+    task->next = worker->closed;
+    worker->closed = task;
+    worker->conn_count--;
+
+    if (worker->accept_paused)
+    {
+        worker->accept_paused = false;
+        endpoint_watch(worker, &worker->listener, EPOLLIN);
+    }
+}
+
+static void free_closed_tasks(http_worker_t *worker)
+{
+    while (worker->closed)
+    {
+        http_task_t *task = worker->closed;
+        worker->closed = task->next;
+        free(task->path);
+        free(task);
+    }
+}
+
+// CLOSING tasks end through linger_event()
+static bool task_finished(const http_task_t *task)
+{
+    if (task->state == HTTP_STATE_RELAY)
+        return task->up.shut && task->down.shut;
+    return false;
+}
+
+// ---------- CONNECT ----------
+// Happy Eyeballs (RFC 8305 section 5): the first address gets a head start
+// of HTTP_CONNECT_DELAY_MS, then the next one joins the race, and so on.
+// The first handshake to finish wins and the others are closed, so a
+// blackholed address costs a quarter second instead of the kernel's SYN
+// retries
+
+// the next address joins the race HTTP_CONNECT_DELAY_MS from now
+static void connect_schedule(http_worker_t *worker, http_task_t *task)
+{
+    task->connect_tick_ms = worker->now_ms + HTTP_CONNECT_DELAY_MS;
+}
+
+// starts a non-blocking connect to the next address that takes one, if
+// there is an address left and room in the race
+// the result shows up as EPOLLOUT on the attempt's socket
+// returns true when an attempt was started
+static bool attempt_next(http_worker_t *worker, http_task_t *task)
+{
+    http_endpoint_t *attempt = NULL;
+    for (size_t i = 0; i < HTTP_CONNECT_RACE && !attempt; i++)
+    {
+        if (task->attempts[i].fd < 0)
+            attempt = &task->attempts[i];
+    }
+    if (!attempt)
+        return false;
+
+    while (task->addr_index < task->addr_count)
+    {
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0)
+        {
+            perror("Failed to create upstream socket");
+            return false;
+        }
+
+        set_nodelay(fd);
+        struct sockaddr_in *addr = &task->addrs[task->addr_index++];
+        if (connect(fd, (struct sockaddr *)addr, sizeof(*addr)) == 0 || errno == EINPROGRESS)
+        {
+            attempt->fd = fd;
+            attempt->hup = false;
+            task->attempt_started_ms[attempt - task->attempts] = worker->now_ms;
+            task->attempt_count++;
+            endpoint_watch(worker, attempt, EPOLLOUT);
+            return true;
+        }
+        close(fd);
+    }
+    return false;
+}
+
+// no attempt left racing and no address left to try
+static void connect_failed(http_task_t *task)
+{
+    fprintf(stderr, "Failed to connect to upstream server %s:%d\n", task->hostname, task->port);
+    send_502_response(task);
+}
+
+// addresses known — starts the race, or answers 502 when there are none
+static void start_connect(http_worker_t *worker, http_task_t *task)
+{
+    task->addr_index = 0;
+    if (task->addr_count == 0)
+    {
+        fprintf(stderr, "No address for upstream server %s\n", task->hostname);
+        send_502_response(task);
+        return;
+    }
+
+    close_endpoint(&task->upstream);
+    task->state = HTTP_STATE_CONNECTING;
+    if (attempt_next(worker, task))
+        connect_schedule(worker, task);
+    else
+        connect_failed(task);
+}
+
+// cached names and IP literals connect straight away; anything else goes to
+// the resolver thread and comes back through the wake fd
+static void resolve_upstream(http_task_t *task)
+{
+    if (http_resolve_cached(task))
+    {
+        start_connect(task->worker, task);
+        return;
+    }
+
+    task->state = HTTP_STATE_RESOLVING;
+    http_timer_cancel(&task->worker->wheel, &task->timer);
+    http_resolve_async(task);
+}
+
+// one attempt's handshake finished, one way or the other
+static void connect_done(http_worker_t *worker, http_task_t *task, http_endpoint_t *attempt)
+{
+    int error = 0;
+    socklen_t error_len = sizeof(error);
+    if (getsockopt(attempt->fd, SOL_SOCKET, SO_ERROR, &error, &error_len) < 0)
+        error = errno;
+
+    if (error == EINPROGRESS || error == EALREADY)
+        return;
+    if (error != 0)
+    {
+        // a refused or unreachable address hands its turn to the next one now
+        attempt_close(task, attempt);
+        if (attempt_next(worker, task))
+            connect_schedule(worker, task);
+        else if (task->attempt_count == 0)
+            connect_failed(task);
+        return;
+    }
+
+    // --- the winner becomes the upstream, the rest are dropped ---
+    endpoint_watch(worker, attempt, 0);
+    task->upstream.fd = attempt->fd;
+    attempt->fd = -1;
+    task->attempt_count--;
+    cancel_attempts(task);
+
+    if (strcasecmp(task->method, "CONNECT") == 0)
+        handle_connect_tunnel(task);
+    else
+        forward_request(task);
+}
+
+// a task's tick came up: attempts past HTTP_CONNECT_TIMEOUT_MS give up, and
+// the next address joins the race
+static void connect_tick(http_worker_t *worker, http_task_t *task)
+{
+    for (size_t i = 0; i < HTTP_CONNECT_RACE; i++)
+    {
+        if (task->attempts[i].fd >= 0 &&
+            worker->now_ms - task->attempt_started_ms[i] >= HTTP_CONNECT_TIMEOUT_MS)
+            attempt_close(task, &task->attempts[i]);
+    }
+
+    attempt_next(worker, task);
+    if (task->attempt_count > 0)
+        connect_schedule(worker, task);
+    else
+        connect_failed(task);
+}
+
+// ---------- EXCHANGE ----------
+// one request / response pair over a connection that outlives it: the
+// request goes up in origin form, the response comes back with its
+// framing intact, and both ends are kept for the next one when they can be
+
+// final response headers read — rewrites them for the client and works out
+// how the body ends and whether either connection survives it
+// returns 0 on success, -1 on a response the proxy can't pass on
+static int begin_response(http_worker_t *worker, http_task_t *task)
+{
+    http_input_t *response = &task->response_in;
+    const char *block = response->data;
+    size_t block_len = task->response_header_len;
+
+    // --- status line + headers ---
+    http_message_t head;
+    if (http_parse_response(block, block_len, &head) < 0)
+    {
+        fprintf(stderr, "Malformed response headers from %s\n", task->hostname);
+        return -1;
+    }
+    int status = head.status;
+
+    // --- interim responses: pass them on, the final one follows ---
+    if (status >= 100 && status < 200 && status != 101)
+    {
+        if (relay_queue(worker, &task->down, block, block_len) < block_len)
+            return -1;
+        response->used = block_len;
+        input_consume(worker, response);
+        return 0;
+    }
+
+    // --- 101 Switching Protocols: both sides now speak something else ---
+    if (status == 101)
+    {
+        if (!task->upgrade_request)
+            return -1;
+
+        http_input_t *request = &task->request_in;
+        if (relay_queue(worker, &task->down, block, response->len) < response->len ||
+            relay_queue(worker, &task->up, request->data + request->used, request->len - request->used) <
+                request->len - request->used)
+            return -1;
+
+        input_release(worker, response);
+        input_release(worker, request);
+        task->response_headers_done = true;
+        task->client_keep_alive = false;
+        task->state = HTTP_STATE_RELAY;
+        task->relay_started_ms = worker->now_ms;
+        return 0;
+    }
+
+    // --- body framing (RFC 7230 section 3.3.3) ---
+    if (body_framing(&head, &task->response_body) < 0)
+        return -1;
+    if (task->head_request || status == 204 || status == 304)
+        task->response_body = (http_body_t){ .framing = HTTP_BODY_NONE, .done = true };
+    else if (task->response_body.framing == HTTP_BODY_NONE)
+        task->response_body = (http_body_t){ .framing = HTTP_BODY_CLOSE };
+
+    bool close_delimited = (task->response_body.framing == HTTP_BODY_CLOSE);
+    task->upstream_keep_alive = !close_delimited &&
+        (head.minor_version >= 1 ? !http_has_token(&head, "Connection", "close")
+                                 : http_has_token(&head, "Connection", "keep-alive"));
+    if (close_delimited)
+        task->client_keep_alive = false;   // the close is how the client sees the end
+
+    // --- status line + end-to-end headers ---
+    char out[HTTP_BUFFER_SIZE];
+    int status_len = snprintf(out, sizeof(out), "HTTP/1.%d %03d %.*s\r\n", head.minor_version, status,
+                              (int)head.reason_len, head.reason);
+    if (status_len < 0 || (size_t)status_len >= sizeof(out))
+        return -1;
+    size_t len = (size_t)status_len;
+
+    static const char close_header[] = "Connection: close\r\n";
+    bool drop_length = http_find_header(&head, "Transfer-Encoding") != NULL;
+    ssize_t copied = -1;
+    if (len + sizeof(close_header) + 2 <= sizeof(out))
+        copied = copy_end_to_end_headers(&head, false, drop_length, out + len,
+                                         sizeof(out) - len - sizeof(close_header) - 2);
+    if (copied < 0)
+        return -1;
+    len += (size_t)copied;
+    if (!task->client_keep_alive)
+    {
+        memcpy(out + len, close_header, sizeof(close_header) - 1);
+        len += sizeof(close_header) - 1;
+    }
+    memcpy(out + len, "\r\n", 2);
+    len += 2;
+
+    if (relay_queue(worker, &task->down, out, len) < len)
+        return -1;
+    response->used = block_len;
+    task->response_headers_done = true;
+    return 0;
+}
+
+// reads the response headers, then streams the body to the client
+// returns 0 on progress or nothing to do yet, -1 on error / early close
+static int response_pump(http_worker_t *worker, http_task_t *task)
+{
+    while (!task->response_headers_done)
+    {
+        int status = recv_http_response(task);
+        if (status <= 0)
+            return status;
+        if (begin_response(worker, task) < 0)
+            return -1;
+    }
+    if (task->state != HTTP_STATE_EXCHANGE)
+        return 0;   // upgraded
+    return body_pump(worker, task->upstream.fd, &task->response_in, &task->down, &task->response_body);
+}
+
+// true when a failed exchange can go again, on a fresh upstream connection
+static bool can_retry(const http_task_t *task)
+{
+    return task->upstream_reused && !task->response_started && task->request_body.framing == HTTP_BODY_NONE;
+}
+
+// the upstream failed or closed mid-exchange
+// a pooled connection the origin timed out just before it was reused is
+// retried on a fresh one, as long as nothing of the response arrived and
+// the request can be sent again in full
+// returns 0 when the task carries on, -1 to close it
+static int upstream_failed(http_worker_t *worker, http_task_t *task)
+{
+    if (task->response_headers_done)
+        return -1;  // the client already has part of the response
+
+    bool retry = can_retry(task);
+    close_endpoint(&task->upstream);
+    relay_release(worker, &task->up);
+    input_release(worker, &task->response_in);
+    task->upstream_reused = false;
+
+    if (retry)
+        resolve_upstream(task);
+    else
+    {
+        fprintf(stderr, "Upstream %s:%d failed before responding\n", task->hostname, task->port);
+        send_502_response(task);
+    }
+    return 0;
+}
+
+// response fully written — parks the upstream in the pool when it can take
+// another request, then waits for the client's next request or closes
+// returns 0 when the task carries on, -1 to close it
+static int exchange_finish(http_worker_t *worker, http_task_t *task)
+{
+    http_input_t *response = &task->response_in;
+
+    // --- upstream: reusable only at a clean message boundary ---
+    if (task->upstream_keep_alive && task->request_body.done && !task->upstream.hup &&
+        !relay_pending(&task->up) && response->used == response->len)
+    {
+        endpoint_watch(worker, &task->upstream, 0);
+        http_pool_put(worker, task->upstream.fd, task->hostname, task->port);
+        task->upstream.fd = -1;
+    }
+    else
+        close_endpoint(&task->upstream);
+
+    relay_release(worker, &task->up);
+    input_release(worker, response);
+    head_release(worker, task);
+    task->upstream_reused = false;
+
+    // --- client: an unread body leaves no boundary to start the next request at ---
+    if (!task->client_keep_alive || !task->request_body.done)
+    {
+        task->state = HTTP_STATE_CLOSING;
+        return 0;
+    }
+
+    input_consume(worker, &task->request_in);
+    task->state = HTTP_STATE_READ_REQUEST;
+    task->request_deadline_ms = worker->now_ms + HTTP_HEADER_TIMEOUT_MS;
+
+    // a pipelined request may already be buffered
+    int status = recv_http_request(task);
+    if (status > 0)
+        handle_http_request(task);
+    return (status < 0) ? -1 : 0;
+}
+
+// request body up, response down; either endpoint's event drives both,
+// since bytes read from one side can usually be written to the other at once
+// returns 0 when the task carries on, -1 to close it
+static int exchange_event(http_worker_t *worker, http_task_t *task, bool from_client, uint32_t revents)
+{
+    bool readable = (revents & (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0;
+    http_input_t *request = &task->request_in;
+    http_input_t *response = &task->response_in;
+
+    // --- client → upstream ---
+    // an upstream that answers early (a 413, a 401) may stop reading the body
+    // or reset; the rest of the body is then left unread, and the response
+    // still comes through
+    if (!task->upload_stopped)
+    {
+        if ((from_client && readable && !task->request_body.done) || body_buffered(request, &task->request_body))
+        {
+            if (body_pump(worker, task->client.fd, request, &task->up, &task->request_body) < 0)
+                return -1;
+        }
+        if (relay_write(worker, task->upstream.fd, &task->up) < 0)
+        {
+            if (can_retry(task))
+                return upstream_failed(worker, task);
+            relay_release(worker, &task->up);
+            task->upload_stopped = true;
+        }
+    }
+
+    // --- upstream → client ---
+    if (!response_complete(task) && ((!from_client && readable) || response->used < response->len))
+    {
+        if (response_pump(worker, task) < 0)
+            return upstream_failed(worker, task);
+        if (task->state != HTTP_STATE_EXCHANGE)
+            return 0;
+    }
+    if (relay_write(worker, task->client.fd, &task->down) < 0)
+        return -1;
+
+    if (response_complete(task) && !relay_pending(&task->down))
+        return exchange_finish(worker, task);
+    return 0;
+}
+
+// ---------- CLOSING ----------
+
+// flushes the final response, then half-closes and drops whatever the client
+// still sends until it closes too. Closing with unread bytes (a body the
+// upstream refused, a blocked upload) would send an RST, and the RST throws
+// away response bytes the client hasn't read yet (RFC 7230 section 6.6).
+// Reads don't count as activity, so the idle sweep bounds the wait
+// returns 0 to keep waiting, -1 to close
+static int linger_event(http_worker_t *worker, http_task_t *task)
+{
+    if (relay_write(worker, task->client.fd, &task->down) < 0)
+        return -1;
+    if (relay_pending(&task->down))
+        return 0;
+
+    if (!task->lingering)
+    {
+        if (shutdown(task->client.fd, SHUT_WR) < 0)
+            return -1;
+        task->lingering = true;
+    }
+
+    char discard[HTTP_BUFFER_SIZE];
+    while (1)
+    {
+        ssize_t bytes = recv(task->client.fd, discard, sizeof(discard), 0);
+        if (bytes > 0)
+            continue;
+        if (bytes < 0 && would_block())
+            return 0;
+        return -1;  // the client closed too
+    }
+}
+
+// ---------- TUNNEL CLIENTHELLO ----------
+// a CONNECT tunnel holds the client's first bytes until they show whether a
+// TLS ClientHello opens it, which then goes through the Layer 6 policy (SNI
+// against the blocklist, version, ALPN) right here — a block closes the
+// tunnel before a byte of it reaches the server. Anything that isn't TLS
+// passes untouched
+
+// what's held so far is enough to decide on
+// returns 0 when the tunnel carries on (or is still waiting), -1 to close it
+static int hello_check(http_worker_t *worker, http_task_t *task)
+{
+    http_input_t *held = &task->request_in;
+    unsigned char *data = (unsigned char *)held->data;
+    int len = (int)held->len;
+    if (len == 0)
+        return 0;
+
+    // --- a TLS record still arriving is worth the wait, if it fits ---
+    int record = tls_record_size(data, len);
+    bool fits = (len < HTTP_BUFFER_SIZE - 1);
+    if (data[0] == TLS_CONTENT_TYPE_HANDSHAKE && (record == 0 || len < record) && fits)
+        return 0;
+
+    tls_hello_t hello = { 0 };
+    if (parse_client_hello(data, len, &hello))
+    {
+        tls_hello_verdict(&hello);
+        log_tls_decision(&hello, task);
+        if (tls_verdict_blocks(hello.verdict))
+            return -1;
+    }
+    else if (is_tls_client_hello(data, len))
+    {
+        // more than a relay buffer — judged on the SNI in what is held,
+        // refused when there is none in it
+        tls_prefix_verdict(data, len, record, &hello);
+        log_tls_decision(&hello, task);
+        if (tls_verdict_blocks(hello.verdict))
+            return -1;
+    }
+
+    // --- hand what was held to the tunnel ---
+    relay_queue(worker, &task->up, held->data, held->len);
+    input_release(worker, held);
+    task->hello_pending = false;
+    return 0;
+}
+
+// the client sent more while the tunnel holds its first bytes
+// returns 0 to carry on, -1 to close the tunnel
+static int hello_read(http_worker_t *worker, http_task_t *task)
+{
+    ssize_t bytes = input_fill(worker, task->client.fd, &task->request_in);
+    if (bytes == 0)
+        return -1;  // gone in the middle of a ClientHello
+    if (bytes < 0 && !would_block())
+        return -1;
+    return hello_check(worker, task);
+}
+
+// ---------- EVENTS ----------
+
+static void accept_clients(http_worker_t *worker)
+{
+    while (1)
+    {
+        struct sockaddr_in client_addr;
+        socklen_t client_len = sizeof(client_addr);
+        int client_fd = accept4(worker->listener.fd, (struct sockaddr *)&client_addr, &client_len,
+                                SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_fd < 0)
+        {
+            if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM)
+            {
+                // The listener would stay readable and spin — mute it until a connection closes
+                perror("Failed to accept incoming connection");
+                if (worker->conn_count > 0)
+                {
+                    worker->accept_paused = true;
+                    endpoint_watch(worker, &worker->listener, 0);
+                }
+            }
+            else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNABORTED)
+                perror("Failed to accept incoming connection");
+            return;
+        }
+
+        // --- admission: per-client and overall caps ---
+        // turned away before anything is allocated, so a flood costs an
+        // accept and a close
+        http_evict_t refused;
+        if (!http_admit(&client_addr, &refused))
+        {
+            count_eviction(worker, refused);
+            close(client_fd);
+            continue;
+        }
+
+        set_nodelay(client_fd);
+
+        // --- allocate task ---
+        http_task_t *task = calloc(1, sizeof(http_task_t));
+        if (!task)
+        {
+            perror("Failed to allocate memory for HTTP task");
+            http_release(&client_addr);
+            close(client_fd);
+            continue;
+        }
+
+        // --- fill in task fields ---
+        task->client = (http_endpoint_t){ .fd = client_fd, .kind = HTTP_EV_CLIENT, .task = task };
+        task->upstream = (http_endpoint_t){ .fd = -1, .kind = HTTP_EV_UPSTREAM, .task = task };
+        for (size_t i = 0; i < HTTP_CONNECT_RACE; i++)
+            task->attempts[i] = task->upstream;
+        task->up.pipe = task->down.pipe = (http_pipe_t){ .read_fd = -1, .write_fd = -1 };
+        task->client_addr = client_addr;
+        task->worker = worker;
+        task->state = HTTP_STATE_READ_REQUEST;
+        task->request_deadline_ms = worker->now_ms + HTTP_HEADER_TIMEOUT_MS;
+        task->timer.data = task;
+        worker->conn_count++;
+
+        idle_touch(worker, task);
+        update_interest(worker, task);
+    }
+}
+
+// resolver threads push finished tasks onto the worker's list and poke its eventfd
+static void take_resolved(http_worker_t *worker)
+{
+    uint64_t count;
+    while (read(worker->wake.fd, &count, sizeof(count)) > 0)
+        ;
+
+    pthread_mutex_lock(&worker->resolved_lock);
+    http_task_t *task = worker->resolved;
+    worker->resolved = NULL;
+    pthread_mutex_unlock(&worker->resolved_lock);
+
+    while (task)
+    {
+        http_task_t *next = task->next;
+        task->next = NULL;
+        idle_touch(worker, task);
+
+        start_connect(worker, task);
+
+        if (task_finished(task))
+            close_task(worker, task);
+        else
+            update_interest(worker, task);
+        task = next;
+    }
+}
+
+static void task_event(http_worker_t *worker, http_endpoint_t *endpoint, uint32_t revents)
+{
+    http_task_t *task = endpoint->task;
+    if (task->closed || endpoint->fd < 0)
+        return;     // closed or pooled earlier in this batch
+
+    bool from_client = (endpoint->kind == HTTP_EV_CLIENT);
+    int status = 0;
+
+    if (!from_client && task->state == HTTP_STATE_CONNECTING)
+    {
+        connect_done(worker, task, endpoint);
+    }
+    else if ((revents & EPOLLERR) && (from_client || task->state != HTTP_STATE_EXCHANGE))
+    {
+        status = -1;
+    }
+    else
+    {
+        // an upstream reset mid-exchange can still have its response queued
+        // ahead of the error — exchange_event() reads that first
+        if (revents & (EPOLLHUP | EPOLLERR))
+            endpoint->hup = true;
+
+        switch (task->state)
+        {
+            case HTTP_STATE_READ_REQUEST:
+                status = recv_http_request(task);
+                if (status > 0)
+                {
+                    status = 0;
+                    handle_http_request(task);
+                }
+                break;
+
+            case HTTP_STATE_EXCHANGE:
+                status = exchange_event(worker, task, from_client, revents);
+                break;
+
+            case HTTP_STATE_RELAY:
+            {
+                // read what arrived, then hand it on right away — the other
+                // side is usually writable, which saves a trip through epoll
+                http_relay_t *in = from_client ? &task->up : &task->down;
+                http_relay_t *out = from_client ? &task->down : &task->up;
+                int peer_fd = from_client ? task->upstream.fd : task->client.fd;
+
+                if ((revents & (EPOLLIN | EPOLLHUP)) && relay_has_room(in))
+                    status = (from_client && task->hello_pending) ? hello_read(worker, task)
+                                                                 : relay_read(worker, endpoint->fd, in);
+                if (status == 0)
+                    status = relay_write(worker, peer_fd, in);
+                if (status == 0 && (revents & EPOLLOUT))
+                    status = relay_write(worker, endpoint->fd, out);
+                break;
+            }
+
+            case HTTP_STATE_CLOSING:
+                status = endpoint->hup ? -1 : linger_event(worker, task);
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    if (status < 0 || task_finished(task))
+    {
+        close_task(worker, task);
+        return;
+    }
+    // a lingering client gets no more time for sending — the idle sweep ends it
+    if (task->state != HTTP_STATE_RESOLVING && !task->lingering)
+        idle_touch(worker, task);
+    update_interest(worker, task);
+}
+
+// a task's timer came up: the connect race ticks, then whatever deadline
+// has passed closes it; otherwise it is re-armed for the next one
+static void task_timer(http_worker_t *worker, http_task_t *task)
+{
+    if (task->state == HTTP_STATE_CONNECTING && task->connect_tick_ms <= worker->now_ms)
+        connect_tick(worker, task);
+
+    http_evict_t reason;
+    if (task_deadline(task, &reason) <= worker->now_ms)
+    {
+        count_eviction(worker, reason);
+        close_task(worker, task);
+        return;
+    }
+    update_interest(worker, task);
+}
+
+static void expire_timers(http_worker_t *worker)
+{
+    http_timer_t *timer;
+    while ((timer = http_wheel_expire(&worker->wheel, worker->now_ms)) != NULL)
+        task_timer(worker, (http_task_t *)timer->data);
+}
+
+static void *worker_loop(void *arg)
+{
+    http_worker_t *worker = (http_worker_t *)arg;
+    struct epoll_event events[HTTP_MAX_EVENTS];
+    long long pool_wait = -1;
+
+    while (1)
+    {
+        // --- sleep until an event, a task's timer or a pooled connection expires ---
+        long long wait = pool_wait;
+        long long timer_wait = http_wheel_next_ms(&worker->wheel, now_ms());
+        if (timer_wait >= 0 && (wait < 0 || timer_wait < wait))
+            wait = timer_wait;
+        int timeout_ms = (wait < 0) ? -1 : (wait > 0) ? (int)wait : 0;
+
+        int count = epoll_wait(worker->epoll_fd, events, HTTP_MAX_EVENTS, timeout_ms);
+        if (count < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait failed");
+            break;
+        }
+        worker->now_ms = now_ms();
+
+        for (int i = 0; i < count; i++)
+        {
+            http_endpoint_t *endpoint = (http_endpoint_t *)events[i].data.ptr;
+            switch (endpoint->kind)
+            {
+                case HTTP_EV_LISTEN:    accept_clients(worker); break;
+                case HTTP_EV_WAKE:      take_resolved(worker); break;
+                case HTTP_EV_POOLED:    http_pool_event(worker, endpoint); break;
+                default:                task_event(worker, endpoint, events[i].events); break;
+            }
+        }
+
+        expire_timers(worker);
+        pool_wait = http_pool_sweep(worker);
+        free_closed_tasks(worker);
+    }
+
+    return NULL;
+}
+
+// ---------- STARTUP ----------
+
+// thousands of connections means thousands of fds — lift the soft limit to the hard one
+static void raise_fd_limit(void)
+{
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
+    {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+
+static int init_worker(http_worker_t *worker)
 {
     // --- create TCP socket ---
-    int server_fd = socket(AF_INET, SOCK_STREAM, 0);
+    int server_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
     if (server_fd < 0)
     {
         perror("Failed to create TCP socket");
-        exit(1);
+        return -1;
     }
 
-    // --- SO_REUSEADDR ---
+    // --- SO_REUSEADDR + SO_REUSEPORT: one listener per event loop on the same port ---
     int opt = 1;
-    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0)
+    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0 ||
+        setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0)
     {
-        perror("Failed to set SO_REUSEADDR");
+        perror("Failed to set SO_REUSEADDR / SO_REUSEPORT");
         close(server_fd);
-        exit(1);
+        return -1;
     }
 
     // --- build server_addr struct ---
@@ -32,72 +1457,150 @@ void start_proxy_server()
     server_addr.sin_port = htons(HTTP_PORT);
     server_addr.sin_addr.s_addr = INADDR_ANY;
 
-    // --- bind ---
-    // man 2 bind — same as DNS
+    // --- bind + listen ---
     if (bind(server_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0)
     {
         perror("Failed to bind TCP socket");
         close(server_fd);
-        exit(1);
+        return -1;
     }
-
-    // --- listen ---
     if (listen(server_fd, MAX_PENDING_CONNECTIONS) < 0)
     {
         perror("Failed to listen on TCP socket");
         close(server_fd);
-        exit(1);
+        return -1;
     }
 
-    printf("[LAYER_7] [HTTP] Listening on 0.0.0.0:%d\n", HTTP_PORT);
+    // --- epoll set with the listener and the resolver wake-up ---
+    worker->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    int wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (worker->epoll_fd < 0 || wake_fd < 0)
+    {
+        perror("Failed to create event loop");
+        close(server_fd);
+        return -1;
+    }
 
-    // --- accept loop ---
-    while (1)
+    worker->pool = calloc(1, sizeof(http_pool_t));
+    if (!worker->pool)
     {
-        struct sockaddr_in client_addr;
-        socklen_t client_len = sizeof(client_addr);
-        int client_fd = accept(server_fd, (struct sockaddr *)&client_addr, &client_len);
+        perror("Failed to allocate upstream connection pool");
+        close(server_fd);
+        return -1;
+    }
 
-        if (client_fd < 0)
-        {
-            perror("Failed to accept incoming connection");
-            continue; // Try accepting the next connection
-        }
+    worker->now_ms = now_ms();
+    http_wheel_init(&worker->wheel, worker->now_ms);
+    worker->listener = (http_endpoint_t){ .fd = server_fd, .kind = HTTP_EV_LISTEN };
+    worker->wake = (http_endpoint_t){ .fd = wake_fd, .kind = HTTP_EV_WAKE };
+    pthread_mutex_init(&worker->resolved_lock, NULL);
+    endpoint_watch(worker, &worker->listener, EPOLLIN);
+    endpoint_watch(worker, &worker->wake, EPOLLIN);
+    return 0;
+}
 
-        // --- allocate task ---
-        http_task_t *task = calloc(1, sizeof(http_task_t));
-        if (!task)
-        {
-            perror("Failed to allocate memory for HTTP task");
-            close(client_fd);
-            continue;
-        }
+// open connections and why connections were turned away or cut short,
+// summed over the event loops
+static void dump_stats(FILE *out)
+{
+    static const char *const names[HTTP_EVICT_COUNT] = {
+        [HTTP_EVICT_CLIENT_CAP]         = "refused_client_cap",
+        [HTTP_EVICT_GLOBAL_CAP]         = "refused_global_cap",
+        [HTTP_EVICT_HEADER_TIMEOUT]     = "header_timeout",
+        [HTTP_EVICT_IDLE]               = "idle_timeout",
+        [HTTP_EVICT_TUNNEL_IDLE]        = "tunnel_idle",
+        [HTTP_EVICT_TUNNEL_LIFETIME]    = "tunnel_lifetime",
+    };
+
+    size_t connections, clients;
+    http_admitted(&connections, &clients);
+    fprintf(out, "[LAYER_7] [HTTP] [STATS] connections=%zu clients=%zu", connections, clients);
+    for (int reason = 0; reason < HTTP_EVICT_COUNT; reason++)
+    {
+        uint64_t total = 0;
+        for (size_t i = 0; i < g_worker_count; i++)
+            total += __atomic_load_n(&g_workers[i].evicted[reason], __ATOMIC_RELAXED);
+        fprintf(out, " %s=%llu", names[reason], (unsigned long long)total);
+    }
+    fprintf(out, "\n");
+    fflush(out);
+}
 
-        // --- fill in task fields ---
-        task->client_socket = client_fd;
-        task->client_addr = client_addr;
+void start_proxy_server(const char *dns_server)
+{
+    // a peer resetting mid-relay must fail the send, not kill the process
+    signal(SIGPIPE, SIG_IGN);
+    raise_fd_limit();
+
+    // SIGUSR1 asks for the stats; blocked before any thread starts, so only
+    // the sigwait() below ever takes it
+    sigset_t stats_signal;
+    sigemptyset(&stats_signal);
+    sigaddset(&stats_signal, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &stats_signal, NULL);
+
+    if (http_resolver_start(dns_server) != 0)
+        exit(1);
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    g_worker_count = (cpus < 1) ? 1 : (cpus > HTTP_MAX_WORKERS) ? HTTP_MAX_WORKERS : (size_t)cpus;
+
+    // --- bind every listener before any loop starts, so a busy port fails fast ---
+    for (size_t i = 0; i < g_worker_count; i++)
+    {
+        if (init_worker(&g_workers[i]) != 0)
+            exit(1);
+    }
+
+    printf("[LAYER_7] [HTTP] Listening on 0.0.0.0:%d (%zu event loops)\n", HTTP_PORT, g_worker_count);
 
-        // --- spawn thread ---
-        pthread_t thread_id;
-        if (pthread_create(&thread_id, NULL, handle_http_request, task) != 0)
+    for (size_t i = 0; i < g_worker_count; i++)
+    {
+        if (pthread_create(&g_workers[i].thread, NULL, worker_loop, &g_workers[i]) != 0)
         {
-            perror("Failed to create HTTP task thread");
-            free(task);
-            close(client_fd);
-            continue;
+            perror("Failed to create HTTP event loop thread");
+            exit(1);
         }
-        pthread_detach(thread_id);
     }
+
+    int sig;
+    while (sigwait(&stats_signal, &sig) == 0)
+        dump_stats(stdout);
+}
+
+void http_task_resolved(http_task_t *task)
+{
+    http_worker_t *worker = task->worker;
+
+    pthread_mutex_lock(&worker->resolved_lock);
+    task->next = worker->resolved;
+    worker->resolved = task;
+    pthread_mutex_unlock(&worker->resolved_lock);
+
+    uint64_t one = 1;
+    if (write(worker->wake.fd, &one, sizeof(one)) < 0)
+        perror("Failed to wake HTTP event loop");
 }
 
-int recv_http_request(int client_fd, char *buffer, int buffer_size)
+// ---------- REQUESTS ----------
+
+int recv_http_request(http_task_t *task)
 {
-    int total = 0;
+    http_input_t *request = &task->request_in;
 
-    while (total < buffer_size - 1) // leave space for null terminator
+    while (1)
     {
+        // a pipelined request may already be buffered in full; otherwise the
+        // search carries on from where the last read ended
+        size_t head_len = request->data ? http_find_head_end(request->data, request->len, &request->scanned) : 0;
+        if (head_len > 0) // Found end of headers
+        {
+            task->header_len = head_len;
+            return 1;
+        }
+
         // --- recv from client ---
-        ssize_t bytes = recv(client_fd, buffer + total, buffer_size - total - 1, 0);
+        ssize_t bytes = input_fill(task->worker, task->client.fd, request);
         if (bytes == 0)
         {
             // client closed connection gracefully
@@ -105,512 +1608,378 @@ int recv_http_request(int client_fd, char *buffer, int buffer_size)
         }
         else if (bytes < 0)
         {
-            // actual error
-            perror("Error receiving HTTP request");
+            if (would_block())
+                return 0;   // rest of the headers still on the way
+            if (errno != EMSGSIZE)
+                perror("Error receiving HTTP request");
             return -1;
         }
-        
-        total += bytes;
-        buffer[total] = '\0'; // null terminate for string functions
-
-        if (strstr(buffer, "\r\n\r\n") != NULL) // Found end of headers
-            return total;
     }
-
-    return -1;
 }
 
-int parse_http_request(char *buffer, http_task_t *task)
+int recv_http_response(http_task_t *task)
 {
-    char method[MAX_METHOD_LENGTH];
-    char url[MAX_HOSTNAME_LENGTH + MAX_PATH_LENGTH]; 
-    char version[MAX_VERSION_LENGTH];
+    http_input_t *response = &task->response_in;
 
-    // --- parse request line ---
-    if (sscanf(buffer, "%s %s %s", method, url, version) < 2)
+    while (1)
     {
-        fprintf(stderr, "Failed to parse HTTP request line\n");
-        return -1;
+        size_t head_len = response->data ? http_find_head_end(response->data, response->len, &response->scanned) : 0;
+        if (head_len > 0)
+        {
+            task->response_header_len = head_len;
+            return 1;
+        }
+
+        ssize_t bytes = input_fill(task->worker, task->upstream.fd, response);
+        if (bytes > 0)
+            task->response_started = true;
+        else if (bytes == 0)
+            return -1;  // closed before the headers were through
+        else
+            return would_block() ? 0 : -1;
     }
+}
 
-    // copy method into task->method
-    strncpy(task->method, method, MAX_METHOD_LENGTH - 1);
-    task->method[MAX_METHOD_LENGTH - 1] = '\0';
+// "host[:port]" into task->hostname (lowercased) and task->port
+// returns 0 on success, -1 on an empty / oversized host, odd characters or a bad port
+static int set_authority(http_task_t *task, const char *authority, size_t len, int default_port)
+{
+    const char *colon = memchr(authority, ':', len);
+    size_t host_len = colon ? (size_t)(colon - authority) : len;
+    if (host_len == 0 || host_len >= MAX_HOSTNAME_LENGTH)
+        return -1;
 
-    // --- extract path from url ---
-    // Case 1: Absolute URI (proxy request) — starts with "http://"
-    if (strncmp(url, "http://", 7) == 0) // absolute URI (proxy request)
+    // an empty port means the default (RFC 3986 section 3.2.3)
+    task->port = default_port;
+    if (colon && colon + 1 < authority + len)
     {
-        // skip "http://"
-        char *hostname_ptr = &url[0] + 7;
-
-        // find the first "/" after the host
-        char *path_start = strchr(hostname_ptr, '/');
-        if (!path_start)
-            path_start = "/";
+        long port = 0;
+        for (const char *digit = colon + 1; digit < authority + len; digit++)
+        {
+            if (*digit < '0' || *digit > '9' || (port = port * 10 + (*digit - '0')) > 65535)
+                return -1;
+        }
+        if (port == 0)
+            return -1;
+        task->port = (int)port;
+    }
 
-        strncpy(task->path, path_start, MAX_PATH_LENGTH - 1);
-        task->path[MAX_PATH_LENGTH - 1] = '\0';
+    // --- lowercase the host ---
+    // letters, digits, '-', '.', '_' only — IPv6 literals and userinfo aren't supported
+    for (size_t i = 0; i < host_len; i++)
+    {
+        unsigned char c = (unsigned char)authority[i];
+        if (!isalnum(c) && c != '-' && c != '.' && c != '_')
+            return -1;
+        task->hostname[i] = (char)tolower(c);
     }
-    else // case 2: Origin Form (normal request) — starts with "/"
+    task->hostname[host_len] = '\0';
+    return 0;
+}
+
+int parse_http_request(const char *buffer, size_t len, http_task_t *task, http_message_t *head)
+{
+    // --- parse request line + headers ---
+    if (http_parse_request(buffer, len, head) < 0)
     {
-        strncpy(task->path, url, MAX_PATH_LENGTH - 1);
-        task->path[MAX_PATH_LENGTH - 1] = '\0';
+        fprintf(stderr, "Failed to parse HTTP request\n");
+        return -1;
     }
 
-    // --- find the Host header ---
-    char *host_start = NULL;
-    char *line = buffer;
-    while (line && *line)
+    // copy method into task->method
+    if (head->method_len >= MAX_METHOD_LENGTH)
     {
-        char *next = strstr(line, "\r\n");
-        if (strncasecmp(line, "Host:", 5) == 0)
-        {
-            host_start = line + 5;
-            while (*host_start == ' ' || *host_start == '\t')
-                host_start++;
-            break;
-        }
-        if (!next) break;
-        line = next + 2;
+        fprintf(stderr, "HTTP method too long\n");
+        return -1;
     }
-    if (host_start == NULL)
+    memcpy(task->method, head->method, head->method_len);
+    task->method[head->method_len] = '\0';
+    bool connect = (strcmp(task->method, "CONNECT") == 0);
+
+    // --- where the request goes ---
+    // Case 1: CONNECT — the target is the authority itself ("example.com:443")
+    // Case 2: Absolute URI (proxy request) — its authority wins over Host (RFC 7230 section 5.4)
+    // Case 3: Origin Form (normal request) — starts with "/", Host names the server
+    const char *target = head->target;
+    size_t target_len = head->target_len;
+    const char *path = target;
+    size_t path_len = target_len;
+    int routed;
+
+    if (connect)
     {
-        // HTTP/1.0 CONNECT may not include Host header
-        // extract host from the URL directly for CONNECT
-        if (strcasecmp(method, "CONNECT") == 0)
-        {
-            // URL is "127.0.0.1:22" — parse it directly
-            strncpy(task->hostname, url, MAX_HOSTNAME_LENGTH - 1);
-            task->hostname[MAX_HOSTNAME_LENGTH - 1] = '\0';
-
-            // strip port
-            char *colon = strchr(task->hostname, ':');
-            if (colon != NULL)
-            {
-                char *endptr;
-                long port = strtol(colon + 1, &endptr, 10);
-                if (*endptr == '\0' && port > 0 && port <= 65535)
-                    task->port = (int)port;
-                else
-                    task->port = 443;
-                *colon = '\0';
-            }
-            else
-                task->port = 443;
-
-            // --- lowercase the host ---
-            for (int i = 0; task->hostname[i]; i++)
-                task->hostname[i] = (char)tolower((unsigned char)task->hostname[i]);
-
-            return 0;
-        }
-        else
+        routed = set_authority(task, target, target_len, 443);
+        path_len = 0;
+    }
+    else if (target_len >= 7 && strncasecmp(target, "http://", 7) == 0)
+    {
+        // the path starts at the first "/" after the host — or at the query,
+        // which then gets the "/" the origin form needs
+        const char *authority = target + 7;
+        const char *end = target + target_len;
+        path = authority;
+        while (path < end && *path != '/' && *path != '?')
+            path++;
+        path_len = (size_t)(end - path);
+        routed = set_authority(task, authority, (size_t)(path - authority), 80);
+    }
+    else
+    {
+        const http_header_t *host = http_find_header(head, "Host");
+        if (!host)
         {
             fprintf(stderr, "Host header not found in HTTP request\n");
             return -1;
         }
+        bool asterisk = (target_len == 1 && *target == '*' && strcmp(task->method, "OPTIONS") == 0);
+        routed = (*target == '/' || asterisk) ? set_authority(task, host->value, host->value_len, 80) : -1;
     }
-
-    // --- extract hostname ---
-    char *host_end = strstr(host_start, "\r\n"); // end of Host header line
-    if (!host_end)
+    if (routed < 0)
     {
-        fprintf(stderr, "Malformed Host header in HTTP request\n");
+        fprintf(stderr, "Invalid host or request target in HTTP request\n");
         return -1;
     }
-    
-    // check host length and copy into task->hostname
-    int host_len = host_end - host_start;
-    if (host_len <= 0 || host_len >= MAX_HOSTNAME_LENGTH)
+
+    // --- keep the path in origin form ---
+    bool slash = !connect && (path_len == 0 || *path == '?');
+    if (path_len + slash >= MAX_PATH_LENGTH)
     {
-        fprintf(stderr, "Invalid Host header length in HTTP request\n");
+        fprintf(stderr, "Request target too long for %s\n", task->hostname);
         return -1;
     }
-
-    strncpy(task->hostname, host_start, host_len);
-    task->hostname[host_len] = '\0'; // null terminate
-    
-    // --- strip port from host ---
-    char *colon = strchr(task->hostname, ':');
-    if (colon != NULL)
+    task->path = malloc(path_len + slash + 1);
+    if (!task->path)
     {
-        char *endptr;
-        long port = strtol(colon + 1, &endptr, 10);
-        
-        if (*endptr == '\0' && port > 0 && port <= 65535)
-            task->port = (int)port;
-        else
-            task->port = (strcasecmp(task->method, "CONNECT") == 0) ? 443 : 80;  // malformed port — use method default
-        
-        *colon = '\0';  // strip port from hostname
+        perror("Failed to allocate request path");
+        return -1;
     }
-    else
-        task->port = (strcasecmp(task->method, "CONNECT") == 0) ? 443 : 80;
-
-    // --- lowercase the host ---
-    for (int i = 0; task->hostname[i]; i++)
-        task->hostname[i] = (char)tolower((unsigned char)task->hostname[i]);
+    if (slash)
+        task->path[0] = '/';
+    memcpy(task->path + slash, path, path_len);
+    task->path[path_len + slash] = '\0';
 
     return 0;
 }
 
-void send_403_response(int client_fd)
+// puts one of the proxy's own replies in front of the client
+// whatever was read or queued for the upstream is done with by now, so it is dropped
+static void queue_response(http_task_t *task, const char *status, const char *body)
 {
-    const char *body = "<html><body><h1>Blocked by Pi-Blocker</h1></body></html>";
-    int body_len = strlen(body);
+    http_worker_t *worker = task->worker;
+    relay_release(worker, &task->up);
+    input_release(worker, &task->request_in);
+    input_release(worker, &task->response_in);
+    head_release(worker, task);
 
-    // build the full response with snprintf
-    char response[HTTP_BUFFER_SIZE];
+    char response[512];
     int len = snprintf(response, sizeof(response),
-        "HTTP/1.1 403 Forbidden\r\n"
+        "HTTP/1.1 %s\r\n"
         "Content-Type: text/html\r\n"
-        "Content-Length: %d\r\n"
+        "Content-Length: %zu\r\n"
         "Connection: close\r\n"
         "\r\n"
-        "%s", body_len, body);
-
-    // send it
-    if (send(client_fd, response, len, 0) < 0)
-    {
-        perror("Failed to send 403 response");
-        return;
-    }
+        "%s", status, strlen(body), body);
+    if (len > 0 && (size_t)len < sizeof(response))
+        relay_queue(worker, &task->down, response, (size_t)len);
 }
 
-void send_502_response(int client_fd)
+void send_400_response(http_task_t *task)
 {
-    const char *body = "<html><body><h1>Bad Gateway</h1></body></html>";
-    int body_len = strlen(body);
-
-    char response[HTTP_BUFFER_SIZE];
-    int len = snprintf(response, sizeof(response),
-        "HTTP/1.1 502 Bad Gateway\r\n"
-        "Content-Type: text/html\r\n"
-        "Content-Length: %d\r\n"
-        "Connection: close\r\n"
-        "\r\n"
-        "%s", body_len, body);
-
-    if (send(client_fd, response, len, 0) < 0)
-    {
-        perror("Failed to send 502 response");
-        return;
-    }
+    queue_response(task, "400 Bad Request", "<html><body><h1>Bad Request</h1></body></html>");
+    task->state = HTTP_STATE_CLOSING;
 }
 
-void forward_request(http_task_t *task, char *buffer, int buffer_len)
+void send_403_response(http_task_t *task)
 {
-    // --- set up hints struct ---
-    struct addrinfo hints;
-    struct addrinfo *results;
+    queue_response(task, "403 Forbidden", "<html><body><h1>Blocked by Pi-Blocker</h1></body></html>");
+    task->state = HTTP_STATE_CLOSING;
+}
 
-    memset(&hints, 0, sizeof(struct addrinfo));
-    hints.ai_family   = AF_INET;
-    hints.ai_socktype = SOCK_STREAM;
-    hints.ai_protocol = IPPROTO_TCP;
+void send_502_response(http_task_t *task)
+{
+    queue_response(task, "502 Bad Gateway", "<html><body><h1>Bad Gateway</h1></body></html>");
+    task->state = HTTP_STATE_CLOSING;
+}
 
-    // --- resolve hostname using task->port ---
-    // use task->port instead of hardcoded "80"
-    char port_str[8];
-    snprintf(port_str, sizeof(port_str), "%d", task->port);
+// the request line in origin form, the client's HTTP version kept, then the
+// end-to-end headers and the blank line — built once, so a retry on a fresh
+// upstream connection can send it again
+// returns 0 on success, -1 when it doesn't fit a buffer
+static int build_request_head(http_task_t *task, const http_message_t *head)
+{
+    char *out = buffer_get(task->worker);
+    if (!out)
+        return -1;
 
-    int status = getaddrinfo(task->hostname, port_str, &hints, &results);
-    if (status != 0)
+    int len = snprintf(out, HTTP_BUFFER_SIZE, "%s %s HTTP/1.%d\r\n", task->method, task->path, head->minor_version);
+    ssize_t copied = -1;
+    if (len > 0 && (size_t)len < HTTP_BUFFER_SIZE - 2)
+        copied = copy_end_to_end_headers(head, task->upgrade_request,
+                                         http_find_header(head, "Transfer-Encoding") != NULL,
+                                         out + len, HTTP_BUFFER_SIZE - (size_t)len - 2);
+    if (copied < 0)
     {
-        fprintf(stderr, "Failed to resolve hostname %s: %s\n",
-                task->hostname, gai_strerror(status));
-        return;
+        buffer_put(task->worker, out);
+        return -1;
     }
+    len += (int)copied;
+    memcpy(out + len, "\r\n", 2);
 
-    // --- create upstream socket and connect ---
-    int upstream_fd = -1;
-    for (struct addrinfo *candidate = results; candidate != NULL; candidate = candidate->ai_next)
-    {
-        upstream_fd = socket(candidate->ai_family, candidate->ai_socktype,
-                             candidate->ai_protocol);
-        if (upstream_fd < 0)
-            continue;
-
-        if (connect(upstream_fd, candidate->ai_addr, candidate->ai_addrlen) == 0)
-            break;
-
-        close(upstream_fd);
-        upstream_fd = -1;
-    }
+    task->request_head = out;
+    task->request_head_len = (size_t)len + 2;
+    return 0;
+}
 
-    freeaddrinfo(results);
+void handle_http_request(http_task_t *task)
+{
+    http_worker_t *worker = task->worker;
+    http_input_t *request = &task->request_in;
 
-    if (upstream_fd < 0)
+    // --- parse HTTP request into task fields ---
+    // the headers are parsed on their own; a body or the next request may follow
+    http_message_t head;
+    free(task->path);
+    task->path = NULL;
+    if (parse_http_request(request->data, task->header_len, task, &head) < 0)
     {
-        perror("Failed to connect to upstream server");
+        send_400_response(task);
         return;
     }
 
-    // --- forward the original request ---
-    ssize_t sent = send(upstream_fd, buffer, buffer_len, 0);
-    if (sent < 0)
+    // --- check blocklist and route request ---
+    // the host is parsed once, for its own check and to scope the path rules
+    domain_name_t host;
+    bool host_parsed = domain_name_from_string(task->hostname, &host) == 0;
+    if (host_parsed && is_blocked_name(&host))
     {
-        perror("Failed to send HTTP request to upstream server");
-        close(upstream_fd);
+        log_decision("BLOCKED", task);
+        send_403_response(task);
         return;
     }
 
-    // --- relay response back to client ---
-    bool client_send_failed = false;
-    while (!client_send_failed)
+    // --- then the path and query, in one pass over the compiled rules ---
+    const char *rule = NULL;
+    if (strcmp(task->method, "CONNECT") != 0 &&
+        (rule = http_path_blocked(host_parsed ? &host : NULL, task->path, strlen(task->path))) != NULL)
     {
-        char relay_buf[HTTP_BUFFER_SIZE];
-        ssize_t bytes = recv(upstream_fd, relay_buf, sizeof(relay_buf), 0);
-
-        if (bytes < 0)
-        {
-            perror("Error receiving response from upstream server");
-            break;
-        }
-        else if (bytes == 0)
-            break; // upstream closed connection
-
-        // handle partial sends
-        ssize_t total_sent = 0;
-        while (total_sent < bytes)
-        {
-            ssize_t s = send(task->client_socket, relay_buf + total_sent,
-                             bytes - total_sent, 0);
-            if (s < 0)
-            {
-                perror("Error sending response to client");
-                client_send_failed = true;
-                break;
-            }
-            total_sent += s;
-        }
+        log_path_decision(rule, task);
+        send_403_response(task);
+        return;
     }
 
-    close(upstream_fd);
-}
-
-void* handle_http_request(void *arg)
-{
-    // cast arg — same pattern as handle_dns_request() in dns.c
-    http_task_t *task = (http_task_t *)arg;
-
-    // --- allocate buffer for receiving HTTP request ---
-    char *buffer = calloc(HTTP_BUFFER_SIZE, 1);
-    if (!buffer)
-    {
-        perror("Failed to allocate buffer for HTTP request");
-        close(task->client_socket);
-        free(task);
-        return NULL;
-    }
-    
-    // --- receive full HTTP request ---
-    int request_len = recv_http_request(task->client_socket, buffer, HTTP_BUFFER_SIZE);
-    if (request_len < 0)
+    if (strcmp(task->method, "CONNECT") == 0)
     {
-        // client closed connection or error occurred
-        free(buffer);
-        close(task->client_socket);
-        free(task);
-        return NULL;
+        // HTTPS tunnel — RFC 7231 section 4.3.6
+        // only bytes past the CONNECT headers belong to the tunnel, and they
+        // are held for the ClientHello check; usually there are none and the
+        // buffer goes back before the wait for DNS
+        log_decision("TUNNEL", task);
+        request->used = task->header_len;
+        input_consume(worker, request);
+        resolve_upstream(task);
+        return;
     }
 
-    // --- parse HTTP request into task fields ---
-    if (parse_http_request(buffer, task) < 0)
+    log_decision("FORWARDED", task);    // plain HTTP
+
+    // --- what this request means for the connections ---
+    task->client_keep_alive = head.minor_version >= 1 &&
+        !http_has_token(&head, "Connection", "close") &&
+        !http_has_token(&head, "Proxy-Connection", "close");
+    task->head_request = (strcmp(task->method, "HEAD") == 0);
+    task->upgrade_request = http_has_token(&head, "Connection", "upgrade") &&
+                            http_find_header(&head, "Upgrade") != NULL;
+    task->upstream_keep_alive = false;
+    task->upload_stopped = false;
+    task->response_headers_done = false;
+    task->response_started = false;
+    task->response_body = (http_body_t){ 0 };
+
+    // a request body is either counted or chunked; one that runs until
+    // close can't be told apart from the next request
+    if (body_framing(&head, &task->request_body) < 0 ||
+        task->request_body.framing == HTTP_BODY_CLOSE)
     {
-        free(buffer);
-        close(task->client_socket);
-        free(task);
-        return NULL;
+        fprintf(stderr, "Unsupported request body framing from %s\n", task->hostname);
+        send_400_response(task);
+        return;
     }
 
-    // --- check blocklist and route request ---
-    if (is_blocked(task->hostname))
-    {
-        log_decision("BLOCKED", task);
-        send_403_response(task->client_socket);
-    }
-    else if (strcasecmp(task->method, "CONNECT") == 0)
+    if (build_request_head(task, &head) < 0)
     {
-        // HTTPS tunnel — RFC 7231 section 4.3.6
-        log_decision("TUNNEL", task);
-        handle_connect_tunnel(task);
+        fprintf(stderr, "Request headers for %s too large to forward\n", task->hostname);
+        send_502_response(task);
+        return;
     }
-    else
+
+    // --- an idle connection to the same origin saves the DNS lookup and the handshake ---
+    int fd = http_pool_take(worker, task->hostname, task->port);
+    if (fd >= 0)
     {
-        // plain HTTP
-        log_decision("FORWARDED", task);
-        forward_request(task, buffer, request_len);
+        task->upstream.fd = fd;
+        task->upstream_reused = true;
+        forward_request(task);
+        return;
     }
 
-    // --- final cleanup ---
-    free(buffer);
-    close(task->client_socket);
-    free(task);
-
-    return NULL;
+    resolve_upstream(task);
 }
 
-void handle_connect_tunnel(http_task_t *task)
+void forward_request(http_task_t *task)
 {
-    // --- resolve hostname ---
-    struct addrinfo hints;
-    struct addrinfo *results;
-    memset(&hints, 0, sizeof(hints));
-    hints.ai_family   = AF_INET;
-    hints.ai_socktype = SOCK_STREAM;
-    hints.ai_protocol = IPPROTO_TCP;
-
-    // --- parse port from task->hostname if present ---
-    char port_str[8];
-    int ret = snprintf(port_str, sizeof(port_str), "%d", task->port);
-    if (ret < 0 || (size_t)ret >= sizeof(port_str))
-    {
-        fprintf(stderr, "Error formatting port string\n");
-        send_502_response(task->client_socket);
-        return;
-    }
-
-    // --- resolve hostname using task->port ---
-    int status = getaddrinfo(task->hostname, port_str, &hints, &results);
-    if (status != 0)    {
-        fprintf(stderr, "Failed to resolve hostname %s: %s\n",
-                task->hostname, gai_strerror(status));
-        send_502_response(task->client_socket);
+    if (relay_queue(task->worker, &task->up, task->request_head, task->request_head_len) < task->request_head_len)
+    {
+        send_502_response(task);
         return;
     }
 
-    // --- connect to real server ---
-    int server_fd = -1;
-    for (struct addrinfo *rp = results; rp != NULL; rp = rp->ai_next)
-    {
-        server_fd = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
-        if (server_fd < 0)
-            continue;
-
-        if (connect(server_fd, rp->ai_addr, rp->ai_addrlen) == 0)
-            break; // success
-
-        close(server_fd);
-        server_fd = -1;
-    }
-    freeaddrinfo(results);
+    // the body (if any) and the response follow through exchange_event()
+    task->request_in.used = task->header_len;
+    task->state = HTTP_STATE_EXCHANGE;
+}
 
-    // --- if connect failed → send 502 ---
-    if (server_fd < 0)
+void handle_connect_tunnel(http_task_t *task)
+{
+    // a client that didn't wait for the 200 may have sent its ClientHello already
+    task->hello_pending = true;
+    if (hello_check(task->worker, task) < 0)
     {
-        perror("Failed to connect to upstream server for CONNECT tunnel");
-        send_502_response(task->client_socket);
+        close_endpoint(&task->upstream);
+        send_403_response(task);
         return;
     }
 
     // --- send 200 Connection Established ---
-    int send_status = send(task->client_socket, "HTTP/1.1 200 Connection Established\r\n\r\n", 39, 0);
-    if (send_status < 0)
+    static const char established[] = "HTTP/1.1 200 Connection Established\r\n\r\n";
+    if (relay_queue(task->worker, &task->down, established, sizeof(established) - 1) < sizeof(established) - 1)
     {
-        perror("Failed to send 200 Connection Established response");
-        close(server_fd);
+        send_502_response(task);
         return;
     }
-
-    // --- relay bytes both directions ---
-    char relay_buf[HTTP_BUFFER_SIZE];
-    struct pollfd fds[2];
-    fds[0].fd = task->client_socket;
-    fds[0].events = POLLIN;
-    fds[1].fd = server_fd;
-    fds[1].events = POLLIN;
-
-    while (1)
-    {
-        int client_activity = poll(fds, 2, 30000);
-
-        if (client_activity < 0)
-        {
-            perror("poll error in CONNECT tunnel");
-            break;
-        }
-        if (client_activity == 0)
-            break;
-
-        // --- browser → server ---
-        if (fds[0].revents & POLLIN)
-        {
-            // recv from client
-            ssize_t bytes = recv(task->client_socket, relay_buf, sizeof(relay_buf), 0);
-            if (bytes < 0)
-            {
-                perror("Error receiving data from client in CONNECT tunnel");
-                break;
-            }
-            else if (bytes == 0)
-                break;
-
-            // send to server
-            int total_sent = 0;
-            while (total_sent < bytes)
-            {
-                int send_bytes = send(server_fd, relay_buf + total_sent, bytes - total_sent, 0);
-                if (send_bytes <= 0)
-                {
-                    perror("Error sending data to server in CONNECT tunnel");
-                    goto tunnel_done;
-                }
-                total_sent += send_bytes;
-            }
-        }
-
-        // --- server → browser ---
-        if (fds[1].revents & POLLIN)
-        {
-            // recv from server
-            ssize_t bytes = recv(server_fd, relay_buf, sizeof(relay_buf), 0);
-            if (bytes < 0)
-            {
-                perror("Error receiving data from server in CONNECT tunnel");
-                break;
-            }
-            else if (bytes == 0)
-                break;
-
-            // send to client
-            int total_sent = 0;
-            while (total_sent < bytes)
-            {
-                int send_bytes = send(task->client_socket, relay_buf + total_sent, bytes - total_sent, 0);
-                if (send_bytes <= 0)
-                {
-                    perror("Error sending data to client in CONNECT tunnel");
-                    goto tunnel_done;
-                }
-                total_sent += send_bytes;
-            }
-        }
-    }
-
-tunnel_done:
-    // --- cleanup ---
-    close(server_fd);
+    task->state = HTTP_STATE_RELAY;
+    task->relay_started_ms = task->worker->now_ms;
 }
 
-void log_decision(const char *action, http_task_t *task)
+// what every decision line starts with: local time and the client's address
+static void log_context(const http_task_t *task, char timestamp[32], char client_ip[INET_ADDRSTRLEN])
 {
-    // --- get timestamp ---
     time_t now = time(NULL);
     struct tm tm_buf;
-    char timestamp[32];
     if (localtime_r(&now, &tm_buf) != NULL)
-        strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", &tm_buf);
+        strftime(timestamp, 32, "%Y-%m-%d %H:%M:%S", &tm_buf);
     else
-        strncpy(timestamp, "unknown-time", sizeof(timestamp));
+        strncpy(timestamp, "unknown-time", 32);
 
-    // --- get client IP as string ---
+    if (inet_ntop(AF_INET, &task->client_addr.sin_addr, client_ip, INET_ADDRSTRLEN) == NULL)
+        strncpy(client_ip, "unknown-ip", INET_ADDRSTRLEN);
+}
+
+void log_decision(const char *action, http_task_t *task)
+{
+    char timestamp[32];
     char client_ip[INET_ADDRSTRLEN];
-    if (inet_ntop(AF_INET, &task->client_addr.sin_addr, client_ip, sizeof(client_ip)) == NULL)
-        strncpy(client_ip, "unknown-ip", sizeof(client_ip));
+    log_context(task, timestamp, client_ip);
 
-    // --- print log line ---
     if (strcasecmp(task->method, "CONNECT") == 0)
     {
         printf("[%s] [LAYER_7] [HTTP] [%s] host=%s port=%d client=%s d3fend=D3-HTTPA attck=T1071.001\n",
@@ -622,3 +1991,27 @@ void log_decision(const char *action, http_task_t *task)
                 timestamp, action, task->hostname, task->path, client_ip);
     }
 }
+
+void log_tls_decision(const tls_hello_t *hello, http_task_t *task)
+{
+    char timestamp[32];
+    char client_ip[INET_ADDRSTRLEN];
+    log_context(task, timestamp, client_ip);
+
+    printf("[%s] [LAYER_7] [HTTP] [TLS %s] host=%s port=%d sni=%s client=%s tls_ver=0x%04X ext_count=%d alpn=%s "
+           "d3fend=D3-TLSIC attck=%s\n",
+            timestamp, tls_verdict_action(hello->verdict), task->hostname, task->port,
+            hello->sni_present ? hello->hostname : "none", client_ip, hello->tls_version,
+            hello->extension_count, hello->alpn[0] ? hello->alpn : "none",
+            tls_verdict_attck(hello->verdict));
+}
+
+void log_path_decision(const char *rule, http_task_t *task)
+{
+    char timestamp[32];
+    char client_ip[INET_ADDRSTRLEN];
+    log_context(task, timestamp, client_ip);
+
+    printf("[%s] [LAYER_7] [HTTP] [BLOCKED (path)] host=%s path=%s rule=%s client=%s d3fend=D3-HTTPA attck=T1071.001\n",
+            timestamp, task->hostname, task->path, rule, client_ip);
+}
@@ -20,6 +20,9 @@
 #include <pthread.h>
 #include <time.h>
 #include <netdb.h>
+#include "parse.h"
+#include "timer.h"
+#include "../../common/tls_policy.h"
 
 // --- includes ---
 // think about what each function will need
@@ -32,51 +35,251 @@
 #define HTTP_PORT 8080
 #define MAX_HOSTNAME_LENGTH 253
 #define MAX_PATH_LENGTH 2048
-#define MAX_PENDING_CONNECTIONS 10
-#define MAX_METHOD_LENGTH 8
-#define MAX_VERSION_LENGTH 16
+#define MAX_PENDING_CONNECTIONS 1024        // listen backlog, per event loop
+#define MAX_METHOD_LENGTH 20                // registered methods run to 17 characters (UPDATEREDIRECTREF)
 
+// --- event loops ---
+#define HTTP_MAX_WORKERS 4                  // one per core on the Pi Zero 2 W
+#define HTTP_MAX_EVENTS 64                  // epoll_wait batch
+#define HTTP_IDLE_TIMEOUT_MS 30000          // no bytes either way for this long → close
+#define HTTP_HEADER_TIMEOUT_MS 10000        // a request head must be in this long after the connection is ready for it
+#define HTTP_TUNNEL_IDLE_MS 30000           // tunnels and upgraded connections: no bytes either way → close
+#define HTTP_TUNNEL_LIFETIME_MS 3600000     // tunnels and upgraded connections close after this, busy or not
+#define HTTP_BUFFER_CACHE 64                // free relay buffers kept per event loop
+#define HTTP_PIPE_SIZE 65536                // splice pipe capacity asked for (F_SETPIPE_SZ)
+#define HTTP_PIPE_CACHE 64                  // drained pipes kept per event loop
+#define HTTP_MAX_ADDRESSES 8                // resolved addresses tried per request
+#define HTTP_CONNECT_DELAY_MS 250           // head start before the next address joins (RFC 8305)
+#define HTTP_CONNECT_TIMEOUT_MS 5000        // one attempt gives up after this — room for two SYN retries
+#define HTTP_CONNECT_RACE 4                 // attempts in flight at once per request
 
-// --- task struct ---
+
+// --- connection state ---
+typedef enum {
+    HTTP_STATE_READ_REQUEST,    // collecting request headers from the client
+    HTTP_STATE_RESOLVING,       // owned by a resolver thread until it hands the task back
+    HTTP_STATE_CONNECTING,      // non-blocking connects to the addresses racing, staggered
+    HTTP_STATE_EXCHANGE,        // one request / response pair, framed so both sides stay open
+    HTTP_STATE_RELAY,           // shuttling raw bytes both ways until close (tunnels, upgrades)
+    HTTP_STATE_CLOSING,         // flushing a final response, then draining the client until it closes
+} http_state_t;
+
+typedef enum {
+    HTTP_EV_LISTEN,
+    HTTP_EV_WAKE,
+    HTTP_EV_CLIENT,
+    HTTP_EV_UPSTREAM,
+    HTTP_EV_POOLED,             // idle upstream connection parked in the worker's pool
+} http_endpoint_kind_t;
+
+// --- why the proxy turned a connection away or closed it early ---
+// counted per event loop, dumped on SIGUSR1
+typedef enum {
+    HTTP_EVICT_CLIENT_CAP,                  // refused: the client IP is at HTTP_MAX_PER_CLIENT
+    HTTP_EVICT_GLOBAL_CAP,                  // refused: HTTP_MAX_CONNECTIONS are open
+    HTTP_EVICT_HEADER_TIMEOUT,              // request head too slow (slowloris)
+    HTTP_EVICT_IDLE,                        // request / response went quiet
+    HTTP_EVICT_TUNNEL_IDLE,
+    HTTP_EVICT_TUNNEL_LIFETIME,
+    HTTP_EVICT_COUNT,
+} http_evict_t;
+
+struct http_task;
+struct http_worker;
+
+// --- one fd registered with a worker's epoll set ---
+// epoll_event.data.ptr points here
+typedef struct {
+    int fd;
+    http_endpoint_kind_t kind;
+    uint32_t events;                        // interest registered with epoll, 0 = not registered
+    bool hup;                               // peer is gone for writing, only reads are left
+    struct http_task *task;
+} http_endpoint_t;
+
+// --- kernel pipe for splice() ---
+// payload moves socket → pipe → socket without ever being copied to user space
 typedef struct {
-    int client_socket;                      // The socket fd to talk back to the client
+    int read_fd;                            // -1 when the relay has no pipe
+    int write_fd;
+    size_t size;                            // capacity the kernel actually granted
+} http_pipe_t;
+
+// --- one relay direction ---
+// data holds the bytes the proxy reads or writes itself (request headers,
+// its own replies); everything else is spliced through the pipe. Both are
+// borrowed from the worker's caches only while bytes are pending, so an idle
+// tunnel holds neither. Pending data always goes out before the pipe.
+typedef struct {
+    char *data;                             // HTTP_BUFFER_SIZE bytes, or NULL
+    size_t start;                           // next byte to write
+    size_t end;                             // one past the last byte read
+    http_pipe_t pipe;
+    size_t piped;                           // bytes sitting in the pipe
+    bool eof;                               // source finished
+    bool shut;                              // destination's write side shut after draining
+} http_relay_t;
+
+// --- bytes the proxy reads itself ---
+// headers and chunk-size lines; whatever was read past them is handed on
+// before anything more is taken from the socket
+typedef struct {
+    char *data;                             // HTTP_BUFFER_SIZE bytes (NUL after len), or NULL
+    size_t len;                             // bytes read
+    size_t used;                            // bytes consumed
+    size_t scanned;                         // searched for the end of the head so far
+} http_input_t;
+
+// --- message body state ---
+typedef enum {
+    HTTP_CHUNK_SIZE,                        // expecting a chunk-size line
+    HTTP_CHUNK_DATA,                        // inside chunk data
+    HTTP_CHUNK_DATA_END,                    // expecting the CRLF after chunk data
+    HTTP_CHUNK_TRAILER,                     // trailer lines until the empty one
+} http_chunk_state_t;
+
+typedef struct {
+    http_framing_t framing;
+    http_chunk_state_t chunk_state;
+    uint64_t remaining;                     // left in the body (LENGTH) or current chunk
+    bool done;
+} http_body_t;
+
+// --- task struct ---
+// one per client connection, owned by the worker that accepted it
+typedef struct http_task {
+    http_endpoint_t client;                 // The socket to talk back to the client
+    http_endpoint_t upstream;               // The real server, fd -1 until connecting
     struct sockaddr_in client_addr;         // Who sent the request (for logging)
+    struct http_worker *worker;
+    http_state_t state;
+    bool closed;                            // fds gone, freed at the end of the event batch
     char method[MAX_METHOD_LENGTH];         // HTTP method (e.g., "GET", "POST")
     char hostname[MAX_HOSTNAME_LENGTH];     // Hostname from the HTTP request
-    char path[MAX_PATH_LENGTH];  
-    int  port;                   // Port number for CONNECT requests (default 443)
+    char *path;                             // request target, up to MAX_PATH_LENGTH - 1
+    int  port;                              // Port number for CONNECT requests (default 443)
+    size_t header_len;                      // request line + headers + blank line
+    char *request_head;                     // head as sent upstream (borrowed buffer), kept for a retry
+    size_t request_head_len;
+
+    http_relay_t up;                        // client → upstream
+    http_relay_t down;                      // upstream → client, and the proxy's own replies
+
+    // --- current request / response ---
+    http_input_t request_in;                // client bytes read by the proxy, next requests included
+    http_input_t response_in;               // upstream bytes read by the proxy
+    http_body_t request_body;
+    http_body_t response_body;
+    size_t response_header_len;             // status line + headers + blank line
+    bool response_headers_done;
+    bool response_started;                  // a response byte arrived — too late to retry
+    bool head_request;                      // response has headers only
+    bool upgrade_request;                   // asked for Upgrade — a 101 turns into RELAY
+    bool client_keep_alive;                 // read another request after this response
+    bool upstream_keep_alive;               // origin connection can go back to the pool
+    bool upstream_reused;                   // came from the pool, so it may be stale
+    bool upload_stopped;                    // upstream quit taking the body — its response may still come
+    bool lingering;                         // CLOSING: response out, write side shut
+    bool hello_pending;                     // CONNECT tunnel: client bytes held until the ClientHello is checked
+
+    // written by the resolver thread while the task is HTTP_STATE_RESOLVING
+    struct sockaddr_in addrs[HTTP_MAX_ADDRESSES];
+    size_t addr_count;
+    size_t addr_index;                      // next address to try
+
+    // --- connect race ---
+    http_endpoint_t attempts[HTTP_CONNECT_RACE];    // fd -1 when the slot is free
+    long long attempt_started_ms[HTTP_CONNECT_RACE];
+    size_t attempt_count;                   // attempts in flight
+    long long connect_tick_ms;              // next address joins / attempts time out
+
+    // --- deadlines, all behind one timer on the worker's wheel ---
+    // the timer is armed for the soonest one and re-armed when it fires
+    // early, so activity only ever stores a time
+    http_timer_t timer;
+    long long last_active_ms;
+    long long request_deadline_ms;          // READ_REQUEST: the head has to be in by then
+    long long relay_started_ms;             // RELAY: for HTTP_TUNNEL_LIFETIME_MS
+    struct http_task *next;                 // resolver queue / hand-back list / free list
 } http_task_t;
 
+// --- one event loop thread ---
+// its own SO_REUSEPORT listener, so the kernel spreads accepts across loops
+typedef struct http_worker {
+    pthread_t thread;
+    int epoll_fd;
+    http_endpoint_t listener;
+    http_endpoint_t wake;                   // eventfd, poked when a resolver hands a task back
+    bool accept_paused;                     // out of fds — listener muted until a close
+
+    pthread_mutex_t resolved_lock;
+    http_task_t *resolved;                  // tasks handed back by resolver threads
+
+    http_wheel_t wheel;                     // every task's deadline timer
+    http_task_t *closed;                    // freed once the current event batch is done
+    struct http_pool *pool;                 // idle upstream connections (pool.c)
+    char *free_buffers[HTTP_BUFFER_CACHE];
+    size_t free_count;
+    http_pipe_t free_pipes[HTTP_PIPE_CACHE];
+    size_t free_pipe_count;
+    size_t conn_count;
+    long long now_ms;                       // clock read once per epoll_wait
+    uint64_t evicted[HTTP_EVICT_COUNT];     // written by this loop only, read by the stats dump
+} http_worker_t;
+
 // --- function signatures ---
 // implement these in proxy.c
 
-// sets up TCP socket and runs the accept loop forever
-void  start_proxy_server();
+// binds one listener per event loop, starts the loops and the resolver
+// (dns_server "ip[:port]", NULL for the local Layer 7 DNS), then dumps the
+// connection and eviction counters on every SIGUSR1; never returns
+void  start_proxy_server(const char *dns_server);
+
+// reads whatever the client socket has until the blank line after the
+// headers, picking up the search where the last read left it
+// returns 1 when the headers are complete, 0 to wait for more, -1 on error / close
+int   recv_http_request(http_task_t *task);
 
-// reads from TCP stream until \r\n\r\n is found
-// returns total bytes read, or -1 on error
-int   recv_http_request(int client_fd, char *buffer, int buffer_size);
+// parses the request head (len bytes of buffer) into head and the task's
+// method, hostname, port and path
+// returns 0 on success, -1 on a malformed request
+int   parse_http_request(const char *buffer, size_t len, http_task_t *task, http_message_t *head);
 
-// parses raw HTTP bytes into the task struct fields
-// returns 0 on success, -1 on failure
-int   parse_http_request(char *buffer, http_task_t *task);
+// queues a 400 Bad Request response and closes once it is sent
+void  send_400_response(http_task_t *task);
 
-// sends a 403 Forbidden HTTP response to the client
-void  send_403_response(int client_fd);
+// queues a 403 Forbidden HTTP response and closes once it is sent
+void  send_403_response(http_task_t *task);
 
-// send a 502 Bad Gateway response (used when CONNECT tunnel setup fails)
-void  send_502_response(int client_fd);
+// queues a 502 Bad Gateway response (used when the upstream can't be reached)
+void  send_502_response(http_task_t *task);
 
-// resolves host, connects to real server, relays request and response
-void forward_request(http_task_t *task, char *buffer, int buffer_len);
+// reads the upstream's response headers the same way
+// returns 1 when they are complete, 0 to wait for more, -1 on error / close
+int   recv_http_response(http_task_t *task);
 
-// thread entry point — orchestrates all the above
-void* handle_http_request(void *arg);
+// upstream connected (or taken from the pool) — sends the request head
+// built by handle_http_request(), then streams body and response
+void forward_request(http_task_t *task);
 
-// handles HTTP CONNECT tunneling for HTTPS — RFC 7231 section 4.3.6
+// headers complete — parses, checks the blocklist, then reuses a pooled
+// upstream or starts resolving
+void  handle_http_request(http_task_t *task);
+
+// upstream connected for CONNECT — RFC 7231 section 4.3.6
+// the tunnel only opens up once the client's ClientHello passes the TLS policy
 void handle_connect_tunnel(http_task_t *task);
 
+// called from a resolver thread — hands the task back to its event loop
+void  http_task_resolved(http_task_t *task);
+
 // writes a structured log line to stdout (and optionally a file)
 void  log_decision(const char *action, http_task_t *task);
 
-#endif
\ No newline at end of file
+// logs the TLS policy verdict for a tunnel's ClientHello (D3-TLSIC)
+void  log_tls_decision(const tls_hello_t *hello, http_task_t *task);
+
+// logs a request blocked by a URL path rule, with the pattern it matched
+void  log_path_decision(const char *rule, http_task_t *task);
+
+#endif
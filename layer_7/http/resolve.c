@@ -0,0 +1,720 @@
+#define _GNU_SOURCE
+
+#include "resolve.h"
+#include "../../common/domain.h"
+#include "../../common/net_hdrs.h"
+#include <errno.h>
+#include <strings.h>
+#include <sys/eventfd.h>
+#include <sys/random.h>
+
+// RFC 1035 values the stub needs
+#define FLAG_QR         0x8000
+#define FLAG_TC         0x0200
+#define FLAG_RD         0x0100
+#define FLAG_RCODE      0x000F
+#define RCODE_NOERROR   0
+#define RCODE_NXDOMAIN  3
+#define TYPE_A          1
+#define TYPE_CNAME      5
+#define TYPE_SOA        6
+#define CLASS_IN        1
+#define RR_FIXED_SIZE   10      // TYPE CLASS TTL RDLENGTH after the owner name
+
+static long long now_ms(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static void fill_task(http_task_t *task, const struct in_addr *addrs, size_t count)
+{
+    task->addr_count = 0;
+    for (size_t i = 0; i < count && i < HTTP_MAX_ADDRESSES; i++)
+    {
+        struct sockaddr_in *addr = &task->addrs[task->addr_count++];
+        memset(addr, 0, sizeof(*addr));
+        addr->sin_family = AF_INET;
+        addr->sin_port = htons((uint16_t)task->port);
+        addr->sin_addr = addrs[i];
+    }
+}
+
+// ---------- CACHE ----------
+
+// --- one cached name ---
+// lives in a bucket chain and in the insertion-order list at the same time
+typedef struct cache_entry {
+    char name[MAX_HOSTNAME_LENGTH];
+    uint32_t hash;
+    struct in_addr addrs[HTTP_MAX_ADDRESSES];
+    size_t count;                           // 0: the name has no address (NXDOMAIN / NODATA)
+    long long expires_ms;
+    struct cache_entry *hnext;
+    struct cache_entry *older;
+    struct cache_entry *newer;
+} cache_entry_t;
+
+// access protected by g_cache_lock
+static pthread_mutex_t g_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static cache_entry_t *g_cache[HTTP_DNS_CACHE_BUCKETS];
+static cache_entry_t *g_cache_oldest = NULL;
+static cache_entry_t *g_cache_newest = NULL;
+static size_t g_cache_count = 0;
+
+// caller must hold g_cache_lock
+static cache_entry_t *cache_find(const char *name, uint32_t hash)
+{
+    for (cache_entry_t *entry = g_cache[hash & (HTTP_DNS_CACHE_BUCKETS - 1)]; entry; entry = entry->hnext)
+    {
+        if (entry->hash == hash && strcmp(entry->name, name) == 0)
+            return entry;
+    }
+    return NULL;
+}
+
+// caller must hold g_cache_lock
+static void cache_unlink(cache_entry_t *entry)
+{
+    cache_entry_t **link = &g_cache[entry->hash & (HTTP_DNS_CACHE_BUCKETS - 1)];
+    while (*link && *link != entry)
+        link = &(*link)->hnext;
+    if (*link)
+        *link = entry->hnext;
+
+    if (entry->older) entry->older->newer = entry->newer;
+    else g_cache_oldest = entry->newer;
+    if (entry->newer) entry->newer->older = entry->older;
+    else g_cache_newest = entry->older;
+    g_cache_count--;
+}
+
+static void cache_store(const char *name, uint32_t hash, const struct in_addr *addrs, size_t count, uint32_t ttl)
+{
+    if (ttl < HTTP_DNS_MIN_TTL) ttl = HTTP_DNS_MIN_TTL;
+    if (ttl > HTTP_DNS_MAX_TTL) ttl = HTTP_DNS_MAX_TTL;
+
+    pthread_mutex_lock(&g_cache_lock);
+
+    // a refreshed name moves to the young end; past the limit the oldest goes
+    cache_entry_t *entry = cache_find(name, hash);
+    if (entry)
+        cache_unlink(entry);
+    else if (g_cache_count >= HTTP_DNS_CACHE_MAX)
+    {
+        entry = g_cache_oldest;
+        cache_unlink(entry);
+    }
+    else if (!(entry = malloc(sizeof(cache_entry_t))))
+    {
+        pthread_mutex_unlock(&g_cache_lock);
+        return;
+    }
+
+    strncpy(entry->name, name, MAX_HOSTNAME_LENGTH - 1);
+    entry->name[MAX_HOSTNAME_LENGTH - 1] = '\0';
+    entry->hash = hash;
+    memcpy(entry->addrs, addrs, count * sizeof(struct in_addr));
+    entry->count = count;
+    entry->expires_ms = now_ms() + (long long)ttl * 1000;
+
+    size_t slot = hash & (HTTP_DNS_CACHE_BUCKETS - 1);
+    entry->hnext = g_cache[slot];
+    g_cache[slot] = entry;
+    entry->older = g_cache_newest;
+    entry->newer = NULL;
+    if (g_cache_newest) g_cache_newest->newer = entry;
+    else g_cache_oldest = entry;
+    g_cache_newest = entry;
+    g_cache_count++;
+
+    pthread_mutex_unlock(&g_cache_lock);
+}
+
+bool http_resolve_cached(http_task_t *task)
+{
+    // --- an address needs no lookup at all ---
+    struct in_addr literal;
+    if (inet_pton(AF_INET, task->hostname, &literal) == 1)
+    {
+        fill_task(task, &literal, 1);
+        return true;
+    }
+
+    uint32_t hash = domain_hash(task->hostname, strlen(task->hostname));
+    bool hit = false;
+
+    pthread_mutex_lock(&g_cache_lock);
+    cache_entry_t *entry = cache_find(task->hostname, hash);
+    if (entry && entry->expires_ms > now_ms())
+    {
+        fill_task(task, entry->addrs, entry->count);
+        hit = true;
+    }
+    pthread_mutex_unlock(&g_cache_lock);
+
+    return hit;
+}
+
+// ---------- LOOKUPS (resolver thread only) ----------
+
+// --- one name in flight ---
+// every task asking for it waits on the same query
+typedef struct {
+    bool used;
+    uint16_t id;
+    char name[MAX_HOSTNAME_LENGTH];
+    uint32_t hash;
+    int attempts;
+    long long sent_ms;
+    http_task_t *waiters;                   // linked through task->next
+} lookup_t;
+
+static lookup_t g_lookups[HTTP_DNS_MAX_PENDING];
+static size_t g_lookup_count = 0;
+static struct sockaddr_in g_servers[2];     // [0] the one asked for, [1] the fallback (default server only)
+static size_t g_server_count = 0;
+static size_t g_current = 0;                // the server g_dns_fd is connected to
+static long long g_fallback_since_ms = 0;
+static int g_dns_fd = -1;                   // UDP, connected to g_servers[g_current]
+static int g_wake_fd = -1;                  // eventfd, poked when a task is queued
+static uint32_t g_rng_state;
+
+// --- tasks queued by the event loops ---
+static pthread_mutex_t g_queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static http_task_t *g_queue_head = NULL;
+static http_task_t *g_queue_tail = NULL;
+
+// xorshift32 — query IDs only need to be hard to guess, not cryptographic
+static uint16_t random_id(void)
+{
+    g_rng_state ^= g_rng_state << 13;
+    g_rng_state ^= g_rng_state >> 17;
+    g_rng_state ^= g_rng_state << 5;
+    return (uint16_t)(g_rng_state >> 8);
+}
+
+// "ip:port" into buf, for logs — inet_ntop, as more than one thread logs
+static const char *server_name(const struct sockaddr_in *addr, char *buf, size_t size)
+{
+    char ip[INET_ADDRSTRLEN];
+    if (!inet_ntop(AF_INET, &addr->sin_addr, ip, sizeof(ip)))
+        strcpy(ip, "unknown-ip");
+    snprintf(buf, size, "%s:%d", ip, ntohs(addr->sin_port));
+    return buf;
+}
+
+// encodes "www.example.com" as 3www7example3com0
+// returns the encoded length, 0 when the name doesn't fit or has an empty label
+static size_t encode_name(const char *name, unsigned char *out, size_t out_size)
+{
+    unsigned char *writer = out;
+    const char *label = name;
+    while (*label)
+    {
+        const char *dot = strchr(label, '.');
+        size_t label_len = dot ? (size_t)(dot - label) : strlen(label);
+        if (label_len == 0 || label_len > 63 || (size_t)(writer - out) + label_len + 2 > out_size)
+            return 0;
+
+        *writer++ = (unsigned char)label_len;
+        memcpy(writer, label, label_len);
+        writer += label_len;
+        label += label_len + (dot ? 1 : 0);
+    }
+    *writer++ = 0;
+    return (size_t)(writer - out);
+}
+
+static uint16_t read_u16(const unsigned char *p)
+{
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static uint32_t read_u32(const unsigned char *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+// returns the offset just past the (possibly compressed) name, 0 if malformed
+static size_t skip_name(const unsigned char *packet, size_t packet_len, size_t offset)
+{
+    while (offset < packet_len)
+    {
+        unsigned char len = packet[offset];
+        if (len == 0)
+            return offset + 1;
+        if ((len & 0xC0) == 0xC0)
+            return (offset + 2 <= packet_len) ? offset + 2 : 0;
+        if (len & 0xC0)
+            return 0;
+        offset += (size_t)len + 1;
+    }
+    return 0;
+}
+
+static int send_query(lookup_t *lookup)
+{
+    unsigned char query[HTTP_DNS_PACKET_SIZE];
+    struct dns_hdr *header = (struct dns_hdr *)query;
+    memset(header, 0, sizeof(*header));
+    header->id = htons(lookup->id);
+    header->flags = htons(FLAG_RD);
+    header->qdcount = htons(1);
+
+    size_t len = sizeof(struct dns_hdr);
+    size_t encoded = encode_name(lookup->name, query + len, sizeof(query) - len - 4);
+    if (encoded == 0)
+        return -1;
+    len += encoded;
+    query[len++] = 0; query[len++] = TYPE_A;
+    query[len++] = 0; query[len++] = CLASS_IN;
+
+    lookup->attempts++;
+    lookup->sent_ms = now_ms();
+    if (send(g_dns_fd, query, len, 0) < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNREFUSED)
+        return -1;
+    return 0;
+}
+
+// hands every waiting task back with the result; count 0 means failure
+static void finish_lookup(lookup_t *lookup, const struct in_addr *addrs, size_t count)
+{
+    http_task_t *task = lookup->waiters;
+    lookup->waiters = NULL;
+    lookup->used = false;
+    g_lookup_count--;
+
+    while (task)
+    {
+        http_task_t *next = task->next;
+        task->next = NULL;
+        fill_task(task, addrs, count);
+        http_task_resolved(task);
+        task = next;
+    }
+}
+
+static void start_lookup(http_task_t *task)
+{
+    uint32_t hash = domain_hash(task->hostname, strlen(task->hostname));
+    lookup_t *free_slot = NULL;
+
+    // --- the name may already be on its way ---
+    for (size_t i = 0; i < HTTP_DNS_MAX_PENDING; i++)
+    {
+        lookup_t *lookup = &g_lookups[i];
+        if (!lookup->used)
+        {
+            if (!free_slot)
+                free_slot = lookup;
+            continue;
+        }
+        if (lookup->hash == hash && strcmp(lookup->name, task->hostname) == 0)
+        {
+            task->next = lookup->waiters;
+            lookup->waiters = task;
+            return;
+        }
+    }
+
+    task->next = NULL;
+    if (!free_slot)
+    {
+        fprintf(stderr, "Failed to resolve hostname %s: too many lookups in flight\n", task->hostname);
+        task->addr_count = 0;
+        http_task_resolved(task);
+        return;
+    }
+
+    // --- new query, with an ID no other lookup in flight has ---
+    lookup_t *lookup = free_slot;
+    uint16_t id;
+    bool taken;
+    do
+    {
+        id = random_id();
+        taken = false;
+        for (size_t i = 0; i < HTTP_DNS_MAX_PENDING && !taken; i++)
+            taken = g_lookups[i].used && g_lookups[i].id == id;
+    } while (taken);
+
+    memset(lookup, 0, sizeof(*lookup));
+    lookup->used = true;
+    lookup->id = id;
+    snprintf(lookup->name, sizeof(lookup->name), "%s", task->hostname);
+    lookup->hash = hash;
+    lookup->waiters = task;
+    g_lookup_count++;
+
+    if (send_query(lookup) < 0)
+    {
+        fprintf(stderr, "Failed to resolve hostname %s: query not sent\n", lookup->name);
+        finish_lookup(lookup, NULL, 0);
+    }
+}
+
+// one answer from the DNS server — matched to its lookup by ID and question
+static void handle_response(const unsigned char *packet, size_t packet_len)
+{
+    if (packet_len < sizeof(struct dns_hdr))
+        return;
+
+    const struct dns_hdr *header = (const struct dns_hdr *)packet;
+    uint16_t id = ntohs(header->id);
+    uint16_t flags = ntohs(header->flags);
+    if (!(flags & FLAG_QR) || ntohs(header->qdcount) != 1)
+        return;
+
+    lookup_t *lookup = NULL;
+    for (size_t i = 0; i < HTTP_DNS_MAX_PENDING && !lookup; i++)
+    {
+        if (g_lookups[i].used && g_lookups[i].id == id)
+            lookup = &g_lookups[i];
+    }
+    if (!lookup)
+        return;     // late answer to a lookup already finished
+
+    // --- the question has to be ours, or it's a stray or spoofed packet ---
+    unsigned char name[MAX_HOSTNAME_LENGTH + 2];
+    size_t name_len = encode_name(lookup->name, name, sizeof(name));
+    size_t offset = sizeof(struct dns_hdr);
+    if (name_len == 0 || offset + name_len + 4 > packet_len ||
+        strncasecmp((const char *)packet + offset, (const char *)name, name_len) != 0 ||
+        read_u16(packet + offset + name_len) != TYPE_A || read_u16(packet + offset + name_len + 2) != CLASS_IN)
+        return;
+    offset += name_len + 4;
+
+    uint16_t rcode = flags & FLAG_RCODE;
+    if (rcode != RCODE_NOERROR && rcode != RCODE_NXDOMAIN)
+    {
+        fprintf(stderr, "Failed to resolve hostname %s: DNS rcode %u\n", lookup->name, rcode);
+        finish_lookup(lookup, NULL, 0);
+        return;
+    }
+
+    // --- answer section: every A record, TTL of the shortest link in the chain ---
+    struct in_addr addrs[HTTP_MAX_ADDRESSES];
+    size_t count = 0;
+    uint32_t ttl = UINT32_MAX;
+    uint16_t answers = ntohs(header->ancount);
+    uint16_t authority = ntohs(header->nscount);
+    bool negative_ttl = false;
+
+    for (uint32_t i = 0; i < (uint32_t)answers + authority; i++)
+    {
+        offset = skip_name(packet, packet_len, offset);
+        if (offset == 0 || offset + RR_FIXED_SIZE > packet_len)
+            break;
+        uint16_t type = read_u16(packet + offset);
+        uint16_t class = read_u16(packet + offset + 2);
+        uint32_t record_ttl = read_u32(packet + offset + 4);
+        uint16_t rdlength = read_u16(packet + offset + 8);
+        const unsigned char *rdata = packet + offset + RR_FIXED_SIZE;
+        offset += RR_FIXED_SIZE + rdlength;
+        if (offset > packet_len || class != CLASS_IN)
+            break;
+
+        if (i < answers)
+        {
+            if (type == TYPE_A && rdlength == 4)
+            {
+                struct in_addr addr;
+                memcpy(&addr, rdata, 4);
+                // a sinkhole's 0.0.0.0 would connect to this very box
+                if (addr.s_addr != INADDR_ANY && count < HTTP_MAX_ADDRESSES)
+                    addrs[count++] = addr;
+            }
+            if ((type == TYPE_A || type == TYPE_CNAME) && record_ttl < ttl)
+                ttl = record_ttl;
+        }
+        else if (count == 0 && type == TYPE_SOA && rdlength >= 20)
+        {
+            // RFC 2308 section 5: negative TTL is the lesser of the SOA's TTL and MINIMUM
+            uint32_t minimum = read_u32(rdata + rdlength - 4);
+            ttl = (record_ttl < minimum) ? record_ttl : minimum;
+            negative_ttl = true;
+        }
+    }
+
+    if (count == 0 && (flags & FLAG_TC))
+    {
+        fprintf(stderr, "Failed to resolve hostname %s: truncated answer\n", lookup->name);
+        finish_lookup(lookup, NULL, 0);
+        return;
+    }
+    if (count == 0 && !negative_ttl)
+        ttl = HTTP_DNS_NEGATIVE_TTL;
+
+    cache_store(lookup->name, lookup->hash, addrs, count, ttl);
+    finish_lookup(lookup, addrs, count);
+}
+
+// resends lookups past HTTP_DNS_TIMEOUT_MS, fails those out of attempts
+// returns ms until the next one is due, -1 when none is in flight
+static int expire_lookups(void)
+{
+    long long now = now_ms();
+    long long next = -1;
+
+    for (size_t i = 0; i < HTTP_DNS_MAX_PENDING && g_lookup_count > 0; i++)
+    {
+        lookup_t *lookup = &g_lookups[i];
+        if (!lookup->used)
+            continue;
+
+        if (now - lookup->sent_ms >= HTTP_DNS_TIMEOUT_MS)
+        {
+            if (lookup->attempts >= HTTP_DNS_ATTEMPTS || send_query(lookup) < 0)
+            {
+                char server[32];
+                fprintf(stderr, "Failed to resolve hostname %s: no answer from %s\n", lookup->name,
+                        server_name(&g_servers[g_current], server, sizeof(server)));
+                finish_lookup(lookup, NULL, 0);
+                continue;
+            }
+        }
+
+        long long due = lookup->sent_ms + HTTP_DNS_TIMEOUT_MS - now;
+        if (next < 0 || due < next)
+            next = due;
+    }
+    return (next < 0) ? -1 : (int)next;
+}
+
+// points the socket at another server and asks it everything in flight
+// answers still on their way from the old one are dropped by the connected socket
+static void use_server(size_t index)
+{
+    char server[32];
+    if (connect(g_dns_fd, (struct sockaddr *)&g_servers[index], sizeof(g_servers[index])) < 0)
+    {
+        perror("Failed to switch DNS server");
+        return;
+    }
+    g_current = index;
+    printf("[LAYER_7] [HTTP] Resolving through %s\n", server_name(&g_servers[index], server, sizeof(server)));
+
+    for (size_t i = 0; i < HTTP_DNS_MAX_PENDING && g_lookup_count > 0; i++)
+    {
+        lookup_t *lookup = &g_lookups[i];
+        if (!lookup->used)
+            continue;
+        lookup->attempts = 0;
+        if (send_query(lookup) < 0)
+            finish_lookup(lookup, NULL, 0);
+    }
+}
+
+// nothing listens on the server's port — fall back if there is somewhere to
+// fall back to, otherwise no point waiting out the retries
+static void server_refused(void)
+{
+    char server[32];
+    if (g_current == 0 && g_server_count > 1)
+    {
+        fprintf(stderr, "DNS server %s refused, falling back to the system resolver\n",
+                server_name(&g_servers[0], server, sizeof(server)));
+        g_fallback_since_ms = now_ms();
+        use_server(1);
+        return;
+    }
+
+    for (size_t i = 0; i < HTTP_DNS_MAX_PENDING && g_lookup_count > 0; i++)
+    {
+        if (!g_lookups[i].used)
+            continue;
+        fprintf(stderr, "Failed to resolve hostname %s: %s refused\n", g_lookups[i].name,
+                server_name(&g_servers[g_current], server, sizeof(server)));
+        finish_lookup(&g_lookups[i], NULL, 0);
+    }
+}
+
+static void take_queued(void)
+{
+    uint64_t count;
+    while (read(g_wake_fd, &count, sizeof(count)) > 0)
+        ;
+
+    pthread_mutex_lock(&g_queue_lock);
+    http_task_t *task = g_queue_head;
+    g_queue_head = g_queue_tail = NULL;
+    pthread_mutex_unlock(&g_queue_lock);
+
+    // the Layer 7 DNS may have come up since — new lookups try it first
+    if (g_current != 0 && now_ms() - g_fallback_since_ms >= HTTP_DNS_RETRY_LOCAL_MS)
+        use_server(0);
+
+    while (task)
+    {
+        http_task_t *next = task->next;
+        task->next = NULL;
+
+        // an earlier lookup may have cached it since the event loop looked
+        if (http_resolve_cached(task))
+            http_task_resolved(task);
+        else
+            start_lookup(task);
+        task = next;
+    }
+}
+
+static void *resolver_loop(void *arg)
+{
+    (void)arg;
+    struct pollfd fds[2] = {
+        { .fd = g_dns_fd, .events = POLLIN },
+        { .fd = g_wake_fd, .events = POLLIN },
+    };
+    int timeout_ms = -1;
+
+    while (1)
+    {
+        if (poll(fds, 2, timeout_ms) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("Resolver poll failed");
+            break;
+        }
+
+        if (fds[1].revents & POLLIN)
+            take_queued();
+
+        // --- every answer that has arrived ---
+        unsigned char packet[HTTP_DNS_PACKET_SIZE];
+        ssize_t len;
+        while ((len = recv(g_dns_fd, packet, sizeof(packet), 0)) > 0 || (len < 0 && errno == ECONNREFUSED))
+        {
+            if (len > 0)
+                handle_response(packet, (size_t)len);
+            else
+                server_refused();
+        }
+
+        timeout_ms = expire_lookups();
+    }
+
+    return NULL;
+}
+
+// ---------- PUBLIC API ----------
+
+static int parse_server(const char *spec, struct sockaddr_in *addr)
+{
+    char ip[INET_ADDRSTRLEN];
+    unsigned long port = HTTP_DNS_PORT;
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+
+    const char *colon = strchr(spec, ':');
+    size_t ip_len = colon ? (size_t)(colon - spec) : strlen(spec);
+    if (ip_len == 0 || ip_len >= sizeof(ip))
+        return -1;
+    memcpy(ip, spec, ip_len);
+    ip[ip_len] = '\0';
+
+    if (colon)
+    {
+        char *end;
+        port = strtoul(colon + 1, &end, 10);
+        if (end == colon + 1 || *end != '\0' || port == 0 || port > 65535)
+            return -1;
+    }
+
+    if (inet_pton(AF_INET, ip, &addr->sin_addr) <= 0)
+        return -1;
+    addr->sin_port = htons((uint16_t)port);
+    return 0;
+}
+
+// first IPv4 "nameserver" line of resolv.conf(5)
+// returns 0 and fills addr, -1 when there is none
+static int system_nameserver(struct sockaddr_in *addr)
+{
+    FILE *file = fopen(HTTP_DNS_RESOLV_CONF, "r");
+    if (!file)
+        return -1;
+
+    char line[256];
+    int found = -1;
+    while (found < 0 && fgets(line, sizeof(line), file))
+    {
+        char keyword[16], ip[INET_ADDRSTRLEN + 1];
+        if (sscanf(line, "%15s %16s", keyword, ip) == 2 && strcmp(keyword, "nameserver") == 0 &&
+            strlen(ip) < INET_ADDRSTRLEN && parse_server(ip, addr) == 0)
+            found = 0;
+    }
+    fclose(file);
+    return found;
+}
+
+int http_resolver_start(const char *server)
+{
+    const char *preferred = server ? server : HTTP_DNS_SERVER;
+    if (parse_server(preferred, &g_servers[0]) < 0)
+    {
+        fprintf(stderr, "Invalid DNS server address: %s\n", preferred);
+        return -1;
+    }
+    g_server_count = 1;
+
+    // the default server is only the preferred one: if the Layer 7 DNS isn't
+    // running, names still resolve through whatever the system uses
+    if (!server && system_nameserver(&g_servers[1]) == 0 &&
+        (g_servers[1].sin_addr.s_addr != g_servers[0].sin_addr.s_addr ||
+         g_servers[1].sin_port != g_servers[0].sin_port))
+        g_server_count = 2;
+
+    // connected, so only the server's answers get through and an ICMP
+    // unreachable shows up as ECONNREFUSED instead of silence
+    g_dns_fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (g_dns_fd < 0 || connect(g_dns_fd, (struct sockaddr *)&g_servers[0], sizeof(g_servers[0])) < 0)
+    {
+        perror("Failed to create resolver socket");
+        return -1;
+    }
+    g_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (g_wake_fd < 0)
+    {
+        perror("Failed to create resolver eventfd");
+        return -1;
+    }
+
+    if (getrandom(&g_rng_state, sizeof(g_rng_state), 0) != sizeof(g_rng_state) || g_rng_state == 0)
+        g_rng_state = (uint32_t)now_ms() | 1;
+
+    pthread_t thread_id;
+    if (pthread_create(&thread_id, NULL, resolver_loop, NULL) != 0)
+    {
+        perror("Failed to create resolver thread");
+        return -1;
+    }
+    pthread_detach(thread_id);
+
+    char name[32], fallback[32];
+    printf("[LAYER_7] [HTTP] Resolving through %s%s%s%s\n", server_name(&g_servers[0], name, sizeof(name)),
+           g_server_count > 1 ? " (falling back to " : "",
+           g_server_count > 1 ? server_name(&g_servers[1], fallback, sizeof(fallback)) : "",
+           g_server_count > 1 ? ")" : "");
+    return 0;
+}
+
+void http_resolve_async(http_task_t *task)
+{
+    task->next = NULL;
+
+    pthread_mutex_lock(&g_queue_lock);
+    if (g_queue_tail)
+        g_queue_tail->next = task;
+    else
+        g_queue_head = task;
+    g_queue_tail = task;
+    pthread_mutex_unlock(&g_queue_lock);
+
+    uint64_t one = 1;
+    if (write(g_wake_fd, &one, sizeof(one)) < 0)
+        perror("Failed to wake resolver");
+}
@@ -0,0 +1,45 @@
+#ifndef RESOLVE_H
+#define RESOLVE_H
+
+#include "proxy.h"
+
+// --- stub resolver ---
+// one thread multiplexes every lookup over a single non-blocking UDP socket,
+// so a slow name never holds up another; each finished task goes back via
+// http_task_resolved()
+#define HTTP_DNS_SERVER         "127.0.0.1" // the Layer 7 DNS — blocklist, local names and its cache apply
+#define HTTP_DNS_PORT           53
+// with the default server only: the system's resolver takes over while
+// nothing listens there, and the Layer 7 DNS is tried again this often
+#define HTTP_DNS_RESOLV_CONF    "/etc/resolv.conf"
+#define HTTP_DNS_RETRY_LOCAL_MS 30000
+#define HTTP_DNS_TIMEOUT_MS     800         // resend after this
+#define HTTP_DNS_ATTEMPTS       3           // sends before the lookup fails
+#define HTTP_DNS_MAX_PENDING    256         // names in flight; tasks for the same name share one query
+#define HTTP_DNS_PACKET_SIZE    512         // no EDNS0 — a handful of A records fits easily
+
+// --- host → address cache ---
+// shared by every event loop; a hit connects straight away, with no trip
+// through the resolver thread
+#define HTTP_DNS_CACHE_BUCKETS  1024        // power of two
+#define HTTP_DNS_CACHE_MAX      2048        // oldest entry evicted past this
+#define HTTP_DNS_MIN_TTL        5           // seconds — a 0 TTL still covers one page's burst of requests
+#define HTTP_DNS_MAX_TTL        3600
+#define HTTP_DNS_NEGATIVE_TTL   30          // no address and no SOA to take the TTL from
+
+// starts the resolver thread, querying server "ip[:port]" — or, for NULL,
+// HTTP_DNS_SERVER with the first IPv4 nameserver in HTTP_DNS_RESOLV_CONF as
+// the fallback for when HTTP_DNS_SERVER refuses
+// returns 0 on success, -1 on failure
+int  http_resolver_start(const char *server);
+
+// fills task->addrs / task->addr_count without a lookup — for an IP literal,
+// or a name cached within its TTL (addr_count 0 when it has no address)
+// returns true when it did, false when http_resolve_async() is needed
+bool http_resolve_cached(http_task_t *task);
+
+// queues task->hostname / task->port; fills task->addrs and task->addr_count
+// (0 when resolution failed) before handing the task back
+void http_resolve_async(http_task_t *task);
+
+#endif
@@ -0,0 +1,299 @@
+// unit tests for parse.c — built by "make test" with AddressSanitizer, so a
+// read past any of the exactly sized buffers below fails the run
+// includes parse.c itself to reach field_end()
+#include "parse.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static int g_failures = 0;
+
+#define CHECK(cond, ...)                                        \
+    do {                                                        \
+        if (!(cond))                                            \
+        {                                                       \
+            fprintf(stderr, "[TEST][PARSE] FAIL %s:%d: ", __FILE__, __LINE__); \
+            fprintf(stderr, __VA_ARGS__);                       \
+            fputc('\n', stderr);                                \
+            g_failures++;                                       \
+        }                                                       \
+    } while (0)
+
+// a heap copy of exactly len bytes, no terminator
+static char *exact(const char *data, size_t len)
+{
+    char *copy = malloc(len ? len : 1);
+    if (!copy)
+    {
+        perror("malloc");
+        exit(1);
+    }
+    memcpy(copy, data, len);
+    return copy;
+}
+
+// ---------- HEAD END ----------
+
+// the head arrives in two reads split at every byte, then one byte per read
+static void test_find_head_end(void)
+{
+    static const char *const heads[] = {
+        "GET / HTTP/1.1\r\nHost: a\r\n\r\n",
+        "GET / HTTP/1.1\nHost: a\n\n",
+        "GET / HTTP/1.1\r\nHost: a\n\r\n",
+        "GET / HTTP/1.1\nHost: a\r\n\n",
+        "GET / HTTP/1.1\r\nX: \r\r\nHost: a\r\n\r\n",
+        "\r\n\r\n",
+        "\n\n",
+    };
+    static const char body[] = "\r\n\r\nbody";
+
+    for (size_t h = 0; h < sizeof(heads) / sizeof(heads[0]); h++)
+    {
+        size_t head_len = strlen(heads[h]);
+        size_t len = head_len + sizeof(body) - 1;
+        char message[256];
+        memcpy(message, heads[h], head_len);
+        memcpy(message + head_len, body, sizeof(body) - 1);
+
+        for (size_t split = 0; split <= len; split++)
+        {
+            char *buf = exact(message, split);
+            size_t scanned = 0;
+            size_t found = http_find_head_end(buf, split, &scanned);
+            free(buf);
+            CHECK(found == 0 || found == head_len, "head %zu split %zu: early end %zu", h, split, found);
+            CHECK(scanned <= split, "head %zu split %zu: scanned %zu past the data", h, split, scanned);
+            if (found)
+                continue;
+
+            buf = exact(message, len);
+            found = http_find_head_end(buf, len, &scanned);
+            free(buf);
+            CHECK(found == head_len, "head %zu split %zu: end %zu, want %zu", h, split, found, head_len);
+        }
+
+        size_t scanned = 0, found = 0;
+        for (size_t n = 1; n <= len && !found; n++)
+        {
+            char *buf = exact(message, n);
+            found = http_find_head_end(buf, n, &scanned);
+            free(buf);
+        }
+        CHECK(found == head_len, "head %zu byte by byte: end %zu, want %zu", h, found, head_len);
+    }
+}
+
+// ---------- FIELD END ----------
+
+// the byte-at-a-time rule the vector loops have to agree with
+static size_t scalar_field_end(const unsigned char *p, size_t len, bool space_ends)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        unsigned char c = p[i];
+        if (c == 0x7f || (c < 0x20 && c != '\t') || (space_ends && (c == ' ' || c == '\t')))
+            return i;
+    }
+    return len;
+}
+
+// every byte value at every offset of the first two 16-byte blocks, in
+// buffers long enough for the vector loop and with tails for the scalar one
+static void test_field_end(void)
+{
+    for (size_t len = 16; len <= 48; len += 8)
+    {
+        for (size_t offset = 0; offset < 32 && offset < len; offset++)
+        {
+            for (int c = 0; c < 256; c++)
+            {
+                unsigned char data[48];
+                memset(data, 'a', sizeof(data));
+                for (size_t i = 0; i < len; i += 5)
+                    data[i] = 0x80 | (unsigned char)i;      // obs-text passes
+                data[offset] = (unsigned char)c;
+
+                char *buf = exact((const char *)data, len);
+                for (int space_ends = 0; space_ends <= 1; space_ends++)
+                {
+                    size_t got = (size_t)(field_end(buf, buf + len, space_ends) - buf);
+                    size_t want = scalar_field_end(data, len, space_ends);
+                    CHECK(got == want, "len %zu offset %zu byte 0x%02x space_ends %d: %zu, want %zu",
+                          len, offset, c, space_ends, got, want);
+                }
+                free(buf);
+            }
+        }
+    }
+}
+
+// ---------- LIMITS ----------
+
+// the spans in msg are gone by the time it returns — lengths and counts only
+static int parse_request(const char *text, size_t len, http_message_t *msg)
+{
+    char *buf = exact(text, len);
+    int result = http_parse_request(buf, len, msg);
+    free(buf);
+    return result;
+}
+
+// oversized methods and targets parse to exact spans; one header past
+// HTTP_MAX_HEADERS is refused; a head cut anywhere never parses
+static void test_limits(void)
+{
+    static char text[16384];
+    http_message_t msg;
+    size_t long_len = 8192;
+
+    // --- method ---
+    memset(text, 'M', long_len);
+    int len = long_len + snprintf(text + long_len, sizeof(text) - long_len, " / HTTP/1.1\r\n\r\n");
+    CHECK(parse_request(text, (size_t)len, &msg) == 0 && msg.method_len == long_len,
+          "long method: length %zu", msg.method_len);
+
+    // --- target ---
+    len = snprintf(text, sizeof(text), "GET /");
+    memset(text + len, 'a', long_len);
+    len += long_len;
+    len += snprintf(text + len, sizeof(text) - (size_t)len, " HTTP/1.1\r\n\r\n");
+    CHECK(parse_request(text, (size_t)len, &msg) == 0 && msg.target_len == long_len + 1,
+          "long target: length %zu", msg.target_len);
+
+    // --- header count ---
+    for (int count = HTTP_MAX_HEADERS - 1; count <= HTTP_MAX_HEADERS + 1; count++)
+    {
+        len = snprintf(text, sizeof(text), "GET / HTTP/1.1\r\n");
+        for (int i = 0; i < count; i++)
+            len += snprintf(text + len, sizeof(text) - (size_t)len, "X-%d: %d\r\n", i, i);
+        len += snprintf(text + len, sizeof(text) - (size_t)len, "\r\n");
+
+        int result = parse_request(text, (size_t)len, &msg);
+        if (count <= HTTP_MAX_HEADERS)
+            CHECK(result == 0 && msg.header_count == (size_t)count, "%d headers: %d, %zu parsed",
+                  count, result, msg.header_count);
+        else
+            CHECK(result < 0, "%d headers accepted", count);
+    }
+
+    // --- truncation ---
+    len = snprintf(text, sizeof(text), "POST /a?b=c HTTP/1.1\r\nHost: example.com\r\nContent-Length: 5\r\n\r\n");
+    for (int cut = 0; cut < len; cut++)
+        CHECK(parse_request(text, (size_t)cut, &msg) < 0, "head cut at %d parsed", cut);
+    CHECK(parse_request(text, (size_t)len, &msg) == 0, "whole head refused");
+}
+
+// ---------- BODY FRAMING ----------
+
+static void test_body_framing(void)
+{
+    static const struct {
+        const char *headers;
+        int result;
+        http_framing_t framing;
+        uint64_t length;
+    } cases[] = {
+        { "", 0, HTTP_BODY_NONE, 0 },
+        { "Content-Length: 10\r\n", 0, HTTP_BODY_LENGTH, 10 },
+        { "Content-Length: 0\r\n", 0, HTTP_BODY_LENGTH, 0 },
+        { "Content-Length: 10\r\nContent-Length: 10\r\n", 0, HTTP_BODY_LENGTH, 10 },
+        { "Content-Length: 10\r\nContent-Length: 11\r\n", -1, HTTP_BODY_NONE, 0 },
+        { "Content-Length: 1x\r\n", -1, HTTP_BODY_NONE, 0 },
+        { "Content-Length: -1\r\n", -1, HTTP_BODY_NONE, 0 },
+        { "Content-Length: 1234567890123456789\r\n", -1, HTTP_BODY_NONE, 0 },
+        { "Content-Length:\r\n", -1, HTTP_BODY_NONE, 0 },
+        // Transfer-Encoding overrides Content-Length, conflicting or not
+        { "Content-Length: 10\r\nTransfer-Encoding: chunked\r\n", 0, HTTP_BODY_CHUNKED, 0 },
+        { "Transfer-Encoding: chunked\r\nContent-Length: 10\r\n", 0, HTTP_BODY_CHUNKED, 0 },
+        { "Transfer-Encoding: chunked\r\nContent-Length: 1\r\nContent-Length: 2\r\n", 0, HTTP_BODY_CHUNKED, 0 },
+        { "Transfer-Encoding: gzip, CHUNKED\r\n", 0, HTTP_BODY_CHUNKED, 0 },
+        { "Transfer-Encoding: chunked, gzip\r\nContent-Length: 10\r\n", 0, HTTP_BODY_CLOSE, 0 },
+        { "Transfer-Encoding: chunked\r\nTransfer-Encoding: identity\r\n", 0, HTTP_BODY_CLOSE, 0 },
+        { "Transfer-Encoding: xchunked\r\n", 0, HTTP_BODY_CLOSE, 0 },
+    };
+
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+    {
+        char text[256];
+        int len = snprintf(text, sizeof(text), "POST / HTTP/1.1\r\n%s\r\n", cases[i].headers);
+        char *buf = exact(text, (size_t)len);
+        http_message_t msg;
+        if (http_parse_request(buf, (size_t)len, &msg) < 0)
+        {
+            CHECK(false, "case %zu: head refused", i);
+            free(buf);
+            continue;
+        }
+
+        http_framing_t framing = HTTP_BODY_NONE;
+        uint64_t length = 0;
+        int result = http_body_framing(&msg, &framing, &length);
+        free(buf);
+        CHECK(result == cases[i].result, "case %zu: result %d, want %d", i, result, cases[i].result);
+        if (result == 0)
+            CHECK(framing == cases[i].framing && (framing != HTTP_BODY_LENGTH || length == cases[i].length),
+                  "case %zu: framing %d length %llu", i, (int)framing, (unsigned long long)length);
+    }
+}
+
+// ---------- CHUNK SIZE ----------
+
+// anything strtoull() would stretch to a number has to be refused, or the
+// proxy and the next hop frame the body differently
+static void test_chunk_size(void)
+{
+    static const struct {
+        const char *line;
+        int result;
+        uint64_t size;
+    } cases[] = {
+        { "0\r\n", 0, 0 },
+        { "1a\r\n", 0, 0x1a },
+        { "FF\n", 0, 0xff },
+        { "10;name=value\r\n", 0, 0x10 },
+        { "10 ;name\r\n", 0, 0x10 },
+        { "000000000000000010\r\n", 0, 0x10 },
+        { "ffffffffffffffff\r\n", 0, UINT64_MAX },
+        { "10000000000000000\r\n", -1, 0 },
+        { "-1\r\n", -1, 0 },
+        { "+5\r\n", -1, 0 },
+        { " 5\r\n", -1, 0 },
+        { "\t5\r\n", -1, 0 },
+        { "0x10\r\n", -1, 0 },
+        { "5g\r\n", -1, 0 },
+        { "\r\n", -1, 0 },
+        { ";ext\r\n", -1, 0 },
+        { "5", -1, 0 },
+    };
+
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+    {
+        size_t len = strlen(cases[i].line);
+        char *buf = exact(cases[i].line, len);
+        uint64_t size = 0;
+        int result = http_chunk_size(buf, len, &size);
+        free(buf);
+        CHECK(result == cases[i].result, "case %zu: result %d, want %d", i, result, cases[i].result);
+        if (result == 0)
+            CHECK(size == cases[i].size, "case %zu: size %llu, want %llu", i,
+                  (unsigned long long)size, (unsigned long long)cases[i].size);
+    }
+}
+
+int main(void)
+{
+    test_find_head_end();
+    test_field_end();
+    test_limits();
+    test_body_framing();
+    test_chunk_size();
+
+    if (g_failures > 0)
+    {
+        printf("[TEST][PARSE] %d check(s) failed\n", g_failures);
+        return 1;
+    }
+    printf("[TEST][PARSE] All checks passed\n");
+    return 0;
+}
@@ -0,0 +1,138 @@
+// randomized test for timer.c — arms, re-arms and cancels timers at random
+// and moves time the way an event loop does (never past http_wheel_next_ms),
+// checking every expiry against a plain list of what is armed
+// usage: ./test_timer [seed]
+#include "timer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define TEST_TIMERS     512
+#define TEST_STEPS      200000
+
+static int g_failures = 0;
+
+#define CHECK(cond, ...)                                        \
+    do {                                                        \
+        if (!(cond))                                            \
+        {                                                       \
+            fprintf(stderr, "[TEST][TIMER] FAIL %s:%d: ", __FILE__, __LINE__); \
+            fprintf(stderr, __VA_ARGS__);                       \
+            fputc('\n', stderr);                                \
+            g_failures++;                                       \
+        }                                                       \
+    } while (0)
+
+typedef struct {
+    http_timer_t timer;
+    bool armed;
+    long long due_ms;                       // expires_ms, or when it was armed if that is later
+} test_timer_t;
+
+static uint64_t g_state;
+
+// xorshift64, so a seed replays the same run anywhere
+static uint64_t next_random(void)
+{
+    g_state ^= g_state << 13;
+    g_state ^= g_state >> 7;
+    g_state ^= g_state << 17;
+    return g_state;
+}
+
+static long long random_below(long long limit)
+{
+    return (long long)(next_random() % (uint64_t)limit);
+}
+
+// mostly short, some beyond the wheel's top level, some already past
+static long long random_delay(void)
+{
+    switch (random_below(8))
+    {
+        case 0:  return -random_below(1000);
+        case 1:  return random_below(10 * 1000);
+        case 2:  return random_below(2 * 3600 * 1000LL);
+        case 3:  return random_below(48 * 3600 * 1000LL);
+        default: return random_below(200);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t seed = (argc > 1) ? strtoull(argv[1], NULL, 0) : 0x9e3779b97f4a7c15ULL;
+    g_state = seed ? seed : 1;
+
+    static test_timer_t timers[TEST_TIMERS];
+    for (size_t i = 0; i < TEST_TIMERS; i++)
+        timers[i].timer.data = &timers[i];
+
+    long long now = 1000000007LL;
+    http_wheel_t wheel;
+    http_wheel_init(&wheel, now);
+    size_t armed = 0;
+    uint64_t fired = 0;
+
+    for (int step = 0; step < TEST_STEPS && g_failures == 0; step++)
+    {
+        // --- a few random arms, re-arms and cancels ---
+        for (int ops = (int)random_below(4); ops > 0; ops--)
+        {
+            test_timer_t *t = &timers[random_below(TEST_TIMERS)];
+            if (t->armed && random_below(3) == 0)
+            {
+                http_timer_cancel(&wheel, &t->timer);
+                t->armed = false;
+                armed--;
+                continue;
+            }
+
+            long long expires = now + random_delay();
+            http_timer_arm(&wheel, &t->timer, expires);
+            t->due_ms = (expires > now) ? expires : now;
+            if (!t->armed)
+                armed++;
+            t->armed = true;
+        }
+        CHECK(wheel.count == armed, "step %d: wheel counts %zu timers, %zu armed", step, wheel.count, armed);
+
+        // --- sleep, but no longer than the wheel asks for ---
+        long long wait = http_wheel_next_ms(&wheel, now);
+        long long sleep = (random_below(16) == 0) ? random_below(3600 * 1000LL) : random_below(50);
+        if (wait >= 0 && wait < sleep)
+            sleep = wait;
+        now += sleep;
+
+        // --- everything handed out is due, and at most a tick late ---
+        http_timer_t *timer;
+        while ((timer = http_wheel_expire(&wheel, now)) != NULL)
+        {
+            test_timer_t *t = timer->data;
+            CHECK(t->armed, "step %d: timer %td fired while not armed", step, t - timers);
+            CHECK(now >= t->due_ms, "step %d: timer %td fired %lldms early", step, t - timers, t->due_ms - now);
+            CHECK(now - t->due_ms <= HTTP_WHEEL_TICK_MS, "step %d: timer %td fired %lldms late",
+                  step, t - timers, now - t->due_ms);
+            CHECK(!http_timer_pending(timer), "step %d: timer %td still pending after firing", step, t - timers);
+            t->armed = false;
+            armed--;
+            fired++;
+        }
+
+        // --- and nothing due more than a tick ago was held back ---
+        for (size_t i = 0; i < TEST_TIMERS; i++)
+        {
+            if (timers[i].armed)
+                CHECK(now - timers[i].due_ms <= HTTP_WHEEL_TICK_MS, "step %d: timer %zu overdue by %lldms",
+                      step, i, now - timers[i].due_ms);
+        }
+    }
+
+    if (g_failures > 0)
+    {
+        printf("[TEST][TIMER] %d check(s) failed (seed 0x%llx)\n", g_failures, (unsigned long long)seed);
+        return 1;
+    }
+    printf("[TEST][TIMER] All checks passed (%llu timers fired, seed 0x%llx)\n",
+           (unsigned long long)fired, (unsigned long long)seed);
+    return 0;
+}
@@ -0,0 +1,186 @@
+#include "timer.h"
+
+// ---------- SLOT LISTS ----------
+
+static void list_push(http_timer_t **head, http_timer_t *timer)
+{
+    timer->next = *head;
+    if (*head)
+        (*head)->pprev = &timer->next;
+    timer->pprev = head;
+    *head = timer;
+}
+
+static void list_unlink(http_timer_t *timer)
+{
+    *timer->pprev = timer->next;
+    if (timer->next)
+        timer->next->pprev = timer->pprev;
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+// first tick at or after expires_ms — rounding up keeps timers from firing early
+static uint64_t expiry_tick(const http_wheel_t *wheel, long long expires_ms)
+{
+    if (expires_ms <= wheel->base_ms)
+        return 0;
+    return (uint64_t)((expires_ms - wheel->base_ms + HTTP_WHEEL_TICK_MS - 1) / HTTP_WHEEL_TICK_MS);
+}
+
+// files an unlinked timer by how far off it is; already due goes straight
+// to the expired list
+static void place(http_wheel_t *wheel, http_timer_t *timer)
+{
+    uint64_t due = expiry_tick(wheel, timer->expires_ms);
+    if (due <= wheel->tick)
+    {
+        timer->level = HTTP_WHEEL_LEVELS;
+        list_push(&wheel->expired, timer);
+        return;
+    }
+
+    uint64_t delta = due - wheel->tick;
+    uint64_t span = (uint64_t)1 << (HTTP_WHEEL_BITS * HTTP_WHEEL_LEVELS);
+    if (delta >= span)
+        due = wheel->tick + span - 1;   // comes back through the top level until it fits
+
+    int level = 0;
+    while (level < HTTP_WHEEL_LEVELS - 1 && delta >= (uint64_t)1 << (HTTP_WHEEL_BITS * (level + 1)))
+        level++;
+
+    int slot = (int)((due >> (HTTP_WHEEL_BITS * level)) & (HTTP_WHEEL_SLOTS - 1));
+    timer->level = (uint8_t)level;
+    timer->slot = (uint8_t)slot;
+    list_push(&wheel->slots[level][slot], timer);
+    wheel->occupied[level] |= (uint64_t)1 << slot;
+}
+
+// ---------- ADVANCING ----------
+
+// re-files everything in one slot, which now lands a level (or more) lower
+static void cascade(http_wheel_t *wheel, int level, int slot)
+{
+    http_timer_t *timer = wheel->slots[level][slot];
+    wheel->slots[level][slot] = NULL;
+    wheel->occupied[level] &= ~((uint64_t)1 << slot);
+
+    while (timer)
+    {
+        http_timer_t *next = timer->next;
+        timer->next = NULL;
+        timer->pprev = NULL;
+        place(wheel, timer);
+        timer = next;
+    }
+}
+
+static void advance(http_wheel_t *wheel, uint64_t target)
+{
+    while (wheel->tick < target)
+    {
+        // with the lowest levels empty nothing can come due before the next
+        // boundary of the first level that holds anything
+        int empty = 0;
+        while (empty < HTTP_WHEEL_LEVELS && !wheel->occupied[empty])
+            empty++;
+        if (empty == HTTP_WHEEL_LEVELS)
+        {
+            wheel->tick = target;
+            return;
+        }
+
+        uint64_t next = wheel->tick + 1;
+        if (empty > 0)
+        {
+            uint64_t boundary = ((wheel->tick >> (HTTP_WHEEL_BITS * empty)) + 1) << (HTTP_WHEEL_BITS * empty);
+            next = (boundary < target) ? boundary : target;
+        }
+        wheel->tick = next;
+
+        // --- a level-0 wrap brings the next slot of level 1 down, and so on up ---
+        for (int level = 1; level < HTTP_WHEEL_LEVELS; level++)
+        {
+            if (next & (((uint64_t)1 << (HTTP_WHEEL_BITS * level)) - 1))
+                break;
+            cascade(wheel, level, (int)((next >> (HTTP_WHEEL_BITS * level)) & (HTTP_WHEEL_SLOTS - 1)));
+        }
+
+        cascade(wheel, 0, (int)(next & (HTTP_WHEEL_SLOTS - 1)));
+    }
+}
+
+// ---------- PUBLIC API ----------
+
+void http_wheel_init(http_wheel_t *wheel, long long now_ms)
+{
+    *wheel = (http_wheel_t){ .base_ms = now_ms };
+}
+
+void http_timer_arm(http_wheel_t *wheel, http_timer_t *timer, long long expires_ms)
+{
+    http_timer_cancel(wheel, timer);
+    timer->expires_ms = expires_ms;
+    place(wheel, timer);
+    wheel->count++;
+}
+
+void http_timer_cancel(http_wheel_t *wheel, http_timer_t *timer)
+{
+    if (!timer->pprev)
+        return;
+
+    list_unlink(timer);
+    if (timer->level < HTTP_WHEEL_LEVELS && !wheel->slots[timer->level][timer->slot])
+        wheel->occupied[timer->level] &= ~((uint64_t)1 << timer->slot);
+    wheel->count--;
+}
+
+bool http_timer_pending(const http_timer_t *timer)
+{
+    return timer->pprev != NULL;
+}
+
+http_timer_t *http_wheel_expire(http_wheel_t *wheel, long long now_ms)
+{
+    if (!wheel->expired && now_ms > wheel->base_ms)
+        advance(wheel, (uint64_t)((now_ms - wheel->base_ms) / HTTP_WHEEL_TICK_MS));
+
+    http_timer_t *timer = wheel->expired;
+    if (timer)
+    {
+        list_unlink(timer);
+        wheel->count--;
+    }
+    return timer;
+}
+
+long long http_wheel_next_ms(const http_wheel_t *wheel, long long now_ms)
+{
+    if (wheel->expired)
+        return 0;
+    if (wheel->count == 0)
+        return -1;
+
+    // --- the next level-0 slot in use, or the next boundary of the lowest
+    // level above that holds anything, whichever comes first ---
+    uint64_t next = UINT64_MAX;
+    if (wheel->occupied[0])
+    {
+        int shift = (int)((wheel->tick + 1) & (HTTP_WHEEL_SLOTS - 1));
+        uint64_t rotated = (wheel->occupied[0] >> shift) | (shift ? wheel->occupied[0] << (HTTP_WHEEL_SLOTS - shift) : 0);
+        next = wheel->tick + 1 + (uint64_t)__builtin_ctzll(rotated);
+    }
+    for (int level = 1; level < HTTP_WHEEL_LEVELS; level++)
+    {
+        if (!wheel->occupied[level])
+            continue;
+        uint64_t boundary = ((wheel->tick >> (HTTP_WHEEL_BITS * level)) + 1) << (HTTP_WHEEL_BITS * level);
+        if (boundary < next)
+            next = boundary;
+        break;
+    }
+
+    long long wait = wheel->base_ms + (long long)next * HTTP_WHEEL_TICK_MS - now_ms;
+    return (wait > 0) ? wait : 0;
+}
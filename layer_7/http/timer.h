@@ -0,0 +1,55 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// --- hierarchical timer wheel ---
+// per event loop, so no locking. Four levels of 64 slots: level 0 holds
+// what is due within 64 ticks, each level above covers 64 times the span of
+// the one below and drops its slot a level down as time reaches it. Arming,
+// re-arming and cancelling are O(1) whatever the number of timers; ticks
+// with nothing to do on the lower levels are skipped in one step
+#define HTTP_WHEEL_TICK_MS      8           // resolution — timers fire up to a tick late, never early
+#define HTTP_WHEEL_BITS         6
+#define HTTP_WHEEL_SLOTS        (1 << HTTP_WHEEL_BITS)
+#define HTTP_WHEEL_LEVELS       4           // 64^4 ticks ≈ 37 hours; anything later is re-filed on the way
+
+typedef struct http_timer {
+    long long expires_ms;
+    struct http_timer *next;                // slot list
+    struct http_timer **pprev;              // what points at this timer, NULL when not armed
+    uint8_t level;                          // HTTP_WHEEL_LEVELS: on the expired list
+    uint8_t slot;
+    void *data;                             // owner, for whoever handles the expiry
+} http_timer_t;
+
+typedef struct {
+    http_timer_t *slots[HTTP_WHEEL_LEVELS][HTTP_WHEEL_SLOTS];
+    uint64_t occupied[HTTP_WHEEL_LEVELS];   // bit per non-empty slot
+    http_timer_t *expired;                  // due, waiting to be handed out
+    long long base_ms;                      // time of tick 0
+    uint64_t tick;                          // ticks handled so far
+    size_t count;                           // armed timers, expired ones included
+} http_wheel_t;
+
+void http_wheel_init(http_wheel_t *wheel, long long now_ms);
+
+// (re)arms timer to fire at expires_ms
+void http_timer_arm(http_wheel_t *wheel, http_timer_t *timer, long long expires_ms);
+
+// disarms timer; harmless when it isn't armed
+void http_timer_cancel(http_wheel_t *wheel, http_timer_t *timer);
+
+bool http_timer_pending(const http_timer_t *timer);
+
+// moves the wheel up to now_ms and hands out one due timer, disarmed, or
+// NULL when there are none — call until NULL
+http_timer_t *http_wheel_expire(http_wheel_t *wheel, long long now_ms);
+
+// milliseconds until the wheel may next have a timer due (for epoll_wait),
+// -1 when nothing is armed
+long long http_wheel_next_ms(const http_wheel_t *wheel, long long now_ms);
+
+#endif
@@ -4,7 +4,7 @@ set -euo pipefail
 ROOT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
 
 if [[ ${EUID:-$(id -u)} -ne 0 ]]; then
-    echo "[LAYER_7] Run as root so DNS can bind UDP port 53:"
+    echo "[LAYER_7] Run as root so DNS can bind port 53 (UDP + TCP):"
     echo "  sudo ./start_layer7.sh"
     exit 1
 fi
@@ -43,7 +43,7 @@ dns_pid=$!
 http_pid=$!
 
 echo "[LAYER_7] Started"
-echo "[LAYER_7] DNS  PID=$dns_pid  port=53/udp"
+echo "[LAYER_7] DNS  PID=$dns_pid  port=53/udp+tcp"
 echo "[LAYER_7] HTTP PID=$http_pid port=8080/tcp"
 
 wait -n "$dns_pid" "$http_pid"
@@ -36,20 +36,25 @@ ip -n "$NS_NAME" link set lo up
 ip -n "$NS_NAME" addr add "$NS_IP/24" dev "$NS_IF"
 ip -n "$NS_NAME" link set "$NS_IF" up
 
-TARGET_PORT=""
-if ss -ltn '( sport = :8080 )' 2>/dev/null | grep -q ':8080'; then
-    TARGET_PORT="8080"
-elif ss -ltn '( sport = :443 )' 2>/dev/null | grep -q ':443'; then
-    TARGET_PORT="443"
+# direct TLS is seen by Layer 6 on the wire; TLS through the proxy's CONNECT
+# tunnels is checked by the Layer 7 proxy itself
+if ss -ltn '( sport = :443 )' 2>/dev/null | grep -q ':443'; then
+    echo "[TEST][L6] Sending a TLS 1.0 ClientHello from namespace to $HOST_IP:443"
+    ip netns exec "$NS_NAME" timeout 8 openssl s_client \
+        -connect "${HOST_IP}:443" \
+        -tls1 \
+        -cipher 'DEFAULT:@SECLEVEL=0' \
+        -servername "$TLS_SNI" </dev/null >/dev/null 2>&1 || true
+elif ss -ltn '( sport = :8080 )' 2>/dev/null | grep -q ':8080'; then
+    echo "[TEST][L6] Sending a TLS 1.0 ClientHello through the proxy tunnel at $HOST_IP:8080 (Layer 7 logs the verdict)"
+    ip netns exec "$NS_NAME" timeout 8 openssl s_client \
+        -proxy "${HOST_IP}:8080" \
+        -connect "${TLS_SNI}:443" \
+        -tls1 \
+        -cipher 'DEFAULT:@SECLEVEL=0' \
+        -servername "$TLS_SNI" </dev/null >/dev/null 2>&1 || true
 else
-    echo "No listener on port 8080 or 443. Start Layer 7 HTTP proxy or another service first."
+    echo "No listener on port 443 or 8080. Start Layer 7 HTTP proxy or another service first."
     exit 1
 fi
-
-echo "[TEST][L6] Sending a TLS 1.0 ClientHello from namespace to $HOST_IP:$TARGET_PORT"
-ip netns exec "$NS_NAME" timeout 8 openssl s_client \
-    -connect "${HOST_IP}:${TARGET_PORT}" \
-    -tls1 \
-    -cipher 'DEFAULT:@SECLEVEL=0' \
-    -servername "$TLS_SNI" </dev/null >/dev/null 2>&1 || true
 sleep 1
@@ -0,0 +1,98 @@
+#!/usr/bin/env bash
+# Checks the HTTP proxy's connect race: a name resolving to a blackholed
+# address first and a live local listener second must connect to the
+# listener after HTTP_CONNECT_DELAY_MS, not after HTTP_CONNECT_TIMEOUT_MS.
+# Starts its own dns-filter (with a hosts file) and http-proxy; the proxy
+# listens on its fixed port, so stop a running one first.
+# Needs root, iptables, curl and python3.
+set -euo pipefail
+
+ROOT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")/.." && pwd)"
+DNS_DIR="$ROOT_DIR/layer_7/dns"
+HTTP_DIR="$ROOT_DIR/layer_7/http"
+DROP_ADDR="${DROP_ADDR:-192.0.2.1}"   # TEST-NET-1, SYNs to it are dropped for the test
+FILTER_PORT="${FILTER_PORT:-5399}"
+ORIGIN_PORT="${ORIGIN_PORT:-18081}"
+PROXY_PORT="$(awk '/#define HTTP_PORT / {print $3}' "$HTTP_DIR/proxy.h")"
+DELAY_MS="$(awk '/#define HTTP_CONNECT_DELAY_MS/ {print $3}' "$HTTP_DIR/proxy.h")"
+TIMEOUT_MS="$(awk '/#define HTTP_CONNECT_TIMEOUT_MS/ {print $3}' "$HTTP_DIR/proxy.h")"
+
+for cmd in iptables curl python3; do
+    command -v "$cmd" >/dev/null 2>&1 || { echo "Missing required command: $cmd"; exit 1; }
+done
+if [[ $EUID -ne 0 ]]; then
+    echo "[TEST][L7][RACE] Needs root for iptables"
+    exit 1
+fi
+if (exec 3<>"/dev/tcp/127.0.0.1/$PROXY_PORT") 2>/dev/null; then
+    echo "[TEST][L7][RACE] Port $PROXY_PORT is in use — stop the running proxy first"
+    exit 1
+fi
+
+make -s -C "$DNS_DIR"
+make -s -C "$HTTP_DIR"
+
+WORK_DIR="$(mktemp -d)"
+cleanup() {
+    iptables -D OUTPUT -d "$DROP_ADDR" -p tcp -j DROP 2>/dev/null || true
+    for pid in "${proxy_pid:-}" "${filter_pid:-}" "${origin_pid:-}"; do
+        [[ -n "$pid" ]] && kill "$pid" 2>/dev/null || true
+    done
+    wait 2>/dev/null || true
+    rm -rf "$WORK_DIR"
+}
+trap cleanup INT TERM EXIT
+
+failures=0
+check() {
+    if [[ "$2" == "true" ]]; then
+        echo "[TEST][L7][RACE] PASS $1"
+    else
+        echo "[TEST][L7][RACE] FAIL $1"
+        failures=$((failures + 1))
+    fi
+}
+
+# answers come back in file order: the dropped address first
+cat > "$WORK_DIR/hosts" <<EOF
+127.0.0.1 live.race.test
+$DROP_ADDR race.test
+127.0.0.1 race.test
+EOF
+echo ok > "$WORK_DIR/index.html"
+
+iptables -I OUTPUT -d "$DROP_ADDR" -p tcp -j DROP
+
+python3 -m http.server --bind 127.0.0.1 --directory "$WORK_DIR" "$ORIGIN_PORT" > /dev/null 2>&1 &
+origin_pid=$!
+# local names never go upstream, so the upstream address is never used
+(cd "$DNS_DIR" && exec ./dns-filter -l 0 -c none -p "$FILTER_PORT" -H "$WORK_DIR/hosts" 127.0.0.1:9) \
+    > "$WORK_DIR/dns-filter.log" 2>&1 &
+filter_pid=$!
+(cd "$HTTP_DIR" && exec ./http-proxy -r "127.0.0.1:$FILTER_PORT") > "$WORK_DIR/http-proxy.log" 2>&1 &
+proxy_pid=$!
+sleep 2
+
+# fetch NAME — prints "status milliseconds"
+fetch() {
+    curl -x "http://127.0.0.1:$PROXY_PORT" "http://$1:$ORIGIN_PORT/" -m $((TIMEOUT_MS / 1000 * 2)) \
+        -s -o /dev/null -w '%{http_code} %{time_total}\n' |
+        awk '{printf "%s %d\n", $1, $2 * 1000}'
+}
+
+# --- the listener alone: connects straight away ---
+read -r status ms <<< "$(fetch live.race.test)"
+check "live address alone: $status in ${ms}ms" \
+    "$([[ $status == 200 && $ms -lt $DELAY_MS ]] && echo true || echo false)"
+
+# --- dropped address first: the listener joins after the head start and wins ---
+read -r status ms <<< "$(fetch race.test)"
+check "dropped address first: $status in ${ms}ms (head start ${DELAY_MS}ms, attempt timeout ${TIMEOUT_MS}ms)" \
+    "$([[ $status == 200 && $ms -ge $((DELAY_MS - 50)) && $ms -lt $((DELAY_MS + 500)) ]] && echo true || echo false)"
+
+if [[ $failures -gt 0 ]]; then
+    echo "[TEST][L7][RACE] $failures check(s) failed"
+    cat "$WORK_DIR/http-proxy.log"
+    exit 1
+fi
+echo "[TEST][L7][RACE] All checks passed"